@@ -0,0 +1,10 @@
+# Builds the DAQ software together with the command line session tools.
+# source/Miniscope-DAQ-QT-Software.pro can still be opened on its own to build only the DAQ software.
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    app \
+    sessiontool
+
+app.file = source/Miniscope-DAQ-QT-Software.pro
+sessiontool.file = source/sessiontool/sessiontool.pro
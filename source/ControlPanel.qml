@@ -11,6 +11,7 @@ Item {
     property double currentRecordTime: 0
     property double ucRecordLength: 1
     property bool recording: false
+    property var qualityData: [] // {name, values, latest, alarm} per device and quality metric
 
     signal submitNoteSignal(string note)
     signal extTriggerSwitchToggled(bool checkedState)
@@ -132,6 +133,60 @@ Item {
             }
         }
 
+        ColumnLayout {
+            id: qualityColumn
+            objectName: "qualityColumn"
+            Layout.fillWidth: true
+            Layout.columnSpan: 2
+            spacing: 2
+            visible: root.qualityData.length > 0
+
+            Repeater {
+                model: root.qualityData.length
+                RowLayout {
+                    Layout.fillWidth: true
+                    Text {
+                        text: root.qualityData[index].name + ": " + root.qualityData[index].latest.toPrecision(4)
+                        color: root.qualityData[index].alarm ? "red" : "black"
+                        font.pointSize: 9
+                        font.family: "Arial"
+                        Layout.preferredWidth: 220
+                    }
+                    Canvas {
+                        id: sparkline
+                        Layout.fillWidth: true
+                        Layout.preferredHeight: 18
+                        onPaint: {
+                            var ctx = getContext("2d");
+                            var values = root.qualityData[index].values;
+                            ctx.clearRect(0, 0, width, height);
+                            if (values.length < 2)
+                                return;
+                            var low = Math.min.apply(null, values);
+                            var high = Math.max.apply(null, values);
+                            var range = (high > low) ? high - low : 1;
+                            ctx.strokeStyle = root.qualityData[index].alarm ? "red" : "darkgreen";
+                            ctx.lineWidth = 1;
+                            ctx.beginPath();
+                            for (var i = 0; i < values.length; i++) {
+                                var x = i * (width - 1) / (values.length - 1);
+                                var y = height - 1 - (values[i] - low) / range * (height - 2);
+                                if (i === 0)
+                                    ctx.moveTo(x, y);
+                                else
+                                    ctx.lineTo(x, y);
+                            }
+                            ctx.stroke();
+                        }
+                        Connections {
+                            target: root
+                            onQualityDataChanged: sparkline.requestPaint()
+                        }
+                    }
+                }
+            }
+        }
+
         DelayButton {
             id: bRecord
             objectName: "bRecord"
@@ -1,4 +1,4 @@
-QT += qml quick widgets
+QT += qml quick widgets network
 CONFIG += c++11
 
 # The following define makes your compiler emit warnings if you use
@@ -16,13 +16,36 @@ SOURCES += \
         backend.cpp \
         behaviorcam.cpp \
         behaviortracker.cpp \
+        behaviortrackerworker.cpp \
+        cameracalibrator.cpp \
+        clockmodel.cpp \
+        closedlooppublisher.cpp \
         controlpanel.cpp \
         datasaver.cpp \
+        dffengine.cpp \
+        experiment.cpp \
+        frametriplebuffer.cpp \
+        histogramengine.cpp \
+        latencytracker.cpp \
         main.cpp \
         miniscope.cpp \
+        motioncorrector.cpp \
         newquickview.cpp \
+        previewfilter.cpp \
+        previewgenerator.cpp \
+        pretriggerbuffer.cpp \
+        qualitymonitor.cpp \
+        segmenthasher.cpp \
+        sessionmigrator.cpp \
+        stereocalibrator.cpp \
+        stereotriangulator.cpp \
+        summaryimages.cpp \
+        syncindex.cpp \
+        traceextractor.cpp \
+        undistorter.cpp \
         videodisplay.cpp \
-        videostreamocv.cpp
+        videostreamocv.cpp \
+        xxhash64.cpp
 
 RESOURCES += qml.qrc
 
@@ -44,12 +67,36 @@ HEADERS += \
     backend.h \
     behaviorcam.h \
     behaviortracker.h \
+    behaviortrackerworker.h \
+    cameracalibrator.h \
+    clockmodel.h \
+    closedlooppublisher.h \
     controlpanel.h \
     datasaver.h \
+    dffengine.h \
+    experiment.h \
+    frametriplebuffer.h \
+    histogramengine.h \
+    latencytracker.h \
+    migrationfiles.h \
     miniscope.h \
+    motioncorrector.h \
     newquickview.h \
+    previewfilter.h \
+    previewgenerator.h \
+    pretriggerbuffer.h \
+    qualitymonitor.h \
+    segmenthasher.h \
+    sessionmigrator.h \
+    stereocalibrator.h \
+    stereotriangulator.h \
+    summaryimages.h \
+    syncindex.h \
+    traceextractor.h \
+    undistorter.h \
     videodisplay.h \
-    videostreamocv.h
+    videostreamocv.h \
+    xxhash64.h
 
 DISTFILES +=
 
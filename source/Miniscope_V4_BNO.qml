@@ -15,6 +15,13 @@ Item {
     signal takeScreenShotSignal()
     signal dFFSwitchChanged(bool value)
     signal saturationSwitchChanged(bool value)
+    signal autoContrastSwitchChanged(bool value)
+    signal setTraceRoiClicked()
+    signal summaryDisplayChanged(string type)
+    signal previewFilterToggled()
+
+    property string summaryDisplay: "Live"
+    property var summaryDisplayTypes: ["Live", "Mean", "Max", "Std", "Correlation"]
 
     Keys.onPressed: {
         if (event.key === Qt.Key_H) {
@@ -27,6 +34,18 @@ Item {
             // Take screenshot of window
             takeScreenShotSignal();
         }
+        if (event.key === Qt.Key_R) {
+            // Draw a new trace ROI
+            setTraceRoiClicked();
+        }
+        if (event.key === Qt.Key_F) {
+            // Turn the live view's background removal and denoising on or off
+            previewFilterToggled();
+        }
+        if (event.key === Qt.Key_S) {
+            // Cycle through live view and summary images of the recording
+            summaryDisplayChanged(summaryDisplayTypes[(summaryDisplayTypes.indexOf(summaryDisplay) + 1) % summaryDisplayTypes.length]);
+        }
     }
 
     VideoDisplay {
@@ -48,6 +67,14 @@ Item {
             if (idx >= 20)
                 idx = 0;
         }
+        onRoiChanged: {
+            // Only shown while a trace ROI is being drawn
+            rectROI.visible = videoDisplay.ROI[4] === 1;
+            rectROI.x = videoDisplay.ROI[0];
+            rectROI.y = videoDisplay.ROI[1];
+            rectROI.width = videoDisplay.ROI[2];
+            rectROI.height = videoDisplay.ROI[3];
+        }
 
         SequentialAnimation on t {
             NumberAnimation { to: 1; duration: 2500; easing.type: Easing.InQuad }
@@ -55,7 +82,53 @@ Item {
             loops: Animation.Infinite
             running: true
                 }
+
+        Rectangle {
+            id: rectROI
+            x: 0
+            y: 0
+            width: 0
+            height: 0
+            visible: false
+            color: "#00000000"
+            radius: Math.min(width, height) / 2
+
+            border.color: "red"
+            border.width: 2
+        }
+    }
+    Text {
+        id: latency
+        objectName: "latency"
+        anchors.left: parent.left
+        anchors.leftMargin: 4
+        anchors.bottom: parent.bottom
+        anchors.bottomMargin: 4
+        text: videoDisplay.latencySummary
+        color: "white"
+        style: Text.Outline
+        styleColor: "black"
+        font.pointSize: 9
+        font.family: "Arial"
+        visible: root.state == "controlsShown"
     }
+
+    Text {
+        id: summaryDisplayLabel
+        objectName: "summaryDisplayLabel"
+        anchors.right: parent.right
+        anchors.rightMargin: 4
+        anchors.bottom: parent.bottom
+        anchors.bottomMargin: 4
+        text: "Summary: " + root.summaryDisplay
+        color: "white"
+        style: Text.Outline
+        styleColor: "black"
+        font.pointSize: 9
+        font.family: "Arial"
+        visible: root.summaryDisplay != "Live"
+    }
+
     TopMenu{
         id: topMenu
         anchors.top: parent.top
@@ -90,10 +163,23 @@ Item {
                 Layout.row: 0
             }
 
+            Switch {
+                id: autoContrastSwitch
+                objectName: "autoContrastSwitch"
+                text: qsTr("Auto Contrast")
+                hoverEnabled: false
+
+                font.bold: true
+                font.family: "Arial"
+                Layout.alignment: Qt.AlignHCenter | Qt.AlignTop
+                Layout.column: 1
+                Layout.row: 0
+            }
+
             Switch {
                 id: saturationSwitch
                 objectName: "saturationSwitch"
-                text: qsTr("Show Saturation")
+                text: qsTr("Show Saturation") + " (" + (videoDisplay.saturatedFraction * 100).toFixed(2) + "%)"
                 hoverEnabled: false
 
                 font.bold: true
@@ -293,6 +379,10 @@ Item {
         target: saturationSwitch
         onClicked: saturationSwitchChanged(saturationSwitch.checked)
     }
+    Connections{
+        target: autoContrastSwitch
+        onClicked: autoContrastSwitchChanged(autoContrastSwitch.checked)
+    }
 
     states: [
         State{
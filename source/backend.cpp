@@ -7,6 +7,8 @@
 #include <QJsonObject>
 #include <QJsonArray>
 #include <QThread>
+#include <QThreadPool>
+#include <QElapsedTimer>
 #include <QObject>
 #include <QVariant>
 #include <QDir>
@@ -25,6 +27,8 @@
 #include "controlpanel.h"
 #include "datasaver.h"
 #include "behaviortracker.h"
+#include "sessionmigrator.h"
+#include "segmenthasher.h"
 
 //#include <libusb.h>
 
@@ -35,7 +39,10 @@ backEnd::backEnd(QObject *parent) :
     m_versionNumber(""),
     m_userConfigFileName(""),
     m_userConfigOK(false),
-    behavTracker(nullptr)
+    sessionMigrator(nullptr),
+    behavTracker(nullptr),
+    experiment(nullptr),
+    experimentThread(nullptr)
 {
 #ifdef DEBUG
 //    QString homePath = QDir::homePath();
@@ -225,6 +232,8 @@ void backEnd::onRunClicked()
         constructUserConfigGUI();
 
         setupDataSaver(); // must happen after devices have been made
+        setupSegmentHasher();
+        setupSessionMigrator();
     }
     else {
         // TODO: throw out error
@@ -257,6 +266,11 @@ void backEnd::connectSnS()
 {
 
     // Start and stop recording signals
+    if (behavTracker && behavTracker->getStereoTriangulator()) {
+        // Connected before DataSaver's stopRecording so the last pairs reach trajectory3D.csv before it gets closed
+        QObject::connect(controlPanel, &ControlPanel::recordStop, behavTracker->getStereoTriangulator(), &StereoTriangulator::flush,
+                         Qt::BlockingQueuedConnection);
+    }
     QObject::connect(controlPanel, SIGNAL( recordStart()), dataSaver, SLOT (startRecording()));
     QObject::connect(controlPanel, SIGNAL( recordStop()), dataSaver, SLOT (stopRecording()));
     QObject::connect((controlPanel), SIGNAL( sendNote(QString) ), dataSaver, SLOT ( takeNote(QString) ));
@@ -265,6 +279,7 @@ void backEnd::connectSnS()
 
 
     QObject::connect(dataSaver, SIGNAL(sendMessage(QString)), controlPanel, SLOT( receiveMessage(QString)));
+    QObject::connect(controlPanel, &ControlPanel::setExtTriggerTrackingState, dataSaver, &DataSaver::setExtTriggerTrackingState);
 
     for (int i = 0; i < miniscope.length(); i++) {
         // For triggering screenshots
@@ -273,9 +288,25 @@ void backEnd::connectSnS()
 
         QObject::connect(controlPanel, &ControlPanel::setExtTriggerTrackingState, miniscope[i], &Miniscope::setExtTriggerTrackingState);
         QObject::connect(miniscope[i], &Miniscope::extTriggered, controlPanel, &ControlPanel::extTriggerTriggered);
+        QObject::connect(miniscope[i], &Miniscope::extTriggerTimeStamp, dataSaver, &DataSaver::setTriggerTimeStamp);
 
         QObject::connect(controlPanel, &ControlPanel::recordStart, miniscope[i], &Miniscope::startRecording);
         QObject::connect(controlPanel, &ControlPanel::recordStop, miniscope[i], &Miniscope::stopRecording);
+
+        if (miniscope[i]->getQualityMonitor()) {
+            QObject::connect(miniscope[i]->getQualityMonitor(), &QualityMonitor::metricsReady, dataSaver,
+                             [this](QString name, int frameNum, qint64 timeStamp, QVector<float> values) {
+                dataSaver->writeAuxRow(name, "qualityMetrics", frameNum, timeStamp, values);
+            });
+            QObject::connect(miniscope[i]->getQualityMonitor(), &QualityMonitor::metricsReady, controlPanel, &ControlPanel::handleQualityMetrics);
+            QObject::connect(miniscope[i]->getQualityMonitor(), &QualityMonitor::alarmChanged, controlPanel, &ControlPanel::handleQualityAlarm);
+        }
+        if (miniscope[i]->getClosedLoopPublisher()) {
+            QObject::connect(miniscope[i]->getClosedLoopPublisher(), &ClosedLoopPublisher::eventPublished, dataSaver,
+                             [this](QString name, int frameNum, qint64 timeStamp, QVector<float> values) {
+                dataSaver->writeAuxRow(name, "closedLoopEvents", frameNum, timeStamp, values);
+            });
+        }
     }
     for (int i = 0; i < behavCam.length(); i++) {
         QObject::connect(behavCam[i], SIGNAL(sendMessage(QString)), controlPanel, SLOT( receiveMessage(QString)));
@@ -283,14 +314,43 @@ void backEnd::connectSnS()
         QObject::connect(behavCam[i], SIGNAL(takeScreenShot(QString)), dataSaver, SLOT( takeScreenShot(QString)));
 
         QObject::connect(this, SIGNAL( closeAll()), behavCam[i], SLOT (close()));
+        QObject::connect(behavCam[i], &BehaviorCam::cameraCalibrationChanged, dataSaver, &DataSaver::setCameraCalibration);
 
         if (behavTracker) {
-            QObject::connect(behavCam[i], SIGNAL(newFrameAvailable(QString, int)), behavTracker, SLOT( handleNewFrameAvailable(QString, int)));
-
+            // Direct so frames get handed to the tracker's worker from the camera's thread
+            QObject::connect(behavCam[i], SIGNAL(newFrameAvailable(QString, int)), behavTracker, SLOT( handleNewFrameAvailable(QString, int)), Qt::DirectConnection);
+            QObject::connect(behavCam[i], &BehaviorCam::cameraCalibrationChanged, behavTracker, &BehaviorTracker::setCameraCalibration);
+            if (behavTracker->getWorker(behavCam[i]->getDeviceName())) {
+                QObject::connect(behavTracker->getWorker(behavCam[i]->getDeviceName()), &BehaviorTrackerWorker::positionReady, dataSaver,
+                                 [this](QString name, int frameNum, qint64 timeStamp, QVector<float> values) {
+                    dataSaver->writeAuxRow(name, "behaviorTracking", frameNum, timeStamp, values);
+                });
+            }
         }
     }
-    if (behavTracker)
+    if (behavTracker) {
+        QObject::connect(behavTracker, SIGNAL(sendMessage(QString)), controlPanel, SLOT( receiveMessage(QString)));
         QObject::connect(this, SIGNAL( closeAll()), behavTracker, SLOT (close()));
+        QObject::connect(behavTracker, &BehaviorTracker::stereoCalibrationChanged, dataSaver, &DataSaver::setStereoCalibration);
+        if (behavTracker->getStereoTriangulator()) {
+            QObject::connect(behavTracker->getStereoTriangulator(), &StereoTriangulator::trajectoryReady, dataSaver,
+                             [this](QString name, int frameNum, qint64 timeStamp, QVector<float> values) {
+                dataSaver->writeAuxRow(name, "trajectory3D", frameNum, timeStamp, values);
+            });
+        }
+    }
+    if (experiment) {
+        QObject::connect(experiment, &Experiment::experimentStateReady, dataSaver,
+                         [this](QString name, int frameNum, qint64 timeStamp, QVector<float> values) {
+            dataSaver->writeAuxRow(name, "experiment", frameNum, timeStamp, values);
+        });
+        // Zone events are in experiment.csv too. This shows them to the user while running
+        QObject::connect(experiment, &Experiment::zoneChanged, controlPanel, [this](QString zone, bool entered, qint64 timeStamp) {
+            Q_UNUSED(timeStamp);
+            controlPanel->receiveMessage("Experiment: " + QString(entered ? "Entered " : "Left ") + zone + ".");
+        });
+        QObject::connect(this, &backEnd::closeAll, experimentThread, &QThread::quit);
+    }
 }
 
 void backEnd::setupDataSaver()
@@ -309,8 +369,27 @@ void backEnd::setupDataSaver()
                                             miniscope[i]->getFreeFramesPointer(),
                                             miniscope[i]->getUsedFramesPointer(),
                                             miniscope[i]->getAcqFrameNumPointer());
+        dataSaver->setTimingParameters(miniscope[i]->getDeviceName(), miniscope[i]->getTimingBufferPointer(), miniscope[i]->getClockModel());
 
         dataSaver->setHeadOrientationConfig(miniscope[i]->getDeviceName(), miniscope[i]->getHeadOrienataionStreamState(), miniscope[i]->getHeadOrienataionFilterState());
+        dataSaver->setCropRegions(miniscope[i]->getDeviceName(),
+                                  miniscope[i]->getCropRegions(),
+                                  miniscope[i]->getCropCircularMasks(),
+                                  miniscope[i]->getCropMode());
+        if (miniscope[i]->getMotionCorrector())
+            dataSaver->setRegistrationParameters(miniscope[i]->getDeviceName(),
+                                                 miniscope[i]->getMotionCorrector()->getRegisteredBufferPointer(),
+                                                 miniscope[i]->getMotionCorrector()->getShiftBufferPointer(),
+                                                 miniscope[i]->getMotionCorrector()->getRegisteredFrameNumPointer(),
+                                                 miniscope[i]->getImageRegistrationMode() == "Record");
+        if (miniscope[i]->getTraceExtractor())
+            dataSaver->setTraceParameters(miniscope[i]->getDeviceName(), miniscope[i]->getTraceExtractor());
+        if (miniscope[i]->getQualityMonitor())
+            dataSaver->setupAuxStream(miniscope[i]->getDeviceName(), "qualityMetrics", QualityMonitor::columns());
+        if (miniscope[i]->getClosedLoopPublisher())
+            dataSaver->setupAuxStream(miniscope[i]->getDeviceName(), "closedLoopEvents", ClosedLoopPublisher::columns());
+        if (miniscope[i]->getSummaryImages())
+            dataSaver->setSummaryImages(miniscope[i]->getDeviceName(), miniscope[i]->getSummaryImages());
 
     }
     for (int i = 0; i < behavCam.length(); i++) {
@@ -323,9 +402,21 @@ void backEnd::setupDataSaver()
                                             behavCam[i]->getFreeFramesPointer(),
                                             behavCam[i]->getUsedFramesPointer(),
                                             behavCam[i]->getAcqFrameNumPointer());
+        dataSaver->setTimingParameters(behavCam[i]->getDeviceName(), behavCam[i]->getTimingBufferPointer(), behavCam[i]->getClockModel());
         dataSaver->setHeadOrientationConfig(behavCam[i]->getDeviceName(), false, false);
         dataSaver->setROI(behavCam[i]->getDeviceName(), behavCam[i]->getROI());
+        if (!behavCam[i]->getCameraCalibration().isEmpty())
+            dataSaver->setCameraCalibration(behavCam[i]->getDeviceName(), behavCam[i]->getCameraCalibration());
+        if (behavTracker && behavTracker->getWorker(behavCam[i]->getDeviceName()))
+            dataSaver->setupAuxStream(behavCam[i]->getDeviceName(), "behaviorTracking", behavTracker->getWorker(behavCam[i]->getDeviceName())->columns());
+    }
+    if (behavTracker && behavTracker->getStereoTriangulator()) {
+        dataSaver->setupAuxStream(behavTracker->getStereoTriangulator()->getDeviceName(), "trajectory3D", StereoTriangulator::columns());
+        if (!behavTracker->getStereoCalibration().isEmpty())
+            dataSaver->setStereoCalibration(behavTracker->getStereoCalibration());
     }
+    if (experiment)
+        dataSaver->setupAuxStream(experiment->getCameraName(), "experiment", experiment->columns());
 
     dataSaverThread = new QThread;
     dataSaver->moveToThread(dataSaverThread);
@@ -336,6 +427,38 @@ void backEnd::setupDataSaver()
     dataSaverThread->start();
 }
 
+void backEnd::setupSegmentHasher()
+{
+    segmentHasher = new SegmentHasher();
+    QObject::connect(segmentHasher, SIGNAL(sendMessage(QString)), controlPanel, SLOT( receiveMessage(QString)));
+    QObject::connect(dataSaver, &DataSaver::fileCompleted, segmentHasher, &SegmentHasher::handleFileCompleted);
+    QObject::connect(dataSaver, &DataSaver::recordingCompleted, segmentHasher, &SegmentHasher::handleRecordingCompleted);
+
+    segmentHasherThread = new QThread;
+    segmentHasher->moveToThread(segmentHasherThread);
+    segmentHasherThread->start();
+}
+
+void backEnd::setupSessionMigrator()
+{
+    // Only used when recordings go to a local scratch directory before dataDirectory
+    QString scratchDirectory = m_userConfig["scratchDirectory"].toString();
+    if (scratchDirectory.isEmpty())
+        return;
+
+    sessionMigrator = new SessionMigrator(scratchDirectory, m_userConfig["migrationBandwidthMBps"].toDouble(0));
+    QObject::connect(sessionMigrator, SIGNAL(sendMessage(QString)), controlPanel, SLOT( receiveMessage(QString)));
+    // Files only get moved once they are hashed
+    QObject::connect(segmentHasher, &SegmentHasher::fileHashed, sessionMigrator, &SessionMigrator::migrateFile);
+    QObject::connect(segmentHasher, &SegmentHasher::sessionHashed, sessionMigrator, &SessionMigrator::finishSession);
+    QObject::connect(this, &backEnd::closeAll, sessionMigrator, &SessionMigrator::close);
+
+    sessionMigratorThread = new QThread;
+    sessionMigrator->moveToThread(sessionMigratorThread);
+    QObject::connect(sessionMigratorThread, SIGNAL (started()), sessionMigrator, SLOT (startRunning()));
+    sessionMigratorThread->start();
+}
+
 void backEnd::testCodecSupport()
 {
     // This function will test which codecs are supported on host's machine
@@ -403,9 +526,44 @@ void backEnd::setupBehaviorTracker()
     for (int i = 0; i < behavCam.length(); i++) {
         behavTracker->setBehaviorCamBufferParameters(behavCam[i]->getDeviceName(),
                                                      behavCam[i]->getFrameBufferPointer(),
+                                                     behavCam[i]->getTimeStampBufferPointer(),
+                                                     behavCam[i]->getTimingBufferPointer(),
                                                      behavCam[i]->getBufferSize(),
                                                      behavCam[i]->getAcqFrameNumPointer());
+        behavTracker->setCameraCalibration(behavCam[i]->getDeviceName(), behavCam[i]->getCameraCalibration());
+    }
+    behavTracker->setupStereo();
+}
+
+void backEnd::setupExperiment()
+{
+    QJsonObject options = ucExperiment;
+
+    // Positions come from the behavior tracker, by default from the first camera
+    if (!behavTracker || behavCam.isEmpty()) {
+        controlPanel->receiveMessage("Warning: Experiment needs a behavior camera and a behaviorTracker. Experiment not started.");
+        return;
+    }
+    if (options["camera"].toString().isEmpty())
+        options["camera"] = behavCam[0]->getDeviceName();
+    if (!behavTracker->getWorker(options["camera"].toString())) {
+        controlPanel->receiveMessage("Warning: " + options["camera"].toString() + " is not tracked. Experiment not started.");
+        return;
+    }
+
+    experiment = new Experiment(options);
+    if (!experiment->isValid()) {
+        controlPanel->receiveMessage("Error: Experiment needs type linearTrack or arena, four corners in tracker pixels and the track or arena size.");
+        delete experiment;
+        experiment = nullptr;
+        return;
     }
+
+    experimentThread = new QThread;
+    experiment->moveToThread(experimentThread);
+    QObject::connect(behavTracker->getWorker(experiment->getCameraName()), &BehaviorTrackerWorker::positionReady, experiment, &Experiment::handlePosition);
+    QObject::connect(experimentThread, SIGNAL (finished()), experimentThread, SLOT (deleteLater()));
+    experimentThread->start();
 }
 
 bool backEnd::checkForUniqueDeviceNames()
@@ -431,6 +589,21 @@ bool backEnd::checkForUniqueDeviceNames()
             break;
         }
     }
+    // Closed loop servers remove a server of the same name when they start, so two devices can't share one
+    QVector<QString> serverNames;
+    for (int i = 0; i < ucMiniscopes.size(); i++) {
+        QJsonObject jClosedLoop = ucMiniscopes[i].toObject()["closedLoop"].toObject();
+        if (!jClosedLoop["enable"].toBool(false))
+            continue;
+        tempName = jClosedLoop["serverName"].toString("miniscopeEvents_" + ucMiniscopes[i].toObject()["deviceName"].toString());
+        if (!serverNames.contains(tempName))
+            serverNames.append(tempName);
+        else {
+            qDebug() << "Repeating closed loop serverName" << tempName;
+            repeatingDeviceName = true;
+            break;
+        }
+    }
 
     if (repeatingDeviceName == true) {
         qDebug() << "Repeating Device Names!";
@@ -457,6 +630,70 @@ bool backEnd::checkForCompression()
     return true;
 }
 
+void backEnd::initializeDevices()
+{
+    // Opening a camera and setting up its DAQ blocks for a while, so all devices connect at the same time
+    QThreadPool pool;
+    QElapsedTimer timer;
+    QVector<VideoStreamOCV*> streams;
+    QStringList names;
+    QVector<qint64> readyTime;
+    int idx, numReady;
+    qint64 deadline;
+
+    for (idx = 0; idx < miniscope.length(); idx++) {
+        streams.append(miniscope[idx]->getStream());
+        names.append(ucMiniscopes[idx].toObject()["deviceName"].toString());
+    }
+    for (idx = 0; idx < behavCam.length(); idx++) {
+        streams.append(behavCam[idx]->getStream());
+        names.append(ucBehaviorCams[idx].toObject()["deviceName"].toString());
+    }
+    if (streams.isEmpty())
+        return;
+
+    timer.start();
+    pool.setMaxThreadCount(streams.length());
+    for (idx = 0; idx < miniscope.length(); idx++)
+        pool.start(new StreamConnectTask(miniscope[idx]->getStream(), miniscope[idx]->getCameraID()));
+    for (idx = 0; idx < behavCam.length(); idx++)
+        pool.start(new StreamConnectTask(behavCam[idx]->getStream(), behavCam[idx]->getCameraID()));
+    pool.waitForDone();
+
+    for (idx = 0; idx < miniscope.length(); idx++)
+        miniscope[idx]->setupStream();
+    for (idx = 0; idx < behavCam.length(); idx++)
+        behavCam[idx]->setupStream();
+
+    // Wait until every connected device streams so its initialize commands went out before the user config controls get loaded
+    deadline = timer.elapsed() + DEVICE_READY_TIMEOUT_MS;
+    readyTime.fill(-1, streams.length());
+    numReady = 0;
+    for (idx = 0; idx < streams.length(); idx++) {
+        if (streams[idx]->connectionState() == 0)
+            numReady++;
+    }
+    while (numReady < streams.length() && timer.elapsed() < deadline) {
+        QThread::msleep(DEVICE_READY_POLL_MS);
+        for (idx = 0; idx < streams.length(); idx++) {
+            if (readyTime[idx] < 0 && streams[idx]->connectionState() != 0 && streams[idx]->isReady()) {
+                readyTime[idx] = timer.elapsed();
+                numReady++;
+            }
+        }
+    }
+
+    for (idx = 0; idx < streams.length(); idx++) {
+        if (streams[idx]->connectionState() == 0)
+            continue;
+        if (readyTime[idx] >= 0)
+            controlPanel->receiveMessage(names[idx] + " streaming after " + QString::number(readyTime[idx]) + "ms (connecting took " +
+                                         QString::number(streams[idx]->getConnectTime()) + "ms).");
+        else
+            controlPanel->receiveMessage("Warning: " + names[idx] + " has not sent a frame " + QString::number(timer.elapsed()) + "ms after connecting.");
+    }
+}
+
 void backEnd::constructUserConfigGUI()
 {
     int idx;
@@ -476,8 +713,6 @@ void backEnd::constructUserConfigGUI()
 
         // Connect send and receive message to textbox in controlPanel
         QObject::connect(miniscope.last(), SIGNAL(sendMessage(QString)), controlPanel, SLOT( receiveMessage(QString)));
-
-        miniscope.last()->createView();
     }
     for (idx = 0; idx < ucBehaviorCams.size(); idx++) {
         behavCam.append(new BehaviorCam(this, ucBehaviorCams[idx].toObject()));
@@ -488,16 +723,20 @@ void backEnd::constructUserConfigGUI()
 
         // Connect send and receive message to textbox in controlPanel
         QObject::connect(behavCam.last(), SIGNAL(sendMessage(QString)), controlPanel, SLOT( receiveMessage(QString)));
-
-        behavCam.last()->createView();
-    }
-    if (!ucExperiment.isEmpty()){
-        // Construct experiment interface
     }
+    initializeDevices();
+
+    for (idx = 0; idx < miniscope.length(); idx++)
+        miniscope[idx]->createView();
+    for (idx = 0; idx < behavCam.length(); idx++)
+        behavCam[idx]->createView();
     if (!ucBehaviorTracker.isEmpty()) {
         behavTracker = new BehaviorTracker(this, m_userConfig);
         setupBehaviorTracker();
     }
+    if (!ucExperiment.isEmpty() && ucExperiment["type"].toString("None") != "None"){
+        setupExperiment();
+    }
 
 
     connectSnS();
@@ -12,7 +12,12 @@
 #include "controlpanel.h"
 #include "datasaver.h"
 #include "behaviortracker.h"
+#include "experiment.h"
+#include "sessionmigrator.h"
+#include "segmenthasher.h"
 
+#define DEVICE_READY_TIMEOUT_MS     1000    // Longest wait for the first frame of all devices once their streams started
+#define DEVICE_READY_POLL_MS        5
 
 class backEnd : public QObject
 {
@@ -44,9 +49,11 @@ public:
     void loadUserConfigFile();
     bool checkUserConfigForIssues();
     void constructUserConfigGUI();
+    void initializeDevices();
     void parseUserConfig();
 
     void setupBehaviorTracker();
+    void setupExperiment();
 
     bool checkForUniqueDeviceNames();
     bool checkForCompression();
@@ -73,6 +80,8 @@ public slots:
 private:
     void connectSnS();
     void setupDataSaver();
+    void setupSegmentHasher();
+    void setupSessionMigrator();
 
     void testCodecSupport();
 
@@ -102,8 +111,17 @@ private:
     DataSaver *dataSaver;
     QThread *dataSaverThread;
 
+    SegmentHasher *segmentHasher;
+    QThread *segmentHasherThread;
+
+    SessionMigrator *sessionMigrator;
+    QThread *sessionMigratorThread;
+
     BehaviorTracker *behavTracker;
 
+    Experiment *experiment;
+    QThread *experimentThread;
+
     QVector<QString> m_availableCodec;
     QString m_availableCodecList;
     QVector<QString> unAvailableCodec;
@@ -23,6 +23,7 @@ Item {
     signal calibrateCameraQuit()
 
     signal saturationSwitchChanged(bool value)
+    signal autoContrastSwitchChanged(bool value)
 
     Keys.onPressed: {
         if (event.key === Qt.Key_H) {
@@ -48,7 +49,8 @@ Item {
 
             TextArea {
                 text: "Camera Calibration " + "<br/>" +
-                      "Directions go here"
+                      "Press Begin and slowly move the chessboard through the whole view, tilting it in different directions. " +
+                      "Board size is set by cameraCalibration in the camera's user config."
                 verticalAlignment: Text.AlignVCenter
                 horizontalAlignment: Text.AlignHCenter
                 Layout.margins: 5
@@ -65,10 +67,22 @@ Item {
                     }
             }
 
+            Text {
+                id: camCalibStatus
+                objectName: "camCalibStatus"
+                text: ""
+                Layout.margins: 5
+                Layout.fillWidth: true
+                font.pointSize: 10
+                font.family: "Arial"
+                wrapMode: Text.WordWrap
+            }
+
             ProgressBar {
                 id: camCalibProgressBar
+                objectName: "camCalibProgressBar"
                 width: parent.width
-                value: 0.5
+                value: 0
             }
 
             RowLayout {
@@ -184,6 +198,22 @@ Item {
         }
     }
 
+    Text {
+        id: latency
+        objectName: "latency"
+        anchors.left: parent.left
+        anchors.leftMargin: 4
+        anchors.bottom: parent.bottom
+        anchors.bottomMargin: 4
+        text: videoDisplay.latencySummary
+        color: "white"
+        style: Text.Outline
+        styleColor: "black"
+        font.pointSize: 9
+        font.family: "Arial"
+        visible: root.state == "controlsShown"
+    }
+
     TopMenu{
         id: topMenu
         anchors.top: parent.top
@@ -232,10 +262,23 @@ Item {
                 }
             }
 
+            Switch {
+                id: autoContrastSwitch
+                objectName: "autoContrastSwitch"
+                text: qsTr("Auto Contrast")
+                hoverEnabled: false
+
+                font.bold: true
+                font.family: "Arial"
+                Layout.alignment: Qt.AlignHCenter | Qt.AlignTop
+                Layout.column: 1
+                Layout.row: 0
+            }
+
             Switch {
                 id: saturationSwitch
                 objectName: "saturationSwitch"
-                text: qsTr("Show Saturation")
+                text: qsTr("Show Saturation") + " (" + (videoDisplay.saturatedFraction * 100).toFixed(2) + "%)"
                 hoverEnabled: false
 
                 font.bold: true
@@ -447,6 +490,10 @@ Item {
         target: saturationSwitch
         onClicked: saturationSwitchChanged(saturationSwitch.checked)
     }
+    Connections{
+        target: autoContrastSwitch
+        onClicked: autoContrastSwitchChanged(autoContrastSwitch.checked)
+    }
 
 
     states: [
@@ -3,6 +3,13 @@ import QtQuick.Controls 2.12
 import QtQuick.Layouts 1.12
 
 Item {
+    id: root
+    property string positionText: ""
+    property bool stereoAvailable: false
+    property string stereoStatus: ""
+    property double stereoProgress: 0
+
+    signal stereoCalibrateClicked()
 
     ColumnLayout {
         id: columnLayout
@@ -13,6 +20,34 @@ Item {
             id: cbCameraNames
         }
 
+        Text {
+            id: positionDisplay
+            text: root.positionText
+            font.pointSize: 10
+        }
+
+        Button {
+            id: bStereoCalibrate
+            text: "Stereo Calibration"
+            visible: root.stereoAvailable
+            onClicked: root.stereoCalibrateClicked()
+        }
+
+        Text {
+            id: stereoStatusText
+            text: root.stereoStatus
+            visible: root.stereoAvailable
+            font.pointSize: 9
+            wrapMode: Text.WordWrap
+            Layout.preferredWidth: 380
+        }
+
+        ProgressBar {
+            id: stereoProgressBar
+            value: root.stereoProgress
+            visible: root.stereoAvailable
+            Layout.preferredWidth: 380
+        }
 
     }
 
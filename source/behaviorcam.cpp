@@ -14,6 +14,7 @@
 #include <QQmlApplicationEngine>
 #include <QVector>
 #include <QVariant>
+#include <QFile>
 
 BehaviorCam::BehaviorCam(QObject *parent, QJsonObject ucBehavCam) :
     QObject(parent),
@@ -22,12 +23,20 @@ BehaviorCam::BehaviorCam(QObject *parent, QJsonObject ucBehavCam) :
     rootObject(nullptr),
     vidDisplay(nullptr),
     m_previousDisplayFrameNum(0),
+    previewGenerator(nullptr),
+    previewThread(nullptr),
+    m_lastLatencyUpdate(0),
     m_acqFrameNum(new QAtomicInt(0)),
     m_daqFrameNum(new QAtomicInt(0)),
     m_streamHeadOrientationState(false),
     m_camCalibWindowOpen(false),
     m_camCalibRunning(false),
-    m_roiIsDefined(false)
+    camCalibrator(nullptr),
+    camCalibThread(nullptr),
+    m_roiIsDefined(false),
+    m_autoContrast(false),
+    m_manualAlpha(1),
+    m_manualBeta(0)
 {
 
     m_ucBehavCam = ucBehavCam; // hold user config for this Miniscope
@@ -36,6 +45,14 @@ BehaviorCam::BehaviorCam(QObject *parent, QJsonObject ucBehavCam) :
 
     parseUserConfigBehavCam();
 
+    // Calibration from an earlier session
+    if (!m_ucBehavCam["cameraCalibrationFileLocation"].toString().isEmpty()) {
+        if (QFile::exists(m_ucBehavCam["cameraCalibrationFileLocation"].toString()))
+            m_cameraCalibration = CameraCalibrator::loadCalibration(m_ucBehavCam["cameraCalibrationFileLocation"].toString());
+        else
+            qDebug() << m_ucBehavCam["cameraCalibrationFileLocation"].toString() << "doesn't exist yet. Calibrate the camera to create it.";
+    }
+
     // TODO: Handle cases where there is more than webcams and MiniCAMs
     if (m_ucBehavCam["deviceType"].toString().toLower().contains("webcam")) {
         isMiniCAM = false;
@@ -62,7 +79,12 @@ BehaviorCam::BehaviorCam(QObject *parent, QJsonObject ucBehavCam) :
     behavCamStream->setHeadOrientationConfig(false, false); // don't allow head orientation streaming for behavior cameras
     behavCamStream->setIsColor(m_cBehavCam["isColor"].toBool(false));
 
-    m_camConnected = behavCamStream->connect2Camera(m_ucBehavCam["deviceID"].toInt());
+    // backEnd connects the stream together with the other devices' and then calls setupStream()
+}
+
+void BehaviorCam::setupStream()
+{
+    m_camConnected = behavCamStream->connectionState();
     if (m_camConnected == 0) {
         qDebug() << "Not able to connect and open " << m_ucBehavCam["deviceName"].toString();
     }
@@ -75,6 +97,8 @@ BehaviorCam::BehaviorCam(QObject *parent, QJsonObject ucBehavCam) :
                                              usedFrames,
                                              m_acqFrameNum,
                                              m_daqFrameNum);
+        behavCamStream->setTimingBuffer(timingBuffer);
+        behavCamStream->setClockModel(&m_clockModel);
 
 
         // -----------------
@@ -95,18 +119,26 @@ BehaviorCam::BehaviorCam(QObject *parent, QJsonObject ucBehavCam) :
         // Handle request for reinitialization of commands
         QObject::connect(behavCamStream, &VideoStreamOCV::requestInitCommands, this, &BehaviorCam::handleInitCommandsRequest);
 
-        // Pass new Frame available through to parent
-//        QObject::connect(behavCamStream, &VideoStreamOCV::newFrameAvailable, this, &BehaviorCam::newFrameAvailable);
+        // Pass new Frame available through to parent. Direct so listeners like the behavior tracker aren't held up by the GUI thread
+        QObject::connect(behavCamStream, &VideoStreamOCV::newFrameAvailable, this, &BehaviorCam::newFrameAvailable, Qt::DirectConnection);
         // ----------------------------------------------
 
+        // Display frames get prepared on their own thread at no more than displayFrameRate
+        previewGenerator = new PreviewGenerator(frameBuffer, m_acqFrameNum, FRAME_BUFFER_SIZE, m_ucBehavCam["displayFrameRate"].toDouble(30));
+        previewGenerator->setTimingBuffer(timingBuffer);
+        previewThread = new QThread;
+        previewGenerator->moveToThread(previewThread);
+        QObject::connect(previewThread, SIGNAL (started()), previewGenerator, SLOT (startRunning()));
+        QObject::connect(previewThread, SIGNAL (finished()), previewThread, SLOT (deleteLater()));
+        previewThread->start();
+
         connectSnS();
 
         if (isMiniCAM)
             sendInitCommands();
 
+        // backEnd waits for isStreamReady() so the initialize commands go out before the user config controls get loaded
         videoStreamThread->start();
-
-        QThread::msleep(500);
     }
 }
 
@@ -143,11 +175,15 @@ void BehaviorCam::createView()
 
         QObject::connect(rootObject, SIGNAL( saturationSwitchChanged(bool) ),
                              this, SLOT( handleSaturationSwitchChanged(bool) ));
+        QObject::connect(rootObject, SIGNAL( autoContrastSwitchChanged(bool) ),
+                             this, SLOT( handleAutoContrastSwitchChanged(bool) ));
 
         configureBehavCamControls();
         vidDisplay = rootObject->findChild<VideoDisplay*>("vD");
         vidDisplay->setMaxBuffer(FRAME_BUFFER_SIZE);
         vidDisplay->setWindowScaleValue(m_ucBehavCam["windowScale"].toDouble(1));
+        vidDisplay->setLatencyTracker(&m_latencyTracker);
+        m_latencyTracker.setLogFile(m_ucBehavCam["latencyLogFile"].toString(""));
 
         // Turn on or off saturation display
         if (m_ucBehavCam["showSaturation"].toBool(false)) {
@@ -159,6 +195,13 @@ void BehaviorCam::createView()
             rootObject->findChild<QQuickItem*>("saturationSwitch")->setProperty("checked", false);
         }
 
+        // Auto-contrast sets alpha and beta from percentiles of a running histogram
+        previewGenerator->histogram().setPercentiles(m_ucBehavCam["autoContrastLowPercentile"].toDouble(0.5),
+                                                     m_ucBehavCam["autoContrastHighPercentile"].toDouble(99.5));
+        m_autoContrast = m_ucBehavCam["autoContrast"].toBool(false);
+        if (rootObject->findChild<QQuickItem*>("autoContrastSwitch"))
+            rootObject->findChild<QQuickItem*>("autoContrastSwitch")->setProperty("checked", m_autoContrast);
+
         QObject::connect(rootObject, SIGNAL( takeScreenShotSignal() ),
                              this, SLOT( handleTakeScreenShotSignal() ));
         QObject::connect(rootObject, SIGNAL( vidPropChangedSignal(QString, double, double, double) ),
@@ -442,22 +485,38 @@ void BehaviorCam::testSlot(QString type, double value)
 void BehaviorCam::sendNewFrame(){
 //    vidDisplay->setProperty("displayFrame", QImage("C:/Users/DBAharoni/Pictures/Miniscope/Logo/1.png"));
     int f = *m_acqFrameNum;
+    double alpha, beta;
+    QImage tempFrame2;
+
+    // Display frames come downscaled and ready to show from the preview thread
+    previewGenerator->setTargetSize(vidDisplay->displaySize().width(), vidDisplay->displaySize().height());
+    if (previewGenerator->takeFrame()) {
+        // Stays valid until the next takeFrame(). VideoDisplay copies it right away
+        const cv::Mat &preview = previewGenerator->frame();
+        if (preview.channels() == 1)
+            tempFrame2 = QImage(preview.data, preview.cols, preview.rows, preview.step, QImage::Format_Grayscale8);
+        else
+            tempFrame2 = QImage(preview.data, preview.cols, preview.rows, preview.step, QImage::Format_RGB888);
+        vidDisplay->setDisplayFrame(tempFrame2, previewGenerator->frameTiming());
+    }
+
+    // Latency overlay and log get refreshed once a second
+    if (LatencyTracker::now() - m_lastLatencyUpdate > 1000000) {
+        m_lastLatencyUpdate = LatencyTracker::now();
+        vidDisplay->setLatencySummary(m_latencyTracker.summary());
+        m_latencyTracker.writeLog();
+    }
 
     if (f > m_previousDisplayFrameNum) {
         m_previousDisplayFrameNum = f;
-        QImage tempFrame2;
 //        qDebug() << "Send frame = " << f;
         f = (f - 1)%FRAME_BUFFER_SIZE;
 
-        // TODO: Think about where color to gray and vise versa should take place.
-        if (frameBuffer[f].channels() == 1) {
-            cv::cvtColor(frameBuffer[f], tempFrame, cv::COLOR_GRAY2BGR);
-            tempFrame2 = QImage(tempFrame.data, tempFrame.cols, tempFrame.rows, tempFrame.step, QImage::Format_RGB888);
+        if (m_autoContrast && previewGenerator->histogram().autoContrast(alpha, beta)) {
+            vidDisplay->setAlpha(alpha);
+            vidDisplay->setBeta(beta);
         }
-        else
-            tempFrame2 = QImage(frameBuffer[f].data, frameBuffer[f].cols, frameBuffer[f].rows, frameBuffer[f].step, QImage::Format_RGB888);
-
-        vidDisplay->setDisplayFrame(tempFrame2);
+        vidDisplay->setSaturatedFraction(previewGenerator->histogram().saturatedFraction());
 
         vidDisplay->setBufferUsed(usedFrames->available());
         if (f > 0) // This is just a quick cheat so I don't have to wrap around for (f-1)
@@ -482,10 +541,14 @@ void BehaviorCam::handlePropChangedSignal(QString type, double displayValue, dou
     sendMessage(m_deviceName + " " + type + " changed to " + QString::number(displayValue) + ".");
     // Handle props that only affect the user display here
     if (type == "alpha"){
-        vidDisplay->setAlpha(displayValue);
+        m_manualAlpha = displayValue;
+        if (!m_autoContrast)
+            vidDisplay->setAlpha(displayValue);
     }
     else if (type == "beta") {
-        vidDisplay->setBeta(displayValue);
+        m_manualBeta = displayValue;
+        if (!m_autoContrast)
+            vidDisplay->setBeta(displayValue);
     }
     else {
         // Here handles prop changes that need to be sent over to the Miniscope
@@ -568,28 +631,59 @@ void BehaviorCam::handleCamCalibClicked()
 void BehaviorCam::handleCamCalibStart()
 {
     qDebug() << "Beginning camera calibration";
-    m_camCalibRunning = true;
-    // Probably can use an if statement in sendNewFrame() to send frames somewhere for camera calibration
-    // Probably want to update the cam calib window that opens up with info as the cam is being calibrated
-
-    // When done, calibration should be saved in a file and the file path should be updated in the user config or
-    // Another option would be to just save all the calibration data directly into the user config file
+    if (!m_camConnected)
+        return;
 
+    // Calibrator and its thread stay around for later calibrations in this session
+    if (!camCalibrator) {
+        QJsonObject options = m_ucBehavCam["cameraCalibration"].toObject();
+        options["fileLocation"] = m_ucBehavCam["cameraCalibrationFileLocation"].toString();
+        camCalibrator = new CameraCalibrator(m_deviceName, frameBuffer, FRAME_BUFFER_SIZE, m_acqFrameNum, options);
+        camCalibThread = new QThread;
+        camCalibrator->moveToThread(camCalibThread);
+        QObject::connect(behavCamStream, &VideoStreamOCV::newFrameAvailable, camCalibrator, &CameraCalibrator::handleNewFrame);
+        QObject::connect(camCalibrator, &CameraCalibrator::sendMessage, this, &BehaviorCam::sendMessage);
+        QObject::connect(camCalibrator, &CameraCalibrator::progressChanged, this, &BehaviorCam::handleCamCalibProgress);
+        QObject::connect(camCalibrator, &CameraCalibrator::calibrationDone, this, &BehaviorCam::handleCamCalibDone);
+        QObject::connect(camCalibThread, SIGNAL (finished()), camCalibThread, SLOT (deleteLater()));
+        camCalibThread->start();
+    }
+    m_camCalibRunning = true;
+    QMetaObject::invokeMethod(camCalibrator, "start", Qt::QueuedConnection);
 }
 
 void BehaviorCam::handleCamCalibQuit()
 {
     qDebug() << "Quitting camera calibration";
     if (m_camCalibRunning) {
-        // Do stuff to exit cam calibration algorithm without issue
+        QMetaObject::invokeMethod(camCalibrator, "stop", Qt::QueuedConnection);
         m_camCalibRunning = false;
     }
     m_camCalibWindowOpen = false;
 }
+
+void BehaviorCam::handleCamCalibProgress(double progress, QString status)
+{
+    if (rootObject->findChild<QQuickItem*>("camCalibProgressBar"))
+        rootObject->findChild<QQuickItem*>("camCalibProgressBar")->setProperty("value", progress);
+    if (rootObject->findChild<QQuickItem*>("camCalibStatus"))
+        rootObject->findChild<QQuickItem*>("camCalibStatus")->setProperty("text", status);
+}
+
+void BehaviorCam::handleCamCalibDone(QJsonObject calibration)
+{
+    m_camCalibRunning = false;
+    m_cameraCalibration = calibration;
+    cameraCalibrationChanged(m_deviceName, calibration);
+}
 void BehaviorCam::close()
 {
     if (m_camConnected)
         view->close();
+    if (previewThread)
+        previewThread->quit();
+    if (camCalibThread)
+        camCalibThread->quit();
 }
 
 void BehaviorCam::handleSetRoiClicked()
@@ -646,3 +740,13 @@ void BehaviorCam::handleSaturationSwitchChanged(bool checked)
 {
     vidDisplay->setShowSaturation(checked);
 }
+
+void BehaviorCam::handleAutoContrastSwitchChanged(bool checked)
+{
+    m_autoContrast = checked;
+    if (!checked) {
+        // Back to whatever the sliders are set to
+        vidDisplay->setAlpha(m_manualAlpha);
+        vidDisplay->setBeta(m_manualBeta);
+    }
+}
@@ -16,6 +16,8 @@
 #include "videostreamocv.h"
 #include "videodisplay.h"
 #include "newquickview.h"
+#include "previewgenerator.h"
+#include "cameracalibrator.h"
 #include <opencv2/opencv.hpp>
 
 #define PROTOCOL_I2C            -2
@@ -36,6 +38,11 @@ class BehaviorCam : public QObject
     Q_OBJECT
 public:
     explicit BehaviorCam(QObject *parent = nullptr, QJsonObject ucBehavCam = QJsonObject());
+    // Connecting is slow, so backEnd connects all devices at once on a thread pool before setting up their streams
+    VideoStreamOCV* getStream() { return behavCamStream; }
+    int getCameraID() { return m_ucBehavCam["deviceID"].toInt(); }
+    void setupStream();
+    bool isStreamReady() { return behavCamStream->isReady(); }
     void createView();
     void connectSnS();
     void parseUserConfigBehavCam();
@@ -44,6 +51,8 @@ public:
 //    void sendInitCommands();
     cv::Mat* getFrameBufferPointer(){return frameBuffer;}
     qint64* getTimeStampBufferPointer(){return timeStampBuffer;}
+    FrameTiming* getTimingBufferPointer(){return timingBuffer;}
+    ClockModel* getClockModel() { return &m_clockModel; }
     int getBufferSize() {return FRAME_BUFFER_SIZE;}
     QSemaphore* getFreeFramesPointer(){return freeFrames;}
     QSemaphore* getUsedFramesPointer(){return usedFrames;}
@@ -51,6 +60,7 @@ public:
 //    QAtomicInt* getDAQFrameNumPointer() { return m_daqFrameNum; }
     QString getDeviceName() {return m_deviceName;}
     int* getROI() { return m_roiBoundingBox; }
+    QJsonObject getCameraCalibration() { return m_cameraCalibration; }
 
 
 
@@ -61,6 +71,7 @@ signals:
     void sendMessage(QString msg);
     void takeScreenShot(QString type);
     void newFrameAvailable(QString name, int frameNum);
+    void cameraCalibrationChanged(QString name, QJsonObject calibration);
     void openCamPropsDialog();
 
 public slots:
@@ -71,6 +82,7 @@ public slots:
     void close();
     void handleInitCommandsRequest();
     void handleSaturationSwitchChanged(bool checked);
+    void handleAutoContrastSwitchChanged(bool checked);
 
     void handleCamPropsClicked() { emit openCamPropsDialog();}
     void handleSetRoiClicked();
@@ -79,6 +91,8 @@ public slots:
     void handleCamCalibClicked();
     void handleCamCalibStart();
     void handleCamCalibQuit();
+    void handleCamCalibProgress(double progress, QString status);
+    void handleCamCalibDone(QJsonObject calibration);
 
     // Setting new ROI
     void handleNewROI(int leftEdge, int topEdge, int width, int height);
@@ -94,14 +108,19 @@ private:
     VideoStreamOCV *behavCamStream;
     QThread *videoStreamThread;
     cv::Mat frameBuffer[FRAME_BUFFER_SIZE];
-    cv::Mat tempFrame;
     qint64 timeStampBuffer[FRAME_BUFFER_SIZE];
+    FrameTiming timingBuffer[FRAME_BUFFER_SIZE];
+    ClockModel m_clockModel; // Corrects time stamps from the DAQ's frame counter
     QSemaphore *freeFrames;
     QSemaphore *usedFrames;
     QObject *rootObject;
     VideoDisplay *vidDisplay;
     QTimer *timer;
     int m_previousDisplayFrameNum;
+    PreviewGenerator *previewGenerator;
+    QThread *previewThread;
+    LatencyTracker m_latencyTracker;
+    qint64 m_lastLatencyUpdate;
     QAtomicInt *m_acqFrameNum;
     QAtomicInt *m_daqFrameNum;
 
@@ -124,11 +143,19 @@ private:
     // Camera Calibration Vars
     bool m_camCalibWindowOpen;
     bool m_camCalibRunning;
+    CameraCalibrator *camCalibrator;
+    QThread *camCalibThread;
+    QJsonObject m_cameraCalibration; // Empty when the camera isn't calibrated
 
     // ROI
     bool m_roiIsDefined;
     int m_roiBoundingBox[4]; // left, top, width, height
 
+    // Display levels. The sliders' values are kept so they come back when auto-contrast is turned off
+    bool m_autoContrast;
+    double m_manualAlpha;
+    double m_manualBeta;
+
     // Handle MiniCAM stuff
     bool isMiniCAM;
 };
@@ -1,19 +1,28 @@
 #include "behaviortracker.h"
 #include "newquickview.h"
+#include "cameracalibrator.h"
 
 #include <opencv2/opencv.hpp>
 
 #include <QJsonObject>
+#include <QJsonArray>
+#include <QFile>
 #include <QDebug>
 #include <QAtomicInt>
 #include <QObject>
 #include <QGuiApplication>
 #include <QScreen>
 #include <QQuickItem>
+#include <QDateTime>
 
 BehaviorTracker::BehaviorTracker(QObject *parent, QJsonObject userConfig) :
     QObject(parent),
-    numberOfCameras(0)
+    numberOfCameras(0),
+    m_lastGuiUpdate(0),
+    stereoCalibrator(nullptr),
+    stereoCalibratorThread(nullptr),
+    stereoTriangulator(nullptr),
+    stereoTriangulatorThread(nullptr)
 {
     m_userConfig = userConfig;
     parseUserConfigTracker();
@@ -26,27 +35,131 @@ void BehaviorTracker::parseUserConfigTracker()
     QJsonObject jTracker = m_userConfig["behaviorTracker"].toObject();
     m_trackerType = jTracker["type"].toString("None");
 
+    m_stereoOptions = jTracker["stereo"].toObject();
+    if (m_stereoOptions["enable"].toBool(false)) {
+        QJsonArray jCameras = m_stereoOptions["cameras"].toArray();
+        for (int i = 0; i < jCameras.size(); i++)
+            m_stereoCameras.append(jCameras[i].toString());
+    }
+
 }
 
-void BehaviorTracker::setBehaviorCamBufferParameters(QString name, cv::Mat *frameBuf, int bufSize, QAtomicInt *acqFrameNum)
+void BehaviorTracker::setBehaviorCamBufferParameters(QString name, cv::Mat *frameBuf, qint64 *tsBuf, FrameTiming *timingBuf, int bufSize, QAtomicInt *acqFrameNum)
 {
     frameBuffer[name] = frameBuf;
+    timeStampBuffer[name] = tsBuf;
+    timingBuffer[name] = timingBuf;
     bufferSize[name] = bufSize;
     m_acqFrameNum[name] = acqFrameNum;
 
     currentFrameNumberProcessed[name] = 0;
     numberOfCameras++;
+
+    if (m_trackerType != "HSV" && m_trackerType != "background") {
+        qDebug() << "Behavior tracker type" << m_trackerType << "not supported.";
+        return;
+    }
+
+    worker[name] = new BehaviorTrackerWorker(name, frameBuf, tsBuf, bufSize, acqFrameNum, m_userConfig["behaviorTracker"].toObject());
+    workerThread[name] = new QThread;
+    worker[name]->moveToThread(workerThread[name]);
+    QObject::connect(worker[name], &BehaviorTrackerWorker::sendMessage, this, &BehaviorTracker::sendMessage);
+    QObject::connect(worker[name], &BehaviorTrackerWorker::positionReady, this, &BehaviorTracker::handlePositionReady);
+    QObject::connect(workerThread[name], SIGNAL (finished()), workerThread[name], SLOT (deleteLater()));
+    workerThread[name]->start();
+}
+
+void BehaviorTracker::setupStereo()
+{
+    if (m_stereoCameras.isEmpty())
+        return;
+    if (m_stereoCameras.size() != 2 || !worker.contains(m_stereoCameras[0]) || !worker.contains(m_stereoCameras[1])) {
+        sendMessage("Error: behaviorTracker stereo needs the names of two tracked cameras.");
+        m_stereoCameras.clear();
+        return;
+    }
+
+    stereoTriangulator = new StereoTriangulator(m_stereoCameras[0], m_stereoCameras[1], m_stereoOptions);
+    for (int i = 0; i < 2; i++) {
+        stereoTriangulator->setTimingBuffer(i, timingBuffer[m_stereoCameras[i]], bufferSize[m_stereoCameras[i]]);
+        // Workers hand out undistorted positions when their camera is calibrated
+        stereoTriangulator->setCameraCalibration(i, m_calibration.value(m_stereoCameras[i]), isUndistorting());
+    }
+    if (QFile::exists(m_stereoOptions["calibrationFileLocation"].toString()))
+        m_stereoCalibration = StereoCalibrator::loadCalibration(m_stereoOptions["calibrationFileLocation"].toString());
+    if (!m_stereoCalibration.isEmpty())
+        stereoTriangulator->setCalibration(m_stereoCalibration);
+    else
+        sendMessage("Warning: No stereo calibration yet. Use Stereo Calibration in the Behavior Tracker window.");
+
+    stereoTriangulatorThread = new QThread;
+    stereoTriangulator->moveToThread(stereoTriangulatorThread);
+    QObject::connect(worker[m_stereoCameras[0]], &BehaviorTrackerWorker::positionReady, stereoTriangulator, &StereoTriangulator::handlePosition);
+    QObject::connect(worker[m_stereoCameras[1]], &BehaviorTrackerWorker::positionReady, stereoTriangulator, &StereoTriangulator::handlePosition);
+    QObject::connect(stereoTriangulator, &StereoTriangulator::sendMessage, this, &BehaviorTracker::sendMessage);
+    QObject::connect(stereoTriangulatorThread, SIGNAL (finished()), stereoTriangulatorThread, SLOT (deleteLater()));
+    stereoTriangulatorThread->start();
+
+    rootObject->setProperty("stereoAvailable", true);
 }
 
 void BehaviorTracker::cameraCalibration()
 {
-    // calibrate differently for 1 and 2 cameras
-    // for 1 camera need to define points on track and use prospective
-    // for 2 cameras we can use stereo calibrate and find 3d point
-    // ask user for specs of calibration grid (or just use a standard one
-    // collect images in increments of a few seconds
-    // display if calibration grid was detected
-    // run calibration and save to file(s)
+    // Intrinsics of each camera come from its own calibration window (BehaviorCam, CameraCalibrator) and reach
+    // the workers through setCameraCalibration(). This adds the extrinsics between the two stereo cameras
+    if (m_stereoCameras.size() != 2)
+        return;
+
+    if (!stereoCalibrator) {
+        stereoCalibrator = new StereoCalibrator(m_stereoOptions);
+        stereoCalibratorThread = new QThread;
+        QObject::connect(stereoCalibrator, &StereoCalibrator::sendMessage, this, &BehaviorTracker::sendMessage);
+        QObject::connect(stereoCalibrator, &StereoCalibrator::progressChanged, this, &BehaviorTracker::handleStereoCalibrationProgress);
+        QObject::connect(stereoCalibrator, &StereoCalibrator::calibrationDone, this, &BehaviorTracker::handleStereoCalibrationDone);
+        QObject::connect(stereoCalibratorThread, SIGNAL (finished()), stereoCalibratorThread, SLOT (deleteLater()));
+        for (int i = 0; i < 2; i++) {
+            QString name = m_stereoCameras[i];
+            stereoCalibrator->setCamera(i, name, frameBuffer[name], timeStampBuffer[name], bufferSize[name], m_acqFrameNum[name]);
+            stereoCalibrator->setCameraCalibration(i, m_calibration.value(name));
+        }
+        stereoCalibrator->moveToThread(stereoCalibratorThread);
+        stereoCalibratorThread->start();
+    }
+    QMetaObject::invokeMethod(stereoCalibrator, "start", Qt::QueuedConnection);
+}
+
+void BehaviorTracker::handleStereoCalibrationProgress(double progress, QString status)
+{
+    rootObject->setProperty("stereoProgress", progress);
+    rootObject->setProperty("stereoStatus", status);
+}
+
+void BehaviorTracker::handleStereoCalibrationDone(QJsonObject calibration)
+{
+    m_stereoCalibration = calibration;
+    if (stereoTriangulator)
+        QMetaObject::invokeMethod(stereoTriangulator, "setCalibration", Qt::QueuedConnection, Q_ARG(QJsonObject, calibration));
+    stereoCalibrationChanged(calibration);
+}
+
+void BehaviorTracker::setCameraCalibration(QString name, QJsonObject calibration)
+{
+    // Single camera calibrations come from BehaviorCam. The worker builds its undistortion tables on its next frame
+    if (!calibration.isEmpty())
+        m_calibration[name] = calibration;
+    if (worker.contains(name) && !calibration.isEmpty())
+        QMetaObject::invokeMethod(worker[name], "setCalibration", Qt::QueuedConnection, Q_ARG(QJsonObject, calibration));
+
+    // Stereo needs to know the worker's positions are undistorted from now on, so they don't get undistorted twice
+    int camera = m_stereoCameras.indexOf(name);
+    if (camera >= 0 && !calibration.isEmpty()) {
+        if (stereoTriangulator)
+            QMetaObject::invokeMethod(stereoTriangulator, "setCameraCalibration", Qt::QueuedConnection,
+                                      Q_ARG(int, camera), Q_ARG(QJsonObject, calibration), Q_ARG(bool, isUndistorting()));
+        if (stereoCalibrator)
+            QMetaObject::invokeMethod(stereoCalibrator, "setCameraCalibration", Qt::QueuedConnection,
+                                      Q_ARG(int, camera), Q_ARG(QJsonObject, calibration));
+    }
 }
 
 void BehaviorTracker::createView()
@@ -60,7 +173,7 @@ void BehaviorTracker::createView()
     view = new NewQuickView(url);
 
     view->setWidth(400);
-    view->setHeight(200);
+    view->setHeight(300);
     view->setTitle("Behavior Tracker");
     view->setX(400);
     view->setY(50);
@@ -74,15 +187,50 @@ void BehaviorTracker::createView()
 
 void BehaviorTracker::connectSnS()
 {
-
+    QObject::connect(rootObject, SIGNAL( stereoCalibrateClicked() ), this, SLOT( cameraCalibration()));
 }
 
 void BehaviorTracker::handleNewFrameAvailable(QString name, int frameNum)
 {
+    Q_UNUSED(frameNum);
+    // Connected directly so this runs on the camera's stream thread and goes straight to the worker's queue
+    // without passing through the GUI thread. The worker picks up every frame acquired since its last pass
+    if (worker.contains(name))
+        QMetaObject::invokeMethod(worker[name], "handleNewFrame", Qt::QueuedConnection);
+}
 
+void BehaviorTracker::handlePositionReady(QString name, int frameNum, qint64 timeStamp, QVector<float> values)
+{
+    Q_UNUSED(frameNum);
+    Q_UNUSED(timeStamp);
+    QStringList lines;
+
+    if (values[3] > 0)
+        positionText[name] = name + ": " + QString::number(values[0], 'f', 1) + ", " + QString::number(values[1], 'f', 1) +
+                " px, " + QString::number(values[2], 'f', 0) + " deg" +
+                (values.size() > 8 && !qIsNaN(values[8]) ? ", " + QString::number(values[8], 'f', 0) + " px/s" : "");
+    else
+        positionText[name] = name + ": not found";
+
+    // Text in the tracker window doesn't need to keep up with the camera
+    if (QDateTime::currentMSecsSinceEpoch() - m_lastGuiUpdate < 100)
+        return;
+    m_lastGuiUpdate = QDateTime::currentMSecsSinceEpoch();
+    for (auto it = positionText.constBegin(); it != positionText.constEnd(); ++it)
+        lines.append(it.value());
+    rootObject->setProperty("positionText", lines.join("\n"));
 }
 
 void BehaviorTracker::close()
 {
+    QStringList names = workerThread.keys();
+    for (int i = 0; i < names.length(); i++)
+        workerThread[names[i]]->quit();
+    if (stereoCalibrator)
+        QMetaObject::invokeMethod(stereoCalibrator, "stop", Qt::QueuedConnection);
+    if (stereoCalibratorThread)
+        stereoCalibratorThread->quit();
+    if (stereoTriangulatorThread)
+        stereoTriangulatorThread->quit();
     view->close();
 }
@@ -2,6 +2,9 @@
 #define BEHAVIORTRACKER_H
 
 #include "newquickview.h"
+#include "behaviortrackerworker.h"
+#include "stereocalibrator.h"
+#include "stereotriangulator.h"
 
 #include <opencv2/opencv.hpp>
 
@@ -12,6 +15,7 @@
 #include <QString>
 #include <QDebug>
 #include <QQuickItem>
+#include <QThread>
 
 class BehaviorTracker : public QObject
 {
@@ -19,28 +23,57 @@ class BehaviorTracker : public QObject
 public:
     explicit BehaviorTracker(QObject *parent = nullptr, QJsonObject userConfig = QJsonObject());
     void parseUserConfigTracker();
-    void loadCamCalibration(QString name);
-    void setBehaviorCamBufferParameters(QString name, cv::Mat* frameBuf, int bufSize, QAtomicInt* acqFrameNum);
-    void cameraCalibration();
+    void setBehaviorCamBufferParameters(QString name, cv::Mat* frameBuf, qint64* tsBuf, FrameTiming* timingBuf, int bufSize, QAtomicInt* acqFrameNum);
+    BehaviorTrackerWorker* getWorker(QString name) { return worker.value(name, nullptr); }
+    void setupStereo(); // After all cameras and their calibrations were set
+    StereoTriangulator* getStereoTriangulator() { return stereoTriangulator; }
+    QJsonObject getStereoCalibration() { return m_stereoCalibration; }
     void createView();
     void connectSnS();
 
 signals:
     void sendMessage(QString msg);
+    void stereoCalibrationChanged(QJsonObject calibration);
 
 public slots:
+    void cameraCalibration();
+    void handleStereoCalibrationProgress(double progress, QString status);
+    void handleStereoCalibrationDone(QJsonObject calibration);
     void handleNewFrameAvailable(QString name, int frameNum);
+    void setCameraCalibration(QString name, QJsonObject calibration);
+    void handlePositionReady(QString name, int frameNum, qint64 timeStamp, QVector<float> values);
     void testSlot(QString msg) { qDebug() << msg; }
     void close();
 
 private:
+    // Workers undistort the positions of calibrated cameras unless undistort is off
+    bool isUndistorting() { return m_userConfig["behaviorTracker"].toObject()["undistort"].toString("points") != "off"; }
+
     QString m_trackerType;
     int numberOfCameras;
     // Info from behavior cameras
     QMap<QString, cv::Mat*> frameBuffer;
+    QMap<QString, qint64*> timeStampBuffer;
+    QMap<QString, FrameTiming*> timingBuffer;
     QMap<QString, QAtomicInt*> m_acqFrameNum;
     QMap<QString, int> bufferSize;
 
+    // One worker and thread per camera
+    QMap<QString, BehaviorTrackerWorker*> worker;
+    QMap<QString, QThread*> workerThread;
+    QMap<QString, QString> positionText;
+    qint64 m_lastGuiUpdate;
+    QMap<QString, QJsonObject> m_calibration;
+
+    // Two camera 3D tracking ("stereo" in the behaviorTracker config)
+    QJsonObject m_stereoOptions;
+    QStringList m_stereoCameras;
+    QJsonObject m_stereoCalibration;
+    StereoCalibrator *stereoCalibrator;
+    QThread *stereoCalibratorThread;
+    StereoTriangulator *stereoTriangulator;
+    QThread *stereoTriangulatorThread;
+
     QMap<QString, cv::Mat> currentFrame;
     QMap<QString, int> currentFrameNumberProcessed;
     QJsonObject m_userConfig;
@@ -0,0 +1,380 @@
+#include "behaviortrackerworker.h"
+
+#include <QJsonArray>
+#include <QDebug>
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+
+#include <limits>
+#include <algorithm>
+
+BehaviorTrackerWorker::BehaviorTrackerWorker(QString deviceName, cv::Mat *frameBuf, qint64 *tsBuf, int bufSize, QAtomicInt *acqFrameNum, QJsonObject options, QObject *parent) :
+    QObject(parent),
+    m_deviceName(deviceName),
+    m_trackerType(options["type"].toString("None")),
+    frameBuffer(frameBuf),
+    timeStampBuffer(tsBuf),
+    bufferSize(bufSize),
+    m_acqFrameNum(acqFrameNum),
+    m_lastFrameNum(0),
+    m_hueWraps(false),
+    m_minArea(options["minArea"].toInt(TRACKER_DEFAULT_MIN_AREA)),
+    m_openRadius(qMax(0, options["openRadius"].toInt(1))),
+    m_warnedGrey(false),
+    m_undistortMode(options["undistort"].toString("points")),
+    m_polarity(options["polarity"].toString("dark")),
+    m_threshold(options["threshold"].toDouble(25)),
+    m_updateFrames(qMax(1, options["backgroundUpdateFrames"].toInt(30))),
+    m_updateRow(0),
+    m_passes(0),
+    m_headMinSpeed(options["headMinSpeed"].toDouble(20)),
+    m_hasPrevious(false),
+    m_previousTime(0)
+{
+    // Ranges in the user config go from 0 to 1. OpenCV's 8 bit HSV has hue from 0 to 180 and the rest from 0 to 255
+    QJsonArray hue = options["hue"].toArray({0, 1});
+    QJsonArray saturation = options["saturation"].toArray({0, 1});
+    QJsonArray value = options["value"].toArray({0, 1});
+    m_lower = cv::Scalar(hue[0].toDouble() * 180, saturation[0].toDouble() * 255, value[0].toDouble() * 255);
+    m_upper = cv::Scalar(hue[1].toDouble() * 180, saturation[1].toDouble() * 255, value[1].toDouble() * 255);
+    m_hueWraps = m_lower[0] > m_upper[0];
+
+    // Tracking ROI per camera, in sensor pixels
+    QJsonObject jROI = options["ROI"].toObject()[m_deviceName].toObject();
+    m_roi = cv::Rect(jROI["leftEdge"].toInt(0), jROI["topEdge"].toInt(0), jROI["width"].toInt(0), jROI["height"].toInt(0));
+
+    if (m_openRadius > 0)
+        m_kernel = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(2 * m_openRadius + 1, 2 * m_openRadius + 1));
+}
+
+void BehaviorTrackerWorker::setCalibration(QJsonObject calibration)
+{
+    if (m_undistortMode != "off" && m_undistorter.setCalibration(calibration))
+        qDebug() << m_deviceName << "tracker undistorting" << m_undistortMode;
+}
+
+QStringList BehaviorTrackerWorker::columns() const
+{
+    QStringList names = {"X (px)", "Y (px)", "Orientation (deg)", "Area (px)"};
+    if (m_trackerType == "background")
+        names << "Head X (px)" << "Head Y (px)" << "Tail X (px)" << "Tail Y (px)" << "Speed (px/s)";
+    return names;
+}
+
+void BehaviorTrackerWorker::handleNewFrame()
+{
+    int available = m_acqFrameNum->loadAcquire();
+
+    if (available - m_lastFrameNum > bufferSize / 2) {
+        if (m_lastFrameNum > 0)
+            qDebug() << m_deviceName << "tracker fell behind by" << available - m_lastFrameNum << "frames. Skipping ahead.";
+        m_lastFrameNum = available - 1;
+    }
+
+    while (m_lastFrameNum < available) {
+        m_lastFrameNum++;
+        processFrame(m_lastFrameNum);
+    }
+}
+
+cv::Rect BehaviorTrackerWorker::trackingRegion(const cv::Mat &frame)
+{
+    cv::Rect full(0, 0, frame.cols, frame.rows);
+    if (m_roi.area() <= 0)
+        return full;
+    return m_roi & full;
+}
+
+void BehaviorTrackerWorker::processFrame(int frameNum)
+{
+    int idx = (frameNum - 1) % bufferSize;
+    const cv::Mat &frame = frameBuffer[idx];
+    const float none = std::numeric_limits<float>::quiet_NaN();
+    QVector<float> values = {none, none, none, 0};
+    cv::Rect region;
+    int label;
+
+    if (frame.empty())
+        return;
+    region = trackingRegion(frame);
+    if (region.area() <= 0)
+        return;
+
+    // Points are undistorted after tracking. Frames get undistorted first and tracked as they are
+    bool undistortPoints = false;
+    cv::Mat roiFrame = frame(region);
+    if (m_undistorter.isValid() && m_undistorter.setRegion(region, frame.size())) {
+        if (m_undistortMode == "frames") {
+            m_undistorter.undistortFrame(frame, m_undistorted);
+            roiFrame = m_undistorted;
+        }
+        else
+            undistortPoints = true;
+    }
+
+    if (m_trackerType == "HSV") {
+        thresholdHSV(roiFrame);
+        label = largestBlob(values, region.tl());
+        if (label > 0 && undistortPoints)
+            undistortValues(values);
+    }
+    else if (m_trackerType == "background") {
+        values << none << none << none << none << none;
+        segmentBackground(roiFrame);
+        label = m_mask.empty() ? 0 : largestBlob(values, region.tl());
+        if (label > 0) {
+            blobEnds(label, values, region.tl());
+            if (undistortPoints)
+                undistortValues(values);
+            orderHeadTail(values, timeStampBuffer[idx]);
+        }
+        else
+            m_hasPrevious = false;
+    }
+
+    positionReady(m_deviceName, frameNum, timeStampBuffer[idx], values);
+}
+
+void BehaviorTrackerWorker::thresholdHSV(const cv::Mat &roiFrame)
+{
+    // Only the ROI gets converted. cvtColor and inRange are both vectorized in OpenCV
+    if (roiFrame.channels() == 1) {
+        if (!m_warnedGrey) {
+            sendMessage("Warning: " + m_deviceName + " is not set to color (\"isColor\"). HSV tracker only uses the value range.");
+            m_warnedGrey = true;
+        }
+        cv::inRange(roiFrame, m_lower[2], m_upper[2], m_mask);
+    }
+    else {
+        cv::cvtColor(roiFrame, m_hsv, cv::COLOR_BGR2HSV);
+        if (m_hueWraps) {
+            cv::inRange(m_hsv, cv::Scalar(m_lower[0], m_lower[1], m_lower[2]), cv::Scalar(180, m_upper[1], m_upper[2]), m_mask);
+            cv::inRange(m_hsv, cv::Scalar(0, m_lower[1], m_lower[2]), cv::Scalar(m_upper[0], m_upper[1], m_upper[2]), m_mask2);
+            cv::bitwise_or(m_mask, m_mask2, m_mask);
+        }
+        else
+            cv::inRange(m_hsv, m_lower, m_upper, m_mask);
+    }
+
+    // Removes single pixel speckle before looking for blobs
+    if (!m_kernel.empty())
+        cv::morphologyEx(m_mask, m_mask, cv::MORPH_OPEN, m_kernel);
+}
+
+int BehaviorTrackerWorker::largestBlob(QVector<float> &values, cv::Point offset)
+{
+    int numLabels = cv::connectedComponentsWithStats(m_mask, m_labels, m_stats, m_centroids, 8, CV_32S);
+    int best = 0, bestArea = 0;
+    cv::Rect box;
+    cv::Moments m;
+
+    // Label 0 is the background
+    for (int i = 1; i < numLabels; i++) {
+        if (m_stats.at<int>(i, cv::CC_STAT_AREA) > bestArea) {
+            bestArea = m_stats.at<int>(i, cv::CC_STAT_AREA);
+            best = i;
+        }
+    }
+    if (best == 0 || bestArea < m_minArea)
+        return 0;
+
+    // Orientation of the blob's major axis from its second order central moments
+    box = cv::Rect(m_stats.at<int>(best, cv::CC_STAT_LEFT), m_stats.at<int>(best, cv::CC_STAT_TOP),
+                   m_stats.at<int>(best, cv::CC_STAT_WIDTH), m_stats.at<int>(best, cv::CC_STAT_HEIGHT));
+    m = cv::moments(m_labels(box) == best, true);
+
+    values[0] = m_centroids.at<double>(best, 0) + offset.x;
+    values[1] = m_centroids.at<double>(best, 1) + offset.y;
+    values[2] = 0.5 * atan2(2 * m.mu11, m.mu20 - m.mu02) * 180 / CV_PI;
+    values[3] = bestArea;
+    return best;
+}
+
+void BehaviorTrackerWorker::segmentBackground(const cv::Mat &roiFrame)
+{
+    if (roiFrame.channels() == 1)
+        roiFrame.copyTo(m_gray);
+    else
+        cv::cvtColor(roiFrame, m_gray, cv::COLOR_BGR2GRAY);
+
+    if (m_background.size() != m_gray.size()) {
+        // New model, seeded with this frame. Nothing gets segmented until it has seen a full pass
+        m_gray.copyTo(m_background);
+        for (int b = 0; b < TRACKER_HIST_BINS; b++) {
+            cv::inRange(m_gray, b * (256 / TRACKER_HIST_BINS), (b + 1) * (256 / TRACKER_HIST_BINS) - 1, m_histogram[b]);
+            m_histogram[b] &= TRACKER_HIST_SEED;
+        }
+        m_updateRow = 0;
+        m_passes = 0;
+        m_mask.release();
+        return;
+    }
+
+    updateBackground();
+    if (m_passes == 0) {
+        m_mask.release();
+        return;
+    }
+
+    // Saturating subtraction leaves only pixels darker (or lighter) than the background
+    if (m_polarity == "light")
+        cv::subtract(m_gray, m_background, m_diff);
+    else if (m_polarity == "any")
+        cv::absdiff(m_gray, m_background, m_diff);
+    else
+        cv::subtract(m_background, m_gray, m_diff);
+    cv::threshold(m_diff, m_mask, m_threshold, 255, cv::THRESH_BINARY);
+    if (!m_kernel.empty())
+        cv::morphologyEx(m_mask, m_mask, cv::MORPH_OPEN, m_kernel);
+}
+
+void BehaviorTrackerWorker::updateBackground()
+{
+    // Amortized: each frame only updates its band of rows
+    const int rows = m_gray.rows;
+    const int band = (rows + m_updateFrames - 1) / m_updateFrames;
+    const int end = qMin(rows, m_updateRow + band);
+
+    for (int y = m_updateRow; y < end; y++)
+        updateBackgroundRow(y);
+
+    m_updateRow = end;
+    if (m_updateRow >= rows) {
+        m_updateRow = 0;
+        m_passes++;
+        if (m_passes % TRACKER_HIST_DECAY_PASSES == 0) {
+            for (int b = 0; b < TRACKER_HIST_BINS; b++)
+                m_histogram[b].convertTo(m_histogram[b], -1, 0.5);
+        }
+    }
+}
+
+void BehaviorTrackerWorker::updateBackgroundRow(int y)
+{
+    const int binWidth = 256 / TRACKER_HIST_BINS;
+    const uchar *src = m_gray.ptr<uchar>(y);
+    uchar *bg = m_background.ptr<uchar>(y);
+    uchar *hist[TRACKER_HIST_BINS];
+    int x = 0;
+
+    for (int b = 0; b < TRACKER_HIST_BINS; b++)
+        hist[b] = m_histogram[b].ptr<uchar>(y);
+
+#if CV_SIMD
+    const int lanes = cv::v_uint8::nlanes;
+    const cv::v_uint8 vOne = cv::vx_setall_u8(1);
+    const cv::v_uint8 vSnap = cv::vx_setall_u8(TRACKER_BG_SNAP);
+    cv::v_uint16 v16[2];
+    for (; x <= m_gray.cols - lanes; x += lanes) {
+        cv::v_uint8 v = cv::vx_load(src + x);
+        cv::v_uint8 b8 = cv::vx_load(bg + x);
+        cv::v_expand(v, v16[0], v16[1]);
+        cv::v_uint8 bin = cv::v_pack(v16[0] >> 4, v16[1] >> 4);
+        cv::v_uint8 best = cv::vx_setzero_u8(), center = cv::vx_setzero_u8();
+
+        // Count this frame's bin and find the mode in the same pass over the planes
+        for (int b = 0; b < TRACKER_HIST_BINS; b++) {
+            cv::v_uint8 count = cv::vx_load(hist[b] + x) + ((bin == cv::vx_setall_u8(b)) & vOne);
+            cv::v_uint8 higher = count > best;
+            cv::v_store(hist[b] + x, count);
+            best = cv::v_max(best, count);
+            center = cv::v_select(higher, cv::vx_setall_u8(b * binWidth + binWidth / 2), center);
+        }
+
+        // Running median restricted to the mode, so the animal passing through doesn't pull it
+        b8 = cv::v_select(cv::v_absdiff(b8, center) > vSnap, center, b8);
+        cv::v_uint8 inMode = cv::v_absdiff(v, center) <= vSnap;
+        b8 = b8 + ((v > b8) & inMode & vOne);
+        b8 = b8 - ((v < b8) & inMode & vOne);
+        cv::v_store(bg + x, b8);
+    }
+#endif
+    for (; x < m_gray.cols; x++) {
+        int bin = src[x] / binWidth, best = 0, center = 0;
+        if (hist[bin][x] < 255)
+            hist[bin][x]++;
+        for (int b = 0; b < TRACKER_HIST_BINS; b++) {
+            if (hist[b][x] > best) {
+                best = hist[b][x];
+                center = b * binWidth + binWidth / 2;
+            }
+        }
+        if (abs(bg[x] - center) > TRACKER_BG_SNAP)
+            bg[x] = center;
+        if (abs(src[x] - center) <= TRACKER_BG_SNAP) {
+            if (src[x] > bg[x])
+                bg[x]++;
+            else if (src[x] < bg[x])
+                bg[x]--;
+        }
+    }
+}
+
+void BehaviorTrackerWorker::blobEnds(int label, QVector<float> &values, cv::Point offset)
+{
+    // Ends of the blob along its major axis
+    const float cx = values[0] - offset.x, cy = values[1] - offset.y;
+    const float c = cos(values[2] * CV_PI / 180), s = sin(values[2] * CV_PI / 180);
+    const int left = m_stats.at<int>(label, cv::CC_STAT_LEFT), top = m_stats.at<int>(label, cv::CC_STAT_TOP);
+    const int right = left + m_stats.at<int>(label, cv::CC_STAT_WIDTH), bottom = top + m_stats.at<int>(label, cv::CC_STAT_HEIGHT);
+    float minProj = 0, maxProj = 0, proj;
+
+    for (int y = top; y < bottom; y++) {
+        const int *row = m_labels.ptr<int>(y);
+        for (int x = left; x < right; x++) {
+            if (row[x] != label)
+                continue;
+            proj = (x - cx) * c + (y - cy) * s;
+            minProj = qMin(minProj, proj);
+            maxProj = qMax(maxProj, proj);
+        }
+    }
+    values[4] = values[0] + c * maxProj;
+    values[5] = values[1] + s * maxProj;
+    values[6] = values[0] + c * minProj;
+    values[7] = values[1] + s * minProj;
+}
+
+void BehaviorTrackerWorker::undistortValues(QVector<float> &values)
+{
+    // Centroid, then head and tail when there are any
+    cv::Point2f p;
+    for (int i = 0; i + 1 < values.size(); i += (i == 0 ? 4 : 2)) {
+        if (qIsNaN(values[i]))
+            continue;
+        p = m_undistorter.undistortPoint(cv::Point2f(values[i], values[i + 1]));
+        values[i] = p.x;
+        values[i + 1] = p.y;
+    }
+}
+
+void BehaviorTrackerWorker::orderHeadTail(QVector<float> &values, qint64 timeStamp)
+{
+    cv::Point2f center(values[0], values[1]), a(values[4], values[5]), b(values[6], values[7]), velocity(0, 0);
+    bool aIsHead;
+
+    if (m_hasPrevious && timeStamp > m_previousTime)
+        velocity = (center - m_previousCenter) * (1000.0f / (timeStamp - m_previousTime));
+
+    // The head leads while the animal moves. Otherwise it stays the end closest to where the head was
+    if (cv::norm(velocity) >= m_headMinSpeed)
+        aIsHead = (a - center).dot(velocity) >= 0;
+    else if (m_hasPrevious)
+        aIsHead = cv::norm(a - m_previousHead) <= cv::norm(b - m_previousHead);
+    else
+        aIsHead = true;
+    if (!aIsHead)
+        std::swap(a, b);
+
+    values[4] = a.x;
+    values[5] = a.y;
+    values[6] = b.x;
+    values[7] = b.y;
+    values[8] = m_hasPrevious ? cv::norm(velocity) : std::numeric_limits<float>::quiet_NaN();
+
+    m_hasPrevious = true;
+    m_previousCenter = center;
+    m_previousHead = a;
+    m_previousTime = timeStamp;
+}
@@ -0,0 +1,105 @@
+#ifndef BEHAVIORTRACKERWORKER_H
+#define BEHAVIORTRACKERWORKER_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QJsonObject>
+#include <QStringList>
+#include <QVector>
+
+#include <opencv2/core/core.hpp>
+
+#include "undistorter.h"
+
+#define TRACKER_DEFAULT_MIN_AREA    20 // Blobs smaller than this many pixels count as noise
+#define TRACKER_HIST_BINS           16 // Per pixel background histogram, 16 gray levels per bin
+#define TRACKER_HIST_SEED           4  // Count given to the first frame's bin so the model starts from it
+#define TRACKER_HIST_DECAY_PASSES   128 // Counts are halved after this many passes over the frame, which also keeps them below 256
+#define TRACKER_BG_SNAP             12 // Background further than this from the center of the mode bin jumps to it
+
+// Tracks a single behavior camera for BehaviorTracker. Each camera gets its own worker on its own thread
+// so dual camera rigs don't have to share a core. Only reads the camera's frame ring, so capture is never blocked,
+// and jumps to the newest frame when it falls more than half a ring behind.
+// "HSV": thresholds the tracking ROI of the frame in HSV and reports the centroid, orientation and area of the largest blob.
+// "background": segments the animal as the largest blob that differs from a background model, and also reports
+// head and tail points and speed. The model is the mode of a small per pixel histogram of gray levels, refined inside
+// the mode bin by a running median. It is updated a band of rows per frame so a full pass takes backgroundUpdateFrames.
+class BehaviorTrackerWorker : public QObject
+{
+    Q_OBJECT
+public:
+    BehaviorTrackerWorker(QString deviceName, cv::Mat *frameBuf, qint64 *tsBuf, int bufSize, QAtomicInt *acqFrameNum, QJsonObject options, QObject *parent = nullptr);
+
+    QStringList columns() const;
+
+signals:
+    void sendMessage(QString msg);
+    // Same layout as columns(). Position is NaN and area 0 when nothing was found
+    void positionReady(QString deviceName, int frameNum, qint64 timeStamp, QVector<float> values);
+
+public slots:
+    void handleNewFrame();
+    void setCalibration(QJsonObject calibration);
+
+private:
+    void processFrame(int frameNum);
+    cv::Rect trackingRegion(const cv::Mat &frame);
+    void thresholdHSV(const cv::Mat &roiFrame);
+    int largestBlob(QVector<float> &values, cv::Point offset);
+    void segmentBackground(const cv::Mat &roiFrame);
+    void updateBackground();
+    void updateBackgroundRow(int y);
+    void blobEnds(int label, QVector<float> &values, cv::Point offset);
+    void undistortValues(QVector<float> &values);
+    void orderHeadTail(QVector<float> &values, qint64 timeStamp);
+
+    QString m_deviceName;
+    QString m_trackerType;
+    cv::Mat *frameBuffer;
+    qint64 *timeStampBuffer;
+    int bufferSize;
+    QAtomicInt *m_acqFrameNum;
+    int m_lastFrameNum;
+
+    cv::Rect m_roi; // Empty means the whole frame
+    cv::Scalar m_lower;
+    cv::Scalar m_upper;
+    bool m_hueWraps; // Hue range passes through red, so it is split in two
+    int m_minArea;
+    int m_openRadius;
+    bool m_warnedGrey;
+
+    // Lens distortion, from the camera's calibration. "points" undistorts the results, "frames" tracks on undistorted frames
+    QString m_undistortMode;
+    Undistorter m_undistorter;
+    cv::Mat m_undistorted;
+
+    // Background model. One histogram plane per bin keeps the update vectorizable
+    cv::Mat m_histogram[TRACKER_HIST_BINS];
+    cv::Mat m_background;
+    cv::Mat m_gray;
+    cv::Mat m_diff;
+    QString m_polarity; // "dark", "light" or "any" animal compared to the background
+    double m_threshold;
+    int m_updateFrames;
+    int m_updateRow;
+    int m_passes;
+    double m_headMinSpeed;
+
+    // Previous detection, for speed and keeping head and tail apart
+    bool m_hasPrevious;
+    cv::Point2f m_previousCenter;
+    cv::Point2f m_previousHead;
+    qint64 m_previousTime;
+
+    // Reused between frames to avoid allocations
+    cv::Mat m_hsv;
+    cv::Mat m_mask;
+    cv::Mat m_mask2;
+    cv::Mat m_kernel;
+    cv::Mat m_labels;
+    cv::Mat m_stats;
+    cv::Mat m_centroids;
+};
+
+#endif // BEHAVIORTRACKERWORKER_H
@@ -0,0 +1,266 @@
+#include "cameracalibrator.h"
+
+#include <QRunnable>
+#include <QMutexLocker>
+#include <QThread>
+#include <QDateTime>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QFile>
+#include <QDebug>
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/calib3d.hpp>
+
+class BoardDetectionTask : public QRunnable
+{
+public:
+    BoardDetectionTask(CameraCalibrator *calibrator, cv::Mat gray) : m_calibrator(calibrator), m_gray(gray) {}
+    void run() override { m_calibrator->detectBoard(m_gray); }
+
+private:
+    CameraCalibrator *m_calibrator;
+    cv::Mat m_gray;
+};
+
+CameraCalibrator::CameraCalibrator(QString deviceName, cv::Mat *frameBuf, int bufSize, QAtomicInt *acqFrameNum, QJsonObject options, QObject *parent) :
+    QObject(parent),
+    m_deviceName(deviceName),
+    frameBuffer(frameBuf),
+    bufferSize(bufSize),
+    m_acqFrameNum(acqFrameNum),
+    m_boardSize(options["boardWidth"].toInt(9), options["boardHeight"].toInt(6)),
+    m_squareSize(options["squareSize"].toDouble(1)),
+    m_numViews(qMax(3, options["numViews"].toInt(20))),
+    m_sampleIntervalMs(options["sampleIntervalMs"].toInt(500)),
+    m_fileName(options["fileLocation"].toString()),
+    m_running(false),
+    m_lastSample(0),
+    m_sampled(0),
+    m_missed(0)
+{
+    // Leave some cores for acquisition, display and recording
+    int threads = options["threads"].toInt(0);
+    if (threads <= 0)
+        threads = qMax(1, QThread::idealThreadCount() / 2);
+    m_pool.setMaxThreadCount(threads);
+}
+
+CameraCalibrator::~CameraCalibrator()
+{
+    m_pool.clear();
+    m_pool.waitForDone();
+}
+
+void CameraCalibrator::start()
+{
+    m_pool.clear();
+    m_pool.waitForDone();
+    m_views.clear();
+    m_newDetections.clear();
+    m_missed = 0;
+    m_sampled = 0;
+    m_running = true;
+    progressChanged(0, "Hold a " + QString::number(m_boardSize.width + 1) + "x" + QString::number(m_boardSize.height + 1) +
+                    " chessboard in view and move it around the whole frame.");
+}
+
+void CameraCalibrator::stop()
+{
+    m_running = false;
+    m_pool.clear();
+}
+
+void CameraCalibrator::handleNewFrame()
+{
+    int f = m_acqFrameNum->loadAcquire();
+    cv::Mat gray;
+
+    // Only the newest frame is sampled, and only when a pool thread is free to take it
+    if (!m_running || f <= 0 || QDateTime::currentMSecsSinceEpoch() - m_lastSample < m_sampleIntervalMs)
+        return;
+    if (m_pool.activeThreadCount() >= m_pool.maxThreadCount())
+        return;
+
+    const cv::Mat &frame = frameBuffer[(f - 1) % bufferSize];
+    if (frame.empty())
+        return;
+    if (frame.channels() == 1)
+        frame.copyTo(gray);
+    else
+        cv::cvtColor(frame, gray, cv::COLOR_BGR2GRAY);
+
+    m_lastSample = QDateTime::currentMSecsSinceEpoch();
+    m_imageSize = gray.size();
+    m_sampled++;
+    m_pool.start(new BoardDetectionTask(this, gray));
+}
+
+void CameraCalibrator::detectBoard(cv::Mat gray)
+{
+    std::vector<cv::Point2f> corners;
+    bool found = findBoard(gray, m_boardSize, corners);
+
+    QMutexLocker locker(&m_detectionMutex);
+    if (found)
+        m_newDetections.append(corners);
+    else
+        m_missed++;
+    QMetaObject::invokeMethod(this, "collectDetections", Qt::QueuedConnection);
+}
+
+void CameraCalibrator::collectDetections()
+{
+    QVector<std::vector<cv::Point2f>> detections;
+    int missed;
+    double movement;
+    QString status;
+
+    {
+        QMutexLocker locker(&m_detectionMutex);
+        detections.swap(m_newDetections);
+        missed = m_missed;
+    }
+    if (!m_running)
+        return;
+
+    // A view only counts if the board moved since the last one, so holding still doesn't fill up the calibration
+    for (int i = 0; i < detections.size(); i++) {
+        if (!m_views.empty()) {
+            movement = 0;
+            for (size_t j = 0; j < detections[i].size(); j++)
+                movement += cv::norm(detections[i][j] - m_views.back()[j]);
+            movement /= detections[i].size();
+            if (movement < CALIBRATION_MIN_BOARD_MOVE * m_imageSize.width) {
+                status = "Board found. Move it to a new position.";
+                continue;
+            }
+        }
+        m_views.push_back(detections[i]);
+        status = "Board found.";
+    }
+    if (detections.isEmpty())
+        status = "No board found in the last sample.";
+
+    progressChanged((double) m_views.size() / m_numViews,
+                    status + " " + QString::number(m_views.size()) + " of " + QString::number(m_numViews) +
+                    " views. " + QString::number(missed) + " of " + QString::number(m_sampled) + " samples without a board.");
+
+    if ((int) m_views.size() >= m_numViews) {
+        m_running = false;
+        m_pool.clear();
+        solve();
+    }
+}
+
+void CameraCalibrator::solve()
+{
+    std::vector<std::vector<cv::Point3f>> objectPoints;
+    std::vector<cv::Point3f> board;
+    std::vector<cv::Mat> rvecs, tvecs;
+    cv::Mat cameraMatrix, distCoeffs;
+    QJsonObject calibration;
+    double rms;
+
+    progressChanged(1, "Solving calibration...");
+    for (int y = 0; y < m_boardSize.height; y++)
+        for (int x = 0; x < m_boardSize.width; x++)
+            board.push_back(cv::Point3f(x * m_squareSize, y * m_squareSize, 0));
+    objectPoints.assign(m_views.size(), board);
+
+    try {
+        rms = cv::calibrateCamera(objectPoints, m_views, m_imageSize, cameraMatrix, distCoeffs, rvecs, tvecs);
+    }
+    catch (cv::Exception &e) {
+        sendMessage("Error: " + m_deviceName + " calibration failed. " + QString::fromStdString(e.msg));
+        progressChanged(0, "Calibration failed.");
+        return;
+    }
+
+    calibration["deviceName"] = m_deviceName;
+    calibration["date"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+    calibration["imageWidth"] = m_imageSize.width;
+    calibration["imageHeight"] = m_imageSize.height;
+    calibration["cameraMatrix"] = matToJson(cameraMatrix);
+    calibration["distCoeffs"] = matToJson(distCoeffs);
+    calibration["rmsError"] = rms;
+    calibration["boardWidth"] = m_boardSize.width;
+    calibration["boardHeight"] = m_boardSize.height;
+    calibration["squareSize"] = m_squareSize;
+    calibration["numViews"] = (int) m_views.size();
+
+    if (m_fileName.isEmpty())
+        sendMessage("Warning: " + m_deviceName + " has no cameraCalibrationFileLocation. Calibration is only saved with recordings of this session.");
+    else if (!saveCalibration(calibration, m_fileName))
+        sendMessage("Error: Could not save " + m_deviceName + " calibration to " + m_fileName + ".");
+
+    sendMessage(m_deviceName + " calibrated with a reprojection error of " + QString::number(rms, 'f', 3) + " px.");
+    progressChanged(1, "Done. Reprojection error " + QString::number(rms, 'f', 3) + " px.");
+    calibrationDone(calibration);
+}
+
+QJsonObject CameraCalibrator::loadCalibration(QString fileName)
+{
+    QFile file(fileName);
+    QJsonObject calibration;
+
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qDebug() << "Could not open camera calibration" << fileName;
+        return calibration;
+    }
+    calibration = QJsonDocument::fromJson(file.readAll()).object();
+    file.close();
+    if (calibration["cameraMatrix"].toArray().size() != 9) {
+        qDebug() << "Camera calibration" << fileName << "has no camera matrix";
+        return QJsonObject();
+    }
+    return calibration;
+}
+
+bool CameraCalibrator::saveCalibration(QJsonObject calibration, QString fileName)
+{
+    QFile file(fileName);
+
+    if (!file.open(QFile::WriteOnly | QFile::Truncate))
+        return false;
+    file.write(QJsonDocument(calibration).toJson());
+    file.close();
+    return true;
+}
+
+bool CameraCalibrator::intrinsics(QJsonObject calibration, cv::Mat &cameraMatrix, cv::Mat &distCoeffs)
+{
+    QJsonArray jMatrix = calibration["cameraMatrix"].toArray();
+    QJsonArray jDist = calibration["distCoeffs"].toArray();
+
+    if (jMatrix.size() != 9)
+        return false;
+    cameraMatrix = cv::Mat(3, 3, CV_64F);
+    for (int i = 0; i < 9; i++)
+        cameraMatrix.at<double>(i / 3, i % 3) = jMatrix[i].toDouble();
+    distCoeffs = cv::Mat(1, jDist.size(), CV_64F);
+    for (int i = 0; i < jDist.size(); i++)
+        distCoeffs.at<double>(i) = jDist[i].toDouble();
+    return true;
+}
+
+bool CameraCalibrator::findBoard(const cv::Mat &gray, cv::Size boardSize, std::vector<cv::Point2f> &corners)
+{
+    bool found = cv::findChessboardCorners(gray, boardSize, corners,
+                                           cv::CALIB_CB_ADAPTIVE_THRESH | cv::CALIB_CB_NORMALIZE_IMAGE | cv::CALIB_CB_FAST_CHECK);
+    if (found)
+        cv::cornerSubPix(gray, corners, cv::Size(11, 11), cv::Size(-1, -1),
+                         cv::TermCriteria(cv::TermCriteria::EPS + cv::TermCriteria::COUNT, 30, 0.01));
+    return found;
+}
+
+QJsonArray CameraCalibrator::matToJson(const cv::Mat &mat)
+{
+    // Row major, doubles
+    QJsonArray array;
+    cv::Mat values;
+    mat.convertTo(values, CV_64F);
+    for (int i = 0; i < (int) values.total(); i++)
+        array.append(values.at<double>(i / values.cols, i % values.cols));
+    return array;
+}
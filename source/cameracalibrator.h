@@ -0,0 +1,78 @@
+#ifndef CAMERACALIBRATOR_H
+#define CAMERACALIBRATOR_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QThreadPool>
+#include <QMutex>
+#include <QVector>
+
+#include <opencv2/core/core.hpp>
+
+#include <vector>
+
+#define CALIBRATION_MIN_BOARD_MOVE  0.05 // Mean corner movement, as a fraction of frame width, needed for a new view to count
+
+// Intrinsic calibration of a behavior camera from views of a chessboard ("cameraCalibration" in the camera's user config).
+// While running, frames are sampled from the camera's buffer at sampleIntervalMs and board detection runs on a thread pool,
+// so a slow detection never holds up the camera. Once numViews different views of the board were found the camera matrix and
+// distortion coefficients are solved and handed out as JSON, which is also what gets saved to cameraCalibrationFileLocation.
+class CameraCalibrator : public QObject
+{
+    Q_OBJECT
+public:
+    CameraCalibrator(QString deviceName, cv::Mat *frameBuf, int bufSize, QAtomicInt *acqFrameNum, QJsonObject options, QObject *parent = nullptr);
+    ~CameraCalibrator();
+
+    void detectBoard(cv::Mat gray); // Runs on the thread pool
+
+    static QJsonObject loadCalibration(QString fileName);
+    static bool saveCalibration(QJsonObject calibration, QString fileName);
+    static bool intrinsics(QJsonObject calibration, cv::Mat &cameraMatrix, cv::Mat &distCoeffs);
+    static bool findBoard(const cv::Mat &gray, cv::Size boardSize, std::vector<cv::Point2f> &corners);
+    static QJsonArray matToJson(const cv::Mat &mat);
+
+signals:
+    void sendMessage(QString msg);
+    void progressChanged(double progress, QString status);
+    void calibrationDone(QJsonObject calibration);
+
+public slots:
+    void handleNewFrame();
+    void start();
+    void stop();
+
+private slots:
+    void collectDetections();
+
+private:
+    void solve();
+
+    QString m_deviceName;
+    cv::Mat *frameBuffer;
+    int bufferSize;
+    QAtomicInt *m_acqFrameNum;
+
+    cv::Size m_boardSize; // Inner corners
+    double m_squareSize;
+    int m_numViews;
+    qint64 m_sampleIntervalMs;
+    QString m_fileName;
+
+    QThreadPool m_pool;
+    bool m_running;
+    qint64 m_lastSample;
+    cv::Size m_imageSize;
+    int m_sampled;
+
+    // Filled by detectBoard() on pool threads, picked up by collectDetections()
+    QMutex m_detectionMutex;
+    QVector<std::vector<cv::Point2f>> m_newDetections;
+    int m_missed;
+
+    std::vector<std::vector<cv::Point2f>> m_views;
+};
+
+#endif // CAMERACALIBRATOR_H
@@ -0,0 +1,125 @@
+#include "clockmodel.h"
+
+#include <QMutexLocker>
+
+#include <algorithm>
+#include <cmath>
+
+ClockModel::ClockModel() :
+    m_firstFrameNum(0),
+    m_firstTimeStamp(0),
+    m_lastFrameNum(-1),
+    m_next(0),
+    m_count(0),
+    m_period(0),
+    m_intercept(0),
+    m_jitter(0)
+{
+    m_scratch.reserve(CLOCK_WINDOW_SIZE);
+}
+
+void ClockModel::reset()
+{
+    QMutexLocker locker(&m_mutex);
+    m_lastFrameNum = -1;
+    m_next = 0;
+    m_count = 0;
+    m_period = 0;
+    m_intercept = 0;
+    m_jitter = 0;
+}
+
+double ClockModel::addFrame(qint64 daqFrameNum, qint64 hostTimeStamp)
+{
+    // Counter went backwards or stood still, so the DAQ reconnected or there is no counter at all (webcams)
+    if (daqFrameNum <= m_lastFrameNum || daqFrameNum < 0) {
+        reset();
+        if (daqFrameNum < 0)
+            return hostTimeStamp;
+    }
+    if (m_count == 0) {
+        m_firstFrameNum = daqFrameNum;
+        m_firstTimeStamp = hostTimeStamp;
+    }
+    m_lastFrameNum = daqFrameNum;
+
+    m_frameNum[m_next] = daqFrameNum - m_firstFrameNum;
+    m_timeStamp[m_next] = hostTimeStamp - m_firstTimeStamp;
+    m_next = (m_next + 1) % CLOCK_WINDOW_SIZE;
+    m_count = qMin(m_count + 1, CLOCK_WINDOW_SIZE);
+    if (m_count < CLOCK_MIN_SAMPLES)
+        return hostTimeStamp;
+
+    fit();
+    return m_firstTimeStamp + m_intercept + m_period * (daqFrameNum - m_firstFrameNum);
+}
+
+void ClockModel::fit()
+{
+    const int oldest = (m_next - m_count + CLOCK_WINDOW_SIZE) % CLOCK_WINDOW_SIZE;
+    const int half = m_count / 2;
+    int a, b;
+    double period, intercept, jitter;
+
+    // Slopes between pairs half a window apart. Frame numbers only go up, so none of them divide by zero
+    m_scratch.resize(half);
+    for (int i = 0; i < half; i++) {
+        a = (oldest + i) % CLOCK_WINDOW_SIZE;
+        b = (oldest + i + half) % CLOCK_WINDOW_SIZE;
+        m_scratch[i] = (m_timeStamp[b] - m_timeStamp[a]) / (m_frameNum[b] - m_frameNum[a]);
+    }
+    std::nth_element(m_scratch.begin(), m_scratch.begin() + half / 2, m_scratch.end());
+    period = m_scratch[half / 2];
+
+    m_scratch.resize(m_count);
+    for (int i = 0; i < m_count; i++)
+        m_scratch[i] = m_timeStamp[i] - period * m_frameNum[i];
+    std::nth_element(m_scratch.begin(), m_scratch.begin() + m_count / 2, m_scratch.end());
+    intercept = m_scratch[m_count / 2];
+
+    for (int i = 0; i < m_count; i++)
+        m_scratch[i] = std::abs(m_timeStamp[i] - intercept - period * m_frameNum[i]);
+    std::nth_element(m_scratch.begin(), m_scratch.begin() + m_count / 2, m_scratch.end());
+    jitter = m_scratch[m_count / 2];
+
+    QMutexLocker locker(&m_mutex);
+    m_period = period;
+    m_intercept = intercept;
+    m_jitter = jitter;
+}
+
+double ClockModel::framePeriod()
+{
+    QMutexLocker locker(&m_mutex);
+    return m_period;
+}
+
+double ClockModel::drift()
+{
+    QMutexLocker locker(&m_mutex);
+    double nominal;
+
+    if (m_period <= 0)
+        return 0;
+    nominal = 1000.0 / qMax(1.0, std::round(1000.0 / m_period));
+    return (m_period / nominal - 1) * 1e6;
+}
+
+double ClockModel::jitter()
+{
+    QMutexLocker locker(&m_mutex);
+    return m_jitter;
+}
+
+QJsonObject ClockModel::summary()
+{
+    QJsonObject jSummary;
+    double period = framePeriod();
+
+    jSummary["framePeriodMs"] = period;
+    jSummary["frameRate"] = period > 0 ? 1000.0 / period : 0;
+    jSummary["driftPpm"] = drift();
+    jSummary["jitterMs"] = jitter();
+    jSummary["windowFrames"] = CLOCK_WINDOW_SIZE;
+    return jSummary;
+}
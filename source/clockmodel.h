@@ -0,0 +1,52 @@
+#ifndef CLOCKMODEL_H
+#define CLOCKMODEL_H
+
+#include <QtGlobal>
+#include <QMutex>
+#include <QJsonObject>
+
+#include <vector>
+
+#define CLOCK_WINDOW_SIZE       512 // Frames the fit is taken over. About 17 s at 30 FPS
+#define CLOCK_MIN_SAMPLES       32  // Frames needed before time stamps get corrected
+
+// Online fit of host time stamps against the DAQ's frame counter. The DAQ counts frames on its own clock, so
+// host time = intercept + period * DAQ frame number, and everything the host adds on top (USB transfer, scheduling)
+// is noise around that line. The fit is a Theil-Sen estimate over the last CLOCK_WINDOW_SIZE frames: the slope is the
+// median of the slopes between frames half a window apart and the intercept the median of what is left, so late frames
+// and dropped frames don't pull it. Corrected time stamps carry the median transfer delay as a constant offset.
+// addFrame() is called from the stream thread. The fit summary can be read from any thread.
+class ClockModel
+{
+public:
+    ClockModel();
+    void reset();
+    // Returns the corrected time stamp in ms since epoch. Until there is a fit, and for frames that don't count up, it is the host time stamp
+    double addFrame(qint64 daqFrameNum, qint64 hostTimeStamp);
+
+    double framePeriod(); // ms per DAQ frame on the host clock. 0 until there is a fit
+    // DAQ clock rate relative to the host's, in ppm. Taken against the nearest whole frame rate, which is what the DAQ is set to
+    double drift();
+    double jitter(); // Median absolute difference between host time stamps and the fit, in ms
+    QJsonObject summary();
+
+private:
+    void fit();
+
+    // Ring of the last frames. Frame numbers and times are relative to the first frame after a reset
+    qint64 m_firstFrameNum;
+    qint64 m_firstTimeStamp;
+    qint64 m_lastFrameNum;
+    double m_frameNum[CLOCK_WINDOW_SIZE];
+    double m_timeStamp[CLOCK_WINDOW_SIZE];
+    int m_next;
+    int m_count;
+    std::vector<double> m_scratch;
+
+    QMutex m_mutex; // For the fit, which is read from other threads
+    double m_period;
+    double m_intercept;
+    double m_jitter;
+};
+
+#endif // CLOCKMODEL_H
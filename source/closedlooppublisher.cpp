@@ -0,0 +1,200 @@
+#include "closedlooppublisher.h"
+#include "traceextractor.h"
+
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QDebug>
+
+#include <algorithm>
+
+ClosedLoopPublisher::ClosedLoopPublisher(QString deviceName, cv::Mat *frameBuf, qint64 *tsBuf, FrameTiming *timingBuf, int bufSize,
+                                         QAtomicInt *sourceFrameNum, float *traceBuf, QJsonObject options, QObject *parent) :
+    QObject(parent),
+    m_deviceName(deviceName),
+    m_serverName(options["serverName"].toString("miniscopeEvents_" + deviceName)),
+    frameBuffer(frameBuf),
+    timeStampBuffer(tsBuf),
+    timingBuffer(timingBuf),
+    traceBuffer(traceBuf),
+    bufferSize(bufSize),
+    m_sourceFrameNum(sourceFrameNum),
+    m_lastFrameNum(0),
+    m_server(nullptr),
+    m_latency(CLOSED_LOOP_LATENCY_WINDOW, 0),
+    m_latencyCount(0),
+    m_reportedCount(0),
+    m_lastReport(0)
+{
+    QJsonArray rules = options["rules"].toArray();
+    QStringList valueNames = {"mean", "corrected", "dFF"}; // Order of the values of an ROI in the trace buffer
+
+    for (int i = 0; i < rules.size(); i++) {
+        QJsonObject jRule = rules[i].toObject();
+        Rule rule;
+        rule.name = jRule["name"].toString("rule" + QString::number(i));
+        rule.roi = jRule["roi"].toInt(-1);
+        rule.valueIndex = qMax(0, valueNames.indexOf(jRule["value"].toString("dFF")));
+        rule.region = cv::Rect(jRule["leftEdge"].toInt(0), jRule["topEdge"].toInt(0), jRule["width"].toInt(0), jRule["height"].toInt(0));
+        rule.threshold = jRule["threshold"].toDouble(0);
+        rule.rising = jRule["direction"].toString("rising") != "falling";
+        rule.refractoryMs = jRule["refractoryMs"].toInt(0);
+        rule.hasPrevious = false;
+        rule.previous = 0;
+        rule.lastEventTime = 0;
+
+        if (rule.roi >= 0 && traceBuffer == nullptr) {
+            qDebug() << "Closed loop rule" << rule.name << "uses an ROI but trace extraction is off. Rule ignored.";
+            continue;
+        }
+        if (rule.roi < 0 && rule.region.area() <= 0) {
+            qDebug() << "Closed loop rule" << rule.name << "needs an roi or a region. Rule ignored.";
+            continue;
+        }
+        m_rules.append(rule);
+    }
+}
+
+void ClosedLoopPublisher::startRunning()
+{
+    // Server has to be created on this object's thread
+    m_server = new QLocalServer(this);
+    QLocalServer::removeServer(m_serverName); // Left over from a crashed session
+    if (!m_server->listen(m_serverName)) {
+        sendMessage("Error: Closed loop server " + m_serverName + " could not start. " + m_server->errorString());
+        return;
+    }
+    QObject::connect(m_server, &QLocalServer::newConnection, this, &ClosedLoopPublisher::handleNewConnection);
+    sendMessage(m_deviceName + " publishing closed loop events on " + m_serverName + " (" + m_server->fullServerName() + ") with " + QString::number(m_rules.size()) + " rules.");
+}
+
+void ClosedLoopPublisher::handleNewConnection()
+{
+    QLocalSocket *client;
+    while ((client = m_server->nextPendingConnection()) != nullptr) {
+        m_clients.append(client);
+        QObject::connect(client, &QLocalSocket::disconnected, this, [this, client]() {
+            m_clients.removeAll(client);
+            client->deleteLater();
+        });
+    }
+}
+
+void ClosedLoopPublisher::handleNewFrame()
+{
+    int available = m_sourceFrameNum->loadAcquire();
+
+    // Old frames are useless for closed loop and may already be overwritten
+    if (available - m_lastFrameNum > bufferSize / 2)
+        m_lastFrameNum = available - 1;
+
+    while (m_lastFrameNum < available) {
+        m_lastFrameNum++;
+        processFrame(m_lastFrameNum);
+    }
+
+    if (m_latencyCount > m_reportedCount && LatencyTracker::now() / 1000 - m_lastReport > CLOSED_LOOP_REPORT_INTERVAL_MS)
+        reportLatency();
+}
+
+double ClosedLoopPublisher::ruleValue(const Rule &rule, int idx, bool &valid)
+{
+    const float *slot;
+    const cv::Mat &frame = frameBuffer[idx];
+
+    valid = false;
+    if (rule.roi >= 0) {
+        slot = &traceBuffer[idx * TRACE_SLOT_SIZE];
+        if (rule.roi >= (int) slot[0])
+            return 0;
+        valid = true;
+        return slot[1 + rule.roi * TRACE_VALUES_PER_ROI + rule.valueIndex];
+    }
+
+    if (frame.empty() || (rule.region & cv::Rect(0, 0, frame.cols, frame.rows)) != rule.region)
+        return 0;
+    valid = true;
+    return cv::mean(frame(rule.region))[0];
+}
+
+void ClosedLoopPublisher::processFrame(int frameNum)
+{
+    int idx = (frameNum - 1) % bufferSize;
+    qint64 timeStamp = timeStampBuffer[idx];
+    double value;
+    bool valid, crossed;
+
+    for (int i = 0; i < m_rules.size(); i++) {
+        Rule &rule = m_rules[i];
+        value = ruleValue(rule, idx, valid);
+        if (!valid)
+            continue;
+
+        if (rule.rising)
+            crossed = rule.hasPrevious && rule.previous < rule.threshold && value >= rule.threshold;
+        else
+            crossed = rule.hasPrevious && rule.previous > rule.threshold && value <= rule.threshold;
+        rule.previous = value;
+        rule.hasPrevious = true;
+
+        if (crossed && (rule.lastEventTime == 0 || timeStamp - rule.lastEventTime >= rule.refractoryMs)) {
+            rule.lastEventTime = timeStamp;
+            publish(rule, i, frameNum, timeStamp, value,
+                    timingBuffer && timingBuffer[idx].dequeued > 0 ? LatencyTracker::now() - timingBuffer[idx].dequeued : -1);
+        }
+    }
+}
+
+void ClosedLoopPublisher::publish(const Rule &rule, int ruleIndex, int frameNum, qint64 timeStamp, double value, qint64 latency)
+{
+    QJsonObject event;
+    QByteArray line;
+
+    event["device"] = m_deviceName;
+    event["rule"] = rule.name;
+    event["frameNum"] = frameNum;
+    event["timeStamp"] = timeStamp;
+    event["value"] = value;
+    event["latencyUs"] = latency; // From the frame leaving the camera driver to this event, -1 if unknown
+    line = QJsonDocument(event).toJson(QJsonDocument::Compact) + "\n";
+
+    for (int i = m_clients.size() - 1; i >= 0; i--) {
+        QLocalSocket *client = m_clients[i];
+        if (client->bytesToWrite() > CLOSED_LOOP_MAX_CLIENT_BUFFER) {
+            sendMessage("Warning: Closed loop client is not reading events. Disconnecting it.");
+            client->abort();
+            continue;
+        }
+        client->write(line);
+        client->flush(); // Hands the bytes to the OS now instead of on the next event loop pass
+    }
+
+    if (latency >= 0) {
+        m_latency[m_latencyCount % CLOSED_LOOP_LATENCY_WINDOW] = latency;
+        m_latencyCount++;
+    }
+    eventPublished(m_deviceName, frameNum, timeStamp, {(float) ruleIndex, (float) value, (float) latency});
+}
+
+void ClosedLoopPublisher::reportLatency()
+{
+    int n = qMin(m_latencyCount, CLOSED_LOOP_LATENCY_WINDOW);
+    QVector<qint64> sorted = m_latency.mid(0, n);
+
+    std::sort(sorted.begin(), sorted.end());
+    m_lastReport = LatencyTracker::now() / 1000;
+    m_reportedCount = m_latencyCount;
+    sendMessage(m_deviceName + " closed loop latency p50/p99: " +
+                QString::number(sorted[n / 2] / 1000.0, 'f', 1) + "/" +
+                QString::number(sorted[qMin(n - 1, (int) (n * 0.99))] / 1000.0, 'f', 1) + " ms over " +
+                QString::number(n) + " events.");
+}
+
+void ClosedLoopPublisher::close()
+{
+    for (int i = 0; i < m_clients.size(); i++)
+        m_clients[i]->disconnectFromServer();
+    if (m_server)
+        m_server->close();
+}
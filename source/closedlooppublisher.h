@@ -0,0 +1,85 @@
+#ifndef CLOSEDLOOPPUBLISHER_H
+#define CLOSEDLOOPPUBLISHER_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QJsonObject>
+#include <QVector>
+#include <QList>
+
+#include <opencv2/core/core.hpp>
+
+#include "latencytracker.h"
+
+class QLocalServer;
+class QLocalSocket;
+
+#define CLOSED_LOOP_MAX_CLIENT_BUFFER   65536   // Clients that stop reading get dropped instead of growing memory
+#define CLOSED_LOOP_LATENCY_WINDOW      256
+#define CLOSED_LOOP_REPORT_INTERVAL_MS  30000   // Latency summary to the Control Panel at most this often
+
+// Watches ROI traces or pixel regions of a Miniscope stream for threshold crossings ("closedLoop" in the user config)
+// and publishes an event for each as a line of JSON to every client of a local socket server
+// (a Unix domain socket, or a named pipe on Windows). Runs on its own thread and only reads the buffers,
+// so it never holds up acquisition or recording. When it falls far behind it skips to the newest frame.
+// Latency is measured from the time the frame was dequeued from the camera to the time the event was written.
+class ClosedLoopPublisher : public QObject
+{
+    Q_OBJECT
+public:
+    ClosedLoopPublisher(QString deviceName, cv::Mat *frameBuf, qint64 *tsBuf, FrameTiming *timingBuf, int bufSize,
+                        QAtomicInt *sourceFrameNum, float *traceBuf, QJsonObject options, QObject *parent = nullptr);
+
+    static QStringList columns() { return {"Rule Index", "Value", "Latency (us)"}; }
+
+signals:
+    void sendMessage(QString msg);
+    // Same layout as columns(), for DataSaver's aux stream
+    void eventPublished(QString deviceName, int frameNum, qint64 timeStamp, QVector<float> values);
+
+public slots:
+    void startRunning();
+    void handleNewFrame();
+    void close();
+
+private:
+    struct Rule {
+        QString name;
+        int roi;            // Trace ROI index, or -1 for a pixel region
+        int valueIndex;     // Which trace value of the ROI
+        cv::Rect region;
+        double threshold;
+        bool rising;
+        qint64 refractoryMs;
+        bool hasPrevious;
+        double previous;
+        qint64 lastEventTime;
+    };
+
+    void processFrame(int frameNum);
+    double ruleValue(const Rule &rule, int idx, bool &valid);
+    void publish(const Rule &rule, int ruleIndex, int frameNum, qint64 timeStamp, double value, qint64 latency);
+    void handleNewConnection();
+    void reportLatency();
+
+    QString m_deviceName;
+    QString m_serverName;
+    cv::Mat *frameBuffer;
+    qint64 *timeStampBuffer;
+    FrameTiming *timingBuffer;
+    float *traceBuffer;
+    int bufferSize;
+    QAtomicInt *m_sourceFrameNum;
+    int m_lastFrameNum;
+
+    QVector<Rule> m_rules;
+    QLocalServer *m_server;
+    QList<QLocalSocket*> m_clients;
+
+    QVector<qint64> m_latency; // Ring of the latest event latencies in us
+    int m_latencyCount;
+    int m_reportedCount;
+    qint64 m_lastReport;
+};
+
+#endif // CLOSEDLOOPPUBLISHER_H
@@ -2,6 +2,7 @@
 
 
 #include "newquickview.h"
+#include "qualitymonitor.h"
 
 
 #include <QObject>
@@ -13,6 +14,8 @@
 #include <QTimer>
 #include <QTime>
 #include <QMetaObject>
+#include <QVariantList>
+#include <QVariantMap>
 
 ControlPanel::ControlPanel(QObject *parent, QJsonObject userConfig) :
     QObject(parent),
@@ -24,6 +27,10 @@ ControlPanel::ControlPanel(QObject *parent, QJsonObject userConfig) :
     recordTimer = new QTimer(this);
     QObject::connect(recordTimer, &QTimer::timeout, this, &ControlPanel::recordTimerTick);
 
+    // Metrics arrive at frame rate. The sparklines get redrawn a few times a second
+    qualityTimer = new QTimer(this);
+    QObject::connect(qualityTimer, &QTimer::timeout, this, &ControlPanel::updateQualityDisplay);
+
     createView();
 }
 
@@ -162,6 +169,51 @@ void ControlPanel::extTriggerTriggered(bool state)
     }
 }
 
+void ControlPanel::handleQualityMetrics(QString deviceName, int frameNum, qint64 timeStamp, QVector<float> values)
+{
+    Q_UNUSED(frameNum);
+    Q_UNUSED(timeStamp);
+    QStringList names = QualityMonitor::columns();
+    QString key;
+
+    for (int i = 0; i < values.size() && i < names.length(); i++) {
+        key = deviceName + " " + names[i];
+        if (!m_qualityHistory.contains(key))
+            m_qualityKeys.append(key);
+        m_qualityHistory[key].append(values[i]);
+        if (m_qualityHistory[key].size() > QUALITY_SPARKLINE_LENGTH)
+            m_qualityHistory[key].removeFirst();
+    }
+    if (!qualityTimer->isActive())
+        qualityTimer->start(250);
+}
+
+void ControlPanel::handleQualityAlarm(QString deviceName, int metric, bool active)
+{
+    QStringList names = QualityMonitor::columns();
+    if (metric >= 0 && metric < names.length())
+        m_qualityAlarm[deviceName + " " + names[metric]] = active;
+}
+
+void ControlPanel::updateQualityDisplay()
+{
+    QVariantList data, values;
+    QVariantMap entry;
+
+    for (int i = 0; i < m_qualityKeys.length(); i++) {
+        const QVector<float> &history = m_qualityHistory[m_qualityKeys[i]];
+        values.clear();
+        for (int j = 0; j < history.size(); j++)
+            values.append(history[j]);
+        entry["name"] = m_qualityKeys[i];
+        entry["values"] = values;
+        entry["latest"] = history.isEmpty() ? 0 : history.last();
+        entry["alarm"] = m_qualityAlarm.value(m_qualityKeys[i], false);
+        data.append(entry);
+    }
+    rootObject->setProperty("qualityData", data);
+}
+
 void ControlPanel::close()
 {
     view->close();
@@ -7,6 +7,11 @@
 #include <QQuickItem>
 #include <QJsonObject>
 #include <QTimer>
+#include <QMap>
+#include <QVector>
+#include <QStringList>
+
+#define QUALITY_SPARKLINE_LENGTH    120 // Newest metric values kept per sparkline
 
 class ControlPanel : public QObject
 {
@@ -25,6 +30,9 @@ public slots:
     void handleNoteSumbit(QString note);
     void extTriggerSwitchToggled2(bool checkedState);
     void extTriggerTriggered(bool state);
+    void handleQualityMetrics(QString deviceName, int frameNum, qint64 timeStamp, QVector<float> values);
+    void handleQualityAlarm(QString deviceName, int metric, bool active);
+    void updateQualityDisplay();
     void close();
 
 signals:
@@ -46,6 +54,12 @@ private:
     QTimer *recordTimer;
     bool m_recording;
 
+    // Live image quality sparklines, one per device and metric
+    QTimer *qualityTimer;
+    QStringList m_qualityKeys;
+    QMap<QString, QVector<float>> m_qualityHistory;
+    QMap<QString, bool> m_qualityAlarm;
+
 
 };
 
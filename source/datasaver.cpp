@@ -1,4 +1,6 @@
 #include "datasaver.h"
+#include "sessionmigrator.h"
+#include "motioncorrector.h"
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -24,7 +26,10 @@ DataSaver::DataSaver(QObject *parent) :
     QObject(parent),
     baseDirectory(""),
     m_recording(false),
-    m_running(false)
+    m_running(false),
+    m_preTriggerActive(false),
+    m_preTriggerSeconds(0),
+    m_triggerTimeStamp(-1)
 {
 
 }
@@ -101,16 +106,17 @@ void DataSaver::setupBaseDirectory()
 {
 //    if (baseDirectory.isEmpty()) {
         QString tempString, tempString2;
+        QString sessionPath;
+        QString scratchDirectory = m_userConfig["scratchDirectory"].toString();
         QJsonArray directoryStructure = m_userConfig["directoryStructure"].toArray();
 
         // Construct and make base directory
-        baseDirectory = m_userConfig["dataDirectory"].toString();
         for (int i = 0; i < directoryStructure.size(); i++) {
             tempString = directoryStructure[i].toString();
             if (tempString == "date")
-                baseDirectory += "/" + recordStartDateTime.date().toString("yyyy_MM_dd");
+                sessionPath += "/" + recordStartDateTime.date().toString("yyyy_MM_dd");
             else if (tempString == "time")
-                baseDirectory += "/" + recordStartDateTime.time().toString("HH_mm_ss");
+                sessionPath += "/" + recordStartDateTime.time().toString("HH_mm_ss");
             else {
                 tempString2 = m_userConfig[tempString].toString().replace(" ", "_");
 
@@ -118,10 +124,10 @@ void DataSaver::setupBaseDirectory()
                     // Entry does not exist in User Config JSON file
                     sendMessage("Warning: " + tempString + " does not have associated value in User Config JSON file.");
                     sendMessage("Warning: Using /" + tempString + "Missing/ as place holder in data path.");
-                    baseDirectory += "/" + tempString + "Missing";
+                    sessionPath += "/" + tempString + "Missing";
                 }
                 else
-                    baseDirectory += "/" + tempString2;
+                    sessionPath += "/" + tempString2;
             }
 //            else if (tempString == "researcherName")
 //                baseDirectory += "/" + m_userConfig["researcherName"].toString().replace(" ", "_");
@@ -130,6 +136,16 @@ void DataSaver::setupBaseDirectory()
 //            else if (tempString == "animalName")
 //                baseDirectory += " /" + m_userConfig["animalName"].toString().replace(" ", "_");
         }
+
+        // With a scratch directory everything gets written locally first and moved to dataDirectory by SessionMigrator
+        if (scratchDirectory.isEmpty()) {
+            baseDirectory = m_userConfig["dataDirectory"].toString() + sessionPath;
+            m_migrationDirectory = "";
+        }
+        else {
+            baseDirectory = scratchDirectory + sessionPath;
+            m_migrationDirectory = m_userConfig["dataDirectory"].toString() + sessionPath;
+        }
 //    }
 }
 
@@ -143,69 +159,36 @@ void DataSaver::startRunning()
     m_running = true;
     int i;
     int bufPosition;
-    int fileNum;
-    bool isColor;
-    QString tempStr;
+    double correctedTimeStamp;
     QStringList names;
     while(m_running) {
         // for video streams
         names = frameBuffer.keys();
         for (i = 0; i < frameBuffer.size(); i++) {
-            while (usedCount[names[i]]->tryAcquire()) {
+            while (frameIsReady(names[i]) && usedCount[names[i]]->tryAcquire()) {
                 // grad info from buffer in a threadsafe way
+                bufPosition = frameCount[names[i]] % bufferSize[names[i]];
+                correctedTimeStamp = timingBuffer.contains(names[i]) ? timingBuffer[names[i]][bufPosition].correctedTimeStamp : 0;
+                if (correctedTimeStamp <= 0)
+                    correctedTimeStamp = timeStampBuffer[names[i]][bufPosition];
+                const cv::Mat &frame = recordRegisteredFrames.value(names[i], false) ?
+                            registeredFrameBuffer[names[i]][bufPosition] : frameBuffer[names[i]][bufPosition];
                 if (m_recording) {
                     // save frame to file
-                    if ((savedFrameCount[names[i]] % framesPerFile[names[i]]) == 0) {
-                        // Create first as well as new video files
-                        fileNum = (int) (savedFrameCount[names[i]] / framesPerFile[names[i]]);
-                        tempStr = deviceDirectory[names[i]] + "/" + QString::number(fileNum) + ".avi";
-                        videoWriter[names[i]]->release(); // release full file
-                        if (frameBuffer[names[i]][0].channels() == 1)
-                            isColor = false;
-                        else
-                            isColor = true;
-                        // TODO: Add compression options here
-                        if (ROI.contains(names[i])) {
-                            // Need to trim frame to ROI
-                            videoWriter[names[i]]->open(tempStr.toUtf8().constData(),
-                                    dataCompressionFourCC[names[i]], 60,
-                                    cv::Size(ROI[names[i]][2], ROI[names[i]][3]), isColor); // color should be set to false?
-                        }
-                        else {
-                            videoWriter[names[i]]->open(tempStr.toUtf8().constData(),
-                                    dataCompressionFourCC[names[i]], 60,
-                                    cv::Size(frameBuffer[names[i]][0].cols, frameBuffer[names[i]][0].rows), isColor); // color should be set to false?
-                        }
-
-                    }
-                    bufPosition = frameCount[names[i]] % bufferSize[names[i]];
-                    *csvStream[names[i]] << savedFrameCount[names[i]] << ","
-                                         << (timeStampBuffer[names[i]][bufPosition] - recordStartDateTime.toMSecsSinceEpoch()) << ","
-                                         << usedCount[names[i]]->available() << endl;
-
-                    if (headOrientationStreamState[names[i]] == true && bnoBuffer[names[i]] != nullptr) {
-                        if (headOrientationFilterState[names[i]] && bnoBuffer[names[i]][bufPosition*5 + 4] >= 0.05) { // norm is below 0.98. Should be 1 ideally
-                            // Filter bad data and current data is bad
-                        }
-                        else {
-                            *headOriStream[names[i]] << (timeStampBuffer[names[i]][bufPosition] - recordStartDateTime.toMSecsSinceEpoch()) << ","
-                                                     << bnoBuffer[names[i]][bufPosition*5 + 0] << ","
-                                                     << bnoBuffer[names[i]][bufPosition*5 + 1] << ","
-                                                     << bnoBuffer[names[i]][bufPosition*5 + 2] << ","
-                                                     << bnoBuffer[names[i]][bufPosition*5 + 3] << endl;
-                        }
-
-                    }
-
-                    // TODO: Increment video file if reach max frame number per file
-                    if (ROI.contains(names[i])) {
-                        videoWriter[names[i]]->write(frameBuffer[names[i]][bufPosition](cv::Rect(ROI[names[i]][0],ROI[names[i]][1],ROI[names[i]][2],ROI[names[i]][3])));
-
-                    }
-                    else
-                        videoWriter[names[i]]->write(frameBuffer[names[i]][bufPosition]);
-
-                    savedFrameCount[names[i]]++;
+                    writeFrame(names[i],
+                               frame,
+                               timeStampBuffer[names[i]][bufPosition],
+                               correctedTimeStamp,
+                               (bnoBuffer[names[i]] != nullptr) ? &bnoBuffer[names[i]][bufPosition*5] : nullptr,
+                               shiftBuffer.contains(names[i]) ? &shiftBuffer[names[i]][bufPosition*REGISTRATION_SHIFT_VALUES] : nullptr,
+                               traceExtractor.contains(names[i]) ? &traceExtractor[names[i]]->getTraceBufferPointer()[bufPosition*TRACE_SLOT_SIZE] : nullptr);
+                }
+                else if (m_preTriggerActive) {
+                    // Hold on to the most recent frames so they can be saved once a trigger arrives
+                    preTriggerBuffer[names[i]].push(frame,
+                                                    timeStampBuffer[names[i]][bufPosition],
+                                                    correctedTimeStamp,
+                                                    (bnoBuffer[names[i]] != nullptr) ? &bnoBuffer[names[i]][bufPosition*5] : nullptr);
                 }
 
                 frameCount[names[i]]++;
@@ -216,6 +199,107 @@ void DataSaver::startRunning()
     }
 }
 
+bool DataSaver::frameIsReady(QString name)
+{
+    // Frames stay in the buffer until every processing stage, like motion correction or trace extraction, is done with them
+    const QVector<QAtomicInt*> stages = frameStageNum.value(name);
+    for (int i = 0; i < stages.size(); i++) {
+        if ((qint64) frameCount[name] >= (qint64) stages[i]->loadAcquire())
+            return false;
+    }
+    return true;
+}
+
+void DataSaver::writeFrame(QString name, const cv::Mat &frame, qint64 timeStamp, double correctedTimeStamp, const float *bno, const float *shift, const float *trace)
+{
+    int fileNum;
+    bool isColor;
+    QString tempStr;
+
+    if ((savedFrameCount[name] % framesPerFile[name]) == 0) {
+        // Create first as well as new video files
+        fileNum = (int) (savedFrameCount[name] / framesPerFile[name]);
+        tempStr = deviceDirectory[name] + "/" + QString::number(fileNum) + ".avi";
+        videoWriter[name]->release(); // release full file
+        if (frame.channels() == 1)
+            isColor = false;
+        else
+            isColor = true;
+        // TODO: Add compression options here
+        if (cropRegion.contains(name)) {
+            openCropVideoFiles(name, fileNum, frame);
+        }
+        else if (ROI.contains(name)) {
+            // Need to trim frame to ROI
+            videoWriter[name]->open(tempStr.toUtf8().constData(),
+                    dataCompressionFourCC[name], 60,
+                    cv::Size(ROI[name][2], ROI[name][3]), isColor); // color should be set to false?
+        }
+        else {
+            videoWriter[name]->open(tempStr.toUtf8().constData(),
+                    dataCompressionFourCC[name], 60,
+                    cv::Size(frame.cols, frame.rows), isColor); // color should be set to false?
+        }
+        if (fileNum > 0)
+            segmentCompleted(name, fileNum - 1, framesPerFile[name]);
+    }
+    *csvStream[name] << savedFrameCount[name] << ","
+                     << (timeStamp - recordStartDateTime.toMSecsSinceEpoch()) << ","
+                     << usedCount[name]->available() << ","
+                     << QString::number(correctedTimeStamp - recordStartDateTime.toMSecsSinceEpoch(), 'f', 3) << endl;
+    // Corrected time stamps line devices up to well below a ms, which the host's arrival times can't
+    syncIndex.addFrame(name, savedFrameCount[name], correctedTimeStamp - recordStartDateTime.toMSecsSinceEpoch());
+
+    if (headOrientationStreamState[name] == true && bno != nullptr) {
+        if (headOrientationFilterState[name] && bno[4] >= 0.05) { // norm is below 0.98. Should be 1 ideally
+            // Filter bad data and current data is bad
+        }
+        else {
+            *headOriStream[name] << (timeStamp - recordStartDateTime.toMSecsSinceEpoch()) << ","
+                                 << bno[0] << ","
+                                 << bno[1] << ","
+                                 << bno[2] << ","
+                                 << bno[3] << endl;
+        }
+
+    }
+
+    if (shift != nullptr && shiftStream.contains(name)) {
+        *shiftStream[name] << savedFrameCount[name] << ","
+                           << (timeStamp - recordStartDateTime.toMSecsSinceEpoch()) << ","
+                           << shift[0] << ","
+                           << shift[1] << ","
+                           << shift[2] << endl;
+    }
+
+    if (trace != nullptr && traceFile.contains(name)) {
+        // Record is frame number, time stamp, ROI count and then mean, background subtracted mean and dF/F of each ROI
+        qint32 frameNumber = savedFrameCount[name];
+        qint64 relativeTime = timeStamp - recordStartDateTime.toMSecsSinceEpoch();
+        qint32 roiCount = (qint32) trace[0];
+        traceFile[name]->write((const char*) &frameNumber, sizeof(frameNumber));
+        traceFile[name]->write((const char*) &relativeTime, sizeof(relativeTime));
+        traceFile[name]->write((const char*) &roiCount, sizeof(roiCount));
+        traceFile[name]->write((const char*) &trace[1], sizeof(float) * roiCount * TRACE_VALUES_PER_ROI);
+    }
+
+    if (summaryImages.contains(name))
+        summaryImages[name]->addFrame(frame);
+
+    // TODO: Increment video file if reach max frame number per file
+    if (cropRegion.contains(name)) {
+        writeCropFrames(name, frame);
+    }
+    else if (ROI.contains(name)) {
+        videoWriter[name]->write(frame(cv::Rect(ROI[name][0],ROI[name][1],ROI[name][2],ROI[name][3])));
+
+    }
+    else
+        videoWriter[name]->write(frame);
+
+    savedFrameCount[name]++;
+}
+
 void DataSaver::startRecording()
 {
     // setupBaseDirectory() is called within setupFilePaths() right after recording start time is set. This initial call to setupBaseDir shouldn't be needed.
@@ -239,6 +323,16 @@ void DataSaver::startRecording()
         // TODO: Save meta data JSONs
         jDoc = constructBaseDirectoryMetaData();
         saveJson(jDoc, baseDirectory + "/metaData.json");
+        if (!stereoCalibration.isEmpty())
+            overwriteJson(QJsonDocument(stereoCalibration), baseDirectory + "/stereoCalibration.json");
+
+        if (!m_migrationDirectory.isEmpty()) {
+            // Lets SessionMigrator find this session again if the software gets closed before it is moved
+            QJsonObject migrationTarget;
+            migrationTarget["destination"] = m_migrationDirectory;
+            saveJson(QJsonDocument(migrationTarget), baseDirectory + "/" + MIGRATION_TARGET_FILE_NAME);
+            sendMessage("Recording to scratch. Data will be moved to " + m_migrationDirectory);
+        }
 
         QString deviceName;
         // For Miniscopes
@@ -268,7 +362,7 @@ void DataSaver::startRecording()
             csvFile[keys[i]] = new QFile(deviceDirectory[keys[i]] + "/timeStamps.csv");
             csvFile[keys[i]]->open(QFile::WriteOnly | QFile::Truncate);
             csvStream[keys[i]] = new QTextStream(csvFile[keys[i]]);
-            *csvStream[keys[i]] << "Frame Number,Time Stamp (ms),Buffer Index" << endl;
+            *csvStream[keys[i]] << "Frame Number,Time Stamp (ms),Buffer Index,Corrected Time Stamp (ms)" << endl;
 
             if (headOrientationStreamState[keys[i]] == true && bnoBuffer[keys[i]] != nullptr) {
                 headOriFile[keys[i]] = new QFile(deviceDirectory[keys[i]] + "/headOrientation.csv");
@@ -276,16 +370,79 @@ void DataSaver::startRecording()
                 headOriStream[keys[i]] = new QTextStream(headOriFile[keys[i]]);
                 *headOriStream[keys[i]] << "Time Stamp (ms),qw,qx,qy,qz" << endl;
             }
+
+            if (shiftBuffer.contains(keys[i])) {
+                // Shift that was applied to each frame by motion correction, in pixels
+                shiftFile[keys[i]] = new QFile(deviceDirectory[keys[i]] + "/motionCorrection.csv");
+                shiftFile[keys[i]]->open(QFile::WriteOnly | QFile::Truncate);
+                shiftStream[keys[i]] = new QTextStream(shiftFile[keys[i]]);
+                *shiftStream[keys[i]] << "Frame Number,Time Stamp (ms),X Shift,Y Shift,Peak Correlation" << endl;
+            }
+
+            if (traceExtractor.contains(keys[i])) {
+                // Little endian binary since a few thousand ROIs at 30 FPS is too much for a csv
+                traceFile[keys[i]] = new QFile(deviceDirectory[keys[i]] + "/traces.bin");
+                traceFile[keys[i]]->open(QFile::WriteOnly | QFile::Truncate);
+                quint32 header[2] = {TRACE_FILE_VERSION, TRACE_VALUES_PER_ROI};
+                traceFile[keys[i]]->write(TRACE_FILE_MAGIC, 4);
+                traceFile[keys[i]]->write((const char*) header, sizeof(header));
+                saveTraceROIs(keys[i]);
+            }
             // TODO: Remember to close files on exit or stop recording signal
 
             videoWriter[keys[i]] = new cv::VideoWriter();
             // TODO: Correctly enter size of videoWriter
     //         TODO: Release videoWriters at exit
 
+            if (cropRegion.contains(keys[i])) {
+                if (!cropVideoWriter.contains(keys[i])) {
+                    int numStreams = (cropMode[keys[i]] == "masked") ? 1 : cropRegion[keys[i]].length();
+                    for (int j = 0; j < numStreams; j++)
+                        cropVideoWriter[keys[i]].append(new cv::VideoWriter());
+                    cropFrame[keys[i]].resize(numStreams);
+                }
+                if (cropMode[keys[i]] == "separate") {
+                    for (int j = 0; j < cropRegion[keys[i]].length(); j++)
+                        QDir().mkdir(deviceDirectory[keys[i]] + "/crop" + QString::number(j));
+                }
+            }
+
             savedFrameCount[keys[i]] = 0;
 
+            if (summaryImages.contains(keys[i]))
+                summaryImages[keys[i]]->reset();
+            if (cameraCalibration.contains(keys[i]))
+                overwriteJson(QJsonDocument(cameraCalibration[keys[i]]), deviceDirectory[keys[i]] + "/cameraCalibration.json");
+
+            // Acquired frame number of the first saved frame, counting frames held from before the trigger
+            recordFrameOffset[keys[i]] = (qint64) frameCount[keys[i]] - (preTriggerBuffer.contains(keys[i]) ? preTriggerBuffer[keys[i]].size() : 0);
+            QStringList streamNames = auxColumns.value(keys[i]).keys();
+            for (int j = 0; j < streamNames.length(); j++) {
+                auxFile[keys[i]][streamNames[j]] = new QFile(deviceDirectory[keys[i]] + "/" + streamNames[j] + ".csv");
+                auxFile[keys[i]][streamNames[j]]->open(QFile::WriteOnly | QFile::Truncate);
+                auxStream[keys[i]][streamNames[j]] = new QTextStream(auxFile[keys[i]][streamNames[j]]);
+                *auxStream[keys[i]][streamNames[j]] << "Frame Number,Time Stamp (ms)," << auxColumns[keys[i]][streamNames[j]].join(",") << endl;
+            }
+
+
+        }
+
+        setupSyncIndex();
 
+        // Save frames held from before the trigger. These get negative time stamps.
+        keys = preTriggerBuffer.keys();
+        for (int i = 0; i < keys.length(); i++) {
+            if (preTriggerBuffer[keys[i]].size() > 0)
+                sendMessage(keys[i] + ": saving " + QString::number(preTriggerBuffer[keys[i]].size()) + " pre-trigger frames.");
+            for (int j = 0; j < preTriggerBuffer[keys[i]].size(); j++)
+                writeFrame(keys[i],
+                           preTriggerBuffer[keys[i]].frame(j),
+                           preTriggerBuffer[keys[i]].timeStamp(j),
+                           preTriggerBuffer[keys[i]].correctedTimeStamp(j),
+                           preTriggerBuffer[keys[i]].bno(j));
+            preTriggerBuffer[keys[i]].clear();
         }
+        m_triggerTimeStamp = -1;
 
         // Creates note csv file
         noteFile = new QFile(baseDirectory + "/notes.csv");
@@ -313,11 +470,50 @@ void DataSaver::stopRecording()
         videoWriter[keys[i]]->release();
         csvFile[keys[i]]->close();
 
+        if (cropVideoWriter.contains(keys[i]))
+            for (int j = 0; j < cropVideoWriter[keys[i]].length(); j++)
+                cropVideoWriter[keys[i]][j]->release();
+
         if (headOrientationStreamState[keys[i]] == true && bnoBuffer[keys[i]] != nullptr)
             if (headOriFile[keys[i]]->isOpen())
                 headOriFile[keys[i]]->close();
+
+        if (shiftFile.contains(keys[i]) && shiftFile[keys[i]]->isOpen())
+            shiftFile[keys[i]]->close();
+
+        if (traceFile.contains(keys[i]) && traceFile[keys[i]]->isOpen()) {
+            traceFile[keys[i]]->close();
+            saveTraceROIs(keys[i]); // ROIs might have been added during the recording
+        }
+
+        QStringList streamNames = auxFile.value(keys[i]).keys();
+        for (int j = 0; j < streamNames.length(); j++) {
+            if (auxFile[keys[i]][streamNames[j]]->isOpen())
+                auxFile[keys[i]][streamNames[j]]->close();
+        }
+
+        // Frame period, drift and jitter of the device's time stamps, from the fit the corrected time stamps came from
+        if (clockModel.contains(keys[i]) && clockModel[keys[i]]->framePeriod() > 0)
+            saveJson(QJsonDocument(clockModel[keys[i]]->summary()), deviceDirectory[keys[i]] + "/timeStampFit.json");
+
+        if (summaryImages.contains(keys[i]) && summaryImages[keys[i]]->frameCount() > 0) {
+            if (!summaryImages[keys[i]]->save(deviceDirectory[keys[i]]))
+                sendMessage("Warning: Could not save summary images of " + keys[i] + ".");
+        }
     }
     noteFile->close();
+    syncIndex.close();
+
+    // Last, partially filled segments
+    keys = savedFrameCount.keys();
+    for (int i = 0; i < keys.length(); i++) {
+        if (savedFrameCount[keys[i]] > 0 && videoWriter.contains(keys[i])) {
+            int fileNum = (savedFrameCount[keys[i]] - 1) / framesPerFile[keys[i]];
+            segmentCompleted(keys[i], fileNum, savedFrameCount[keys[i]] - fileNum * framesPerFile[keys[i]]);
+        }
+    }
+    // Everything else in the session folder gets hashed and moved now that all files are closed
+    emit recordingCompleted(baseDirectory, m_migrationDirectory);
 }
 
 void DataSaver::devicePropertyChanged(QString deviceName, QString propName, QVariant propValue)
@@ -335,7 +531,8 @@ void DataSaver::takeScreenShot(QString type)
 
     if (baseDirectory.isEmpty())
         setupBaseDirectory();
-    QString fullFilePath = baseDirectory;
+    // Outside of a recording the scratch session may already have been moved
+    QString fullFilePath = (m_recording || m_migrationDirectory.isEmpty()) ? baseDirectory : m_migrationDirectory;
     fullFilePath.replace("//","/");
     fullFilePath.replace("//","/");
     if (fullFilePath.right(1) == "/")
@@ -390,11 +587,219 @@ void DataSaver::setDataCompression(QString name, QString type)
 
 }
 
+void DataSaver::setExtTriggerTrackingState(bool state)
+{
+    m_preTriggerSeconds = m_userConfig["preTriggerSeconds"].toDouble(0);
+    m_preTriggerActive = state && (m_preTriggerSeconds > 0);
+
+    QStringList names = frameBuffer.keys();
+    for (int i = 0; i < names.length(); i++) {
+        preTriggerBuffer[names[i]].clear();
+        preTriggerBuffer[names[i]].setWindow(m_preTriggerSeconds * 1000);
+    }
+    if (m_preTriggerActive)
+        sendMessage("Holding the last " + QString::number(m_preTriggerSeconds) + "s of frames for external trigger.");
+}
+
+void DataSaver::setTriggerTimeStamp(qint64 timeStamp)
+{
+    m_triggerTimeStamp = timeStamp;
+}
+
 void DataSaver::setROI(QString name, int *bbox)
 {
     ROI[name] = bbox;
 }
 
+void DataSaver::setCropRegions(QString name, QVector<QRect> regions, QVector<bool> circularMask, QString mode)
+{
+    cv::Rect rect;
+    cv::Mat mask;
+    QVector<cv::Mat> masks;
+
+    if (regions.isEmpty())
+        return;
+
+    cropRegion[name].clear();
+    cropBoundingBox[name] = cv::Rect();
+    for (int i = 0; i < regions.length(); i++) {
+        rect = cv::Rect(regions[i].left(), regions[i].top(), regions[i].width(), regions[i].height());
+        cropRegion[name].append(rect);
+        cropBoundingBox[name] |= rect;
+
+        if (circularMask[i]) {
+            // Ellipse inscribed in the crop rectangle
+            mask = cv::Mat::zeros(rect.height, rect.width, CV_8UC1);
+            cv::ellipse(mask, cv::Point(rect.width/2, rect.height/2), cv::Size(rect.width/2, rect.height/2),
+                        0, 0, 360, cv::Scalar(255), cv::FILLED);
+            masks.append(mask);
+        }
+        else
+            masks.append(cv::Mat());
+    }
+
+    if (mode == "masked") {
+        // Combine all regions into a single mask the size of their bounding box
+        cv::Mat combinedMask = cv::Mat::zeros(cropBoundingBox[name].height, cropBoundingBox[name].width, CV_8UC1);
+        for (int i = 0; i < cropRegion[name].length(); i++) {
+            rect = cropRegion[name][i] - cropBoundingBox[name].tl();
+            if (masks[i].empty())
+                combinedMask(rect).setTo(255);
+            else
+                combinedMask(rect).setTo(255, masks[i]);
+        }
+        masks.clear();
+        masks.append(combinedMask);
+    }
+
+    cropMask[name] = masks;
+    cropCircularMask[name] = circularMask;
+    cropMode[name] = mode;
+}
+
+void DataSaver::setRegistrationParameters(QString name, cv::Mat *registeredBuf, float *shiftBuf, QAtomicInt *registeredFrame, bool recordRegistered)
+{
+    registeredFrameBuffer[name] = registeredBuf;
+    shiftBuffer[name] = shiftBuf;
+    recordRegisteredFrames[name] = recordRegistered;
+    addFrameStage(name, registeredFrame);
+}
+
+void DataSaver::setTraceParameters(QString name, TraceExtractor *extractor)
+{
+    traceExtractor[name] = extractor;
+    addFrameStage(name, extractor->getTraceFrameNumPointer());
+}
+
+void DataSaver::writeAuxRow(QString name, QString streamName, int acqFrameNum, qint64 timeStamp, QVector<float> values)
+{
+    qint64 frameNumber;
+
+    if (!m_recording || !auxStream.contains(name) || !auxStream[name].contains(streamName))
+        return;
+    frameNumber = acqFrameNum - 1 - recordFrameOffset[name];
+    if (frameNumber < 0)
+        return; // From before recording started
+
+    QTextStream *stream = auxStream[name][streamName];
+    *stream << frameNumber << "," << (timeStamp - recordStartDateTime.toMSecsSinceEpoch());
+    for (int i = 0; i < values.size(); i++)
+        *stream << "," << values[i];
+    *stream << endl;
+}
+
+void DataSaver::setCameraCalibration(QString name, QJsonObject calibration)
+{
+    cameraCalibration[name] = calibration;
+    // Calibrated in the middle of a recording
+    if (m_recording && deviceDirectory.contains(name) && !overwriteJson(QJsonDocument(calibration), deviceDirectory[name] + "/cameraCalibration.json"))
+        sendMessage("Warning: Could not save the new calibration of " + name + " to cameraCalibration.json.");
+}
+
+void DataSaver::setStereoCalibration(QJsonObject calibration)
+{
+    stereoCalibration = calibration;
+    if (m_recording && !overwriteJson(QJsonDocument(calibration), baseDirectory + "/stereoCalibration.json"))
+        sendMessage("Warning: Could not save the new stereo calibration to stereoCalibration.json.");
+}
+
+void DataSaver::addFrameStage(QString name, QAtomicInt *stageFrame)
+{
+    frameStageNum[name].append(stageFrame);
+}
+
+void DataSaver::setupSyncIndex()
+{
+    QJsonObject jSync = m_userConfig["syncIndex"].toObject();
+    QJsonObject devices = m_userConfig["devices"].toObject();
+    QStringList names = videoWriter.keys();
+    QString reference = jSync["reference"].toString();
+
+    // Only worth it with more than one device. The first Miniscope is the reference unless the user config says otherwise
+    if (!jSync["enable"].toBool(true) || names.size() < 2)
+        return;
+    if (reference.isEmpty()) {
+        if (!devices["miniscopes"].toArray().isEmpty())
+            reference = devices["miniscopes"].toArray()[0].toObject()["deviceName"].toString();
+        else
+            reference = devices["cameras"].toArray()[0].toObject()["deviceName"].toString();
+    }
+    if (!names.contains(reference)) {
+        sendMessage("Warning: syncIndex reference " + reference + " is not recorded. No sync index saved.");
+        return;
+    }
+
+    if (syncIndex.open(baseDirectory, reference, names, jSync["csv"].toBool(false)))
+        saveJson(QJsonDocument(syncIndex.layout()), baseDirectory + "/syncIndex.json");
+    else
+        sendMessage("Warning: Could not create syncIndex.bin.");
+}
+
+void DataSaver::saveTraceROIs(QString name)
+{
+    // Index of an ROI here is its index in traces.bin
+    QJsonObject jROIs;
+    jROIs["ROIs"] = traceExtractor[name]->roiDefinitions();
+    if (!overwriteJson(QJsonDocument(jROIs), deviceDirectory[name] + "/traceROIs.json"))
+        sendMessage("Warning: Could not save " + name + " traceROIs.json.");
+}
+
+void DataSaver::segmentCompleted(QString name, int fileNum, int numFrames)
+{
+    // Hands closed video files of a finished segment to the hashing/migration stages
+    QString fileName = QString::number(fileNum) + ".avi";
+    qint64 firstFrame = (qint64) fileNum * framesPerFile[name];
+    if (cropRegion.contains(name) && cropMode[name] == "separate") {
+        for (int j = 0; j < cropRegion[name].length(); j++)
+            emit fileCompleted(baseDirectory, m_migrationDirectory, deviceDirectory[name] + "/crop" + QString::number(j) + "/" + fileName, firstFrame, numFrames);
+    }
+    else
+        emit fileCompleted(baseDirectory, m_migrationDirectory, deviceDirectory[name] + "/" + fileName, firstFrame, numFrames);
+}
+
+void DataSaver::openCropVideoFiles(QString name, int fileNum, const cv::Mat &frame)
+{
+    QString fileName;
+    cv::Rect rect;
+    bool isColor = (frame.channels() != 1);
+
+    for (int j = 0; j < cropVideoWriter[name].length(); j++) {
+        if (cropMode[name] == "masked") {
+            rect = cropBoundingBox[name];
+            fileName = deviceDirectory[name] + "/" + QString::number(fileNum) + ".avi";
+        }
+        else {
+            rect = cropRegion[name][j];
+            fileName = deviceDirectory[name] + "/crop" + QString::number(j) + "/" + QString::number(fileNum) + ".avi";
+        }
+
+        // Pixels outside of the mask are never written to so they only need to be zeroed once
+        if (!cropMask[name][j].empty())
+            cropFrame[name][j] = cv::Mat::zeros(rect.height, rect.width, frame.type());
+
+        cropVideoWriter[name][j]->release();
+        cropVideoWriter[name][j]->open(fileName.toUtf8().constData(),
+                                       dataCompressionFourCC[name], 60,
+                                       cv::Size(rect.width, rect.height), isColor);
+    }
+}
+
+void DataSaver::writeCropFrames(QString name, const cv::Mat &frame)
+{
+    cv::Rect rect;
+    for (int j = 0; j < cropVideoWriter[name].length(); j++) {
+        rect = (cropMode[name] == "masked") ? cropBoundingBox[name] : cropRegion[name][j];
+        if (cropMask[name][j].empty()) {
+            // Rectangular crop can be written directly from the frame buffer
+            cropVideoWriter[name][j]->write(frame(rect));
+        }
+        else {
+            frame(rect).copyTo(cropFrame[name][j], cropMask[name][j]);
+            cropVideoWriter[name][j]->write(cropFrame[name][j]);
+        }
+    }
+}
+
 QJsonDocument DataSaver::constructBaseDirectoryMetaData()
 {
     QJsonObject metaData;
@@ -464,6 +869,36 @@ QJsonDocument DataSaver::constructDeviceMetaData(QString type, int idx)
         jROI["height"] = ROI[deviceName][3];
         metaData["ROI"] = jROI;
     }
+    if (cropRegion.contains(deviceName)) {
+        QJsonArray jRegions;
+        QJsonObject jRegion;
+        for (int i = 0; i < cropRegion[deviceName].length(); i++) {
+            jRegion["leftEdge"] = cropRegion[deviceName][i].x;
+            jRegion["topEdge"] = cropRegion[deviceName][i].y;
+            jRegion["width"] = cropRegion[deviceName][i].width;
+            jRegion["height"] = cropRegion[deviceName][i].height;
+            jRegion["circularMask"] = cropCircularMask[deviceName][i];
+            jRegions.append(jRegion);
+        }
+        QJsonObject jCrop;
+        jCrop["mode"] = cropMode[deviceName];
+        jCrop["regions"] = jRegions;
+        metaData["cropRegions"] = jCrop;
+    }
+    if (preTriggerBuffer.contains(deviceName) && preTriggerBuffer[deviceName].size() > 0) {
+        // Frames before triggerFrameNumber were recorded before the trigger arrived
+        int triggerFrame = preTriggerBuffer[deviceName].size();
+        if (m_triggerTimeStamp >= 0) {
+            for (int i = 0; i < preTriggerBuffer[deviceName].size(); i++) {
+                if (preTriggerBuffer[deviceName].timeStamp(i) >= m_triggerTimeStamp) {
+                    triggerFrame = i;
+                    break;
+                }
+            }
+        }
+        metaData["preTriggerFrameCount"] = preTriggerBuffer[deviceName].size();
+        metaData["triggerFrameNumber"] = triggerFrame;
+    }
     // loop through device properties at the start of recording
     QStringList keys = deviceProperties[deviceName].keys();
     for (int i = 0; i < keys.length(); i++) {
@@ -485,3 +920,11 @@ void DataSaver::saveJson(QJsonDocument document, QString fileName)
 
 }
 
+bool DataSaver::overwriteJson(QJsonDocument document, QString fileName)
+{
+    QFile jsonFile(fileName);
+    if (!jsonFile.open(QFile::WriteOnly | QFile::Truncate))
+        return false;
+    return jsonFile.write(document.toJson()) >= 0;
+}
+
@@ -11,6 +11,8 @@
 #include <QTextStream>
 #include <QAtomicInt>
 #include <QVariant>
+#include <QVector>
+#include <QRect>
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/highgui/highgui.hpp>
@@ -18,6 +20,13 @@
 #include <opencv2/imgproc.hpp>
 #include <opencv2/videoio.hpp>
 
+#include "pretriggerbuffer.h"
+#include "traceextractor.h"
+#include "summaryimages.h"
+#include "syncindex.h"
+#include "clockmodel.h"
+#include "latencytracker.h"
+
 // TODO: connect to device buffers and semaphores
 class DataSaver : public QObject
 {
@@ -31,9 +40,21 @@ public:
     void setHeadOrientationConfig(QString name, bool enable, bool filter) {headOrientationStreamState[name] = enable; headOrientationStreamState[name] = filter; }
     void setupBaseDirectory();
     void setROI(QString name, int *bbox);
+    void setCropRegions(QString name, QVector<QRect> regions, QVector<bool> circularMask, QString mode);
+    void setRegistrationParameters(QString name, cv::Mat *registeredBuf, float *shiftBuf, QAtomicInt *registeredFrame, bool recordRegistered);
+    void setTraceParameters(QString name, TraceExtractor *extractor);
+    void setSummaryImages(QString name, SummaryImages *images) { summaryImages[name] = images; }
+    void addFrameStage(QString name, QAtomicInt *stageFrame);
+    // Corrected time stamps come from the device's timing buffer, the clock fit summary from its ClockModel
+    void setTimingParameters(QString name, FrameTiming *timingBuf, ClockModel *clock) { timingBuffer[name] = timingBuf; clockModel[name] = clock; }
+    // Extra per frame csv (<streamName>.csv) in a device's folder. Rows come in through writeAuxRow()
+    void setupAuxStream(QString name, QString streamName, QStringList columns) { auxColumns[name][streamName] = columns; }
 
 signals:
     void sendMessage(QString msg);
+    // Closed files for SegmentHasher and SessionMigrator. destinationDirectory is empty when not recording to scratch
+    void fileCompleted(QString sessionDirectory, QString destinationDirectory, QString filePath, qint64 firstFrame, qint64 numFrames);
+    void recordingCompleted(QString sessionDirectory, QString destinationDirectory);
 
 public slots:
     void startRunning();
@@ -43,13 +64,28 @@ public slots:
     void takeScreenShot(QString type);
     void takeNote(QString note);
     void setDataCompression(QString name, QString type);
+    void setExtTriggerTrackingState(bool state);
+    void setTriggerTimeStamp(qint64 timeStamp);
+    void writeAuxRow(QString name, QString streamName, int acqFrameNum, qint64 timeStamp, QVector<float> values);
+    void setCameraCalibration(QString name, QJsonObject calibration);
+    void setStereoCalibration(QJsonObject calibration);
 
 private:
     QJsonDocument constructBaseDirectoryMetaData();
     QJsonDocument constructDeviceMetaData(QString type, int deviceIndex);
     void saveJson(QJsonDocument document, QString fileName);
+    // For files that get replaced while recording, unlike metaData.json which is only ever written once
+    bool overwriteJson(QJsonDocument document, QString fileName);
+    void writeFrame(QString name, const cv::Mat &frame, qint64 timeStamp, double correctedTimeStamp, const float *bno, const float *shift = nullptr, const float *trace = nullptr);
+    void saveTraceROIs(QString name);
+    void setupSyncIndex();
+    bool frameIsReady(QString name);
+    void openCropVideoFiles(QString name, int fileNum, const cv::Mat &frame);
+    void writeCropFrames(QString name, const cv::Mat &frame);
+    void segmentCompleted(QString name, int fileNum, int numFrames);
     QJsonObject m_userConfig;
     QString baseDirectory;
+    QString m_migrationDirectory; // Final location of baseDirectory when recording to scratch. Empty otherwise
     QDateTime recordStartDateTime;
     QMap<QString,QString> deviceDirectory;
 
@@ -66,6 +102,8 @@ private:
     QMap<QString, bool> headOrientationStreamState;
     QMap<QString, bool> headOrientationFilterState;
     QMap<QString, qint64*> timeStampBuffer;
+    QMap<QString, FrameTiming*> timingBuffer;
+    QMap<QString, ClockModel*> clockModel;
     QMap<QString, QSemaphore*> freeCount;
     QMap<QString, QSemaphore*> usedCount;
     QMap<QString, cv::VideoWriter*> videoWriter;
@@ -79,11 +117,54 @@ private:
 
     QMap<QString, int*> ROI;
 
+    // Processing stages that read frames out of a device's buffer. Frames are only taken once every stage is done with them
+    QMap<QString, QVector<QAtomicInt*>> frameStageNum;
+
+    // Motion correction
+    QMap<QString, cv::Mat*> registeredFrameBuffer;
+    QMap<QString, float*> shiftBuffer;
+    QMap<QString, bool> recordRegisteredFrames;
+    QMap<QString, QFile*> shiftFile;
+    QMap<QString, QTextStream*> shiftStream;
+
+    // ROI fluorescence traces
+    QMap<QString, TraceExtractor*> traceExtractor;
+    QMap<QString, QFile*> traceFile;
+
+    // Aux streams. Their rows are numbered like timeStamps.csv using the buffer frame count at the start of recording
+    QMap<QString, QMap<QString, QStringList>> auxColumns;
+    QMap<QString, QMap<QString, QFile*>> auxFile;
+    QMap<QString, QMap<QString, QTextStream*>> auxStream;
+    QMap<QString, qint64> recordFrameOffset;
+
+    // Mean, max, std and local correlation images of each recording, accumulated from the frames that get saved
+    QMap<QString, SummaryImages*> summaryImages;
+    QMap<QString, QJsonObject> cameraCalibration; // Saved as cameraCalibration.json with each recording
+    QJsonObject stereoCalibration; // Saved as stereoCalibration.json in the base directory
+
+    // Frames of every device lined up with the reference device's frames, in the base directory
+    SyncIndex syncIndex;
+
+    // Crop regions. Masks are empty for rectangular regions.
+    QMap<QString, QVector<cv::Rect>> cropRegion;
+    QMap<QString, QVector<cv::Mat>> cropMask;
+    QMap<QString, QVector<bool>> cropCircularMask;
+    QMap<QString, QString> cropMode;
+    QMap<QString, cv::Rect> cropBoundingBox; // Used for "masked" mode
+    QMap<QString, QVector<cv::Mat>> cropFrame; // Zeroed once per file. Only masked pixels get written into it
+    QMap<QString, QVector<cv::VideoWriter*>> cropVideoWriter;
+
     QFile* noteFile;
     QTextStream* noteStream;
 
+    // Frames held before an external trigger starts recording
+    QMap<QString, PreTriggerBuffer> preTriggerBuffer;
+
     bool m_recording;
     bool m_running;
+    bool m_preTriggerActive;
+    double m_preTriggerSeconds;
+    qint64 m_triggerTimeStamp;
 };
 
 #endif // DATASAVER_H
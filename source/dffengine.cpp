@@ -0,0 +1,110 @@
+#include "dffengine.h"
+
+#include <QMetaObject>
+#include <QDebug>
+
+#include <opencv2/core/hal/intrin.hpp>
+
+DFFEngine::DFFEngine(cv::Mat *frameBuf, qint64 *tsBuf, QObject *parent) :
+    QObject(parent),
+    frameBuffer(frameBuf),
+    timeStampBuffer(tsBuf),
+    m_requestedFrame(-1),
+    m_processingScheduled(0),
+    m_enabled(0),
+    m_lastBaselineUpdate(0)
+{
+
+}
+
+void DFFEngine::requestFrame(int bufferIndex)
+{
+    // Only the newest request matters. At most one processFrame() call is queued at a time
+    m_requestedFrame.storeRelease(bufferIndex);
+    if (m_processingScheduled.testAndSetOrdered(0, 1))
+        QMetaObject::invokeMethod(this, "processFrame", Qt::QueuedConnection);
+}
+
+void DFFEngine::processFrame()
+{
+    m_processingScheduled.storeRelease(0);
+    int f = m_requestedFrame.loadAcquire();
+    if (f < 0)
+        return;
+
+    const cv::Mat &frame = frameBuffer[f];
+    qint64 timeStamp = timeStampBuffer[f];
+    if (frame.empty() || frame.type() != CV_8UC1)
+        return;
+
+    if (m_baseline.size() != frame.size()) {
+        resetBaseline(frame);
+        m_lastBaselineUpdate = timeStamp;
+    }
+
+    bool updateBaseline = (timeStamp - m_lastBaselineUpdate) > DFF_BASELINE_UPDATE_MS;
+    bool enabled = m_enabled.loadAcquire();
+    if (!updateBaseline && !enabled)
+        return;
+    if (updateBaseline)
+        m_lastBaselineUpdate = timeStamp;
+
+    cv::Mat &out = m_output.writeBuffer();
+    out.create(frame.size(), CV_8UC1);
+    for (int row = 0; row < frame.rows; row++)
+        computeRow(frame.ptr<uchar>(row), m_baseline.ptr<ushort>(row), out.ptr<uchar>(row), frame.cols, updateBaseline);
+    if (enabled)
+        m_output.publish();
+}
+
+void DFFEngine::resetBaseline(const cv::Mat &frame)
+{
+    // Start from the current frame instead of zero so dF/F is usable right away
+    frame.convertTo(m_baseline, CV_16U, 256);
+}
+
+void DFFEngine::computeRow(const uchar *frame, ushort *baseline, uchar *out, int width, bool updateBaseline)
+{
+    const float scale = 255.0f * 256.0f; // baseline is 8.8 fixed point
+    int x = 0;
+
+#if CV_SIMD
+    const int lanes = cv::v_uint8::nlanes;
+    const cv::v_float32 vScale = cv::vx_setall_f32(scale);
+    const cv::v_float32 vOffset = cv::vx_setall_f32(127.5f);
+    const cv::v_float32 vOne = cv::vx_setall_f32(1.0f);
+    cv::v_uint16 x16[2], b16[2];
+    cv::v_uint32 x32[2], b32[2];
+    cv::v_int32 result[4];
+
+    for (; x <= width - lanes; x += lanes) {
+        cv::v_expand(cv::vx_load(frame + x), x16[0], x16[1]);
+        b16[0] = cv::vx_load(baseline + x);
+        b16[1] = cv::vx_load(baseline + x + lanes / 2);
+
+        for (int half = 0; half < 2; half++) {
+            cv::v_expand(x16[half], x32[0], x32[1]);
+            cv::v_expand(b16[half], b32[0], b32[1]);
+            for (int q = 0; q < 2; q++) {
+                cv::v_float32 fx = cv::v_cvt_f32(cv::v_reinterpret_as_s32(x32[q]));
+                cv::v_float32 fb = cv::v_max(cv::v_cvt_f32(cv::v_reinterpret_as_s32(b32[q])), vOne);
+                result[half * 2 + q] = cv::v_round(fx * vScale / fb - vOffset);
+            }
+        }
+        cv::v_store(out + x, cv::v_pack_u(cv::v_pack(result[0], result[1]), cv::v_pack(result[2], result[3])));
+
+        if (updateBaseline) {
+            // b - (b >> k) + (x << (8 - k))
+            cv::v_store(baseline + x, b16[0] - cv::v_shr<DFF_BASELINE_SHIFT>(b16[0]) + cv::v_shl<8 - DFF_BASELINE_SHIFT>(x16[0]));
+            cv::v_store(baseline + x + lanes / 2, b16[1] - cv::v_shr<DFF_BASELINE_SHIFT>(b16[1]) + cv::v_shl<8 - DFF_BASELINE_SHIFT>(x16[1]));
+        }
+    }
+#endif
+
+    for (; x < width; x++) {
+        float b = baseline[x] > 0 ? baseline[x] : 1.0f;
+        out[x] = cv::saturate_cast<uchar>(frame[x] * scale / b - 127.5f);
+        if (updateBaseline)
+            baseline[x] = baseline[x] - (baseline[x] >> DFF_BASELINE_SHIFT) + (frame[x] << (8 - DFF_BASELINE_SHIFT));
+    }
+}
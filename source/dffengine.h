@@ -0,0 +1,50 @@
+#ifndef DFFENGINE_H
+#define DFFENGINE_H
+
+#include <QObject>
+#include <QAtomicInt>
+
+#include <opencv2/core/core.hpp>
+
+#include "frametriplebuffer.h"
+
+#define DFF_BASELINE_UPDATE_MS  100
+#define DFF_BASELINE_SHIFT      7   // Baseline averages over roughly 2^7 updates (~13s)
+
+// Computes the dF/F display frame of a mono video stream on its own thread.
+// The baseline is an exponential moving average kept as one 16 bit 8.8 fixed point value per pixel:
+//     b += ((x << 8) - b) >> DFF_BASELINE_SHIFT
+// It is updated in the same vectorized pass that writes the display frame,
+//     out = 255 * (x / b - 1 + 0.5)
+// so each displayed frame costs a single read of the frame and the baseline.
+class DFFEngine : public QObject
+{
+    Q_OBJECT
+public:
+    explicit DFFEngine(cv::Mat *frameBuf, qint64 *tsBuf, QObject *parent = nullptr);
+
+    // Called from the GUI thread. Never blocks
+    void requestFrame(int bufferIndex);
+    void setEnabled(bool enabled) { m_enabled.storeRelease(enabled ? 1 : 0); }
+    bool takeDisplayFrame() { return m_output.consume(); }
+    const cv::Mat &displayFrame() const { return m_output.readBuffer(); }
+
+public slots:
+    void processFrame();
+
+private:
+    void resetBaseline(const cv::Mat &frame);
+    void computeRow(const uchar *frame, ushort *baseline, uchar *out, int width, bool updateBaseline);
+
+    cv::Mat *frameBuffer;
+    qint64 *timeStampBuffer;
+    QAtomicInt m_requestedFrame;
+    QAtomicInt m_processingScheduled;
+    QAtomicInt m_enabled;
+
+    cv::Mat m_baseline; // CV_16UC1, 8.8 fixed point
+    qint64 m_lastBaselineUpdate;
+    FrameTripleBuffer m_output;
+};
+
+#endif // DFFENGINE_H
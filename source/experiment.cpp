@@ -0,0 +1,217 @@
+#include "experiment.h"
+
+#include <QJsonArray>
+#include <QDebug>
+
+#include <opencv2/imgproc.hpp>
+
+#include <limits>
+#include <vector>
+
+Experiment::Experiment(QJsonObject options, QObject *parent) :
+    QObject(parent),
+    m_valid(false),
+    m_type(options["type"].toString("None")),
+    m_units(options["units"].toString("cm")),
+    m_cameraName(options["camera"].toString()),
+    m_zoneHysteresis(options["zoneHysteresis"].toDouble(1)),
+    m_currentZone(-1),
+    m_endZone(options["endZone"].toDouble(10)),
+    m_lastEnd(-1),
+    m_laps(0),
+    m_smoothing(qMax(1.0, options["velocitySmoothingMs"].toDouble(EXPERIMENT_DEFAULT_SMOOTHING))),
+    m_hasPrevious(false),
+    m_previousTime(0)
+{
+    QJsonArray jCorners = options["corners"].toArray();
+    QJsonArray jZones = options["zones"].toArray();
+    std::vector<cv::Point2f> pixels, physical;
+
+    if (m_type == "linearTrack")
+        m_size = cv::Size2f(options["trackLength"].toDouble(0), options["trackWidth"].toDouble(10));
+    else if (m_type == "arena") {
+        QJsonArray jSize = options["arenaSize"].toArray();
+        m_size = cv::Size2f(jSize[0].toDouble(0), jSize[1].toDouble(0));
+    }
+    else {
+        qDebug() << "Experiment type" << m_type << "is not supported";
+        return;
+    }
+
+    // Corners in tracker pixels, starting at the physical origin and going along x first
+    for (int i = 0; i < jCorners.size(); i++)
+        pixels.push_back(cv::Point2f(jCorners[i].toArray()[0].toDouble(), jCorners[i].toArray()[1].toDouble()));
+    if (pixels.size() != 4 || m_size.width <= 0 || m_size.height <= 0) {
+        qDebug() << "Experiment needs four corners and a physical size";
+        return;
+    }
+    physical = {cv::Point2f(0, 0), cv::Point2f(m_size.width, 0), cv::Point2f(m_size.width, m_size.height), cv::Point2f(0, m_size.height)};
+
+    for (int i = 0; i < jZones.size(); i++) {
+        QJsonObject jZone = jZones[i].toObject();
+        QJsonArray jX = jZone["x"].toArray({0, m_size.width});
+        QJsonArray jY = jZone["y"].toArray({0, m_size.height});
+        Zone zone;
+        zone.name = jZone["name"].toString("Zone " + QString::number(i + 1));
+        zone.x[0] = jX[0].toDouble();
+        zone.x[1] = jX[1].toDouble();
+        zone.y[0] = jY[0].toDouble();
+        zone.y[1] = jY[1].toDouble();
+        m_zones.append(zone);
+    }
+
+    buildTable(pixels, physical);
+    m_valid = true;
+}
+
+void Experiment::buildTable(const std::vector<cv::Point2f> &pixels, const std::vector<cv::Point2f> &physical)
+{
+    std::vector<cv::Point2f> grid, mapped;
+
+    m_homography = cv::getPerspectiveTransform(pixels, physical);
+
+    // Every pixel the animal can be at, including a margin for a tracked point slightly off the track
+    m_tableRegion = cv::boundingRect(pixels);
+    m_tableRegion.x = qMax(0, m_tableRegion.x - EXPERIMENT_TABLE_MARGIN);
+    m_tableRegion.y = qMax(0, m_tableRegion.y - EXPERIMENT_TABLE_MARGIN);
+    m_tableRegion.width += 2 * EXPERIMENT_TABLE_MARGIN + 1;
+    m_tableRegion.height += 2 * EXPERIMENT_TABLE_MARGIN + 1;
+
+    grid.reserve(m_tableRegion.area());
+    for (int y = m_tableRegion.y; y < m_tableRegion.y + m_tableRegion.height; y++)
+        for (int x = m_tableRegion.x; x < m_tableRegion.x + m_tableRegion.width; x++)
+            grid.push_back(cv::Point2f(x, y));
+    cv::perspectiveTransform(grid, mapped, m_homography);
+    m_table = cv::Mat(mapped, true).reshape(2, m_tableRegion.height);
+}
+
+cv::Point2f Experiment::toPhysical(cv::Point2f pixel)
+{
+    std::vector<cv::Point2f> in(1, pixel), out;
+    float fx = pixel.x - m_tableRegion.x;
+    float fy = pixel.y - m_tableRegion.y;
+    int x0 = (int) floor(fx);
+    int y0 = (int) floor(fy);
+
+    if (x0 < 0 || y0 < 0 || x0 + 1 >= m_tableRegion.width || y0 + 1 >= m_tableRegion.height) {
+        // Far off the track, so it doesn't have to be fast
+        cv::perspectiveTransform(in, out, m_homography);
+        return out[0];
+    }
+
+    // Bilinear between the four table entries around the point
+    fx -= x0;
+    fy -= y0;
+    const cv::Point2f *row0 = m_table.ptr<cv::Point2f>(y0) + x0;
+    const cv::Point2f *row1 = m_table.ptr<cv::Point2f>(y0 + 1) + x0;
+    return (row0[0] * (1 - fx) + row0[1] * fx) * (1 - fy) + (row1[0] * (1 - fx) + row1[1] * fx) * fy;
+}
+
+bool Experiment::inZone(int zone, cv::Point2f position, float margin)
+{
+    const Zone &z = m_zones[zone];
+    return position.x >= z.x[0] - margin && position.x <= z.x[1] + margin &&
+            position.y >= z.y[0] - margin && position.y <= z.y[1] + margin;
+}
+
+int Experiment::findZone(cv::Point2f position)
+{
+    for (int i = 0; i < m_zones.size(); i++) {
+        if (inZone(i, position, 0))
+            return i;
+    }
+    return -1;
+}
+
+void Experiment::updateLaps(float trackPosition)
+{
+    int end = -1;
+
+    if (trackPosition <= m_endZone)
+        end = 0;
+    else if (trackPosition >= m_size.width - m_endZone)
+        end = 1;
+    if (end < 0)
+        return;
+
+    if (m_lastEnd >= 0 && end != m_lastEnd)
+        m_laps++;
+    m_lastEnd = end;
+}
+
+QStringList Experiment::columns() const
+{
+    QString u = " (" + m_units + ")";
+    QString v = " (" + m_units + "/s)";
+
+    if (m_type == "linearTrack")
+        return {"Track Position" + u, "Lateral Position" + u, "Velocity" + v, "Lap", "Zone", "Zone Event"};
+    return {"X" + u, "Y" + u, "Speed" + v, "Zone", "Zone Event"};
+}
+
+void Experiment::handlePosition(QString name, int frameNum, qint64 timeStamp, QVector<float> values)
+{
+    const float none = std::numeric_limits<float>::quiet_NaN();
+    const bool linear = m_type == "linearTrack";
+    QVector<float> state;
+    cv::Point2f position;
+    float event = 0;
+    int zone;
+    double dt, alpha;
+
+    if (!m_valid || name != m_cameraName || values.size() < 2)
+        return;
+
+    if (linear)
+        state = {none, none, none, (float) m_laps, (float) (m_currentZone + 1), 0};
+    else
+        state = {none, none, none, (float) (m_currentZone + 1), 0};
+
+    if (qIsNaN(values[0]) || qIsNaN(values[1])) {
+        // Animal not found. Zone and lap stay as they were
+        experimentStateReady(name, frameNum, timeStamp, state);
+        return;
+    }
+
+    position = toPhysical(cv::Point2f(values[0], values[1]));
+    if (linear)
+        position.x = qBound(0.0f, position.x, m_size.width);
+
+    // Exponentially smoothed velocity, with a time constant instead of a per sample weight so the frame rate doesn't matter
+    dt = (timeStamp - m_previousTime) / 1000.0;
+    if (m_hasPrevious && dt > 0 && dt * 1000 < EXPERIMENT_MAX_GAP) {
+        alpha = 1 - exp(-dt * 1000 / m_smoothing);
+        m_velocity += alpha * ((position - m_previous) / dt - m_velocity);
+    }
+    else if (!m_hasPrevious || dt * 1000 >= EXPERIMENT_MAX_GAP)
+        m_velocity = cv::Point2f(0, 0);
+    m_previous = position;
+    m_previousTime = timeStamp;
+    m_hasPrevious = true;
+
+    // Hysteresis keeps the animal in its zone until it is clearly out of it
+    if (m_currentZone >= 0 && inZone(m_currentZone, position, m_zoneHysteresis))
+        zone = m_currentZone;
+    else
+        zone = findZone(position);
+    if (zone != m_currentZone) {
+        if (m_currentZone >= 0) {
+            event = -(m_currentZone + 1);
+            zoneChanged(m_zones[m_currentZone].name, false, timeStamp);
+        }
+        if (zone >= 0) {
+            // An entry wins the column when the animal goes straight from one zone into another
+            event = zone + 1;
+            zoneChanged(m_zones[zone].name, true, timeStamp);
+        }
+        m_currentZone = zone;
+    }
+
+    if (linear) {
+        updateLaps(position.x);
+        state = {position.x, position.y, m_velocity.x, (float) m_laps, (float) (m_currentZone + 1), event};
+    }
+    else
+        state = {position.x, position.y, (float) cv::norm(m_velocity), (float) (m_currentZone + 1), event};
+    experimentStateReady(name, frameNum, timeStamp, state);
+}
@@ -0,0 +1,78 @@
+#ifndef EXPERIMENT_H
+#define EXPERIMENT_H
+
+#include <QObject>
+#include <QJsonObject>
+#include <QStringList>
+#include <QVector>
+
+#include <opencv2/core/core.hpp>
+
+#define EXPERIMENT_TABLE_MARGIN         16  // Pixels around the track or arena corners covered by the position table
+#define EXPERIMENT_DEFAULT_SMOOTHING    200 // ms time constant of the velocity filter
+#define EXPERIMENT_MAX_GAP              1000 // ms without a position after which velocity starts over
+
+// Turns the pixel positions of one tracked behavior camera into the experiment's physical coordinates and
+// works out where the animal is in the experiment frame by frame.
+// "linearTrack": x runs along the track from its start (0) to trackLength, y across it. Reports track position,
+// velocity along the track and laps. A lap is a run from one end zone to the other.
+// "arena": x and y span arenaSize from the first corner. Reports position and speed.
+// Both report the zone the animal is in and zone entries and exits. The homography between the four pixel corners and
+// the physical corners is evaluated once for every pixel around the corners, so each position is a bilinear table lookup.
+class Experiment : public QObject
+{
+    Q_OBJECT
+public:
+    Experiment(QJsonObject options, QObject *parent = nullptr);
+    bool isValid() { return m_valid; }
+    QString getCameraName() { return m_cameraName; }
+    QStringList columns() const;
+
+signals:
+    // Same layout as columns(). Zone is 1 based and 0 outside of all zones. Zone event is +zone on entry and -zone on exit
+    void experimentStateReady(QString deviceName, int frameNum, qint64 timeStamp, QVector<float> values);
+    void zoneChanged(QString zone, bool entered, qint64 timeStamp);
+
+public slots:
+    void handlePosition(QString name, int frameNum, qint64 timeStamp, QVector<float> values);
+
+private:
+    struct Zone {
+        QString name;
+        float x[2];
+        float y[2];
+    };
+
+    void buildTable(const std::vector<cv::Point2f> &pixels, const std::vector<cv::Point2f> &physical);
+    cv::Point2f toPhysical(cv::Point2f pixel);
+    bool inZone(int zone, cv::Point2f position, float margin);
+    int findZone(cv::Point2f position);
+    void updateLaps(float trackPosition);
+
+    bool m_valid;
+    QString m_type;
+    QString m_units;
+    QString m_cameraName;
+    cv::Size2f m_size; // Physical size, trackLength x trackWidth or arenaSize
+
+    // Position table covering m_tableRegion, one physical point per pixel
+    cv::Mat m_homography;
+    cv::Rect m_tableRegion;
+    cv::Mat m_table;
+
+    QVector<Zone> m_zones;
+    float m_zoneHysteresis;
+    int m_currentZone; // 0 based, -1 outside of all zones
+
+    float m_endZone; // Distance from either end of the track that counts as having reached it
+    int m_lastEnd; // -1 none yet, 0 start, 1 end
+    int m_laps;
+
+    double m_smoothing;
+    bool m_hasPrevious;
+    cv::Point2f m_previous;
+    qint64 m_previousTime;
+    cv::Point2f m_velocity;
+};
+
+#endif // EXPERIMENT_H
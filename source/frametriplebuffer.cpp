@@ -0,0 +1,29 @@
+#include "frametriplebuffer.h"
+
+#define NEW_FRAME_BIT   4
+
+FrameTripleBuffer::FrameTripleBuffer() :
+    m_tags{-1, -1, -1},
+    m_writeIndex(0),
+    m_readIndex(1),
+    m_state(2)
+{
+
+}
+
+void FrameTripleBuffer::publish()
+{
+    // Swap the filled buffer with the published one
+    int previous = m_state.fetchAndStoreOrdered(m_writeIndex | NEW_FRAME_BIT);
+    m_writeIndex = previous & 3;
+}
+
+bool FrameTripleBuffer::consume()
+{
+    if (!(m_state.loadAcquire() & NEW_FRAME_BIT))
+        return false;
+    // Swap the buffer we were reading with the published one
+    int previous = m_state.fetchAndStoreOrdered(m_readIndex);
+    m_readIndex = previous & 3;
+    return true;
+}
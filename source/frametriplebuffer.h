@@ -0,0 +1,34 @@
+#ifndef FRAMETRIPLEBUFFER_H
+#define FRAMETRIPLEBUFFER_H
+
+#include <QAtomicInt>
+
+#include <opencv2/core/core.hpp>
+
+// Lock-free hand off of the newest frame from one producer thread to one consumer thread.
+// The producer fills writeBuffer() and publishes it, the consumer takes the newest published frame.
+// Neither side ever waits and buffers are reused, so nothing gets allocated once frame size is stable.
+class FrameTripleBuffer
+{
+public:
+    FrameTripleBuffer();
+
+    // Producer side
+    cv::Mat &writeBuffer() { return m_buffers[m_writeIndex]; }
+    void setWriteTag(int tag) { m_tags[m_writeIndex] = tag; }
+    void publish();
+
+    // Consumer side. Returns false if nothing new has been published since the last call
+    bool consume();
+    const cv::Mat &readBuffer() const { return m_buffers[m_readIndex]; }
+    int readTag() const { return m_tags[m_readIndex]; } // Caller defined, e.g. the frame a buffer was made from
+
+private:
+    cv::Mat m_buffers[3];
+    int m_tags[3];
+    int m_writeIndex;
+    int m_readIndex;
+    QAtomicInt m_state; // Index of the published buffer. NEW_FRAME_BIT marks it as not yet consumed
+};
+
+#endif // FRAMETRIPLEBUFFER_H
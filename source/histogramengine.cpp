@@ -0,0 +1,130 @@
+#include "histogramengine.h"
+
+#include <QMutexLocker>
+
+#include <string.h>
+
+HistogramEngine::HistogramEngine() :
+    m_rowOffset(0),
+    m_lowPercentile(0.5),
+    m_highPercentile(99.5),
+    m_hasResult(false),
+    m_alpha(1),
+    m_beta(0),
+    m_saturatedFraction(0)
+{
+    memset(m_histogram, 0, sizeof(m_histogram));
+}
+
+void HistogramEngine::setPercentiles(double low, double high)
+{
+    QMutexLocker locker(&m_resultMutex);
+    m_lowPercentile = qBound(0.0, low, 100.0);
+    m_highPercentile = qBound(m_lowPercentile, high, 100.0);
+}
+
+void HistogramEngine::addFrame(const cv::Mat &frame)
+{
+    quint32 counts[HISTOGRAM_BINS];
+    quint64 sampled = 0, saturated = 0;
+
+    if (frame.empty() || frame.depth() != CV_8U)
+        return;
+
+    accumulate(frame, counts);
+    m_rowOffset = (m_rowOffset + 1) % HISTOGRAM_ROW_STRIDE;
+
+    for (int i = 0; i < HISTOGRAM_BINS; i++) {
+        // Counts get scaled up before decaying so sparsely populated bins don't round down to zero
+        m_histogram[i] = m_histogram[i] - (m_histogram[i] >> HISTOGRAM_DECAY_SHIFT) + ((quint64) counts[i] << 4);
+        sampled += counts[i];
+        if (i >= HISTOGRAM_SATURATION_LEVEL)
+            saturated += counts[i];
+    }
+
+    m_resultMutex.lock();
+    m_saturatedFraction = sampled > 0 ? (double) saturated / sampled : 0;
+    m_resultMutex.unlock();
+
+    updateLevels();
+}
+
+void HistogramEngine::accumulate(const cv::Mat &frame, quint32 *counts)
+{
+    // Incrementing a bin depends on the previous increment of that bin. Spreading neighbouring pixels
+    // over four sub-histograms keeps those dependencies apart so the loop isn't bound by store forwarding
+    quint32 sub[4][HISTOGRAM_BINS];
+    const uchar *row;
+    int rowLength = frame.cols * frame.channels(); // Color frames are binned over all channels
+    int i;
+
+    memset(sub, 0, sizeof(sub));
+    for (int r = m_rowOffset; r < frame.rows; r += HISTOGRAM_ROW_STRIDE) {
+        row = frame.ptr<uchar>(r);
+        for (i = 0; i + 4 <= rowLength; i += 4) {
+            sub[0][row[i]]++;
+            sub[1][row[i + 1]]++;
+            sub[2][row[i + 2]]++;
+            sub[3][row[i + 3]]++;
+        }
+        for (; i < rowLength; i++)
+            sub[0][row[i]]++;
+    }
+
+    for (i = 0; i < HISTOGRAM_BINS; i++)
+        counts[i] = sub[0][i] + sub[1][i] + sub[2][i] + sub[3][i];
+}
+
+void HistogramEngine::updateLevels()
+{
+    quint64 total = 0, cumulative = 0, lowCount, highCount;
+    int low = -1, high = -1;
+
+    for (int i = 0; i < HISTOGRAM_BINS; i++)
+        total += m_histogram[i];
+    if (total == 0)
+        return;
+
+    m_resultMutex.lock();
+    lowCount = (quint64) (total * m_lowPercentile / 100.0);
+    highCount = (quint64) (total * m_highPercentile / 100.0);
+    m_resultMutex.unlock();
+
+    for (int i = 0; i < HISTOGRAM_BINS; i++) {
+        cumulative += m_histogram[i];
+        if (low < 0 && cumulative > lowCount)
+            low = i;
+        if (cumulative >= highCount) {
+            high = i;
+            break;
+        }
+    }
+    if (low < 0)
+        low = 0;
+    if (high < 0)
+        high = HISTOGRAM_BINS - 1;
+    // Keep at least one level between black and white so a flat image doesn't divide by zero in the shader
+    if (high <= low)
+        high = qMin(low + 1, HISTOGRAM_BINS - 1);
+    if (high <= low)
+        low = high - 1;
+
+    QMutexLocker locker(&m_resultMutex);
+    m_beta = low / 255.0;
+    m_alpha = high / 255.0;
+    m_hasResult = true;
+}
+
+bool HistogramEngine::autoContrast(double &alpha, double &beta)
+{
+    QMutexLocker locker(&m_resultMutex);
+    alpha = m_alpha;
+    beta = m_beta;
+    return m_hasResult;
+}
+
+double HistogramEngine::saturatedFraction()
+{
+    QMutexLocker locker(&m_resultMutex);
+    return m_saturatedFraction;
+}
@@ -0,0 +1,47 @@
+#ifndef HISTOGRAMENGINE_H
+#define HISTOGRAMENGINE_H
+
+#include <QtGlobal>
+#include <QMutex>
+
+#include <opencv2/core/core.hpp>
+
+#define HISTOGRAM_BINS              256
+#define HISTOGRAM_ROW_STRIDE        4   // Every 4th row gets sampled. The starting row rotates each frame
+#define HISTOGRAM_DECAY_SHIFT       3   // Older counts lose 1/8 of their weight with every frame
+#define HISTOGRAM_SATURATION_LEVEL  253 // Matches the 0.99 saturation threshold of the display shader
+
+// Running intensity histogram of a video stream used for auto-contrast and the saturation statistic.
+// Only a rotating subset of rows is sampled per frame and older counts decay, so the histogram follows
+// changes in LED power or focus within a few frames while costing a fraction of a full pass.
+// addFrame() is called from a single worker thread. Results can be read from any thread.
+class HistogramEngine
+{
+public:
+    HistogramEngine();
+
+    void setPercentiles(double low, double high);
+    void addFrame(const cv::Mat &frame);
+
+    // Display black (beta) and white (alpha) levels in the 0 to 1 range the shader uses.
+    // Returns false until a frame has been added
+    bool autoContrast(double &alpha, double &beta);
+    double saturatedFraction();
+
+private:
+    void accumulate(const cv::Mat &frame, quint32 *counts);
+    void updateLevels();
+
+    quint64 m_histogram[HISTOGRAM_BINS];
+    int m_rowOffset;
+    double m_lowPercentile;
+    double m_highPercentile;
+
+    QMutex m_resultMutex;
+    bool m_hasResult;
+    double m_alpha;
+    double m_beta;
+    double m_saturatedFraction;
+};
+
+#endif // HISTOGRAMENGINE_H
@@ -0,0 +1,121 @@
+#include "latencytracker.h"
+
+#include <QMutexLocker>
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <QTextStream>
+#include <QDebug>
+
+#include <algorithm>
+
+static const char *stageNames[LATENCY_STAGE_COUNT] = {"Ring", "Preview", "Upload", "Swap", "Total"};
+
+LatencyTracker::LatencyTracker() :
+    m_sampleCount(0),
+    m_nextSample(0)
+{
+
+}
+
+LatencyTracker::~LatencyTracker()
+{
+    if (m_logFile.isOpen())
+        m_logFile.close();
+}
+
+qint64 LatencyTracker::now()
+{
+    // Shared by all threads so stamps taken on different threads can be compared
+    static QElapsedTimer timer;
+    static bool started = (timer.start(), true);
+    Q_UNUSED(started);
+    return timer.nsecsElapsed() / 1000;
+}
+
+void LatencyTracker::addSample(const FrameTiming &timing)
+{
+    // Frames that skipped a stage (e.g. dF/F frames have no acquisition time stamps) aren't counted
+    if (timing.dequeued <= 0 || timing.published <= 0 || timing.processed <= 0 || timing.uploaded <= 0 || timing.swapped <= 0)
+        return;
+
+    QMutexLocker locker(&m_mutex);
+    m_samples[0][m_nextSample] = timing.published - timing.dequeued;
+    m_samples[1][m_nextSample] = timing.processed - timing.published;
+    m_samples[2][m_nextSample] = timing.uploaded - timing.processed;
+    m_samples[3][m_nextSample] = timing.swapped - timing.uploaded;
+    m_samples[4][m_nextSample] = timing.swapped - timing.dequeued;
+    m_nextSample = (m_nextSample + 1) % LATENCY_WINDOW_SIZE;
+    m_sampleCount = qMin(m_sampleCount + 1, LATENCY_WINDOW_SIZE);
+}
+
+void LatencyTracker::percentiles(int stage, double &p50, double &p99)
+{
+    // Called with m_mutex held
+    qint64 values[LATENCY_WINDOW_SIZE];
+    int n = m_sampleCount;
+
+    std::copy(m_samples[stage], m_samples[stage] + n, values);
+    std::nth_element(values, values + n / 2, values + n);
+    p50 = values[n / 2] / 1000.0;
+    std::nth_element(values, values + (n * 99) / 100, values + n);
+    p99 = values[(n * 99) / 100] / 1000.0;
+}
+
+QString LatencyTracker::summary()
+{
+    QMutexLocker locker(&m_mutex);
+    QString text = "Latency p50/p99 (ms)";
+    double p50, p99;
+
+    if (m_sampleCount == 0)
+        return text + ": --";
+
+    for (int i = LATENCY_STAGE_COUNT - 1; i >= 0; i--) {
+        percentiles(i, p50, p99);
+        text += (i == LATENCY_STAGE_COUNT - 1 ? " " : " | ") + QString(stageNames[i]) + ": " +
+                QString::number(p50, 'f', 1) + "/" + QString::number(p99, 'f', 1);
+    }
+    return text;
+}
+
+void LatencyTracker::setLogFile(QString filePath)
+{
+    QMutexLocker locker(&m_mutex);
+    bool isNew;
+
+    if (m_logFile.isOpen())
+        m_logFile.close();
+    if (filePath.isEmpty())
+        return;
+
+    m_logFile.setFileName(filePath);
+    isNew = !m_logFile.exists();
+    if (!m_logFile.open(QFile::WriteOnly | QFile::Append | QFile::Text)) {
+        qDebug() << "Could not open latency log" << filePath;
+        return;
+    }
+    if (isNew) {
+        QTextStream stream(&m_logFile);
+        stream << "Time Stamp (ms)";
+        for (int i = 0; i < LATENCY_STAGE_COUNT; i++)
+            stream << "," << stageNames[i] << " p50 (ms)," << stageNames[i] << " p99 (ms)";
+        stream << endl;
+    }
+}
+
+void LatencyTracker::writeLog()
+{
+    QMutexLocker locker(&m_mutex);
+    double p50, p99;
+
+    if (!m_logFile.isOpen() || m_sampleCount == 0)
+        return;
+
+    QTextStream stream(&m_logFile);
+    stream << QDateTime().currentMSecsSinceEpoch();
+    for (int i = 0; i < LATENCY_STAGE_COUNT; i++) {
+        percentiles(i, p50, p99);
+        stream << "," << QString::number(p50, 'f', 3) << "," << QString::number(p99, 'f', 3);
+    }
+    stream << endl;
+}
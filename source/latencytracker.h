@@ -0,0 +1,52 @@
+#ifndef LATENCYTRACKER_H
+#define LATENCYTRACKER_H
+
+#include <QtGlobal>
+#include <QString>
+#include <QMutex>
+#include <QFile>
+
+#define LATENCY_WINDOW_SIZE     256 // Frames the rolling percentiles are taken over
+#define LATENCY_STAGE_COUNT     5
+
+// Monotonic time stamps (us) a frame collects on its way from the camera to the screen
+struct FrameTiming {
+    qint64 dequeued;    // grab() returned the frame
+    qint64 published;   // Frame became available in the frame buffer
+    qint64 processed;   // Preview frame was ready for the GUI thread
+    qint64 uploaded;    // Texture upload finished
+    qint64 swapped;     // Buffers were swapped after drawing the frame
+    qint64 daqFrameNum; // Frame counter of the DAQ, counts dropped frames too. -1 for webcams
+    double correctedTimeStamp; // Host time stamp (ms since epoch) with the host's jitter taken out by ClockModel
+
+    FrameTiming() : dequeued(0), published(0), processed(0), uploaded(0), swapped(0), daqFrameNum(-1), correctedTimeStamp(0) {}
+};
+
+// Rolling p50/p99 of the time spent in each display stage. Samples come from the render thread,
+// summaries are read from the GUI thread.
+// Stages are Ring (dequeued to published), Preview (to processed), Upload (to uploaded), Swap (to swapped) and Total.
+class LatencyTracker
+{
+public:
+    LatencyTracker();
+    ~LatencyTracker();
+
+    static qint64 now();
+
+    void addSample(const FrameTiming &timing);
+    QString summary();
+    void setLogFile(QString filePath);
+    void writeLog();
+
+private:
+    void percentiles(int stage, double &p50, double &p99);
+
+    QMutex m_mutex;
+    qint64 m_samples[LATENCY_STAGE_COUNT][LATENCY_WINDOW_SIZE];
+    int m_sampleCount;
+    int m_nextSample;
+
+    QFile m_logFile;
+};
+
+#endif // LATENCYTRACKER_H
@@ -25,6 +25,7 @@ int main(int argc, char *argv[])
     QGuiApplication app(argc, argv);
 
     qRegisterMetaType < QVector<quint8> >("QVector<quint8>");
+    qRegisterMetaType < QVector<float> >("QVector<float>");
 
     QQmlApplicationEngine engine;
     const QUrl url(QStringLiteral("qrc:/main.qml"));
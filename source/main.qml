@@ -88,7 +88,7 @@ Window {
     MessageDialog {
         id: errorMessageDialog
         title: "User Config File Error"
-        text: "The selected user configuration file contains device name repeats. Please edit the file the so each 'deviceName' entry is unique."
+        text: "The selected user configuration file contains device name or closed loop server name repeats. Please edit the file the so each 'deviceName' entry, and each closed loop 'serverName', is unique."
         onAccepted: {
             visible = false
         }
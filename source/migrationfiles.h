@@ -0,0 +1,9 @@
+#ifndef MIGRATIONFILES_H
+#define MIGRATIONFILES_H
+
+// Files SessionMigrator leaves in a session. Kept apart from sessionmigrator.h so the session tools can skip them
+// without building the migrator
+#define MIGRATION_TARGET_FILE_NAME  "migrationTarget.json"
+#define MIGRATION_STATUS_FILE_NAME  "migration.json"
+
+#endif // MIGRATIONFILES_H
@@ -27,15 +27,34 @@ Miniscope::Miniscope(QObject *parent, QJsonObject ucMiniscope) :
     m_headOrientationStreamState(false),
     m_headOrientationFilterState(false),
     m_displatState("Raw"),
-    baselineFrameBufWritePos(0),
-    baselinePreviousTimeStamp(0),
-    m_extTriggerTrackingState(false)
+    dffEngine(nullptr),
+    dffThread(nullptr),
+    previewGenerator(nullptr),
+    previewThread(nullptr),
+    m_previewFilterEnabled(false),
+    m_lastLatencyUpdate(0),
+    motionCorrector(nullptr),
+    motionCorrectorThread(nullptr),
+    traceExtractor(nullptr),
+    traceExtractorThread(nullptr),
+    qualityMonitor(nullptr),
+    qualityMonitorThread(nullptr),
+    closedLoopPublisher(nullptr),
+    closedLoopThread(nullptr),
+    m_summaryImagesEnabled(false),
+    m_summaryDisplay("Live"),
+    m_lastSummaryUpdate(0),
+    m_extTriggerTrackingState(false),
+    m_autoContrast(false),
+    m_manualAlpha(1),
+    m_manualBeta(0)
 
 {
 
     m_ucMiniscope = ucMiniscope; // hold user config for this Miniscope
     parseUserConfigMiniscope();
     getMiniscopeConfig(m_ucMiniscope["deviceType"].toString()); // holds specific Miniscope configuration
+    parseCropRegions(); // needs frame size from the Miniscope configuration
 
     // Checks to make sure user config and miniscope device type are supporting BNO streaming
     if (m_ucMiniscope.contains("headOrientation")) {
@@ -68,7 +87,12 @@ Miniscope::Miniscope(QObject *parent, QJsonObject ucMiniscope) :
 
     miniscopeStream->setIsColor(m_cMiniscopes["isColor"].toBool(false));
 
-    m_camConnected = miniscopeStream->connect2Camera(m_ucMiniscope["deviceID"].toInt());
+    // backEnd connects the stream together with the other devices' and then calls setupStream()
+}
+
+void Miniscope::setupStream()
+{
+    m_camConnected = miniscopeStream->connectionState();
     if (m_camConnected == 0) {
         qDebug() << "Not able to connect and open " << m_ucMiniscope["deviceName"].toString();
     }
@@ -81,6 +105,8 @@ Miniscope::Miniscope(QObject *parent, QJsonObject ucMiniscope) :
                                              usedFrames,
                                              m_acqFrameNum,
                                              m_daqFrameNum);
+        miniscopeStream->setTimingBuffer(timingBuffer);
+        miniscopeStream->setClockModel(&m_clockModel);
 
 
         // -----------------
@@ -103,6 +129,7 @@ Miniscope::Miniscope(QObject *parent, QJsonObject ucMiniscope) :
 
         // Handle external triggering passthrough
         QObject::connect(this, &Miniscope::setExtTriggerTrackingState, miniscopeStream, &VideoStreamOCV::setExtTriggerTrackingState);
+        QObject::connect(miniscopeStream, &VideoStreamOCV::extTriggerTimeStamp, this, &Miniscope::extTriggerTimeStamp);
         QObject::connect(miniscopeStream, &VideoStreamOCV::extTriggered, this, &Miniscope::extTriggered);
 
         QObject::connect(this, &Miniscope::startRecording, miniscopeStream, &VideoStreamOCV::startRecording);
@@ -116,15 +143,100 @@ Miniscope::Miniscope(QObject *parent, QJsonObject ucMiniscope) :
         QObject::connect(this, &Miniscope::stopRecording, this, &Miniscope::handleRecordStop);
         // ----------------------------------------------
 
+        // Display, dF/F and optionally recording use motion corrected frames when image registration is on
+        cv::Mat *displayBuffer = frameBuffer;
+        QAtomicInt *displayFrameNum = m_acqFrameNum;
+        if (m_imageRegistrationMode != "Off") {
+            motionCorrector = new MotionCorrector(frameBuffer, FRAME_BUFFER_SIZE, m_ucMiniscope["imageRegistrationOptions"].toObject());
+            motionCorrectorThread = new QThread;
+            motionCorrector->moveToThread(motionCorrectorThread);
+            QObject::connect(miniscopeStream, &VideoStreamOCV::newFrameAvailable, motionCorrector, &MotionCorrector::handleNewFrame);
+            QObject::connect(motionCorrector, &MotionCorrector::sendMessage, this, &Miniscope::sendMessage);
+            QObject::connect(motionCorrectorThread, SIGNAL (finished()), motionCorrectorThread, SLOT (deleteLater()));
+            motionCorrectorThread->start();
+            displayBuffer = motionCorrector->getRegisteredBufferPointer();
+            displayFrameNum = motionCorrector->getRegisteredFrameNumPointer();
+        }
+
+        // ROI fluorescence traces get extracted from the same frames that are displayed
+        if (m_ucMiniscope["traceExtraction"].toObject()["enable"].toBool(false)) {
+            traceExtractor = new TraceExtractor(displayBuffer, timeStampBuffer, FRAME_BUFFER_SIZE, displayFrameNum, m_ucMiniscope["traceExtraction"].toObject());
+            QObject::connect(traceExtractor, &TraceExtractor::sendMessage, this, &Miniscope::sendMessage);
+            if (!m_ucMiniscope["traceExtraction"].toObject()["roiFile"].toString().isEmpty())
+                traceExtractor->loadROIFile(m_ucMiniscope["traceExtraction"].toObject()["roiFile"].toString());
+            traceExtractorThread = new QThread;
+            traceExtractor->moveToThread(traceExtractorThread);
+            if (motionCorrector)
+                QObject::connect(motionCorrector, &MotionCorrector::frameRegistered, traceExtractor, &TraceExtractor::handleNewFrame);
+            else
+                QObject::connect(miniscopeStream, &VideoStreamOCV::newFrameAvailable, traceExtractor, &TraceExtractor::handleNewFrame);
+            QObject::connect(traceExtractorThread, SIGNAL (finished()), traceExtractorThread, SLOT (deleteLater()));
+            traceExtractorThread->start();
+        }
+
+        // Closed loop events from ROI traces, or from pixel regions of the displayed frames when traces are off
+        if (m_ucMiniscope["closedLoop"].toObject()["enable"].toBool(false)) {
+            closedLoopPublisher = new ClosedLoopPublisher(m_deviceName, displayBuffer, timeStampBuffer, timingBuffer, FRAME_BUFFER_SIZE,
+                                                          traceExtractor ? traceExtractor->getTraceFrameNumPointer() : displayFrameNum,
+                                                          traceExtractor ? traceExtractor->getTraceBufferPointer() : nullptr,
+                                                          m_ucMiniscope["closedLoop"].toObject());
+            closedLoopThread = new QThread;
+            closedLoopPublisher->moveToThread(closedLoopThread);
+            if (traceExtractor)
+                QObject::connect(traceExtractor, &TraceExtractor::tracesReady, closedLoopPublisher, &ClosedLoopPublisher::handleNewFrame);
+            else if (motionCorrector)
+                QObject::connect(motionCorrector, &MotionCorrector::frameRegistered, closedLoopPublisher, &ClosedLoopPublisher::handleNewFrame);
+            else
+                QObject::connect(miniscopeStream, &VideoStreamOCV::newFrameAvailable, closedLoopPublisher, &ClosedLoopPublisher::handleNewFrame);
+            QObject::connect(closedLoopPublisher, &ClosedLoopPublisher::sendMessage, this, &Miniscope::sendMessage);
+            QObject::connect(closedLoopThread, SIGNAL (started()), closedLoopPublisher, SLOT (startRunning()));
+            QObject::connect(closedLoopThread, SIGNAL (finished()), closedLoopThread, SLOT (deleteLater()));
+            closedLoopThread->start();
+        }
+
+        // Quality metrics are measured on raw frames, as they were acquired
+        if (m_ucMiniscope["qualityMetrics"].toObject()["enable"].toBool(false)) {
+            qualityMonitor = new QualityMonitor(m_deviceName, frameBuffer, timeStampBuffer, FRAME_BUFFER_SIZE, m_acqFrameNum, m_ucMiniscope["qualityMetrics"].toObject());
+            qualityMonitorThread = new QThread;
+            qualityMonitor->moveToThread(qualityMonitorThread);
+            QObject::connect(miniscopeStream, &VideoStreamOCV::newFrameAvailable, qualityMonitor, &QualityMonitor::handleNewFrame);
+            QObject::connect(qualityMonitor, &QualityMonitor::sendMessage, this, &Miniscope::sendMessage);
+            QObject::connect(qualityMonitorThread, SIGNAL (finished()), qualityMonitorThread, SLOT (deleteLater()));
+            qualityMonitorThread->start();
+        }
+
+        m_summaryImagesEnabled = m_ucMiniscope["summaryImages"].toObject()["enable"].toBool(false);
+        m_summaryImages.setLocalCorrelation(m_ucMiniscope["summaryImages"].toObject()["localCorrelation"].toBool(true));
+
+        // dF/F display frames get computed on their own thread
+        dffEngine = new DFFEngine(displayBuffer, timeStampBuffer);
+        dffThread = new QThread;
+        dffEngine->moveToThread(dffThread);
+        QObject::connect(dffThread, SIGNAL (finished()), dffThread, SLOT (deleteLater()));
+        dffThread->start();
+
+        // Display frames get prepared on their own thread at no more than displayFrameRate
+        previewGenerator = new PreviewGenerator(displayBuffer, displayFrameNum, FRAME_BUFFER_SIZE, m_ucMiniscope["displayFrameRate"].toDouble(30));
+        previewGenerator->setTimingBuffer(timingBuffer);
+        previewGenerator->setDFFEngine(dffEngine);
+        if (m_ucMiniscope.contains("previewFilter")) {
+            previewGenerator->setFilterOptions(m_ucMiniscope["previewFilter"].toObject());
+            m_previewFilterEnabled = m_ucMiniscope["previewFilter"].toObject()["enable"].toBool(false);
+            previewGenerator->setFilterEnabled(m_previewFilterEnabled);
+        }
+        previewThread = new QThread;
+        previewGenerator->moveToThread(previewThread);
+        QObject::connect(previewThread, SIGNAL (started()), previewGenerator, SLOT (startRunning()));
+        QObject::connect(previewThread, SIGNAL (finished()), previewThread, SLOT (deleteLater()));
+        previewThread->start();
+
     //    createView();
         connectSnS();
 
         sendInitCommands();
 
+        // backEnd waits for isStreamReady() so the initialize commands go out before the user config controls get loaded
         videoStreamThread->start();
-
-        // Short sleep to make i2c initialize commands be sent before loading in user config controls
-        QThread::msleep(500);
     }
 }
 
@@ -166,11 +278,23 @@ void Miniscope::createView()
                              this, SLOT( handleDFFSwitchChange(bool) ));
         QObject::connect(rootObject, SIGNAL( saturationSwitchChanged(bool) ),
                              this, SLOT( handleSaturationSwitchChanged(bool) ));
+        QObject::connect(rootObject, SIGNAL( autoContrastSwitchChanged(bool) ),
+                             this, SLOT( handleAutoContrastSwitchChanged(bool) ));
 
         configureMiniscopeControls();
         vidDisplay = rootObject->findChild<VideoDisplay*>("vD");
+        if (m_summaryImagesEnabled)
+            QObject::connect(rootObject, SIGNAL( summaryDisplayChanged(QString) ), this, SLOT( handleSummaryDisplayChanged(QString) ));
+        if (previewGenerator->hasFilter())
+            QObject::connect(rootObject, SIGNAL( previewFilterToggled() ), this, SLOT( handlePreviewFilterToggled() ));
+        if (traceExtractor) {
+            QObject::connect(rootObject, SIGNAL( setTraceRoiClicked() ), this, SLOT( handleSetTraceRoiClicked() ));
+            QObject::connect(vidDisplay, &VideoDisplay::newROISignal, this, &Miniscope::handleNewTraceROI);
+        }
         vidDisplay->setMaxBuffer(FRAME_BUFFER_SIZE);
         vidDisplay->setWindowScaleValue(m_ucMiniscope["windowScale"].toDouble(1));
+        vidDisplay->setLatencyTracker(&m_latencyTracker);
+        m_latencyTracker.setLogFile(m_ucMiniscope["latencyLogFile"].toString(""));
 
         // Turn on or off show saturation display
         if (m_ucMiniscope["showSaturation"].toBool(false)) {
@@ -182,6 +306,13 @@ void Miniscope::createView()
             rootObject->findChild<QQuickItem*>("saturationSwitch")->setProperty("checked", false);
         }
 
+        // Auto-contrast sets alpha and beta from percentiles of a running histogram
+        previewGenerator->histogram().setPercentiles(m_ucMiniscope["autoContrastLowPercentile"].toDouble(0.5),
+                                                     m_ucMiniscope["autoContrastHighPercentile"].toDouble(99.5));
+        m_autoContrast = m_ucMiniscope["autoContrast"].toBool(false);
+        if (rootObject->findChild<QQuickItem*>("autoContrastSwitch"))
+            rootObject->findChild<QQuickItem*>("autoContrastSwitch")->setProperty("checked", m_autoContrast);
+
         if (m_headOrientationStreamState)
             bnoDisplay = rootObject->findChild<QQuickItem*>("bno");
 
@@ -225,6 +356,50 @@ void Miniscope::parseUserConfigMiniscope() {
     // Currently not needed. If arrays get added into JSON config then this might
     m_deviceName = m_ucMiniscope["deviceName"].toString("Miniscope " + QString::number(m_ucMiniscope["deviceID"].toInt()));
     m_compressionType = m_ucMiniscope["compression"].toString("None");
+
+    // "Off", "Display" (motion corrected live view) or "Record" (also saves the corrected frames)
+    m_imageRegistrationMode = m_ucMiniscope["imageRegistration"].toString("Off");
+    if (m_imageRegistrationMode != "Off" && m_imageRegistrationMode != "Display" && m_imageRegistrationMode != "Record") {
+        qDebug() << m_deviceName << "image registration mode" << m_imageRegistrationMode << "is not supported. Using 'Off'.";
+        m_imageRegistrationMode = "Off";
+    }
+}
+
+void Miniscope::parseCropRegions()
+{
+    // Crop regions define the portions of the frame that get saved to disk.
+    // "separate" mode saves each region as its own video stream.
+    // "masked" mode saves a single stream bounded by all regions with everything outside the regions zeroed.
+    QJsonObject jCrop = m_ucMiniscope["cropRegions"].toObject();
+    QJsonArray jRegions = jCrop["regions"].toArray();
+    QJsonObject jRegion;
+    QRect region;
+    QRect frameRect(0, 0, m_cMiniscopes["width"].toInt(-1), m_cMiniscopes["height"].toInt(-1));
+
+    m_cropMode = jCrop["mode"].toString("separate");
+    if (m_cropMode != "separate" && m_cropMode != "masked") {
+        qDebug() << m_deviceName << "crop region mode" << m_cropMode << "is not supported. Using 'separate'.";
+        m_cropMode = "separate";
+    }
+
+    for (int i = 0; i < jRegions.size(); i++) {
+        jRegion = jRegions[i].toObject();
+        region = QRect(jRegion["leftEdge"].toInt(-1),
+                       jRegion["topEdge"].toInt(-1),
+                       jRegion["width"].toInt(-1),
+                       jRegion["height"].toInt(-1));
+        if (region.left() < 0 || region.top() < 0 || region.width() <= 0 || region.height() <= 0) {
+            qDebug() << m_deviceName << "crop region" << i << "is missing or has invalid values. Ignoring it.";
+            continue;
+        }
+        if (!frameRect.contains(region)) {
+            // Trim regions that extend past the edge of the frame
+            region = region.intersected(frameRect);
+            qDebug() << m_deviceName << "crop region" << i << "extends beyond frame. Trimmed to" << region;
+        }
+        m_cropRegions.append(region);
+        m_cropCircularMask.append(jRegion["circularMask"].toBool(false));
+    }
 }
 
 void Miniscope::sendInitCommands()
@@ -445,59 +620,48 @@ void Miniscope::testSlot(QString type, double value)
 void Miniscope::sendNewFrame(){
 //    vidDisplay->setProperty("displayFrame", QImage("C:/Users/DBAharoni/Pictures/Miniscope/Logo/1.png"));
     int f = *m_acqFrameNum;
-    cv::Mat tempMat1, tempMat2;
+    double alpha, beta;
+    QImage tempFrame2;
+
+    // Display frames (raw or dF/F) come downscaled and ready to show from the preview thread
+    previewGenerator->setTargetSize(vidDisplay->displaySize().width(), vidDisplay->displaySize().height());
+    if (m_summaryDisplay != "Live") {
+        // Summary images change slowly. Once a second is plenty
+        if (LatencyTracker::now() - m_lastSummaryUpdate > 1000000) {
+            m_lastSummaryUpdate = LatencyTracker::now();
+            cv::Mat summary = m_summaryImages.displayImage(m_summaryDisplay);
+            if (!summary.empty())
+                vidDisplay->setDisplayFrame(QImage(summary.data, summary.cols, summary.rows, summary.step, QImage::Format_Grayscale8));
+        }
+    }
+    else if (previewGenerator->takeFrame()) {
+        // Stays valid until the next takeFrame(). VideoDisplay copies it right away
+        const cv::Mat &preview = previewGenerator->frame();
+        if (preview.channels() == 1)
+            tempFrame2 = QImage(preview.data, preview.cols, preview.rows, preview.step, QImage::Format_Grayscale8);
+        else
+            tempFrame2 = QImage(preview.data, preview.cols, preview.rows, preview.step, QImage::Format_RGB888);
+        vidDisplay->setDisplayFrame(tempFrame2, previewGenerator->frameTiming());
+    }
+
+    // Latency overlay and log get refreshed once a second
+    if (LatencyTracker::now() - m_lastLatencyUpdate > 1000000) {
+        m_lastLatencyUpdate = LatencyTracker::now();
+        vidDisplay->setLatencySummary(m_latencyTracker.summary());
+        m_latencyTracker.writeLog();
+    }
+
     if (f > m_previousDisplayFrameNum) {
         m_previousDisplayFrameNum = f;
-        QImage tempFrame2;
 //        qDebug() << "Send frame = " << f;
         f = (f - 1)%FRAME_BUFFER_SIZE;
 
-        // TODO: Think about where color to gray and vise versa should take place.
-        if (frameBuffer[f].channels() == 1) {
-            cv::cvtColor(frameBuffer[f], tempFrame, cv::COLOR_GRAY2BGR);
-            tempFrame2 = QImage(tempFrame.data, tempFrame.cols, tempFrame.rows, tempFrame.step, QImage::Format_RGB888);
-        }
-        else
-            tempFrame2 = QImage(frameBuffer[f].data, frameBuffer[f].cols, frameBuffer[f].rows, frameBuffer[f].step, QImage::Format_RGB888);
-
-        // Generate moving average baseline frame
-        if ((timeStampBuffer[f] - baselinePreviousTimeStamp) > 100) {
-            // update baseline frame buffer every ~500ms
-            tempMat1 = frameBuffer[f].clone();
-            tempMat1.convertTo(tempMat1, CV_32F);
-            tempMat1 = tempMat1/(BASELINE_FRAME_BUFFER_SIZE);
-            if (baselineFrameBufWritePos == 0) {
-                baselineFrame = tempMat1;
-            }
-            else if (baselineFrameBufWritePos < BASELINE_FRAME_BUFFER_SIZE) {
-                baselineFrame += tempMat1;
-            }
-            else {
-                baselineFrame += tempMat1;
-                baselineFrame -= baselineFrameBuffer[baselineFrameBufWritePos%BASELINE_FRAME_BUFFER_SIZE];
-            }
-            baselineFrameBuffer[baselineFrameBufWritePos % BASELINE_FRAME_BUFFER_SIZE] = tempMat1.clone();
-            baselinePreviousTimeStamp = timeStampBuffer[f];
-            baselineFrameBufWritePos++;
-        }
-
-        if (m_displatState == "Raw") {
-
-//            vidDisplay->setDisplayFrame(tempFrame2.copy());
-            // TODO: Check to see if we can get rid of .copy() here
-            vidDisplay->setDisplayFrame(tempFrame2);
-        }
-        else if (m_displatState == "dFF") {
-            // TODO: Implement this better. I am sure it can be sped up a lot. Maybe do most of it in a shader
-            tempMat2 = frameBuffer[f].clone();
-            tempMat2.convertTo(tempMat2, CV_32F);
-            cv::divide(tempMat2,baselineFrame,tempMat2);
-            tempMat2 = ((tempMat2 - 1.0) + 0.5) * 255;
-            tempMat2.convertTo(tempMat2, CV_8U);
-            cv::cvtColor(tempMat2, tempFrame, cv::COLOR_GRAY2BGR);
-            tempFrame2 = QImage(tempFrame.data, tempFrame.cols, tempFrame.rows, tempFrame.step, QImage::Format_RGB888);
-            vidDisplay->setDisplayFrame(tempFrame2.copy());
+        // Auto-contrast follows the raw stream. dF/F frames keep the slider levels
+        if (m_autoContrast && m_displatState == "Raw" && previewGenerator->histogram().autoContrast(alpha, beta)) {
+            vidDisplay->setAlpha(alpha);
+            vidDisplay->setBeta(beta);
         }
+        vidDisplay->setSaturatedFraction(previewGenerator->histogram().saturatedFraction());
 
         vidDisplay->setBufferUsed(usedFrames->available());
         if (f > 0) // This is just a quick cheat so I don't have to wrap around for (f-1)
@@ -547,10 +711,14 @@ void Miniscope::handlePropChangedSignal(QString type, double displayValue, doubl
     sendMessage(m_deviceName + " " + type + " changed to " + QString::number(displayValue) + ".");
     // Handle props that only affect the user display here
     if (type == "alpha"){
-        vidDisplay->setAlpha(displayValue);
+        m_manualAlpha = displayValue;
+        if (!m_autoContrast)
+            vidDisplay->setAlpha(displayValue);
     }
     else if (type == "beta") {
-        vidDisplay->setBeta(displayValue);
+        m_manualBeta = displayValue;
+        if (!m_autoContrast)
+            vidDisplay->setBeta(displayValue);
     }
     else {
         // Here handles prop changes that need to be sent over to the Miniscope
@@ -635,6 +803,10 @@ void Miniscope::handleDFFSwitchChange(bool checked)
         m_displatState = "dFF";
     else
         m_displatState = "Raw";
+    if (dffEngine)
+        dffEngine->setEnabled(checked);
+    if (previewGenerator)
+        previewGenerator->setShowDFF(checked);
 }
 
 void Miniscope::handleSaturationSwitchChanged(bool checked)
@@ -642,6 +814,16 @@ void Miniscope::handleSaturationSwitchChanged(bool checked)
     vidDisplay->setShowSaturation(checked);
 }
 
+void Miniscope::handleAutoContrastSwitchChanged(bool checked)
+{
+    m_autoContrast = checked;
+    if (!checked) {
+        // Back to whatever the sliders are set to
+        vidDisplay->setAlpha(m_manualAlpha);
+        vidDisplay->setBeta(m_manualBeta);
+    }
+}
+
 void Miniscope::handleSetExtTriggerTrackingState(bool state)
 {
      m_extTriggerTrackingState = state;
@@ -689,4 +871,63 @@ void Miniscope::close()
 {
     if (m_camConnected)
         view->close();
+    if (dffThread)
+        dffThread->quit();
+    if (previewThread)
+        previewThread->quit();
+    if (motionCorrector)
+        motionCorrector->close();
+    if (motionCorrectorThread)
+        motionCorrectorThread->quit();
+    if (traceExtractorThread)
+        traceExtractorThread->quit();
+    if (qualityMonitorThread)
+        qualityMonitorThread->quit();
+    if (closedLoopPublisher)
+        QMetaObject::invokeMethod(closedLoopPublisher, "close", Qt::BlockingQueuedConnection);
+    if (closedLoopThread)
+        closedLoopThread->quit();
+}
+
+void Miniscope::handlePreviewFilterToggled()
+{
+    m_previewFilterEnabled = !m_previewFilterEnabled;
+    previewGenerator->setFilterEnabled(m_previewFilterEnabled);
+    sendMessage(m_deviceName + QString(" preview filter ") + (m_previewFilterEnabled ? "on." : "off."));
+}
+
+void Miniscope::handleSummaryDisplayChanged(QString type)
+{
+    if (type != "Live" && m_summaryImages.frameCount() == 0) {
+        sendMessage("Summary images are built while recording. Nothing has been recorded yet.");
+        return;
+    }
+    m_summaryDisplay = type;
+    m_lastSummaryUpdate = 0;
+    rootObject->setProperty("summaryDisplay", type);
+}
+
+void Miniscope::handleSetTraceRoiClicked()
+{
+    // Tell videodisplay that we will need mouse actions and will need to draw ROI rectangle
+    vidDisplay->setROISelectionState(true);
+}
+
+void Miniscope::handleNewTraceROI(int leftEdge, int topEdge, int width, int height)
+{
+    // Drawn ROIs are the ellipse inside the rectangle, scaled from window to pixel values
+    QJsonObject roi;
+    double scale = m_ucMiniscope["windowScale"].toDouble(1);
+
+    roi["leftEdge"] = (int) round(leftEdge / scale);
+    roi["topEdge"] = (int) round(topEdge / scale);
+    roi["width"] = (int) round(width / scale);
+    roi["height"] = (int) round(height / scale);
+    roi["circularMask"] = true;
+    if (traceExtractor->addROI(roi))
+        sendMessage("Trace ROI " + QString::number(traceExtractor->roiDefinitions().size() - 1) + " set to [" +
+                    QString::number(roi["leftEdge"].toInt()) + ", " +
+                    QString::number(roi["topEdge"].toInt()) + ", " +
+                    QString::number(roi["width"].toInt()) + ", " +
+                    QString::number(roi["height"].toInt()) + "]");
 }
@@ -12,10 +12,18 @@
 #include <QVector>
 #include <QQuickItem>
 #include <QVariant>
+#include <QRect>
 
 #include "videostreamocv.h"
 #include "videodisplay.h"
 #include "newquickview.h"
+#include "dffengine.h"
+#include "previewgenerator.h"
+#include "motioncorrector.h"
+#include "traceextractor.h"
+#include "summaryimages.h"
+#include "qualitymonitor.h"
+#include "closedlooppublisher.h"
 #include <opencv2/opencv.hpp>
 
 
@@ -31,7 +39,6 @@
 #define SEND_COMMAND_ERROR      -20
 
 #define FRAME_BUFFER_SIZE   128
-#define BASELINE_FRAME_BUFFER_SIZE  128
 
 
 class Miniscope : public QObject
@@ -39,15 +46,23 @@ class Miniscope : public QObject
     Q_OBJECT
 public:
     explicit Miniscope(QObject *parent = nullptr, QJsonObject ucMiniscope = QJsonObject());
+    // Connecting is slow, so backEnd connects all devices at once on a thread pool before setting up their streams
+    VideoStreamOCV* getStream() { return miniscopeStream; }
+    int getCameraID() { return m_ucMiniscope["deviceID"].toInt(); }
+    void setupStream();
+    bool isStreamReady() { return miniscopeStream->isReady(); }
     void createView();
     void connectSnS();
     void defineDeviceAddrs();
     void parseUserConfigMiniscope();
+    void parseCropRegions();
     void sendInitCommands();
     QString getCompressionType();
     cv::Mat* getFrameBufferPointer(){return frameBuffer;}
     qint64* getTimeStampBufferPointer(){return timeStampBuffer;}
     float* getBNOBufferPointer() { return bnoBuffer; }
+    FrameTiming* getTimingBufferPointer(){return timingBuffer;}
+    ClockModel* getClockModel() { return &m_clockModel; }
     int getBufferSize() {return FRAME_BUFFER_SIZE;}
     QSemaphore* getFreeFramesPointer(){return freeFrames;}
     QSemaphore* getUsedFramesPointer(){return usedFrames;}
@@ -56,6 +71,15 @@ public:
     QString getDeviceName(){return m_deviceName;}
     bool getHeadOrienataionStreamState() { return m_headOrientationStreamState;}
     bool getHeadOrienataionFilterState() { return m_headOrientationFilterState;}
+    QVector<QRect> getCropRegions() { return m_cropRegions; }
+    QVector<bool> getCropCircularMasks() { return m_cropCircularMask; }
+    QString getCropMode() { return m_cropMode; }
+    MotionCorrector* getMotionCorrector() { return motionCorrector; }
+    QString getImageRegistrationMode() { return m_imageRegistrationMode; }
+    TraceExtractor* getTraceExtractor() { return traceExtractor; }
+    QualityMonitor* getQualityMonitor() { return qualityMonitor; }
+    ClosedLoopPublisher* getClosedLoopPublisher() { return closedLoopPublisher; }
+    SummaryImages* getSummaryImages() { return m_summaryImagesEnabled ? &m_summaryImages : nullptr; }
 
 signals:
     // TODO: setup signals to configure camera in thread
@@ -65,6 +89,7 @@ signals:
     void takeScreenShot(QString type);
     void setExtTriggerTrackingState(bool state);
     void extTriggered(bool state);
+    void extTriggerTimeStamp(qint64 timeStamp);
     void startRecording();
     void stopRecording();
 
@@ -75,10 +100,15 @@ public slots:
     void handleTakeScreenShotSignal();
     void handleDFFSwitchChange(bool checked);
     void handleSaturationSwitchChanged(bool checked);
+    void handleAutoContrastSwitchChanged(bool checked);
     void handleSetExtTriggerTrackingState(bool state);
     void handleRecordStart(); // Currently used to toggle LED on and off
     void handleRecordStop(); // Currently used to toggle LED on and off
     void handleInitCommandsRequest();
+    void handleSetTraceRoiClicked();
+    void handleNewTraceROI(int leftEdge, int topEdge, int width, int height);
+    void handleSummaryDisplayChanged(QString type);
+    void handlePreviewFilterToggled();
     void close();
 
 private:
@@ -93,8 +123,9 @@ private:
     VideoStreamOCV *miniscopeStream;
     QThread *videoStreamThread;
     cv::Mat frameBuffer[FRAME_BUFFER_SIZE];
-    cv::Mat tempFrame;
     qint64 timeStampBuffer[FRAME_BUFFER_SIZE];
+    FrameTiming timingBuffer[FRAME_BUFFER_SIZE];
+    ClockModel m_clockModel; // Corrects time stamps from the DAQ's frame counter
 //    float bnoBuffer[FRAME_BUFFER_SIZE*3];
     float bnoBuffer[FRAME_BUFFER_SIZE*5]; //w,x,y,z,norm
     QSemaphore *freeFrames;
@@ -127,13 +158,42 @@ private:
     QString m_compressionType;
     QString m_displatState;
 
-    cv::Mat baselineFrameBuffer[BASELINE_FRAME_BUFFER_SIZE];
-    cv::Mat baselineFrame;
-    int baselineFrameBufWritePos;
-    qint64 baselinePreviousTimeStamp;
+    DFFEngine *dffEngine;
+    QThread *dffThread;
+    PreviewGenerator *previewGenerator;
+    QThread *previewThread;
+    bool m_previewFilterEnabled;
+    LatencyTracker m_latencyTracker;
+    qint64 m_lastLatencyUpdate;
+
+    QString m_imageRegistrationMode;
+    MotionCorrector *motionCorrector;
+    QThread *motionCorrectorThread;
+    TraceExtractor *traceExtractor;
+    QThread *traceExtractorThread;
+    QualityMonitor *qualityMonitor;
+    QThread *qualityMonitorThread;
+    ClosedLoopPublisher *closedLoopPublisher;
+    QThread *closedLoopThread;
+
+    // Filled by DataSaver while recording. Shown in place of the live view when m_summaryDisplay isn't "Live"
+    bool m_summaryImagesEnabled;
+    SummaryImages m_summaryImages;
+    QString m_summaryDisplay;
+    qint64 m_lastSummaryUpdate;
 
     double m_lastLED0Value;
     bool m_extTriggerTrackingState;
+
+    // Display levels. The sliders' values are kept so they come back when auto-contrast is turned off
+    bool m_autoContrast;
+    double m_manualAlpha;
+    double m_manualBeta;
+
+    // Crop regions that get saved to disk instead of the full frame
+    QVector<QRect> m_cropRegions; // left, top, width, height in pixels
+    QVector<bool> m_cropCircularMask;
+    QString m_cropMode; // "separate" or "masked"
 };
 
 
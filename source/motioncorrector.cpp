@@ -0,0 +1,186 @@
+#include "motioncorrector.h"
+
+#include <QRunnable>
+#include <QMutexLocker>
+#include <QThread>
+
+#include <opencv2/imgproc.hpp>
+
+class RegistrationTask : public QRunnable
+{
+public:
+    RegistrationTask(MotionCorrector *corrector, int frameNum) : m_corrector(corrector), m_frameNum(frameNum) {}
+    void run() override { m_corrector->registerFrame(m_frameNum); }
+
+private:
+    MotionCorrector *m_corrector;
+    int m_frameNum;
+};
+
+MotionCorrector::MotionCorrector(cv::Mat *frameBuf, int bufSize, QJsonObject options, QObject *parent) :
+    QObject(parent),
+    frameBuffer(frameBuf),
+    bufferSize(bufSize),
+    m_patchSize(options["patchSize"].toInt(512)),
+    m_downsample(qMax(1, options["downsample"].toInt(2))),
+    m_maxShift(options["maxShift"].toDouble(40)),
+    m_dispatchedFrameNum(0),
+    m_closing(0),
+    m_doneFrameNum(bufSize, 0),
+    m_registeredFrameNum(0),
+    m_highPassSigma(0)
+{
+    registeredBuffer = new cv::Mat[bufferSize];
+    shiftBuffer = new float[bufferSize * REGISTRATION_SHIFT_VALUES];
+
+    // Leave some cores for acquisition, display and recording
+    int threads = options["threads"].toInt(0);
+    if (threads <= 0)
+        threads = qMax(1, QThread::idealThreadCount() / 2);
+    m_pool.setMaxThreadCount(threads);
+}
+
+MotionCorrector::~MotionCorrector()
+{
+    m_pool.waitForDone();
+    delete [] registeredBuffer;
+    delete [] shiftBuffer;
+}
+
+void MotionCorrector::handleNewFrame(QString name, int frameNum)
+{
+    Q_UNUSED(name);
+    // Frames stay in the acquisition buffer until they are registered since DataSaver waits on registeredFrameNum
+    while (!m_closing.loadAcquire() && m_dispatchedFrameNum < frameNum) {
+        m_dispatchedFrameNum++;
+        m_pool.start(new RegistrationTask(this, m_dispatchedFrameNum));
+    }
+}
+
+void MotionCorrector::registerFrame(int frameNum)
+{
+    int idx = (frameNum - 1) % bufferSize;
+    const cv::Mat &frame = frameBuffer[idx];
+    cv::Mat patch, currentTemplate, transform;
+    cv::Point2d shift(0, 0);
+    double response = 0;
+
+    if (frame.empty()) {
+        frameDone(frameNum);
+        return;
+    }
+
+    setupPatch(frame);
+    patch = preparePatch(frame);
+
+    m_templateMutex.lock();
+    if (m_template.empty())
+        m_template = patch; // First frame is the initial template
+    currentTemplate = m_template;
+    m_templateMutex.unlock();
+
+    if (patch.data != currentTemplate.data) {
+        // Sub-pixel shift of the patch relative to the template (weighted centroid around the correlation peak)
+        shift = cv::phaseCorrelate(currentTemplate, patch, m_window, &response);
+        shift *= m_downsample;
+        if (response < REGISTRATION_MIN_RESPONSE || qAbs(shift.x) > m_maxShift || qAbs(shift.y) > m_maxShift) {
+            // Not trustworthy. Frame is passed on uncorrected
+            shift = cv::Point2d(0, 0);
+        }
+        else
+            updateTemplate(patch, shift);
+    }
+    else
+        response = 1;
+
+    if (shift.x == 0 && shift.y == 0)
+        frame.copyTo(registeredBuffer[idx]);
+    else {
+        transform = (cv::Mat_<double>(2, 3) << 1, 0, -shift.x, 0, 1, -shift.y);
+        cv::warpAffine(frame, registeredBuffer[idx], transform, frame.size(), cv::INTER_LINEAR, cv::BORDER_CONSTANT, cv::Scalar(0));
+    }
+
+    shiftBuffer[idx * REGISTRATION_SHIFT_VALUES + 0] = (float) shift.x;
+    shiftBuffer[idx * REGISTRATION_SHIFT_VALUES + 1] = (float) shift.y;
+    shiftBuffer[idx * REGISTRATION_SHIFT_VALUES + 2] = (float) response;
+    frameDone(frameNum);
+}
+
+void MotionCorrector::setupPatch(const cv::Mat &frame)
+{
+    QMutexLocker locker(&m_patchMutex);
+    int size;
+
+    if (!m_window.empty() && m_patchRect.br().x <= frame.cols && m_patchRect.br().y <= frame.rows)
+        return;
+
+    // Centered square patch. Its downsampled size is rounded down to something the DFT handles quickly
+    size = qMin(m_patchSize, qMin(frame.cols, frame.rows)) / m_downsample;
+    while (size > 16 && cv::getOptimalDFTSize(size) != size)
+        size--;
+    m_patchSizeDownsampled = cv::Size(size, size);
+    m_patchRect = cv::Rect((frame.cols - size * m_downsample) / 2, (frame.rows - size * m_downsample) / 2,
+                           size * m_downsample, size * m_downsample);
+    cv::createHanningWindow(m_window, m_patchSizeDownsampled, CV_32F);
+    m_highPassSigma = size / 16.0;
+}
+
+cv::Mat MotionCorrector::preparePatch(const cv::Mat &frame)
+{
+    cv::Mat patch, background;
+    cv::Rect rect;
+    cv::Size size;
+    double sigma;
+
+    m_patchMutex.lock();
+    rect = m_patchRect;
+    size = m_patchSizeDownsampled;
+    sigma = m_highPassSigma;
+    m_patchMutex.unlock();
+
+    if (m_downsample > 1)
+        cv::resize(frame(rect), patch, size, 0, 0, cv::INTER_AREA);
+    else
+        patch = frame(rect);
+    patch.convertTo(patch, CV_32F);
+
+    // Removing the slowly varying background leaves vasculature and cell edges to align on
+    cv::GaussianBlur(patch, background, cv::Size(0, 0), sigma);
+    patch -= background;
+    return patch;
+}
+
+void MotionCorrector::updateTemplate(const cv::Mat &patch, cv::Point2d shift)
+{
+    cv::Mat aligned, updated;
+    cv::Mat transform = (cv::Mat_<double>(2, 3) << 1, 0, -shift.x / m_downsample, 0, 1, -shift.y / m_downsample);
+
+    cv::warpAffine(patch, aligned, transform, patch.size(), cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+
+    QMutexLocker locker(&m_templateMutex);
+    cv::addWeighted(m_template, 1.0 - 1.0 / REGISTRATION_TEMPLATE_FRAMES, aligned, 1.0 / REGISTRATION_TEMPLATE_FRAMES, 0, updated);
+    m_template = updated;
+}
+
+void MotionCorrector::frameDone(int frameNum)
+{
+    // Advance registeredFrameNum over every frame that is now done in order
+    QMutexLocker locker(&m_doneMutex);
+    int next, first;
+
+    m_doneFrameNum[(frameNum - 1) % bufferSize] = frameNum;
+    first = next = m_registeredFrameNum.loadAcquire() + 1;
+    while (m_doneFrameNum[(next - 1) % bufferSize] == next) {
+        m_registeredFrameNum.storeRelease(next);
+        next++;
+    }
+    if (next > first)
+        frameRegistered(next - 1);
+}
+
+void MotionCorrector::close()
+{
+    // Called from the GUI thread while the corrector thread may be dispatching frames
+    m_closing.storeRelease(1);
+    m_pool.clear();
+}
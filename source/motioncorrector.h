@@ -0,0 +1,78 @@
+#ifndef MOTIONCORRECTOR_H
+#define MOTIONCORRECTOR_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QJsonObject>
+#include <QMutex>
+#include <QThreadPool>
+#include <QVector>
+
+#include <opencv2/core/core.hpp>
+
+#define REGISTRATION_TEMPLATE_FRAMES    32      // Template is a running average over roughly this many registered frames
+#define REGISTRATION_MIN_RESPONSE       0.05    // Phase correlation peaks below this are too weak to trust
+#define REGISTRATION_SHIFT_VALUES       3       // x shift, y shift, peak response
+
+// Real-time rigid motion correction of a mono video stream ("imageRegistration" in the user config).
+// Each frame's shift against a running template is estimated by phase correlation of a cropped, downsampled
+// and high-pass filtered patch from the center of the frame. The full frame is then shifted by the sub-pixel result.
+// Frames get registered in parallel on a thread pool but are handed on strictly in order:
+// registeredFrameNum counts frames that are done, the same way acqFrameNum counts acquired frames,
+// and registered frames sit in a buffer indexed like the acquisition buffer.
+class MotionCorrector : public QObject
+{
+    Q_OBJECT
+public:
+    MotionCorrector(cv::Mat *frameBuf, int bufSize, QJsonObject options, QObject *parent = nullptr);
+    ~MotionCorrector();
+
+    cv::Mat *getRegisteredBufferPointer() { return registeredBuffer; }
+    float *getShiftBufferPointer() { return shiftBuffer; }
+    QAtomicInt *getRegisteredFrameNumPointer() { return &m_registeredFrameNum; }
+
+    void registerFrame(int frameNum); // Runs on the thread pool
+
+signals:
+    void sendMessage(QString msg);
+    void frameRegistered(int frameNum); // Emitted from a pool thread whenever registeredFrameNum advances
+
+public slots:
+    void handleNewFrame(QString name, int frameNum);
+    void close();
+
+private:
+    void setupPatch(const cv::Mat &frame);
+    cv::Mat preparePatch(const cv::Mat &frame);
+    void updateTemplate(const cv::Mat &patch, cv::Point2d shift);
+    void frameDone(int frameNum);
+
+    cv::Mat *frameBuffer;
+    cv::Mat *registeredBuffer;
+    float *shiftBuffer;
+    int bufferSize;
+
+    int m_patchSize;
+    int m_downsample;
+    double m_maxShift;
+
+    QThreadPool m_pool;
+    int m_dispatchedFrameNum;
+    QAtomicInt m_closing;
+
+    // Frames finish out of order. Each slot holds the number of the frame last finished in it
+    QMutex m_doneMutex;
+    QVector<int> m_doneFrameNum;
+    QAtomicInt m_registeredFrameNum;
+
+    QMutex m_patchMutex;
+    cv::Rect m_patchRect;
+    cv::Size m_patchSizeDownsampled;
+    cv::Mat m_window;
+    double m_highPassSigma;
+
+    QMutex m_templateMutex;
+    cv::Mat m_template; // Replaced, never modified in place, so workers can keep using the one they took
+};
+
+#endif // MOTIONCORRECTOR_H
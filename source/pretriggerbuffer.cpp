@@ -0,0 +1,71 @@
+#include "pretriggerbuffer.h"
+
+#include <QVector>
+
+#include <opencv2/core/core.hpp>
+
+PreTriggerBuffer::PreTriggerBuffer() :
+    m_hasBNO(false),
+    m_start(0),
+    m_count(0),
+    m_windowMs(0)
+{
+
+}
+
+void PreTriggerBuffer::push(const cv::Mat &frame, qint64 timeStamp, double correctedTimeStamp, const float *bno)
+{
+    int idx;
+
+    if (m_windowMs <= 0)
+        return;
+
+    // Drop frames that have fallen out of the window
+    while (m_count > 0 && (timeStamp - m_timeStamps[m_start]) > m_windowMs) {
+        m_start = (m_start + 1) % m_frames.size();
+        m_count--;
+    }
+
+    if (m_count == m_frames.size())
+        grow();
+
+    idx = slot(m_count);
+    frame.copyTo(m_frames[idx]); // Reuses the slot's memory when size and type match
+    m_timeStamps[idx] = timeStamp;
+    m_correctedTimeStamps[idx] = correctedTimeStamp;
+    if (bno != nullptr) {
+        m_hasBNO = true;
+        for (int i = 0; i < 5; i++)
+            m_bno[idx*5 + i] = bno[i];
+    }
+    m_count++;
+}
+
+void PreTriggerBuffer::clear()
+{
+    m_start = 0;
+    m_count = 0;
+}
+
+void PreTriggerBuffer::grow()
+{
+    // Unwrap the ring into larger storage with the oldest frame at index 0
+    int newSize = qMax(32, m_frames.size() * 2);
+    QVector<cv::Mat> frames(newSize);
+    QVector<qint64> timeStamps(newSize);
+    QVector<double> correctedTimeStamps(newSize);
+    QVector<float> bno(newSize * 5);
+
+    for (int i = 0; i < m_count; i++) {
+        frames[i] = m_frames[slot(i)];
+        timeStamps[i] = m_timeStamps[slot(i)];
+        correctedTimeStamps[i] = m_correctedTimeStamps[slot(i)];
+        for (int j = 0; j < 5; j++)
+            bno[i*5 + j] = m_bno[slot(i)*5 + j];
+    }
+    m_frames = frames;
+    m_timeStamps = timeStamps;
+    m_correctedTimeStamps = correctedTimeStamps;
+    m_bno = bno;
+    m_start = 0;
+}
@@ -0,0 +1,41 @@
+#ifndef PRETRIGGERBUFFER_H
+#define PRETRIGGERBUFFER_H
+
+#include <QVector>
+#include <QtGlobal>
+
+#include <opencv2/core/core.hpp>
+
+// Rolling store of the most recent frames of a device.
+// Frames older than the window (relative to the newest frame) get dropped.
+// Storage grows to fit the window and is then reused, so no allocations happen once it is full.
+class PreTriggerBuffer
+{
+public:
+    PreTriggerBuffer();
+    void setWindow(qint64 windowMs) { m_windowMs = windowMs; }
+    void push(const cv::Mat &frame, qint64 timeStamp, double correctedTimeStamp, const float *bno);
+    void clear();
+    int size() const { return m_count; }
+
+    // Index 0 is the oldest frame held
+    const cv::Mat &frame(int i) const { return m_frames[slot(i)]; }
+    qint64 timeStamp(int i) const { return m_timeStamps[slot(i)]; }
+    double correctedTimeStamp(int i) const { return m_correctedTimeStamps[slot(i)]; }
+    const float *bno(int i) const { return m_hasBNO ? &m_bno[slot(i)*5] : nullptr; }
+
+private:
+    int slot(int i) const { return (m_start + i) % m_frames.size(); }
+    void grow();
+
+    QVector<cv::Mat> m_frames;
+    QVector<qint64> m_timeStamps;
+    QVector<double> m_correctedTimeStamps;
+    QVector<float> m_bno; // w,x,y,z,norm
+    bool m_hasBNO;
+    int m_start;
+    int m_count;
+    qint64 m_windowMs;
+};
+
+#endif // PRETRIGGERBUFFER_H
@@ -0,0 +1,154 @@
+#include "previewfilter.h"
+
+#include <QElapsedTimer>
+#include <QDebug>
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+
+PreviewFilter::PreviewFilter() :
+    m_configured(false),
+    m_lowSigma(0),
+    m_highSigma(0),
+    m_topHatRadius(0),
+    m_temporalShift(0),
+    m_gain(1),
+    m_timeBudgetMs(8),
+    m_level(0),
+    m_averageMs(0),
+    m_framesUnderBudget(0)
+{
+
+}
+
+void PreviewFilter::configure(QJsonObject options)
+{
+    m_lowSigma = qMax(0.0, options["bandpassLowSigma"].toDouble(1));
+    m_highSigma = qMax(0.0, options["bandpassHighSigma"].toDouble(12));
+    m_topHatRadius = qMax(0, options["topHatRadius"].toInt(0));
+    m_temporalShift = qBound(0, options["temporalShift"].toInt(2), 8);
+    m_gain = options["gain"].toDouble(2);
+    m_timeBudgetMs = options["timeBudgetMs"].toDouble(8);
+    m_configured = true;
+}
+
+void PreviewFilter::apply(cv::Mat &frame, double scale)
+{
+    QElapsedTimer timer;
+    bool spatial = false;
+
+    if (frame.empty() || frame.type() != CV_8UC1)
+        return;
+    timer.start();
+
+    if (m_temporalShift > 0)
+        temporalDenoise(frame);
+
+    // Level 1 estimates backgrounds at half resolution, level 2 also drops the top-hat, level 3 only denoises
+    if (m_level < 3 && (m_lowSigma > 0 || m_highSigma > 0)) {
+        bandpass(frame, scale, m_level >= 1);
+        spatial = m_highSigma > 0;
+    }
+    if (m_level < 2 && m_topHatRadius > 0) {
+        topHat(frame, scale, m_level >= 1);
+        spatial = true;
+    }
+    if (spatial && m_gain != 1)
+        frame.convertTo(frame, -1, m_gain);
+
+    updateLevel(timer.nsecsElapsed() / 1000000.0);
+}
+
+void PreviewFilter::temporalDenoise(cv::Mat &frame)
+{
+    // Same running average as the dF/F baseline: s += x/2^k - s/2^k in 8.8 fixed point, done in place
+    const int shift = m_temporalShift;
+
+    if (m_temporalState.size() != frame.size()) {
+        frame.convertTo(m_temporalState, CV_16U, 256);
+        return;
+    }
+
+    for (int y = 0; y < frame.rows; y++) {
+        uchar *row = frame.ptr<uchar>(y);
+        ushort *state = m_temporalState.ptr<ushort>(y);
+        int x = 0;
+#if CV_SIMD
+        const int lanes = cv::v_uint8::nlanes;
+        cv::v_uint16 x16[2], s16[2];
+        for (; x <= frame.cols - lanes; x += lanes) {
+            cv::v_expand(cv::vx_load(row + x), x16[0], x16[1]);
+            s16[0] = cv::vx_load(state + x);
+            s16[1] = cv::vx_load(state + x + lanes / 2);
+            s16[0] = s16[0] - (s16[0] >> shift) + (x16[0] << (8 - shift));
+            s16[1] = s16[1] - (s16[1] >> shift) + (x16[1] << (8 - shift));
+            cv::v_store(state + x, s16[0]);
+            cv::v_store(state + x + lanes / 2, s16[1]);
+            cv::v_store(row + x, cv::v_pack(s16[0] >> 8, s16[1] >> 8));
+        }
+#endif
+        for (; x < frame.cols; x++) {
+            state[x] = state[x] - (state[x] >> shift) + (row[x] << (8 - shift));
+            row[x] = state[x] >> 8;
+        }
+    }
+}
+
+void PreviewFilter::bandpass(cv::Mat &frame, double scale, bool halfResolution)
+{
+    // Difference of Gaussians. The small one removes shot noise, the large one is the out of focus background
+    double low = m_lowSigma * scale;
+    double high = m_highSigma * scale;
+
+    if (low >= 0.3)
+        cv::GaussianBlur(frame, frame, cv::Size(0, 0), low);
+    if (high <= 0)
+        return;
+
+    if (halfResolution) {
+        cv::pyrDown(frame, m_small);
+        cv::GaussianBlur(m_small, m_small, cv::Size(0, 0), qMax(0.3, high / 2));
+        cv::resize(m_small, m_background, frame.size(), 0, 0, cv::INTER_LINEAR);
+    }
+    else
+        cv::GaussianBlur(frame, m_background, cv::Size(0, 0), high);
+    cv::subtract(frame, m_background, frame);
+}
+
+void PreviewFilter::topHat(cv::Mat &frame, double scale, bool halfResolution)
+{
+    // Rectangular kernels keep the opening separable
+    int radius = qMax(1, (int) round(m_topHatRadius * scale * (halfResolution ? 0.5 : 1)));
+    cv::Mat kernel = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(2 * radius + 1, 2 * radius + 1));
+
+    if (halfResolution) {
+        cv::pyrDown(frame, m_small);
+        cv::morphologyEx(m_small, m_small, cv::MORPH_OPEN, kernel);
+        cv::resize(m_small, m_background, frame.size(), 0, 0, cv::INTER_LINEAR);
+    }
+    else
+        cv::morphologyEx(frame, m_background, cv::MORPH_OPEN, kernel);
+    cv::subtract(frame, m_background, frame);
+}
+
+void PreviewFilter::updateLevel(double elapsedMs)
+{
+    m_averageMs = m_averageMs == 0 ? elapsedMs : 0.9 * m_averageMs + 0.1 * elapsedMs;
+
+    if (m_averageMs > m_timeBudgetMs && m_level < PREVIEW_FILTER_MAX_LEVEL) {
+        m_level++;
+        m_averageMs = 0;
+        m_framesUnderBudget = 0;
+        qDebug() << "Preview filter over its" << m_timeBudgetMs << "ms budget. Stepping down to level" << m_level;
+    }
+    else if (m_averageMs < m_timeBudgetMs / 2 && m_level > 0) {
+        if (++m_framesUnderBudget >= PREVIEW_FILTER_RECOVER_FRAMES) {
+            m_level--;
+            m_averageMs = 0;
+            m_framesUnderBudget = 0;
+            qDebug() << "Preview filter back up to level" << m_level;
+        }
+    }
+    else
+        m_framesUnderBudget = 0;
+}
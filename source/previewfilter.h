@@ -0,0 +1,50 @@
+#ifndef PREVIEWFILTER_H
+#define PREVIEWFILTER_H
+
+#include <QtGlobal>
+#include <QJsonObject>
+
+#include <opencv2/core/core.hpp>
+
+#define PREVIEW_FILTER_MAX_LEVEL        3   // 0 runs everything at display size. See apply() for what each level drops
+#define PREVIEW_FILTER_RECOVER_FRAMES   60  // Frames well under budget before stepping back up a level
+
+// Makes cells visible in the live view of dim, background dominated Miniscope frames ("previewFilter" in the user config).
+// Runs in place on the downscaled display frame: a recursive temporal denoiser, a difference of Gaussians
+// spatial bandpass and a top-hat background removal. The Gaussians and the morphology are separable kernels.
+// Processing time is tracked against timeBudgetMs and the filter steps down to cheaper levels when it runs over.
+// Only used from the preview thread.
+class PreviewFilter
+{
+public:
+    PreviewFilter();
+
+    void configure(QJsonObject options);
+    bool isConfigured() const { return m_configured; }
+    // scale is display pixels per acquired pixel. Kernel sizes are given in acquired pixels
+    void apply(cv::Mat &frame, double scale);
+    int level() const { return m_level; }
+
+private:
+    void temporalDenoise(cv::Mat &frame);
+    void bandpass(cv::Mat &frame, double scale, bool halfResolution);
+    void topHat(cv::Mat &frame, double scale, bool halfResolution);
+    void updateLevel(double elapsedMs);
+
+    bool m_configured;
+    double m_lowSigma;
+    double m_highSigma;
+    int m_topHatRadius;
+    int m_temporalShift;
+    double m_gain;
+    double m_timeBudgetMs;
+
+    cv::Mat m_temporalState; // 8.8 fixed point running average
+    cv::Mat m_background;
+    cv::Mat m_small;
+    int m_level;
+    double m_averageMs;
+    int m_framesUnderBudget;
+};
+
+#endif // PREVIEWFILTER_H
@@ -0,0 +1,80 @@
+#include "previewgenerator.h"
+
+#include <QDebug>
+
+#include <opencv2/imgproc.hpp>
+
+PreviewGenerator::PreviewGenerator(cv::Mat *frameBuf, QAtomicInt *acqFrameNum, int bufSize, double maxFrameRate, QObject *parent) :
+    QObject(parent),
+    frameBuffer(frameBuf),
+    timingBuffer(nullptr),
+    m_acqFrameNum(acqFrameNum),
+    bufferSize(bufSize),
+    m_maxFrameRate(maxFrameRate > 0 ? maxFrameRate : 30),
+    m_lastFrameNum(0),
+    m_timer(nullptr),
+    m_targetWidth(0),
+    m_targetHeight(0),
+    m_showDFF(0),
+    m_dffEngine(nullptr),
+    m_filterEnabled(0)
+{
+
+}
+
+void PreviewGenerator::startRunning()
+{
+    // Timer has to be created on this object's thread
+    m_timer = new QTimer(this);
+    m_timer->setTimerType(Qt::PreciseTimer);
+    QObject::connect(m_timer, &QTimer::timeout, this, &PreviewGenerator::generate);
+    m_timer->start(qMax(1, (int) (1000.0 / m_maxFrameRate)));
+}
+
+void PreviewGenerator::generate()
+{
+    int f = *m_acqFrameNum;
+    if (f > m_lastFrameNum) {
+        m_lastFrameNum = f;
+        f = (f - 1) % bufferSize;
+        m_histogram.addFrame(frameBuffer[f]);
+        // The dF/F baseline follows the stream whether or not dF/F is shown
+        if (m_dffEngine)
+            m_dffEngine->requestFrame(f);
+        if (!m_showDFF.loadAcquire() || !m_dffEngine)
+            publish(frameBuffer[f], f);
+    }
+    if (m_showDFF.loadAcquire() && m_dffEngine && m_dffEngine->takeDisplayFrame())
+        publish(m_dffEngine->displayFrame(), -1);
+}
+
+FrameTiming PreviewGenerator::frameTiming() const
+{
+    int bufferIndex = m_output.readTag();
+    if (!timingBuffer || bufferIndex < 0)
+        return FrameTiming();
+    return timingBuffer[bufferIndex];
+}
+
+void PreviewGenerator::publish(const cv::Mat &source, int bufferIndex)
+{
+    if (source.empty())
+        return;
+
+    int width = m_targetWidth.loadAcquire();
+    int height = m_targetHeight.loadAcquire();
+    cv::Mat &out = m_output.writeBuffer();
+
+    if (width > 0 && height > 0 && (width < source.cols || height < source.rows)) {
+        // Area averaging (vectorized inside OpenCV). Enlarging is left to the GPU
+        cv::resize(source, out, cv::Size(qMin(width, source.cols), qMin(height, source.rows)), 0, 0, cv::INTER_AREA);
+    }
+    else
+        source.copyTo(out);
+    if (bufferIndex >= 0 && m_filterEnabled.loadAcquire() && m_filter.isConfigured())
+        m_filter.apply(out, (double) out.cols / source.cols);
+    if (timingBuffer && bufferIndex >= 0)
+        timingBuffer[bufferIndex].processed = LatencyTracker::now();
+    m_output.setWriteTag(bufferIndex);
+    m_output.publish();
+}
@@ -0,0 +1,64 @@
+#ifndef PREVIEWGENERATOR_H
+#define PREVIEWGENERATOR_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QTimer>
+
+#include <opencv2/core/core.hpp>
+
+#include "frametriplebuffer.h"
+#include "dffengine.h"
+#include "histogramengine.h"
+#include "latencytracker.h"
+#include "previewfilter.h"
+
+// Produces display frames for one device on its own thread, at most displayFrameRate times per second.
+// Frames are downscaled to the size they are shown at before being handed to the GUI thread,
+// so the GUI thread and the renderer only ever touch pixels that end up on screen.
+class PreviewGenerator : public QObject
+{
+    Q_OBJECT
+public:
+    PreviewGenerator(cv::Mat *frameBuf, QAtomicInt *acqFrameNum, int bufSize, double maxFrameRate, QObject *parent = nullptr);
+
+    // Called from the GUI thread. Never block
+    void setTargetSize(int width, int height) { m_targetWidth.storeRelease(width); m_targetHeight.storeRelease(height); }
+    void setDFFEngine(DFFEngine *engine) { m_dffEngine = engine; }
+    void setTimingBuffer(FrameTiming *timingBuf) { timingBuffer = timingBuf; }
+    void setShowDFF(bool show) { m_showDFF.storeRelease(show ? 1 : 0); }
+    // Call before the thread starts. setFilterEnabled() can be called from any thread after that
+    void setFilterOptions(QJsonObject options) { m_filter.configure(options); }
+    void setFilterEnabled(bool enable) { m_filterEnabled.storeRelease(enable ? 1 : 0); }
+    bool hasFilter() const { return m_filter.isConfigured(); }
+    bool takeFrame() { return m_output.consume(); }
+    const cv::Mat &frame() const { return m_output.readBuffer(); }
+    FrameTiming frameTiming() const; // Time stamps of the acquired frame behind frame()
+    HistogramEngine &histogram() { return m_histogram; }
+
+public slots:
+    void startRunning();
+    void generate();
+
+private:
+    void publish(const cv::Mat &source, int bufferIndex);
+
+    cv::Mat *frameBuffer;
+    FrameTiming *timingBuffer;
+    QAtomicInt *m_acqFrameNum;
+    int bufferSize;
+    double m_maxFrameRate;
+    int m_lastFrameNum;
+
+    QTimer *m_timer;
+    QAtomicInt m_targetWidth;
+    QAtomicInt m_targetHeight;
+    QAtomicInt m_showDFF;
+    DFFEngine *m_dffEngine;
+    FrameTripleBuffer m_output;
+    HistogramEngine m_histogram; // Fed with raw frames at display rate
+    PreviewFilter m_filter; // Only for raw frames
+    QAtomicInt m_filterEnabled;
+};
+
+#endif // PREVIEWGENERATOR_H
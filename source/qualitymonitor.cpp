@@ -0,0 +1,185 @@
+#include "qualitymonitor.h"
+
+#include <QDebug>
+
+#include <opencv2/core/hal/intrin.hpp>
+
+#include <limits>
+
+QualityMonitor::QualityMonitor(QString deviceName, cv::Mat *frameBuf, qint64 *tsBuf, int bufSize, QAtomicInt *acqFrameNum, QJsonObject options, QObject *parent) :
+    QObject(parent),
+    m_deviceName(deviceName),
+    frameBuffer(frameBuf),
+    timeStampBuffer(tsBuf),
+    bufferSize(bufSize),
+    m_acqFrameNum(acqFrameNum),
+    m_lastFrameNum(0)
+{
+    QStringList keys = alarmKeys();
+    QJsonObject alarms = options["alarms"].toObject();
+    const float none = std::numeric_limits<float>::quiet_NaN();
+
+    for (int i = 0; i < keys.length(); i++) {
+        QJsonObject limits = alarms[keys[i]].toObject();
+        m_alarmMin.append(limits.contains("min") ? (float) limits["min"].toDouble() : none);
+        m_alarmMax.append(limits.contains("max") ? (float) limits["max"].toDouble() : none);
+        m_alarmActive.append(false);
+        m_alarmLastMessage.append(0);
+    }
+}
+
+void QualityMonitor::handleNewFrame()
+{
+    int f = m_acqFrameNum->loadAcquire();
+    int idx;
+    QVector<float> values;
+
+    // Lossy on purpose: only the newest frame gets measured
+    if (f <= m_lastFrameNum)
+        return;
+    m_lastFrameNum = f;
+    idx = (f - 1) % bufferSize;
+    if (frameBuffer[idx].empty() || frameBuffer[idx].type() != CV_8UC1)
+        return;
+
+    values = measure(frameBuffer[idx]);
+    frameBuffer[idx].copyTo(m_previous);
+    checkAlarms(values, timeStampBuffer[idx]);
+    metricsReady(m_deviceName, f, timeStampBuffer[idx], values);
+}
+
+QVector<float> QualityMonitor::measure(const cv::Mat &frame)
+{
+    const int w = frame.cols, h = frame.rows;
+    const bool hasPrevious = m_previous.size() == frame.size();
+    quint64 sum = 0, saturated = 0, diffSq = 0;
+    qint64 lapSum = 0, lapSq = 0, lapCount = 0;
+    int minValue = 255, maxValue = 0;
+    QVector<float> values;
+
+#if CV_SIMD
+    const int lanes = cv::v_uint8::nlanes;
+    const cv::v_uint8 vLevel = cv::vx_setall_u8(QUALITY_SATURATION_LEVEL);
+    const cv::v_uint8 vOne = cv::vx_setall_u8(1);
+    const cv::v_int16 vOnes16 = cv::vx_setall_s16(1);
+    cv::v_uint8 vMin = cv::vx_setall_u8(255), vMax = cv::vx_setzero_u8();
+    cv::v_uint16 c16[2], l16[2], r16[2], u16[2], d16[2], p16[2], s16[2];
+    cv::v_uint32 s32[2];
+    cv::v_int16 lap, diff;
+#endif
+
+    for (int y = 0; y < h; y++) {
+        const uchar *c = frame.ptr<uchar>(y);
+        const uchar *up = frame.ptr<uchar>(qMax(y - 1, 0));
+        const uchar *down = frame.ptr<uchar>(qMin(y + 1, h - 1));
+        const uchar *p = hasPrevious ? m_previous.ptr<uchar>(y) : nullptr;
+        const bool lapRow = y > 0 && y < h - 1;
+        int x = 0;
+
+        // One pixel: intensity, saturation, motion energy and, away from the border, the 4 neighbor Laplacian
+        auto pixel = [&](int i) {
+            sum += c[i];
+            minValue = qMin(minValue, (int) c[i]);
+            maxValue = qMax(maxValue, (int) c[i]);
+            saturated += c[i] >= QUALITY_SATURATION_LEVEL;
+            if (p) {
+                int d = c[i] - p[i];
+                diffSq += d * d;
+            }
+            if (lapRow && i > 0 && i < w - 1) {
+                int l = 4 * c[i] - c[i - 1] - c[i + 1] - up[i] - down[i];
+                lapSum += l;
+                lapSq += l * l;
+                lapCount++;
+            }
+        };
+
+        pixel(x++);
+#if CV_SIMD
+        cv::v_uint32 vSum = cv::vx_setzero_u32(), vSaturated = cv::vx_setzero_u32();
+        cv::v_int32 vLapSum = cv::vx_setzero_s32(), vLapSq = cv::vx_setzero_s32(), vDiffSq = cv::vx_setzero_s32();
+        const int start = x;
+        for (; x <= w - 1 - lanes; x += lanes) {
+            cv::v_uint8 vc = cv::vx_load(c + x);
+            vMin = cv::v_min(vMin, vc);
+            vMax = cv::v_max(vMax, vc);
+            cv::v_expand(vc, c16[0], c16[1]);
+            cv::v_expand(c16[0] + c16[1], s32[0], s32[1]);
+            vSum += s32[0] + s32[1];
+            cv::v_expand((vc >= vLevel) & vOne, s16[0], s16[1]);
+            cv::v_expand(s16[0] + s16[1], s32[0], s32[1]);
+            vSaturated += s32[0] + s32[1];
+
+            if (p) {
+                cv::v_expand(cv::vx_load(p + x), p16[0], p16[1]);
+                for (int half = 0; half < 2; half++) {
+                    diff = cv::v_reinterpret_as_s16(c16[half]) - cv::v_reinterpret_as_s16(p16[half]);
+                    vDiffSq += cv::v_dotprod(diff, diff);
+                }
+            }
+            if (lapRow) {
+                cv::v_expand(cv::vx_load(c + x - 1), l16[0], l16[1]);
+                cv::v_expand(cv::vx_load(c + x + 1), r16[0], r16[1]);
+                cv::v_expand(cv::vx_load(up + x), u16[0], u16[1]);
+                cv::v_expand(cv::vx_load(down + x), d16[0], d16[1]);
+                for (int half = 0; half < 2; half++) {
+                    lap = cv::v_reinterpret_as_s16(cv::v_shl<2>(c16[half]))
+                            - cv::v_reinterpret_as_s16(l16[half]) - cv::v_reinterpret_as_s16(r16[half])
+                            - cv::v_reinterpret_as_s16(u16[half]) - cv::v_reinterpret_as_s16(d16[half]);
+                    vLapSum += cv::v_dotprod(lap, vOnes16);
+                    vLapSq += cv::v_dotprod(lap, lap);
+                }
+            }
+        }
+        // 32 bit lanes only hold a row's worth of sums, so they get folded in every row
+        sum += cv::v_reduce_sum(vSum);
+        saturated += cv::v_reduce_sum(vSaturated);
+        diffSq += (quint64) cv::v_reduce_sum(vDiffSq);
+        lapSum += cv::v_reduce_sum(vLapSum);
+        lapSq += cv::v_reduce_sum(vLapSq);
+        if (lapRow)
+            lapCount += x - start;
+#endif
+        for (; x < w; x++)
+            pixel(x);
+    }
+
+#if CV_SIMD
+    uchar minLanes[cv::v_uint8::nlanes], maxLanes[cv::v_uint8::nlanes];
+    cv::v_store(minLanes, vMin);
+    cv::v_store(maxLanes, vMax);
+    for (int i = 0; i < lanes; i++) {
+        minValue = qMin(minValue, (int) minLanes[i]);
+        maxValue = qMax(maxValue, (int) maxLanes[i]);
+    }
+#endif
+
+    const double pixels = (double) w * h;
+    const double lapMean = lapCount > 0 ? (double) lapSum / lapCount : 0;
+    values.append(sum / pixels);
+    values.append(minValue);
+    values.append(maxValue);
+    values.append(saturated / pixels);
+    values.append(lapCount > 0 ? (double) lapSq / lapCount - lapMean * lapMean : 0);
+    values.append(hasPrevious ? diffSq / pixels : 0);
+    return values;
+}
+
+void QualityMonitor::checkAlarms(const QVector<float> &values, qint64 timeStamp)
+{
+    QStringList names = columns();
+    bool active;
+
+    for (int i = 0; i < values.size(); i++) {
+        // Comparisons with NaN are false, so metrics without limits never alarm
+        active = values[i] < m_alarmMin[i] || values[i] > m_alarmMax[i];
+        if (active != m_alarmActive[i]) {
+            m_alarmActive[i] = active;
+            alarmChanged(m_deviceName, i, active);
+        }
+        if (active && timeStamp - m_alarmLastMessage[i] > QUALITY_ALARM_HOLD_OFF_MS) {
+            m_alarmLastMessage[i] = timeStamp;
+            sendMessage("Warning: " + m_deviceName + " " + names[i] + " is " + QString::number(values[i], 'g', 4) + ".");
+        }
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef QUALITYMONITOR_H
+#define QUALITYMONITOR_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QJsonObject>
+#include <QStringList>
+#include <QVector>
+
+#include <opencv2/core/core.hpp>
+
+#define QUALITY_SATURATION_LEVEL    255
+#define QUALITY_ALARM_HOLD_OFF_MS   10000 // Repeated alarm messages of one metric are at least this far apart
+
+// Per frame image quality metrics of a Miniscope stream ("qualityMetrics" in the user config):
+// mean, min and max intensity, fraction of saturated pixels, variance of the Laplacian as a focus measure
+// and the mean squared difference to the previous measured frame as motion energy.
+// Everything comes out of a single vectorized pass over the frame. Runs on its own thread and always takes
+// the newest acquired frame, so it never holds up acquisition or recording and skips frames when it falls behind.
+class QualityMonitor : public QObject
+{
+    Q_OBJECT
+public:
+    QualityMonitor(QString deviceName, cv::Mat *frameBuf, qint64 *tsBuf, int bufSize, QAtomicInt *acqFrameNum, QJsonObject options, QObject *parent = nullptr);
+
+    static QStringList columns() { return {"Mean", "Min", "Max", "Saturated Fraction", "Focus", "Motion Energy"}; }
+    static QStringList alarmKeys() { return {"mean", "min", "max", "saturatedFraction", "focus", "motionEnergy"}; } // Same order as columns()
+
+signals:
+    void sendMessage(QString msg);
+    void metricsReady(QString deviceName, int frameNum, qint64 timeStamp, QVector<float> values);
+    void alarmChanged(QString deviceName, int metric, bool active);
+
+public slots:
+    void handleNewFrame();
+
+private:
+    QVector<float> measure(const cv::Mat &frame);
+    void checkAlarms(const QVector<float> &values, qint64 timeStamp);
+
+    QString m_deviceName;
+    cv::Mat *frameBuffer;
+    qint64 *timeStampBuffer;
+    int bufferSize;
+    QAtomicInt *m_acqFrameNum;
+    int m_lastFrameNum;
+    cv::Mat m_previous;
+
+    // Alarm limits per metric. NaN means no limit
+    QVector<float> m_alarmMin;
+    QVector<float> m_alarmMax;
+    QVector<bool> m_alarmActive;
+    QVector<qint64> m_alarmLastMessage;
+};
+
+#endif // QUALITYMONITOR_H
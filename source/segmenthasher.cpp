@@ -0,0 +1,111 @@
+#include "segmenthasher.h"
+#include "sessionmigrator.h"
+#include "xxhash64.h"
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+SegmentHasher::SegmentHasher(QObject *parent) :
+    QObject(parent)
+{
+
+}
+
+bool SegmentHasher::hashFile(QString path, QString &hash, qint64 &bytes)
+{
+    QFile file(path);
+    XXHash64 hasher;
+    QByteArray chunk;
+
+    bytes = 0;
+    if (!file.open(QFile::ReadOnly))
+        return false;
+    while (!file.atEnd()) {
+        chunk = file.read(HASH_CHUNK_SIZE);
+        if (chunk.isEmpty())
+            return false;
+        hasher.update(chunk.constData(), chunk.size());
+        bytes += chunk.size();
+    }
+    hash = hasher.hexDigest();
+    return true;
+}
+
+void SegmentHasher::handleFileCompleted(QString sessionDirectory, QString destinationDirectory, QString filePath, qint64 firstFrame, qint64 numFrames)
+{
+    addEntry(sessionDirectory, filePath, firstFrame, numFrames);
+    if (!destinationDirectory.isEmpty())
+        emit fileHashed(sessionDirectory, destinationDirectory, filePath);
+}
+
+void SegmentHasher::handleRecordingCompleted(QString sessionDirectory, QString destinationDirectory)
+{
+    // Everything not hashed yet: time stamps, meta data, notes, screenshots, ...
+    QDirIterator it(sessionDirectory, QDir::Files, QDirIterator::Subdirectories);
+    QString path, fileName;
+    while (it.hasNext()) {
+        path = it.next();
+        fileName = QFileInfo(path).fileName();
+        if (fileName == MANIFEST_FILE_NAME || fileName == MIGRATION_TARGET_FILE_NAME)
+            continue;
+        if (!m_hashedPaths[sessionDirectory].contains(path))
+            addEntry(sessionDirectory, path, -1, 0);
+    }
+    saveManifest(sessionDirectory);
+
+    m_entries.remove(sessionDirectory);
+    m_hashedPaths.remove(sessionDirectory);
+    if (!destinationDirectory.isEmpty())
+        emit sessionHashed(sessionDirectory, destinationDirectory);
+}
+
+void SegmentHasher::addEntry(QString sessionDirectory, QString filePath, qint64 firstFrame, qint64 numFrames)
+{
+    ManifestEntry entry;
+    entry.path = QDir(sessionDirectory).relativeFilePath(filePath);
+    entry.firstFrame = firstFrame;
+    entry.numFrames = numFrames;
+    if (!hashFile(filePath, entry.hash, entry.bytes)) {
+        sendMessage("Warning: Could not hash " + filePath + ". It will be missing from the session manifest.");
+        return;
+    }
+    m_entries[sessionDirectory].append(entry);
+    m_hashedPaths[sessionDirectory].insert(filePath);
+}
+
+void SegmentHasher::saveManifest(QString sessionDirectory)
+{
+    QJsonObject manifest;
+    QJsonArray files;
+    QJsonObject file;
+    const QVector<ManifestEntry> &entries = m_entries[sessionDirectory];
+
+    manifest["hashAlgorithm"] = "xxh64";
+    manifest["created"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+    for (int i = 0; i < entries.length(); i++) {
+        file = QJsonObject();
+        file["path"] = entries[i].path;
+        file["bytes"] = entries[i].bytes;
+        file["hash"] = entries[i].hash;
+        if (entries[i].firstFrame >= 0) {
+            file["firstFrame"] = entries[i].firstFrame;
+            file["numFrames"] = entries[i].numFrames;
+        }
+        files.append(file);
+    }
+    manifest["files"] = files;
+
+    QFile manifestFile(sessionDirectory + "/" + MANIFEST_FILE_NAME);
+    if (!manifestFile.open(QFile::WriteOnly | QFile::Truncate)) {
+        sendMessage("Warning: Could not save " + manifestFile.fileName());
+        return;
+    }
+    manifestFile.write(QJsonDocument(manifest).toJson());
+    sendMessage("Session manifest saved with " + QString::number(entries.length()) + " files.");
+}
@@ -0,0 +1,50 @@
+#ifndef SEGMENTHASHER_H
+#define SEGMENTHASHER_H
+
+#include <QObject>
+#include <QString>
+#include <QMap>
+#include <QSet>
+#include <QVector>
+
+#define MANIFEST_FILE_NAME      "manifest.json"
+#define HASH_CHUNK_SIZE         (4 * 1024 * 1024)
+
+struct ManifestEntry {
+    QString path; // relative to the session directory
+    qint64 bytes;
+    QString hash;
+    qint64 firstFrame; // -1 for files that are not video segments
+    qint64 numFrames;
+};
+
+// Hashes every file of a recording with xxHash64 on its own thread and writes manifest.json when recording stops.
+// Video segments are hashed right after DataSaver closes them, while their bytes are still in the OS page cache,
+// so the hash does not cost another trip to the disk and never touches the writer loop.
+// Sits in front of SessionMigrator so files only get moved once their hash is known.
+class SegmentHasher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SegmentHasher(QObject *parent = nullptr);
+
+    static bool hashFile(QString path, QString &hash, qint64 &bytes);
+
+signals:
+    void sendMessage(QString msg);
+    void fileHashed(QString sessionDirectory, QString destinationDirectory, QString filePath);
+    void sessionHashed(QString sessionDirectory, QString destinationDirectory);
+
+public slots:
+    void handleFileCompleted(QString sessionDirectory, QString destinationDirectory, QString filePath, qint64 firstFrame, qint64 numFrames);
+    void handleRecordingCompleted(QString sessionDirectory, QString destinationDirectory);
+
+private:
+    void addEntry(QString sessionDirectory, QString filePath, qint64 firstFrame, qint64 numFrames);
+    void saveManifest(QString sessionDirectory);
+
+    QMap<QString, QVector<ManifestEntry>> m_entries;
+    QMap<QString, QSet<QString>> m_hashedPaths;
+};
+
+#endif // SEGMENTHASHER_H
@@ -0,0 +1,302 @@
+#include "sessionmigrator.h"
+#include "xxhash64.h"
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QThread>
+#include <QTimer>
+#include <QDebug>
+
+#include <algorithm>
+
+SessionMigrator::SessionMigrator(QString scratchDirectory, double bandwidthMBps, QObject *parent) :
+    QObject(parent),
+    m_scratchDirectory(scratchDirectory),
+    m_bandwidthMBps(bandwidthMBps),
+    m_processingScheduled(false),
+    m_closing(false)
+{
+
+}
+
+void SessionMigrator::startRunning()
+{
+    resumeSessions();
+}
+
+void SessionMigrator::resumeSessions()
+{
+    // Sessions still on scratch from a previous run
+    QDirIterator it(m_scratchDirectory, QStringList(MIGRATION_TARGET_FILE_NAME), QDir::Files, QDirIterator::Subdirectories);
+    QFile file;
+    QString sessionDirectory, destination;
+
+    while (it.hasNext()) {
+        file.setFileName(it.next());
+        if (!file.open(QFile::ReadOnly))
+            continue;
+        destination = QJsonDocument::fromJson(file.readAll()).object()["destination"].toString();
+        file.close();
+        sessionDirectory = QFileInfo(file.fileName()).absolutePath();
+        if (destination.isEmpty()) {
+            sendMessage("Warning: " + file.fileName() + " has no destination. Session will not be migrated.");
+            continue;
+        }
+        sendMessage("Resuming migration of " + sessionDirectory + " to " + destination);
+        finishSession(sessionDirectory, destination);
+    }
+}
+
+SessionMigrator::SessionState &SessionMigrator::sessionState(QString sourceSessionDirectory, QString destinationSessionDirectory)
+{
+    if (!m_sessions.contains(sourceSessionDirectory)) {
+        SessionState state;
+        state.destination = destinationSessionDirectory;
+        state.recordingFinished = false;
+        state.pendingFiles = 0;
+        state.migratedFiles = 0;
+        state.migratedBytes = 0;
+        state.startTime = QDateTime::currentMSecsSinceEpoch();
+        m_sessions[sourceSessionDirectory] = state;
+        writeStatus(sourceSessionDirectory, false);
+    }
+    return m_sessions[sourceSessionDirectory];
+}
+
+void SessionMigrator::migrateFile(QString sourceSessionDirectory, QString destinationSessionDirectory, QString sourcePath)
+{
+    sessionState(sourceSessionDirectory, destinationSessionDirectory);
+    queueFile(sourceSessionDirectory, sourcePath);
+    scheduleProcessing(0);
+}
+
+void SessionMigrator::finishSession(QString sourceSessionDirectory, QString destinationSessionDirectory)
+{
+    // Recording is done so everything left in the session folder can be moved
+    SessionState &state = sessionState(sourceSessionDirectory, destinationSessionDirectory);
+    state.recordingFinished = true;
+    queueRemainingFiles(sourceSessionDirectory);
+    if (state.pendingFiles == 0)
+        completeSession(sourceSessionDirectory);
+    else
+        scheduleProcessing(0);
+}
+
+void SessionMigrator::queueFile(QString sourceSessionDirectory, QString sourcePath)
+{
+    if (m_queuedPaths.contains(sourcePath))
+        return;
+    QueuedFile file;
+    file.sessionDirectory = sourceSessionDirectory;
+    file.sourcePath = sourcePath;
+    m_queue.enqueue(file);
+    m_queuedPaths.insert(sourcePath);
+    m_sessions[sourceSessionDirectory].pendingFiles++;
+}
+
+void SessionMigrator::queueRemainingFiles(QString sourceSessionDirectory)
+{
+    QDirIterator it(sourceSessionDirectory, QDir::Files, QDirIterator::Subdirectories);
+    QString path;
+    while (it.hasNext()) {
+        path = it.next();
+        if (QFileInfo(path).fileName() == MIGRATION_TARGET_FILE_NAME)
+            continue; // Removed once everything else has been moved
+        queueFile(sourceSessionDirectory, path);
+    }
+}
+
+void SessionMigrator::scheduleProcessing(int delayMs)
+{
+    if (m_processingScheduled || m_closing)
+        return;
+    m_processingScheduled = true;
+    QTimer::singleShot(delayMs, this, &SessionMigrator::processQueue);
+}
+
+void SessionMigrator::processQueue()
+{
+    // Moves one file per call so newly completed files and close requests get handled in between
+    m_processingScheduled = false;
+    if (m_closing || m_queue.isEmpty())
+        return;
+
+    QueuedFile file = m_queue.head();
+    SessionState &state = m_sessions[file.sessionDirectory];
+    QString destinationPath = state.destination + "/" + QDir(file.sessionDirectory).relativeFilePath(file.sourcePath);
+    qint64 size = QFileInfo(file.sourcePath).size();
+
+    if (QFile::exists(file.sourcePath)) {
+        if (!copyAndVerify(file.sourcePath, destinationPath)) {
+            sendMessage("Warning: Could not move " + file.sourcePath + " to " + destinationPath +
+                        ". Retrying in " + QString::number(MIGRATION_RETRY_DELAY_MS / 1000) + "s.");
+            scheduleProcessing(MIGRATION_RETRY_DELAY_MS);
+            return;
+        }
+        if (!QFile::remove(file.sourcePath))
+            qDebug() << "Could not remove migrated file" << file.sourcePath;
+        state.migratedFiles++;
+        state.migratedBytes += size;
+    }
+
+    m_queue.dequeue();
+    m_queuedPaths.remove(file.sourcePath);
+    state.pendingFiles--;
+    if (state.recordingFinished && state.pendingFiles == 0)
+        completeSession(file.sessionDirectory);
+
+    scheduleProcessing(0);
+}
+
+bool SessionMigrator::copyAndVerify(QString sourcePath, QString destinationPath)
+{
+    QFile source(sourcePath);
+    QFile part(destinationPath + ".part");
+    QElapsedTimer timer;
+    XXHash64 hasher;
+    QByteArray chunk;
+    qint64 position = 0;
+    qint64 resumeFrom, skip, written = 0;
+    quint64 sourceHash, copyHash;
+    bool ok;
+
+    QDir().mkpath(QFileInfo(destinationPath).absolutePath());
+
+    // A previous run may have renamed the copy but not deleted the source
+    if (QFile::exists(destinationPath)) {
+        if (QFileInfo(destinationPath).size() == QFileInfo(sourcePath).size()) {
+            sourceHash = hashFile(sourcePath, &ok);
+            if (ok && hashFile(destinationPath, &ok) == sourceHash && ok)
+                return true;
+        }
+        QFile::remove(destinationPath);
+    }
+
+    if (!source.open(QFile::ReadOnly) || !part.open(QFile::ReadWrite))
+        return false;
+
+    // Continue a partial copy. Its content gets checked by the verification below
+    resumeFrom = part.size();
+    if (resumeFrom > source.size()) {
+        part.resize(0);
+        resumeFrom = 0;
+    }
+    if (resumeFrom > 0)
+        qDebug() << "Resuming copy of" << sourcePath << "at" << resumeFrom << "bytes";
+    part.seek(resumeFrom);
+
+    timer.start();
+    while (!source.atEnd()) {
+        chunk = source.read(MIGRATION_CHUNK_SIZE);
+        if (chunk.isEmpty())
+            return false;
+        hasher.update(chunk.constData(), chunk.size());
+        if (position + chunk.size() > resumeFrom) {
+            skip = qMax((qint64) 0, resumeFrom - position);
+            if (part.write(chunk.constData() + skip, chunk.size() - skip) != chunk.size() - skip)
+                return false;
+            written += chunk.size() - skip;
+            throttle(written, timer.elapsed());
+        }
+        position += chunk.size();
+    }
+    sourceHash = hasher.digest();
+    if (!part.flush())
+        return false;
+    part.close();
+    source.close();
+
+    // Read the copy back from the destination to make sure it arrived intact
+    copyHash = hashFile(part.fileName(), &ok);
+    if (!ok || copyHash != sourceHash || QFileInfo(part.fileName()).size() != position) {
+        sendMessage("Warning: Verification of " + destinationPath + " failed. It will be copied again.");
+        QFile::remove(part.fileName());
+        return false;
+    }
+    return QFile::rename(part.fileName(), destinationPath);
+}
+
+quint64 SessionMigrator::hashFile(QString path, bool *ok)
+{
+    QFile file(path);
+    XXHash64 hasher;
+    QByteArray chunk;
+
+    *ok = file.open(QFile::ReadOnly);
+    if (!*ok)
+        return 0;
+    while (!file.atEnd()) {
+        chunk = file.read(MIGRATION_CHUNK_SIZE);
+        if (chunk.isEmpty()) {
+            *ok = false;
+            return 0;
+        }
+        hasher.update(chunk.constData(), chunk.size());
+    }
+    return hasher.digest();
+}
+
+void SessionMigrator::throttle(qint64 bytes, qint64 elapsedMs)
+{
+    if (m_bandwidthMBps <= 0)
+        return;
+    qint64 targetMs = (qint64) (bytes / (m_bandwidthMBps * 1000.0));
+    if (targetMs > elapsedMs)
+        QThread::msleep(targetMs - elapsedMs);
+}
+
+void SessionMigrator::completeSession(QString sourceSessionDirectory)
+{
+    SessionState state = m_sessions[sourceSessionDirectory];
+    QStringList directories;
+
+    writeStatus(sourceSessionDirectory, true);
+
+    // Clean up scratch. Only empty folders get removed
+    QFile::remove(sourceSessionDirectory + "/" + MIGRATION_TARGET_FILE_NAME);
+    QDirIterator it(sourceSessionDirectory, QDir::Dirs | QDir::NoDotAndDotDot, QDirIterator::Subdirectories);
+    while (it.hasNext())
+        directories.append(it.next());
+    std::sort(directories.begin(), directories.end(), [](const QString &a, const QString &b) { return a.length() > b.length(); });
+    for (int i = 0; i < directories.length(); i++)
+        QDir().rmdir(directories[i]);
+    QDir().rmdir(sourceSessionDirectory);
+
+    sendMessage("Session moved to " + state.destination + " (" + QString::number(state.migratedFiles) + " files, " +
+                QString::number(state.migratedBytes / 1e6, 'f', 1) + " MB).");
+    m_sessions.remove(sourceSessionDirectory);
+    emit sessionMigrated(state.destination);
+}
+
+void SessionMigrator::writeStatus(QString sourceSessionDirectory, bool complete)
+{
+    // Tells anyone reading the final directory whether all files have arrived yet
+    const SessionState &state = m_sessions[sourceSessionDirectory];
+    QJsonObject status;
+    status["complete"] = complete;
+    status["source"] = sourceSessionDirectory;
+    status["files"] = state.migratedFiles;
+    status["bytes"] = state.migratedBytes;
+    status["seconds"] = (QDateTime::currentMSecsSinceEpoch() - state.startTime) / 1000.0;
+
+    QDir().mkpath(state.destination);
+    QFile file(state.destination + "/" + MIGRATION_STATUS_FILE_NAME);
+    if (!file.open(QFile::WriteOnly | QFile::Truncate)) {
+        qDebug() << "Could not write" << file.fileName();
+        return;
+    }
+    file.write(QJsonDocument(status).toJson());
+}
+
+void SessionMigrator::close()
+{
+    m_closing = true;
+    if (!m_queue.isEmpty())
+        qDebug() << m_queue.length() << "files not yet migrated. Migration resumes on next start.";
+}
@@ -0,0 +1,70 @@
+#ifndef SESSIONMIGRATOR_H
+#define SESSIONMIGRATOR_H
+
+#include <QObject>
+#include <QString>
+#include <QMap>
+#include <QSet>
+#include <QQueue>
+
+#include "migrationfiles.h"
+
+#define MIGRATION_CHUNK_SIZE        (4 * 1024 * 1024)
+#define MIGRATION_RETRY_DELAY_MS    10000
+
+// Moves recorded files from the local scratch directory to the final data directory in the background.
+// Files get copied to "<name>.part" (resumed if a partial copy already exists), verified by hashing both copies,
+// renamed and then deleted from scratch. A session is marked complete in migration.json once all of its files are moved.
+// Sessions left on scratch (e.g. after a crash) are picked up again on start through their migrationTarget.json.
+class SessionMigrator : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SessionMigrator(QString scratchDirectory, double bandwidthMBps, QObject *parent = nullptr);
+
+signals:
+    void sendMessage(QString msg);
+    void sessionMigrated(QString destinationDirectory);
+
+public slots:
+    void startRunning();
+    void migrateFile(QString sourceSessionDirectory, QString destinationSessionDirectory, QString sourcePath);
+    void finishSession(QString sourceSessionDirectory, QString destinationSessionDirectory);
+    void processQueue();
+    void close();
+
+private:
+    struct SessionState {
+        QString destination;
+        bool recordingFinished;
+        int pendingFiles;
+        int migratedFiles;
+        qint64 migratedBytes;
+        qint64 startTime;
+    };
+    struct QueuedFile {
+        QString sessionDirectory;
+        QString sourcePath;
+    };
+
+    void resumeSessions();
+    SessionState &sessionState(QString sourceSessionDirectory, QString destinationSessionDirectory);
+    void queueFile(QString sourceSessionDirectory, QString sourcePath);
+    void queueRemainingFiles(QString sourceSessionDirectory);
+    bool copyAndVerify(QString sourcePath, QString destinationPath);
+    quint64 hashFile(QString path, bool *ok);
+    void throttle(qint64 bytes, qint64 elapsedMs);
+    void completeSession(QString sourceSessionDirectory);
+    void writeStatus(QString sourceSessionDirectory, bool complete);
+    void scheduleProcessing(int delayMs);
+
+    QString m_scratchDirectory;
+    double m_bandwidthMBps; // 0 means unlimited
+    QMap<QString, SessionState> m_sessions;
+    QQueue<QueuedFile> m_queue;
+    QSet<QString> m_queuedPaths;
+    bool m_processingScheduled;
+    bool m_closing;
+};
+
+#endif // SESSIONMIGRATOR_H
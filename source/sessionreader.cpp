@@ -0,0 +1,754 @@
+#include "sessionreader.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDataStream>
+#include <QRegularExpression>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutexLocker>
+#include <QThread>
+#include <QtConcurrent>
+#include <QDebug>
+
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/imgproc.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#define FRAME_INDEX_MAGIC       0x4D534958 // "MSIX"
+#define MAX_OPEN_SEGMENTS       4
+#define MIN_DECODE_CHUNK        16
+#define AVIIF_KEYFRAME          0x10
+#define AVI_HEADER_SCAN_BYTES   65536 // hdrl, with the stream format, is at the start of the file
+
+static const qint64 NO_TIME_STAMP = std::numeric_limits<qint64>::min();
+
+static inline quint32 readLE32(const char *p)
+{
+    const unsigned char *u = reinterpret_cast<const unsigned char*>(p);
+    return (quint32)u[0] | ((quint32)u[1] << 8) | ((quint32)u[2] << 16) | ((quint32)u[3] << 24);
+}
+
+static inline bool isVideoChunk(const char *id)
+{
+    // DataSaver writes a single video stream so only stream 00 is of interest
+    return id[0] == '0' && id[1] == '0' && id[2] == 'd' && (id[3] == 'c' || id[3] == 'b');
+}
+
+FrameStreamReader::FrameStreamReader(QString videoDirectory, QString timeStampFile) :
+    m_videoDirectory(videoDirectory),
+    m_timeStampFile(timeStampFile),
+    m_timedFrameCount(0),
+    m_indexLoaded(false),
+    m_csvSize(0),
+    m_csvModified(0),
+    m_cacheSize(256)
+{
+
+}
+
+FrameStreamReader::~FrameStreamReader()
+{
+    qDeleteAll(m_openSegments);
+}
+
+bool FrameStreamReader::open(bool forceRebuild)
+{
+    m_indexLoaded = false;
+    if (!forceRebuild && loadIndex()) {
+        m_indexLoaded = true;
+        readSegmentFormats();
+        return true;
+    }
+    if (!buildIndex())
+        return false;
+    saveIndex();
+    readSegmentFormats();
+    return true;
+}
+
+void FrameStreamReader::readSegmentFormats()
+{
+    m_formats.resize(m_segments.length());
+    for (int i = 0; i < m_segments.length(); i++) {
+        if (!readSegmentFormat(segmentPath(i), m_formats[i]))
+            m_formats[i].format = ChunkUnknown;
+    }
+}
+
+bool FrameStreamReader::readSegmentFormat(const QString &path, SegmentFormat &format) const
+{
+    // The video stream's strf chunk is a BITMAPINFOHEADER: size, width, height, planes, bit count, compression, ...
+    QFile file(path);
+    QByteArray header;
+    QByteArray compression;
+    const char *p;
+    int pos = 0;
+    int bitCount;
+
+    if (!file.open(QFile::ReadOnly))
+        return false;
+    header = file.read(AVI_HEADER_SCAN_BYTES);
+    if (header.size() < 12 || !header.startsWith("RIFF") || header.mid(8, 4) != "AVI ")
+        return false;
+    while ((pos = header.indexOf("strh", pos)) >= 0 && header.mid(pos + 8, 4) != "vids")
+        pos += 4;
+    if (pos < 0 || (pos = header.indexOf("strf", pos)) < 0 || pos + 8 + 20 > header.size())
+        return false;
+
+    p = header.constData() + pos + 8;
+    format.width = (qint32) readLE32(p + 4);
+    format.height = qAbs((qint32) readLE32(p + 8));
+    bitCount = (unsigned char) p[14] | ((unsigned char) p[15] << 8);
+    compression = QByteArray(p + 16, 4);
+    format.bottomUp = false;
+    if (format.width <= 0 || format.height <= 0)
+        return false;
+
+    if (compression == "MJPG") {
+        format.format = ChunkMJPG;
+        format.stride = 0;
+    }
+    else if ((compression == "Y800" || compression == "GREY" || compression == "Y8  ") && bitCount == 8) {
+        format.format = ChunkGray;
+        format.stride = format.width;
+    }
+    else if (readLE32(p + 16) == 0 && bitCount == 24) {
+        // Uncompressed DIB. Rows are padded to 4 bytes and stored bottom up unless the height is negative
+        format.format = ChunkBGR;
+        format.stride = (format.width * 3 + 3) & ~3;
+        format.bottomUp = (qint32) readLE32(p + 8) > 0;
+    }
+    else
+        return false;
+    return true;
+}
+
+bool FrameStreamReader::decodeIndexed(QFile &file, int frame, cv::Mat &image) const
+{
+    const FrameIndexEntry &entry = m_frames[frame];
+    const SegmentFormat &format = m_formats[entry.segment];
+    char header[8];
+    QByteArray data;
+
+    if (format.format == ChunkUnknown || entry.byteOffset < 0)
+        return false;
+    if (!file.seek(entry.byteOffset) || file.read(header, 8) != 8)
+        return false;
+    data = file.read(readLE32(header + 4));
+    if (data.isEmpty())
+        return false; // Dropped frame chunk. The decoder repeats the frame before it
+
+    if (format.format == ChunkMJPG) {
+        image = cv::imdecode(cv::Mat(1, data.size(), CV_8UC1, data.data()), cv::IMREAD_COLOR);
+        return !image.empty();
+    }
+    if (data.size() < format.stride * format.height)
+        return false;
+    cv::Mat stored(format.height, format.width, format.format == ChunkGray ? CV_8UC1 : CV_8UC3, data.data(), format.stride);
+    if (format.format == ChunkGray)
+        cv::cvtColor(stored, image, cv::COLOR_GRAY2BGR);
+    else if (format.bottomUp)
+        cv::flip(stored, image, 0);
+    else
+        image = stored.clone();
+    return true;
+}
+
+qint64 FrameStreamReader::duration() const
+{
+    if (m_timedFrameCount < 2)
+        return 0;
+    return m_frames[m_timedFrameCount - 1].timeStamp - m_frames[0].timeStamp;
+}
+
+int FrameStreamReader::frameAtTime(qint64 timeStamp) const
+{
+    auto first = m_frames.constBegin();
+    auto last = first + m_timedFrameCount;
+    auto it = std::lower_bound(first, last, timeStamp,
+                               [](const FrameIndexEntry &entry, qint64 t) { return entry.timeStamp < t; });
+    if (it == last)
+        return m_frames.length();
+    return (int)(it - first);
+}
+
+QVector<SegmentIndexEntry> FrameStreamReader::listSegments() const
+{
+    // Segments are named 0.avi, 1.avi, ... Transcoded sessions can use another container
+    QVector<SegmentIndexEntry> segments;
+    QMap<int, QFileInfo> numbered;
+    QRegularExpression segmentName("^(\\d+)\\.(avi|mkv)$", QRegularExpression::CaseInsensitiveOption);
+    QRegularExpressionMatch match;
+
+    QFileInfoList files = QDir(m_videoDirectory).entryInfoList(QDir::Files);
+    for (int i = 0; i < files.length(); i++) {
+        match = segmentName.match(files[i].fileName());
+        if (match.hasMatch())
+            numbered[match.captured(1).toInt()] = files[i];
+    }
+
+    QList<int> keys = numbered.keys();
+    for (int i = 0; i < keys.length(); i++) {
+        if (keys[i] != i)
+            break; // Missing segment. Frames after it can't be numbered correctly
+        SegmentIndexEntry segment;
+        segment.fileName = numbered[keys[i]].fileName();
+        segment.size = numbered[keys[i]].size();
+        segment.lastModified = numbered[keys[i]].lastModified().toMSecsSinceEpoch();
+        segment.firstFrame = 0;
+        segment.frameCount = 0;
+        segments.append(segment);
+    }
+    return segments;
+}
+
+bool FrameStreamReader::buildIndex()
+{
+    QVector<qint64> offsets, timeStamps, rowOffsets;
+    QVector<bool> keyFrames;
+    cv::VideoCapture capture;
+    int frameCount, lastKey;
+    QString path;
+    FrameIndexEntry entry;
+    QFileInfo csvInfo(m_timeStampFile);
+
+    m_segments = listSegments();
+    m_frames.clear();
+    if (m_segments.isEmpty()) {
+        m_error = "No video segments in " + m_videoDirectory;
+        return false;
+    }
+
+    for (int seg = 0; seg < m_segments.length(); seg++) {
+        path = m_videoDirectory + "/" + m_segments[seg].fileName;
+        offsets.clear();
+        keyFrames.clear();
+        if (scanAVI(path, offsets, keyFrames)) {
+            frameCount = offsets.length();
+        }
+        else {
+            // Not an AVI we can walk. Let the decoder count frames and rely on it to seek
+            capture.open(path.toUtf8().constData());
+            frameCount = capture.isOpened() ? (int) capture.get(cv::CAP_PROP_FRAME_COUNT) : 0;
+            capture.release();
+        }
+
+        m_segments[seg].firstFrame = m_frames.length();
+        m_segments[seg].frameCount = frameCount;
+        lastKey = 0;
+        for (int i = 0; i < frameCount; i++) {
+            entry.segment = seg;
+            entry.frameInSegment = i;
+            if (offsets.isEmpty()) {
+                entry.byteOffset = -1;
+                entry.keyFrame = i;
+            }
+            else {
+                entry.byteOffset = offsets[i];
+                if (keyFrames[i])
+                    lastKey = i;
+                entry.keyFrame = lastKey;
+            }
+            entry.timeStamp = NO_TIME_STAMP;
+            entry.csvOffset = -1;
+            m_frames.append(entry);
+        }
+    }
+
+    readTimeStamps(timeStamps, rowOffsets);
+    m_timedFrameCount = 0;
+    for (int i = 0; i < m_frames.length() && i < timeStamps.length(); i++) {
+        m_frames[i].timeStamp = timeStamps[i];
+        m_frames[i].csvOffset = rowOffsets[i];
+        if (timeStamps[i] != NO_TIME_STAMP && m_timedFrameCount == i)
+            m_timedFrameCount++;
+    }
+    if (timeStamps.length() != m_frames.length())
+        qDebug() << m_videoDirectory << "has" << m_frames.length() << "frames but" << timeStamps.length() << "time stamps";
+
+    m_csvSize = csvInfo.exists() ? csvInfo.size() : 0;
+    m_csvModified = csvInfo.exists() ? csvInfo.lastModified().toMSecsSinceEpoch() : 0;
+    return true;
+}
+
+static void walkAVIChunks(QFile &file, qint64 pos, qint64 end, bool inMovi, QVector<qint64> &offsets, QVector<bool> &indexKeyFrames)
+{
+    char header[12];
+    qint64 chunkSize;
+    bool isList;
+
+    while (pos + 8 <= end) {
+        if (!file.seek(pos) || file.read(header, 8) != 8)
+            return;
+        isList = memcmp(header, "RIFF", 4) == 0 || memcmp(header, "LIST", 4) == 0;
+        chunkSize = readLE32(header + 4);
+        if (chunkSize == 0 && isList)
+            chunkSize = end - pos - 8; // Size never got written, e.g. recording was interrupted
+        chunkSize = qMin(chunkSize, end - pos - 8);
+
+        if (isList) {
+            if (file.read(header + 8, 4) != 4)
+                return;
+            if (inMovi || memcmp(header + 8, "movi", 4) == 0)
+                walkAVIChunks(file, pos + 12, pos + 8 + chunkSize, true, offsets, indexKeyFrames);
+            else if (memcmp(header + 8, "AVI", 3) == 0) // "AVI " and OpenDML "AVIX" extensions
+                walkAVIChunks(file, pos + 12, pos + 8 + chunkSize, false, offsets, indexKeyFrames);
+        }
+        else if (inMovi && isVideoChunk(header)) {
+            offsets.append(pos);
+        }
+        else if (!inMovi && memcmp(header, "idx1", 4) == 0) {
+            QByteArray index = file.read(chunkSize);
+            for (int i = 0; i + 16 <= index.size(); i += 16) {
+                if (isVideoChunk(index.constData() + i))
+                    indexKeyFrames.append(readLE32(index.constData() + i + 4) & AVIIF_KEYFRAME);
+            }
+        }
+        pos += 8 + chunkSize + (chunkSize & 1);
+    }
+}
+
+bool FrameStreamReader::scanAVI(const QString &path, QVector<qint64> &offsets, QVector<bool> &keyFrames) const
+{
+    // Walks the RIFF chunk headers to find the offset of every video chunk without reading frame data.
+    // Key frame flags come from the idx1 index when there is one. Without it every frame is treated as a key frame,
+    // which holds for the intra-only codecs used for recording.
+    QFile file(path);
+    char header[12];
+    QVector<bool> indexKeyFrames;
+
+    if (!file.open(QFile::ReadOnly))
+        return false;
+    if (file.read(header, 12) != 12 || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "AVI ", 4) != 0)
+        return false;
+
+    walkAVIChunks(file, 0, file.size(), false, offsets, indexKeyFrames);
+    if (offsets.isEmpty())
+        return false;
+
+    keyFrames.fill(true, offsets.length());
+    for (int i = 0; i < offsets.length() && i < indexKeyFrames.length(); i++)
+        keyFrames[i] = indexKeyFrames[i];
+    keyFrames[0] = true;
+    return true;
+}
+
+void FrameStreamReader::readTimeStamps(QVector<qint64> &timeStamps, QVector<qint64> &rowOffsets) const
+{
+    // Rows are "Frame Number,Time Stamp (ms),Buffer Index"
+    QFile file(m_timeStampFile);
+    QList<QByteArray> values;
+    qint64 rowOffset;
+    int frameNumber;
+    int firstUnfilled = 0;
+    bool ok;
+
+    if (!file.open(QFile::ReadOnly))
+        return;
+    file.readLine(); // header
+    while (!file.atEnd()) {
+        rowOffset = file.pos();
+        values = file.readLine().trimmed().split(',');
+        if (values.length() < 2)
+            continue;
+        frameNumber = values[0].toInt(&ok);
+        if (!ok || frameNumber < 0)
+            continue;
+        if (frameNumber >= timeStamps.length()) {
+            // Rows that are missing get no time stamp
+            timeStamps.resize(frameNumber + 1);
+            rowOffsets.resize(frameNumber + 1);
+            for (int i = firstUnfilled; i < frameNumber; i++) {
+                timeStamps[i] = NO_TIME_STAMP;
+                rowOffsets[i] = -1;
+            }
+            firstUnfilled = frameNumber + 1;
+        }
+        timeStamps[frameNumber] = values[1].toLongLong(&ok);
+        if (!ok)
+            timeStamps[frameNumber] = NO_TIME_STAMP;
+        rowOffsets[frameNumber] = rowOffset;
+    }
+}
+
+bool FrameStreamReader::indexIsCurrent(const QVector<SegmentIndexEntry> &segments, qint64 csvSize, qint64 csvModified) const
+{
+    QVector<SegmentIndexEntry> current = listSegments();
+    QFileInfo csvInfo(m_timeStampFile);
+
+    if (current.length() != segments.length())
+        return false;
+    for (int i = 0; i < current.length(); i++) {
+        if (current[i].fileName != segments[i].fileName ||
+                current[i].size != segments[i].size ||
+                current[i].lastModified != segments[i].lastModified)
+            return false;
+    }
+    if ((csvInfo.exists() ? csvInfo.size() : 0) != csvSize ||
+            (csvInfo.exists() ? csvInfo.lastModified().toMSecsSinceEpoch() : 0) != csvModified)
+        return false;
+    return true;
+}
+
+bool FrameStreamReader::loadIndex()
+{
+    QFile file(m_videoDirectory + "/" + FRAME_INDEX_FILE_NAME);
+    QDataStream in;
+    quint32 magic, version;
+    qint32 segmentCount, frameCount, timedFrameCount;
+    qint64 csvSize, csvModified;
+    QVector<SegmentIndexEntry> segments;
+    QVector<FrameIndexEntry> frames;
+
+    if (!file.open(QFile::ReadOnly))
+        return false;
+    in.setDevice(&file);
+    in.setVersion(QDataStream::Qt_5_12);
+    in >> magic >> version;
+    if (magic != FRAME_INDEX_MAGIC || version != FRAME_INDEX_VERSION)
+        return false;
+
+    in >> csvSize >> csvModified >> timedFrameCount >> segmentCount;
+    if (in.status() != QDataStream::Ok || segmentCount < 0)
+        return false;
+    segments.resize(segmentCount);
+    for (int i = 0; i < segmentCount; i++)
+        in >> segments[i].fileName >> segments[i].size >> segments[i].lastModified >> segments[i].firstFrame >> segments[i].frameCount;
+    if (in.status() != QDataStream::Ok || !indexIsCurrent(segments, csvSize, csvModified))
+        return false;
+
+    in >> frameCount;
+    if (in.status() != QDataStream::Ok || frameCount < 0)
+        return false;
+    frames.resize(frameCount);
+    for (int i = 0; i < frameCount; i++)
+        in >> frames[i].segment >> frames[i].frameInSegment >> frames[i].keyFrame
+           >> frames[i].byteOffset >> frames[i].timeStamp >> frames[i].csvOffset;
+    if (in.status() != QDataStream::Ok)
+        return false;
+
+    m_segments = segments;
+    m_frames = frames;
+    m_timedFrameCount = timedFrameCount;
+    m_csvSize = csvSize;
+    m_csvModified = csvModified;
+    return true;
+}
+
+void FrameStreamReader::saveIndex()
+{
+    QFile file(m_videoDirectory + "/" + FRAME_INDEX_FILE_NAME);
+    QDataStream out;
+
+    if (!file.open(QFile::WriteOnly | QFile::Truncate)) {
+        // Read only session. Index just won't be reused
+        qDebug() << "Could not save frame index to" << file.fileName();
+        return;
+    }
+    out.setDevice(&file);
+    out.setVersion(QDataStream::Qt_5_12);
+    out << (quint32) FRAME_INDEX_MAGIC << (quint32) FRAME_INDEX_VERSION;
+    out << m_csvSize << m_csvModified << (qint32) m_timedFrameCount << (qint32) m_segments.length();
+    for (int i = 0; i < m_segments.length(); i++)
+        out << m_segments[i].fileName << m_segments[i].size << m_segments[i].lastModified << m_segments[i].firstFrame << m_segments[i].frameCount;
+    out << (qint32) m_frames.length();
+    for (int i = 0; i < m_frames.length(); i++)
+        out << m_frames[i].segment << m_frames[i].frameInSegment << m_frames[i].keyFrame
+            << m_frames[i].byteOffset << m_frames[i].timeStamp << m_frames[i].csvOffset;
+}
+
+bool FrameStreamReader::seekSegment(cv::VideoCapture &capture, int &nextFrame, int segment, int frameInSegment) const
+{
+    const FrameIndexEntry &target = m_frames[m_segments[segment].firstFrame + frameInSegment];
+
+    // Decoding forward is cheaper than seeking as long as no key frame lies in between
+    if (frameInSegment < nextFrame || target.keyFrame > nextFrame) {
+        if (!capture.set(cv::CAP_PROP_POS_FRAMES, target.keyFrame))
+            return false;
+        nextFrame = target.keyFrame;
+    }
+    while (nextFrame < frameInSegment) {
+        if (!capture.grab())
+            return false;
+        nextFrame++;
+    }
+    return true;
+}
+
+cv::Mat FrameStreamReader::readFrame(int frame)
+{
+    cv::Mat image = cachedFrame(frame);
+    if (!image.empty() || frame < 0 || frame >= m_frames.length())
+        return image;
+
+    const FrameIndexEntry &entry = m_frames[frame];
+    if (m_formats[entry.segment].format != ChunkUnknown) {
+        QFile file(segmentPath(entry.segment));
+        if (file.open(QFile::ReadOnly) && decodeIndexed(file, frame, image))
+            return image;
+    }
+
+    OpenSegment *open = takeOpenSegment(entry.segment);
+    if (open->capture.isOpened() && seekSegment(open->capture, open->nextFrame, entry.segment, entry.frameInSegment)) {
+        if (open->capture.read(image))
+            open->nextFrame++;
+    }
+    returnOpenSegment(entry.segment, open);
+    return image;
+}
+
+FrameStreamReader::OpenSegment *FrameStreamReader::takeOpenSegment(int segment)
+{
+    OpenSegment *open;
+    {
+        QMutexLocker locker(&m_segmentMutex);
+        open = m_openSegments.take(segment);
+    }
+    if (open == nullptr) {
+        // Not open yet, or another read is using it
+        open = new OpenSegment;
+        open->nextFrame = 0;
+        open->capture.open(segmentPath(segment).toUtf8().constData());
+    }
+    return open;
+}
+
+void FrameStreamReader::returnOpenSegment(int segment, OpenSegment *open)
+{
+    QMutexLocker locker(&m_segmentMutex);
+    if (m_openSegments.contains(segment)) {
+        delete open;
+        return;
+    }
+    if (m_openSegments.size() >= MAX_OPEN_SEGMENTS) {
+        delete m_openSegments.first();
+        m_openSegments.erase(m_openSegments.begin());
+    }
+    m_openSegments[segment] = open;
+}
+
+QVector<FrameStreamReader::DecodeChunk> FrameStreamReader::splitIntoChunks(int first, int count, cv::Mat *out, bool skipCached)
+{
+    // Consecutive frames of one segment form a chunk, decoded with its own capture so chunks can run in parallel
+    QVector<DecodeChunk> chunks;
+    DecodeChunk chunk;
+    int last = qMin(first + count, m_frames.length());
+    int maxChunk = qMax(MIN_DECODE_CHUNK, count / qMax(1, QThread::idealThreadCount()));
+
+    chunk.count = 0;
+    for (int i = qMax(first, 0); i < last; i++) {
+        cv::Mat cached = skipCached ? cachedFrame(i) : cv::Mat();
+        if (!cached.empty()) {
+            if (out != nullptr)
+                out[i - first] = cached;
+            if (chunk.count > 0)
+                chunks.append(chunk);
+            chunk.count = 0;
+            continue;
+        }
+        if (chunk.count > 0 && (m_frames[i].segment != m_frames[chunk.first].segment || chunk.count >= maxChunk)) {
+            chunks.append(chunk);
+            chunk.count = 0;
+        }
+        if (chunk.count == 0) {
+            chunk.first = i;
+            chunk.out = out == nullptr ? nullptr : out + (i - first);
+        }
+        chunk.count++;
+    }
+    if (chunk.count > 0)
+        chunks.append(chunk);
+    return chunks;
+}
+
+int FrameStreamReader::decodeChunk(const DecodeChunk &chunk)
+{
+    const FrameIndexEntry &start = m_frames[chunk.first];
+    cv::VideoCapture capture;
+    cv::Mat image;
+    int nextFrame = 0;
+    int decoded = 0;
+
+    if (m_formats[start.segment].format != ChunkUnknown) {
+        QFile file(segmentPath(start.segment));
+        if (file.open(QFile::ReadOnly)) {
+            for (; decoded < chunk.count; decoded++) {
+                image = cv::Mat();
+                if (!decodeIndexed(file, chunk.first + decoded, image))
+                    break;
+                if (chunk.out != nullptr)
+                    chunk.out[decoded] = image;
+                else
+                    cacheFrame(chunk.first + decoded, image);
+            }
+        }
+        if (decoded == chunk.count)
+            return decoded;
+    }
+
+    // The rest goes through the decoder, starting at the first frame that could not be read from its chunk
+    if (!capture.open(segmentPath(start.segment).toUtf8().constData()))
+        return decoded;
+    if (!seekSegment(capture, nextFrame, start.segment, start.frameInSegment + decoded))
+        return decoded;
+    for (int i = decoded; i < chunk.count; i++) {
+        image = cv::Mat(); // new buffer for every frame since they are handed out
+        if (!capture.read(image))
+            break;
+        if (chunk.out != nullptr)
+            chunk.out[i] = image;
+        else
+            cacheFrame(chunk.first + i, image);
+        decoded++;
+    }
+    return decoded;
+}
+
+QVector<cv::Mat> FrameStreamReader::readFrames(int first, int count)
+{
+    QVector<cv::Mat> frames(qMax(0, qMin(count, m_frames.length() - first)));
+    if (frames.isEmpty())
+        return frames;
+
+    QVector<DecodeChunk> chunks = splitIntoChunks(first, frames.length(), frames.data(), true);
+    QtConcurrent::blockingMap(chunks, [this](const DecodeChunk &chunk) { decodeChunk(chunk); });
+    return frames;
+}
+
+QFuture<void> FrameStreamReader::prefetch(int first, int count)
+{
+    QVector<DecodeChunk> chunks = splitIntoChunks(first, count, nullptr, true);
+    std::function<int(const DecodeChunk&)> decode = [this](const DecodeChunk &chunk) { return decodeChunk(chunk); };
+    return QtConcurrent::mapped(chunks, decode);
+}
+
+void FrameStreamReader::setCacheSize(int frames)
+{
+    QMutexLocker locker(&m_cacheMutex);
+    m_cacheSize = qMax(0, frames);
+    while (m_cacheOrder.length() > m_cacheSize)
+        m_cache.remove(m_cacheOrder.dequeue());
+}
+
+cv::Mat FrameStreamReader::cachedFrame(int frame)
+{
+    QMutexLocker locker(&m_cacheMutex);
+    return m_cache.value(frame);
+}
+
+void FrameStreamReader::cacheFrame(int frame, const cv::Mat &image)
+{
+    QMutexLocker locker(&m_cacheMutex);
+    if (m_cacheSize == 0 || m_cache.contains(frame))
+        return;
+    while (m_cacheOrder.length() >= m_cacheSize)
+        m_cache.remove(m_cacheOrder.dequeue());
+    m_cache[frame] = image;
+    m_cacheOrder.enqueue(frame);
+}
+
+int FrameStreamReader::forEachFrameInTimeRange(qint64 startTime, qint64 endTime,
+                                               std::function<bool (int, qint64, const cv::Mat &)> callback,
+                                               int batchSize)
+{
+    int first = frameAtTime(startTime);
+    int last = frameAtTime(endTime);
+    int visited = 0;
+    QVector<cv::Mat> batch;
+    QFuture<void> next;
+
+    batchSize = qMax(1, batchSize);
+    if (m_cacheSize < 2 * batchSize)
+        setCacheSize(2 * batchSize);
+
+    for (int i = first; i < last; i += batchSize) {
+        batch = readFrames(i, qMin(batchSize, last - i));
+        if (i + batchSize < last)
+            next = prefetch(i + batchSize, qMin(batchSize, last - i - batchSize));
+        for (int j = 0; j < batch.length(); j++) {
+            if (!callback(i + j, m_frames[i + j].timeStamp, batch[j])) {
+                next.waitForFinished();
+                return visited;
+            }
+            visited++;
+        }
+        next.waitForFinished();
+    }
+    return visited;
+}
+
+SessionReader::SessionReader(QString sessionDirectory) :
+    m_sessionDirectory(QDir(sessionDirectory).absolutePath())
+{
+
+}
+
+bool SessionReader::open(bool forceRebuild)
+{
+    QDir sessionDir(m_sessionDirectory);
+    QStringList failed, errors;
+
+    m_streams.clear();
+    m_streamNames.clear();
+    if (!sessionDir.exists()) {
+        m_error = m_sessionDirectory + " does not exist.";
+        return false;
+    }
+
+    // Either a session folder holding device folders or a single device folder
+    if (QFile::exists(m_sessionDirectory + "/timeStamps.csv")) {
+        addDeviceDirectory(m_sessionDirectory);
+    }
+    else {
+        QStringList folders = sessionDir.entryList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+        for (int i = 0; i < folders.length(); i++) {
+            if (QFile::exists(m_sessionDirectory + "/" + folders[i] + "/timeStamps.csv"))
+                addDeviceDirectory(m_sessionDirectory + "/" + folders[i]);
+        }
+    }
+
+    for (int i = 0; i < m_streamNames.length(); i++) {
+        if (!m_streams[m_streamNames[i]]->open(forceRebuild)) {
+            failed.append(m_streamNames[i]);
+            errors.append(m_streamNames[i] + ": " + m_streams[m_streamNames[i]]->errorString());
+        }
+    }
+    for (int i = 0; i < failed.length(); i++) {
+        m_streams.remove(failed[i]);
+        m_streamNames.removeOne(failed[i]);
+    }
+    m_error = errors.join("\n");
+    if (m_streamNames.isEmpty() && m_error.isEmpty())
+        m_error = "No recorded devices found in " + m_sessionDirectory;
+    return !m_streamNames.isEmpty();
+}
+
+void SessionReader::addDeviceDirectory(QString directory)
+{
+    QString name = QFileInfo(directory).fileName();
+    QString timeStampFile = directory + "/timeStamps.csv";
+    QStringList cropFolders;
+
+    QFile file(directory + "/metaData.json");
+    if (file.open(QFile::ReadOnly)) {
+        QJsonObject metaData = QJsonDocument::fromJson(file.readAll()).object();
+        name = metaData["deviceName"].toString(name);
+    }
+
+    // Crop regions saved in "separate" mode live in sub folders and share the device's time stamps
+    cropFolders = QDir(directory).entryList(QStringList("crop*"), QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+    if (cropFolders.isEmpty()) {
+        m_streamNames.append(name);
+        m_streams[name] = QSharedPointer<FrameStreamReader>(new FrameStreamReader(directory, timeStampFile));
+    }
+    for (int i = 0; i < cropFolders.length(); i++) {
+        m_streamNames.append(name + "/" + cropFolders[i]);
+        m_streams[name + "/" + cropFolders[i]] = QSharedPointer<FrameStreamReader>(
+                    new FrameStreamReader(directory + "/" + cropFolders[i], timeStampFile));
+    }
+}
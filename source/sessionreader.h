@@ -0,0 +1,158 @@
+#ifndef SESSIONREADER_H
+#define SESSIONREADER_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QMap>
+#include <QHash>
+#include <QQueue>
+#include <QMutex>
+#include <QFile>
+#include <QFuture>
+#include <QDateTime>
+#include <QSharedPointer>
+
+#include <functional>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/videoio.hpp>
+
+#define FRAME_INDEX_FILE_NAME   "frameIndex.bin"
+#define FRAME_INDEX_VERSION     1
+
+// Where a frame lives on disk
+struct FrameIndexEntry {
+    qint32 segment;         // Index into segments, i.e. segment N is N.avi
+    qint32 frameInSegment;
+    qint32 keyFrame;        // Frame index within the segment of the closest preceding key frame
+    qint64 byteOffset;      // Offset of the frame's chunk in the AVI file. -1 if unknown
+    qint64 timeStamp;       // ms relative to the start of the recording, from timeStamps.csv
+    qint64 csvOffset;       // Offset of the frame's row in timeStamps.csv. -1 if there is no row
+};
+
+struct SegmentIndexEntry {
+    QString fileName;
+    qint64 size;
+    qint64 lastModified;
+    qint32 firstFrame;
+    qint32 frameCount;
+};
+
+// Random access to the frames of one recorded video stream (a device folder or one of its crop folders).
+// A frame index is built on first open and cached next to the data so later opens don't rescan any files.
+// The cache gets rebuilt whenever a segment or timeStamps.csv changes size or modification time.
+// Frames of uncompressed and MJPG segments are read straight from their indexed chunk. Other codecs decode through
+// a VideoCapture that seeks to the frame's key frame. Frames come out as BGR either way.
+class FrameStreamReader
+{
+public:
+    FrameStreamReader(QString videoDirectory, QString timeStampFile);
+    ~FrameStreamReader();
+    bool open(bool forceRebuild = false);
+    bool indexWasLoaded() const { return m_indexLoaded; }
+    QString errorString() const { return m_error; }
+
+    int frameCount() const { return m_frames.length(); }
+    int segmentCount() const { return m_segments.length(); }
+    const FrameIndexEntry &frameInfo(int frame) const { return m_frames[frame]; }
+    const SegmentIndexEntry &segmentInfo(int segment) const { return m_segments[segment]; }
+    qint64 timeStamp(int frame) const { return m_frames[frame].timeStamp; }
+    qint64 duration() const;
+
+    // First frame with a time stamp at or after timeStamp. Returns frameCount() if there is none
+    int frameAtTime(qint64 timeStamp) const;
+
+    cv::Mat readFrame(int frame);
+    QVector<cv::Mat> readFrames(int first, int count);
+    QFuture<void> prefetch(int first, int count);
+    void setCacheSize(int frames);
+
+    // Calls callback for every frame in [startTime, endTime) in order. Stops early if callback returns false.
+    // The next batch is decoded in the background while the current one is handed out.
+    int forEachFrameInTimeRange(qint64 startTime, qint64 endTime,
+                                std::function<bool(int frame, qint64 timeStamp, const cv::Mat &image)> callback,
+                                int batchSize = 64);
+
+private:
+    // Codecs whose chunks decode on their own
+    enum ChunkFormat { ChunkUnknown, ChunkGray, ChunkBGR, ChunkMJPG };
+    struct SegmentFormat {
+        ChunkFormat format;
+        int width;
+        int height;
+        int stride; // Bytes per row including padding
+        bool bottomUp;
+    };
+    struct OpenSegment {
+        cv::VideoCapture capture;
+        int nextFrame; // frame within segment the next read() returns
+    };
+    struct DecodeChunk {
+        int first;
+        int count;
+        cv::Mat *out; // nullptr puts the frames into the cache instead
+    };
+
+    bool buildIndex();
+    bool loadIndex();
+    void saveIndex();
+    bool indexIsCurrent(const QVector<SegmentIndexEntry> &segments, qint64 csvSize, qint64 csvModified) const;
+    QVector<SegmentIndexEntry> listSegments() const;
+    bool scanAVI(const QString &path, QVector<qint64> &offsets, QVector<bool> &keyFrames) const;
+    void readTimeStamps(QVector<qint64> &timeStamps, QVector<qint64> &rowOffsets) const;
+    QVector<DecodeChunk> splitIntoChunks(int first, int count, cv::Mat *out, bool skipCached);
+    int decodeChunk(const DecodeChunk &chunk);
+    bool seekSegment(cv::VideoCapture &capture, int &nextFrame, int segment, int frameInSegment) const;
+    QString segmentPath(int segment) const { return m_videoDirectory + "/" + m_segments[segment].fileName; }
+    void readSegmentFormats();
+    bool readSegmentFormat(const QString &path, SegmentFormat &format) const;
+    bool decodeIndexed(QFile &file, int frame, cv::Mat &image) const;
+    OpenSegment *takeOpenSegment(int segment);
+    void returnOpenSegment(int segment, OpenSegment *open);
+    cv::Mat cachedFrame(int frame);
+    void cacheFrame(int frame, const cv::Mat &image);
+
+    QString m_videoDirectory;
+    QString m_timeStampFile;
+    int m_timedFrameCount; // leading frames that have a time stamp
+    bool m_indexLoaded;
+    QString m_error;
+
+    qint64 m_csvSize;
+    qint64 m_csvModified;
+    QVector<SegmentIndexEntry> m_segments;
+    QVector<FrameIndexEntry> m_frames;
+    QVector<SegmentFormat> m_formats;
+
+    // Captures not in use for single frame reads. A read takes its segment's capture out while it decodes
+    QMutex m_segmentMutex;
+    QMap<int, OpenSegment*> m_openSegments;
+
+    QMutex m_cacheMutex;
+    QHash<int, cv::Mat> m_cache;
+    QQueue<int> m_cacheOrder;
+    int m_cacheSize;
+};
+
+// Finds the recorded video streams of a session and opens a FrameStreamReader for each.
+// Streams are named by device name, crop regions as "<deviceName>/cropN".
+class SessionReader
+{
+public:
+    explicit SessionReader(QString sessionDirectory);
+    bool open(bool forceRebuild = false);
+    QString errorString() const { return m_error; }
+    QStringList streamNames() const { return m_streamNames; }
+    FrameStreamReader *stream(QString name) const { return m_streams.value(name).data(); }
+
+private:
+    void addDeviceDirectory(QString directory);
+
+    QString m_sessionDirectory;
+    QString m_error;
+    QStringList m_streamNames;
+    QMap<QString, QSharedPointer<FrameStreamReader>> m_streams;
+};
+
+#endif // SESSIONREADER_H
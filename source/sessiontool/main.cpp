@@ -0,0 +1,82 @@
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTextStream>
+#include <QThread>
+#include <QElapsedTimer>
+
+#include "sessiontranscoder.h"
+#include "sessionreader.h"
+#include "sessionverifier.h"
+
+static int indexSession(QString sessionDirectory, bool rebuild)
+{
+    QTextStream out(stdout);
+    QElapsedTimer timer;
+    FrameStreamReader *stream;
+
+    timer.start();
+    SessionReader reader(sessionDirectory);
+    if (!reader.open(rebuild)) {
+        out << "Error: " << reader.errorString() << endl;
+        return 1;
+    }
+    if (!reader.errorString().isEmpty())
+        out << "Warning: " << reader.errorString() << endl;
+
+    QStringList names = reader.streamNames();
+    for (int i = 0; i < names.length(); i++) {
+        stream = reader.stream(names[i]);
+        out << names[i] << ": " << stream->frameCount() << " frames in " << stream->segmentCount() << " segments, "
+            << QString::number(stream->duration() / 1000.0, 'f', 1) << " s"
+            << (stream->indexWasLoaded() ? " (cached index)" : " (index built)") << endl;
+    }
+    out << "Opened in " << timer.elapsed() << " ms" << endl;
+    return 0;
+}
+
+// Headless tools for sessions recorded with the Miniscope DAQ Software.
+// Usage: MiniscopeSessionTool transcode <sessionDirectory> <outputDirectory> [--codec FFV1] [--container avi]
+//        MiniscopeSessionTool index <sessionDirectory> [--rebuild]
+//        MiniscopeSessionTool verify <sessionDirectory> [--threads N]
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("MiniscopeSessionTool");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Offline tools for sessions recorded with the Miniscope DAQ Software.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("command", "transcode, index or verify");
+    parser.addPositionalArgument("arguments", "Arguments of the command.", "[arguments...]");
+
+    QCommandLineOption codecOption("codec", "FourCC of the codec to encode with. Segments of lossless codecs (FFV1, GREY, ...) fail if any pixel changed.", "fourCC", "FFV1");
+    QCommandLineOption containerOption("container", "Container/file extension for the new segments.", "extension", "avi");
+    QCommandLineOption threadsOption("threads", "Number of files processed at once.", "count", QString::number(QThread::idealThreadCount()));
+    QCommandLineOption rebuildOption("rebuild", "Rebuild the frame index even if a current one is cached.");
+    parser.addOption(codecOption);
+    parser.addOption(containerOption);
+    parser.addOption(threadsOption);
+    parser.addOption(rebuildOption);
+
+    parser.process(app);
+
+    QStringList args = parser.positionalArguments();
+    QString command = args.isEmpty() ? QString() : args.takeFirst();
+
+    if (command == "transcode" && args.length() == 2) {
+        SessionTranscoder transcoder(args[0], args[1],
+                                     parser.value(codecOption),
+                                     parser.value(containerOption),
+                                     qMax(1, parser.value(threadsOption).toInt()));
+        return transcoder.run() == 0 ? 0 : 1;
+    }
+    if (command == "index" && args.length() == 1)
+        return indexSession(args[0], parser.isSet(rebuildOption));
+    if (command == "verify" && args.length() == 1) {
+        SessionVerifier verifier(args[0], qMax(1, parser.value(threadsOption).toInt()));
+        return verifier.run() == 0 ? 0 : 1;
+    }
+
+    parser.showHelp(1);
+    return 1;
+}
@@ -0,0 +1,44 @@
+# Command line tools for working with recorded sessions.
+# Miniscope-DAQ.pro in the repository root builds them together with the main application.
+QT -= gui
+QT += core concurrent
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = MiniscopeSessionTool
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH += $$PWD/..
+
+SOURCES += \
+        main.cpp \
+        sessiontranscoder.cpp \
+        sessionverifier.cpp \
+        ../segmenthasher.cpp \
+        ../sessionreader.cpp \
+        ../xxhash64.cpp
+
+HEADERS += \
+        sessiontranscoder.h \
+        sessionverifier.h \
+        ../segmenthasher.h \
+        ../migrationfiles.h \
+        ../sessionreader.h \
+        ../xxhash64.h
+
+win32 {
+    # Path to your openCV .lib file(s)
+    LIBS += -LC:/opencv-4.4.0/build/lib/Release -lopencv_world440
+
+    # Path to openCV header files
+    INCLUDEPATH += C:/opencv-4.4.0/build/install/include
+} else {
+    CONFIG += link_pkgconfig
+    PKGCONFIG += opencv4
+}
+
+# Default rules for deployment.
+qnx: target.path = /tmp/$${TARGET}/bin
+else: unix:!android: target.path = /opt/$${TARGET}/bin
+!isEmpty(target.path): INSTALLS += target
@@ -0,0 +1,322 @@
+#include "sessiontranscoder.h"
+#include "xxhash64.h"
+#include "sessionreader.h"
+#include "segmenthasher.h"
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QMutexLocker>
+#include <QTextStream>
+#include <QThreadPool>
+#include <QtConcurrent>
+
+#include <algorithm>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <opencv2/videoio.hpp>
+
+SessionTranscoder::SessionTranscoder(QString sessionDirectory, QString outputDirectory, QString codec, QString container, int threads) :
+    m_sessionDirectory(QDir(sessionDirectory).absolutePath()),
+    m_outputDirectory(QDir(outputDirectory).absolutePath()),
+    m_codec(codec),
+    m_container(container),
+    m_threads(threads)
+{
+    std::string fourCC = m_codec.leftJustified(4, ' ').toStdString();
+    m_fourCC = cv::VideoWriter::fourcc(fourCC[0], fourCC[1], fourCC[2], fourCC[3]);
+    m_lossless = QStringList(TRANSCODE_LOSSLESS_CODECS).contains(m_codec.leftJustified(4, ' '));
+}
+
+int SessionTranscoder::run()
+{
+    QElapsedTimer timer;
+    qint64 bytesIn = 0, bytesOut = 0;
+    int framesOut = 0;
+    int failed = 0;
+    int lossy = 0;
+    double seconds;
+
+    if (!collectFiles())
+        return -1;
+    if (m_jobs.isEmpty()) {
+        printLine("No video segments found in " + m_sessionDirectory);
+        return -1;
+    }
+    if (!copyOtherFiles())
+        return -1;
+
+    printLine("Transcoding " + QString::number(m_jobs.length()) + " segments to " + m_codec + "/" + m_container +
+              (m_lossless ? " (lossless)" : " (lossy)") + " using " + QString::number(m_threads) + " threads.");
+
+    timer.start();
+    QThreadPool::globalInstance()->setMaxThreadCount(m_threads);
+    QtConcurrent::blockingMap(m_jobs, [this](TranscodeJob &job) { transcodeSegment(job); });
+    seconds = timer.elapsed() / 1000.0;
+
+    for (int i = 0; i < m_jobs.length(); i++) {
+        bytesIn += m_jobs[i].bytesIn;
+        bytesOut += m_jobs[i].bytesOut;
+        framesOut += m_jobs[i].framesOut;
+        if (!m_jobs[i].success)
+            failed++;
+        else if (m_jobs[i].lossy)
+            lossy++;
+    }
+    failed += checkFrameCounts();
+
+    printLine(QString("Done in %1 s. %2 frames, %3 frames/s, %4 MB/s read, %5 MB/s written. Size ratio %6.")
+              .arg(seconds, 0, 'f', 1)
+              .arg(framesOut)
+              .arg(framesOut / qMax(seconds, 0.001), 0, 'f', 1)
+              .arg(bytesIn / 1e6 / qMax(seconds, 0.001), 0, 'f', 1)
+              .arg(bytesOut / 1e6 / qMax(seconds, 0.001), 0, 'f', 1)
+              .arg((double) bytesOut / qMax(bytesIn, (qint64) 1), 0, 'f', 3));
+    if (lossy > 0)
+        printLine("Warning: " + QString::number(lossy) + " segment(s) are lossy. Their pixels differ from the source.");
+    if (failed > 0)
+        printLine("Error: " + QString::number(failed) + " problem(s) found. See messages above.");
+
+    saveReport(seconds);
+    return failed;
+}
+
+bool SessionTranscoder::collectFiles()
+{
+    QString relativePath;
+    QFileInfo fileInfo;
+
+    if (!QDir(m_sessionDirectory).exists()) {
+        printLine("Error: Session directory " + m_sessionDirectory + " does not exist.");
+        return false;
+    }
+    if (m_outputDirectory == m_sessionDirectory || m_outputDirectory.startsWith(m_sessionDirectory + "/")) {
+        printLine("Error: Output directory must be outside of the session directory.");
+        return false;
+    }
+
+    QDirIterator it(m_sessionDirectory, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        fileInfo = QFileInfo(it.next());
+        relativePath = QDir(m_sessionDirectory).relativeFilePath(fileInfo.absoluteFilePath());
+        if (fileInfo.fileName() == FRAME_INDEX_FILE_NAME || fileInfo.fileName() == MANIFEST_FILE_NAME)
+            continue; // Would be stale for the new segments
+        if (fileInfo.suffix().toLower() == "avi") {
+            TranscodeJob job;
+            job.inputPath = fileInfo.absoluteFilePath();
+            job.outputPath = m_outputDirectory + "/" + relativePath.chopped(3) + m_container;
+            job.bytesIn = fileInfo.size();
+            m_jobs.append(job);
+        }
+        else
+            m_otherFiles.append(relativePath);
+    }
+
+    // Largest segments first so the slowest jobs don't end up running alone at the end
+    std::sort(m_jobs.begin(), m_jobs.end(), [](const TranscodeJob &a, const TranscodeJob &b) { return a.bytesIn > b.bytesIn; });
+    return true;
+}
+
+bool SessionTranscoder::copyOtherFiles()
+{
+    QString source, destination;
+    for (int i = 0; i < m_otherFiles.length(); i++) {
+        source = m_sessionDirectory + "/" + m_otherFiles[i];
+        destination = m_outputDirectory + "/" + m_otherFiles[i];
+        QDir().mkpath(QFileInfo(destination).absolutePath());
+        if (QFile::exists(destination))
+            QFile::remove(destination);
+        if (!QFile::copy(source, destination)) {
+            printLine("Error: Could not copy " + source + " to " + destination);
+            return false;
+        }
+    }
+    for (int i = 0; i < m_jobs.length(); i++)
+        QDir().mkpath(QFileInfo(m_jobs[i].outputPath).absolutePath());
+    return true;
+}
+
+void SessionTranscoder::transcodeSegment(TranscodeJob &job)
+{
+    QElapsedTimer timer;
+    cv::VideoCapture reader;
+    cv::VideoWriter writer;
+    cv::Mat frame, outFrame;
+    XXHash64 sourceHasher, outputHasher;
+    bool isColor = true;
+    double fps;
+
+    timer.start();
+    if (!reader.open(job.inputPath.toUtf8().constData())) {
+        job.error = "could not open segment";
+        printLine("Error: " + job.inputPath + " " + job.error);
+        return;
+    }
+    fps = reader.get(cv::CAP_PROP_FPS);
+    if (fps <= 0)
+        fps = 60; // DataSaver writes segments at 60
+
+    // Decode and re-encode one frame at a time
+    while (reader.read(frame)) {
+        if (job.framesIn == 0) {
+            // Mono recordings get decoded as 3 identical channels
+            isColor = !isGrayscale(frame);
+            if (!writer.open(job.outputPath.toUtf8().constData(), m_fourCC, fps, frame.size(), isColor)) {
+                job.error = "could not open output with codec " + m_codec;
+                printLine("Error: " + job.outputPath + " " + job.error);
+                return;
+            }
+        }
+        if (!isColor && frame.channels() == 3)
+            cv::cvtColor(frame, outFrame, cv::COLOR_BGR2GRAY);
+        else
+            outFrame = frame;
+        hashFrame(sourceHasher, outFrame);
+        writer.write(outFrame);
+        job.framesIn++;
+    }
+    reader.release();
+    writer.release();
+
+    // Read the new file back to verify frame count and pixel content
+    if (!reader.open(job.outputPath.toUtf8().constData())) {
+        job.error = "could not open transcoded segment for verification";
+        printLine("Error: " + job.outputPath + " " + job.error);
+        return;
+    }
+    while (reader.read(frame)) {
+        if (!isColor && frame.channels() == 3)
+            cv::cvtColor(frame, outFrame, cv::COLOR_BGR2GRAY);
+        else
+            outFrame = frame;
+        hashFrame(outputHasher, outFrame);
+        job.framesOut++;
+    }
+    reader.release();
+
+    job.bytesOut = QFileInfo(job.outputPath).size();
+    job.sourceHash = sourceHasher.hexDigest();
+    job.outputHash = outputHasher.hexDigest();
+    job.seconds = timer.elapsed() / 1000.0;
+
+    if (job.framesIn == 0)
+        job.error = "segment has no frames";
+    else if (job.framesIn != job.framesOut)
+        job.error = "frame count mismatch (" + QString::number(job.framesIn) + " in, " + QString::number(job.framesOut) + " out)";
+    else if (job.sourceHash != job.outputHash) {
+        job.lossy = true;
+        if (m_lossless)
+            job.error = "pixel checksum mismatch although " + m_codec + " is lossless";
+    }
+    job.success = job.error.isEmpty();
+
+    if (!job.success)
+        printLine("Error: " + job.inputPath + " " + job.error);
+    else
+        printLine(QString("%1: %2 frames, %3 -> %4 MB, %5 frames/s%6")
+                  .arg(QDir(m_sessionDirectory).relativeFilePath(job.inputPath))
+                  .arg(job.framesOut)
+                  .arg(job.bytesIn / 1e6, 0, 'f', 1)
+                  .arg(job.bytesOut / 1e6, 0, 'f', 1)
+                  .arg(job.framesOut / qMax(job.seconds, 0.001), 0, 'f', 1)
+                  .arg(job.lossy ? ", lossy (pixel checksum differs)" : ", pixels verified"));
+}
+
+int SessionTranscoder::checkFrameCounts()
+{
+    // Compare frames in each device folder to the number of rows in its timeStamps.csv
+    QMap<QString, int> framesPerDirectory;
+    QString directory, csvPath;
+    QFile csvFile;
+    int rows;
+    int problems = 0;
+
+    for (int i = 0; i < m_jobs.length(); i++)
+        framesPerDirectory[QFileInfo(m_jobs[i].inputPath).absolutePath()] += m_jobs[i].framesOut;
+
+    QStringList keys = framesPerDirectory.keys();
+    for (int i = 0; i < keys.length(); i++) {
+        directory = keys[i];
+        csvPath = directory + "/timeStamps.csv";
+        if (!QFile::exists(csvPath))
+            csvPath = QFileInfo(directory).absolutePath() + "/timeStamps.csv"; // crop region sub folders
+        csvFile.setFileName(csvPath);
+        if (!csvFile.open(QFile::ReadOnly | QFile::Text))
+            continue;
+        rows = -1; // Skip header
+        while (!csvFile.atEnd())
+            if (!csvFile.readLine().trimmed().isEmpty())
+                rows++;
+        csvFile.close();
+
+        if (rows != framesPerDirectory[directory]) {
+            printLine("Error: " + directory + " has " + QString::number(framesPerDirectory[directory]) +
+                      " frames but " + QString::number(rows) + " time stamps.");
+            problems++;
+        }
+    }
+    return problems;
+}
+
+void SessionTranscoder::saveReport(double totalSeconds)
+{
+    QJsonObject report;
+    QJsonArray segments;
+    QJsonObject segment;
+
+    report["sourceDirectory"] = m_sessionDirectory;
+    report["codec"] = m_codec;
+    report["container"] = m_container;
+    report["lossless"] = m_lossless;
+    report["threads"] = m_threads;
+    report["seconds"] = totalSeconds;
+    for (int i = 0; i < m_jobs.length(); i++) {
+        segment = QJsonObject();
+        segment["file"] = QDir(m_outputDirectory).relativeFilePath(m_jobs[i].outputPath);
+        segment["frames"] = m_jobs[i].framesOut;
+        segment["bytesIn"] = m_jobs[i].bytesIn;
+        segment["bytesOut"] = m_jobs[i].bytesOut;
+        segment["sourcePixelHash"] = m_jobs[i].sourceHash;
+        segment["outputPixelHash"] = m_jobs[i].outputHash;
+        segment["success"] = m_jobs[i].success;
+        segment["status"] = !m_jobs[i].success ? "failed" : (m_jobs[i].lossy ? "lossy" : "verified");
+        if (!m_jobs[i].success)
+            segment["error"] = m_jobs[i].error;
+        segments.append(segment);
+    }
+    report["segments"] = segments;
+
+    QFile file(m_outputDirectory + "/transcode.json");
+    if (file.open(QFile::WriteOnly | QFile::Truncate))
+        file.write(QJsonDocument(report).toJson());
+}
+
+void SessionTranscoder::printLine(QString line)
+{
+    QMutexLocker locker(&m_printMutex);
+    QTextStream out(stdout);
+    out << line << endl;
+}
+
+bool SessionTranscoder::isGrayscale(const cv::Mat &frame)
+{
+    if (frame.channels() == 1)
+        return true;
+    if (frame.channels() != 3)
+        return false;
+    cv::Mat channels[3];
+    cv::split(frame, channels);
+    return cv::norm(channels[0], channels[1], cv::NORM_INF) == 0 && cv::norm(channels[1], channels[2], cv::NORM_INF) == 0;
+}
+
+void SessionTranscoder::hashFrame(XXHash64 &hasher, const cv::Mat &frame)
+{
+    for (int row = 0; row < frame.rows; row++)
+        hasher.update(frame.ptr(row), frame.cols * frame.elemSize());
+}
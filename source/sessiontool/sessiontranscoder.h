@@ -0,0 +1,65 @@
+#ifndef SESSIONTRANSCODER_H
+#define SESSIONTRANSCODER_H
+
+#include <QString>
+#include <QVector>
+#include <QMutex>
+
+#include <opencv2/core/core.hpp>
+
+#include "xxhash64.h"
+
+// FourCCs that store every pixel exactly. Segments transcoded to these fail when their pixels differ from the source
+#define TRANSCODE_LOSSLESS_CODECS {"FFV1", "GREY", "Y800", "DIB ", "0000", "LAGS", "HFYU", "FFVH"}
+
+struct TranscodeJob {
+    QString inputPath;
+    QString outputPath;
+
+    // Filled in once the segment has been processed
+    bool success = false;
+    bool lossy = false; // Pixels decoded back from the new file differ from the source
+    QString error;
+    int framesIn = 0;
+    int framesOut = 0;
+    qint64 bytesIn = 0;
+    qint64 bytesOut = 0;
+    QString sourceHash; // xxHash64 of decoded source pixels
+    QString outputHash; // xxHash64 of pixels decoded back from the new file
+    double seconds = 0;
+};
+
+// Re-encodes every video segment of a session recorded by DataSaver into another codec/container.
+// Segments are processed in parallel, one frame at a time, so memory use does not depend on session size.
+// All other files (time stamps, metaData.json, notes, ...) are copied over unchanged.
+class SessionTranscoder
+{
+public:
+    SessionTranscoder(QString sessionDirectory, QString outputDirectory, QString codec, QString container, int threads);
+    int run(); // Returns the number of segments that failed
+
+private:
+    bool collectFiles();
+    bool copyOtherFiles();
+    void transcodeSegment(TranscodeJob &job);
+    int checkFrameCounts();
+    void saveReport(double totalSeconds);
+    void printLine(QString line);
+
+    static bool isGrayscale(const cv::Mat &frame);
+    static void hashFrame(XXHash64 &hasher, const cv::Mat &frame);
+
+    QString m_sessionDirectory;
+    QString m_outputDirectory;
+    QString m_codec;
+    QString m_container;
+    int m_fourCC;
+    bool m_lossless;
+    int m_threads;
+
+    QVector<TranscodeJob> m_jobs;
+    QStringList m_otherFiles;
+    QMutex m_printMutex;
+};
+
+#endif // SESSIONTRANSCODER_H
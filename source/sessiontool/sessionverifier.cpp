@@ -0,0 +1,125 @@
+#include "sessionverifier.h"
+#include "sessionreader.h"
+#include "migrationfiles.h"
+
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QElapsedTimer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutexLocker>
+#include <QSet>
+#include <QTextStream>
+#include <QThreadPool>
+#include <QtConcurrent>
+
+SessionVerifier::SessionVerifier(QString sessionDirectory, int threads) :
+    m_sessionDirectory(QDir(sessionDirectory).absolutePath()),
+    m_threads(threads)
+{
+
+}
+
+int SessionVerifier::run()
+{
+    QFile manifestFile(m_sessionDirectory + "/" + MANIFEST_FILE_NAME);
+    QJsonObject manifest;
+    QJsonArray files;
+    QElapsedTimer timer;
+    qint64 bytes = 0;
+    int problems = 0;
+
+    if (!manifestFile.open(QFile::ReadOnly)) {
+        printLine("Error: " + manifestFile.fileName() + " not found.");
+        return 1;
+    }
+    manifest = QJsonDocument::fromJson(manifestFile.readAll()).object();
+    if (manifest["hashAlgorithm"].toString() != "xxh64") {
+        printLine("Error: Unsupported hash algorithm '" + manifest["hashAlgorithm"].toString() + "'.");
+        return 1;
+    }
+
+    files = manifest["files"].toArray();
+    for (int i = 0; i < files.size(); i++) {
+        VerifyJob job;
+        job.expected.path = files[i].toObject()["path"].toString();
+        job.expected.bytes = (qint64) files[i].toObject()["bytes"].toDouble();
+        job.expected.hash = files[i].toObject()["hash"].toString();
+        job.expected.firstFrame = (qint64) files[i].toObject()["firstFrame"].toDouble(-1);
+        job.expected.numFrames = (qint64) files[i].toObject()["numFrames"].toDouble(0);
+        bytes += job.expected.bytes;
+        m_jobs.append(job);
+    }
+
+    printLine("Verifying " + QString::number(m_jobs.length()) + " files (" + QString::number(bytes / 1e6, 'f', 1) +
+              " MB) using " + QString::number(m_threads) + " threads.");
+    timer.start();
+    QThreadPool::globalInstance()->setMaxThreadCount(m_threads);
+    QtConcurrent::blockingMap(m_jobs, [this](VerifyJob &job) { verifyFile(job); });
+
+    for (int i = 0; i < m_jobs.length(); i++) {
+        if (!m_jobs[i].problem.isEmpty()) {
+            printLine("Error: " + m_jobs[i].expected.path + " " + m_jobs[i].problem);
+            problems++;
+        }
+    }
+    problems += checkForUnlistedFiles();
+
+    printLine(QString("Done in %1 s (%2 MB/s). %3")
+              .arg(timer.elapsed() / 1000.0, 0, 'f', 1)
+              .arg(bytes / 1e3 / qMax(timer.elapsed(), (qint64) 1), 0, 'f', 1)
+              .arg(problems == 0 ? "Session is intact." : QString::number(problems) + " problem(s) found."));
+    return problems;
+}
+
+void SessionVerifier::verifyFile(VerifyJob &job)
+{
+    QString path = m_sessionDirectory + "/" + job.expected.path;
+    QString hash;
+    qint64 bytes;
+
+    if (!QFile::exists(path)) {
+        job.problem = "is missing.";
+        return;
+    }
+    if (QFileInfo(path).size() != job.expected.bytes) {
+        job.problem = "is " + QString::number(QFileInfo(path).size()) + " bytes, expected " + QString::number(job.expected.bytes) + ".";
+        return;
+    }
+    if (!SegmentHasher::hashFile(path, hash, bytes)) {
+        job.problem = "could not be read.";
+        return;
+    }
+    if (hash != job.expected.hash)
+        job.problem = "is corrupted (hash " + hash + ", expected " + job.expected.hash + ").";
+}
+
+int SessionVerifier::checkForUnlistedFiles()
+{
+    // Files added after recording are reported but don't count as problems
+    QSet<QString> listed;
+    QSet<QString> ignored;
+    QString relativePath;
+
+    for (int i = 0; i < m_jobs.length(); i++)
+        listed.insert(m_jobs[i].expected.path);
+    ignored << MANIFEST_FILE_NAME << MIGRATION_STATUS_FILE_NAME << FRAME_INDEX_FILE_NAME << "transcode.json";
+
+    QDirIterator it(m_sessionDirectory, QDir::Files, QDirIterator::Subdirectories);
+    while (it.hasNext()) {
+        relativePath = QDir(m_sessionDirectory).relativeFilePath(it.next());
+        if (!listed.contains(relativePath) && !ignored.contains(QFileInfo(relativePath).fileName()))
+            printLine("Warning: " + relativePath + " is not in the manifest.");
+    }
+    return 0;
+}
+
+void SessionVerifier::printLine(QString line)
+{
+    QMutexLocker locker(&m_printMutex);
+    QTextStream out(stdout);
+    out << line << endl;
+}
@@ -0,0 +1,33 @@
+#ifndef SESSIONVERIFIER_H
+#define SESSIONVERIFIER_H
+
+#include <QString>
+#include <QVector>
+#include <QMutex>
+
+#include "segmenthasher.h"
+
+// Checks every file listed in a session's manifest.json for presence, size and xxHash64, several files at a time.
+class SessionVerifier
+{
+public:
+    SessionVerifier(QString sessionDirectory, int threads);
+    int run(); // Returns the number of problems found
+
+private:
+    struct VerifyJob {
+        ManifestEntry expected;
+        QString problem;
+    };
+
+    void verifyFile(VerifyJob &job);
+    int checkForUnlistedFiles();
+    void printLine(QString line);
+
+    QString m_sessionDirectory;
+    int m_threads;
+    QVector<VerifyJob> m_jobs;
+    QMutex m_printMutex;
+};
+
+#endif // SESSIONVERIFIER_H
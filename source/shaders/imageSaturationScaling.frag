@@ -3,8 +3,12 @@ varying highp vec2 v_texcoord;
 uniform lowp float alpha;
 uniform lowp float beta;
 uniform lowp float showSaturation;
+uniform lowp float isMono;
 void main() {
-   gl_FragColor = texture2D(texture, v_texcoord);
+   if (isMono == 1.0)
+       gl_FragColor = vec4(texture2D(texture, v_texcoord).rrr, 1.0); // single channel texture
+   else
+       gl_FragColor = texture2D(texture, v_texcoord);
    if (gl_FragColor.b >= .99 && showSaturation == 1.0)
        gl_FragColor = vec4(0.0, 0.0, 1.0, 1.0);
    else
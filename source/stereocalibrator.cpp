@@ -0,0 +1,227 @@
+#include "stereocalibrator.h"
+#include "cameracalibrator.h"
+
+#include <QDateTime>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QDebug>
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/calib3d.hpp>
+
+StereoCalibrator::StereoCalibrator(QJsonObject options, QObject *parent) :
+    QObject(parent),
+    m_boardSize(options["boardWidth"].toInt(9), options["boardHeight"].toInt(6)),
+    m_squareSize(options["squareSize"].toDouble(1)),
+    m_numViews(qMax(3, options["numViews"].toInt(20))),
+    m_sampleIntervalMs(options["sampleIntervalMs"].toInt(500)),
+    m_maxPairOffsetMs(options["maxPairOffsetMs"].toInt(20)),
+    m_fileName(options["calibrationFileLocation"].toString()),
+    m_timer(nullptr),
+    m_sampled(0)
+{
+    for (int i = 0; i < 2; i++) {
+        frameBuffer[i] = nullptr;
+        timeStampBuffer[i] = nullptr;
+        bufferSize[i] = 0;
+        m_acqFrameNum[i] = nullptr;
+    }
+}
+
+void StereoCalibrator::setCamera(int camera, QString name, cv::Mat *frameBuf, qint64 *tsBuf, int bufSize, QAtomicInt *acqFrameNum)
+{
+    m_name[camera] = name;
+    frameBuffer[camera] = frameBuf;
+    timeStampBuffer[camera] = tsBuf;
+    bufferSize[camera] = bufSize;
+    m_acqFrameNum[camera] = acqFrameNum;
+}
+
+QJsonObject StereoCalibrator::loadCalibration(QString fileName)
+{
+    QFile file(fileName);
+    QJsonObject calibration;
+
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        qDebug() << "Could not open stereo calibration" << fileName;
+        return calibration;
+    }
+    calibration = QJsonDocument::fromJson(file.readAll()).object();
+    file.close();
+    if (calibration["intrinsics"].toObject().isEmpty() || calibration["R"].toArray().size() != 9 || calibration["T"].toArray().size() != 3) {
+        qDebug() << "Stereo calibration" << fileName << "is missing intrinsics, R or T";
+        return QJsonObject();
+    }
+    return calibration;
+}
+
+void StereoCalibrator::setCameraCalibration(int camera, QJsonObject calibration)
+{
+    m_calibration[camera] = calibration;
+}
+
+void StereoCalibrator::start()
+{
+    cv::Mat cameraMatrix, distCoeffs;
+    for (int i = 0; i < 2; i++) {
+        if (!m_acqFrameNum[i] || !CameraCalibrator::intrinsics(m_calibration[i], cameraMatrix, distCoeffs)) {
+            sendMessage("Error: " + m_name[i] + " needs its own camera calibration before stereo calibration.");
+            progressChanged(0, "Calibrate " + m_name[i] + " first.");
+            return;
+        }
+    }
+
+    // Timer has to be created on this object's thread
+    if (!m_timer) {
+        m_timer = new QTimer(this);
+        QObject::connect(m_timer, &QTimer::timeout, this, &StereoCalibrator::sample);
+    }
+    m_views[0].clear();
+    m_views[1].clear();
+    m_sampled = 0;
+    m_timer->start(m_sampleIntervalMs);
+    progressChanged(0, "Hold a " + QString::number(m_boardSize.width + 1) + "x" + QString::number(m_boardSize.height + 1) +
+                    " chessboard where both " + m_name[0] + " and " + m_name[1] + " see all of it, and move it around.");
+}
+
+void StereoCalibrator::stop()
+{
+    if (m_timer)
+        m_timer->stop();
+}
+
+bool StereoCalibrator::grabPair(cv::Mat *gray)
+{
+    int f0 = m_acqFrameNum[0]->loadAcquire();
+    int f1 = m_acqFrameNum[1]->loadAcquire();
+    int idx0, idx1 = -1, idx;
+    qint64 offset, bestOffset = -1;
+
+    if (f0 <= 0 || f1 <= 0)
+        return false;
+    idx0 = (f0 - 1) % bufferSize[0];
+
+    // Cameras aren't triggered together, so the closest frame in time is the pair
+    for (int f = f1; f > qMax(0, f1 - STEREO_PAIR_SEARCH_FRAMES); f--) {
+        idx = (f - 1) % bufferSize[1];
+        offset = qAbs(timeStampBuffer[1][idx] - timeStampBuffer[0][idx0]);
+        if (bestOffset < 0 || offset < bestOffset) {
+            bestOffset = offset;
+            idx1 = idx;
+        }
+    }
+    if (idx1 < 0 || bestOffset > m_maxPairOffsetMs)
+        return false;
+
+    const cv::Mat *frames[2] = {&frameBuffer[0][idx0], &frameBuffer[1][idx1]};
+    for (int i = 0; i < 2; i++) {
+        if (frames[i]->empty())
+            return false;
+        if (frames[i]->channels() == 1)
+            frames[i]->copyTo(gray[i]);
+        else
+            cv::cvtColor(*frames[i], gray[i], cv::COLOR_BGR2GRAY);
+        m_imageSize[i] = gray[i].size();
+    }
+    return true;
+}
+
+void StereoCalibrator::sample()
+{
+    cv::Mat gray[2];
+    std::vector<cv::Point2f> corners[2];
+    double movement = 0;
+    QString status;
+
+    if (!grabPair(gray)) {
+        progressChanged((double) m_views[0].size() / m_numViews, "Waiting for frames taken at the same time by both cameras.");
+        return;
+    }
+    m_sampled++;
+
+    if (!CameraCalibrator::findBoard(gray[0], m_boardSize, corners[0]))
+        status = "Board not found by " + m_name[0] + ".";
+    else if (!CameraCalibrator::findBoard(gray[1], m_boardSize, corners[1]))
+        status = "Board not found by " + m_name[1] + ".";
+    else {
+        if (!m_views[0].empty()) {
+            for (size_t j = 0; j < corners[0].size(); j++)
+                movement += cv::norm(corners[0][j] - m_views[0].back()[j]);
+            movement /= corners[0].size();
+        }
+        if (!m_views[0].empty() && movement < CALIBRATION_MIN_BOARD_MOVE * m_imageSize[0].width)
+            status = "Board found. Move it to a new position.";
+        else {
+            m_views[0].push_back(corners[0]);
+            m_views[1].push_back(corners[1]);
+            status = "Board found by both cameras.";
+        }
+    }
+
+    progressChanged((double) m_views[0].size() / m_numViews,
+                    status + " " + QString::number(m_views[0].size()) + " of " + QString::number(m_numViews) + " views.");
+    if ((int) m_views[0].size() >= m_numViews) {
+        m_timer->stop();
+        solve();
+    }
+}
+
+void StereoCalibrator::solve()
+{
+    std::vector<std::vector<cv::Point3f>> objectPoints;
+    std::vector<cv::Point3f> board;
+    cv::Mat cameraMatrix[2], distCoeffs[2], R, T, E, F;
+    QJsonObject calibration, jIntrinsics;
+    QJsonArray jCameras;
+    double rms;
+
+    for (int i = 0; i < 2; i++) {
+        if (!CameraCalibrator::intrinsics(m_calibration[i], cameraMatrix[i], distCoeffs[i])) {
+            sendMessage("Error: " + m_name[i] + " needs its own camera calibration before stereo calibration.");
+            progressChanged(0, "Stereo calibration failed.");
+            return;
+        }
+    }
+
+    progressChanged(1, "Solving stereo calibration...");
+    for (int y = 0; y < m_boardSize.height; y++)
+        for (int x = 0; x < m_boardSize.width; x++)
+            board.push_back(cv::Point3f(x * m_squareSize, y * m_squareSize, 0));
+    objectPoints.assign(m_views[0].size(), board);
+
+    try {
+        rms = cv::stereoCalibrate(objectPoints, m_views[0], m_views[1],
+                                  cameraMatrix[0], distCoeffs[0], cameraMatrix[1], distCoeffs[1],
+                                  m_imageSize[0], R, T, E, F, cv::CALIB_FIX_INTRINSIC);
+    }
+    catch (cv::Exception &e) {
+        sendMessage("Error: Stereo calibration failed. " + QString::fromStdString(e.msg));
+        progressChanged(0, "Stereo calibration failed.");
+        return;
+    }
+
+    jCameras.append(m_name[0]);
+    jCameras.append(m_name[1]);
+    jIntrinsics[m_name[0]] = m_calibration[0];
+    jIntrinsics[m_name[1]] = m_calibration[1];
+    calibration["date"] = QDateTime::currentDateTime().toString(Qt::ISODate);
+    calibration["cameras"] = jCameras;
+    calibration["intrinsics"] = jIntrinsics;
+    calibration["R"] = CameraCalibrator::matToJson(R);
+    calibration["T"] = CameraCalibrator::matToJson(T);
+    calibration["E"] = CameraCalibrator::matToJson(E);
+    calibration["F"] = CameraCalibrator::matToJson(F);
+    calibration["rmsError"] = rms;
+    calibration["squareSize"] = m_squareSize;
+    calibration["numViews"] = (int) m_views[0].size();
+
+    if (m_fileName.isEmpty())
+        sendMessage("Warning: behaviorTracker stereo has no calibrationFileLocation. Stereo calibration is only saved with recordings of this session.");
+    else if (!CameraCalibrator::saveCalibration(calibration, m_fileName))
+        sendMessage("Error: Could not save stereo calibration to " + m_fileName + ".");
+
+    sendMessage("Stereo calibration of " + m_name[0] + " and " + m_name[1] + " done with a reprojection error of " + QString::number(rms, 'f', 3) + " px.");
+    progressChanged(1, "Done. Reprojection error " + QString::number(rms, 'f', 3) + " px.");
+    calibrationDone(calibration);
+}
@@ -0,0 +1,65 @@
+#ifndef STEREOCALIBRATOR_H
+#define STEREOCALIBRATOR_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QJsonObject>
+#include <QTimer>
+
+#include <opencv2/core/core.hpp>
+
+#include <vector>
+
+#define STEREO_PAIR_SEARCH_FRAMES   8 // How far back the second camera's buffer is searched for the frame closest in time
+
+// Extrinsic calibration of two behavior cameras that were each calibrated on their own (CameraCalibrator).
+// Every sampleIntervalMs the newest frame of camera 0 is paired with the frame of camera 1 closest to it in time.
+// Views where both see the whole chessboard are collected and solved for the rotation and translation of
+// camera 1 relative to camera 0. The result also carries both cameras' intrinsics so it is all StereoTriangulator needs.
+class StereoCalibrator : public QObject
+{
+    Q_OBJECT
+public:
+    StereoCalibrator(QJsonObject options, QObject *parent = nullptr);
+    void setCamera(int camera, QString name, cv::Mat *frameBuf, qint64 *tsBuf, int bufSize, QAtomicInt *acqFrameNum);
+    // Empty unless the file has intrinsics, R and T, as saved by solve()
+    static QJsonObject loadCalibration(QString fileName);
+
+signals:
+    void sendMessage(QString msg);
+    void progressChanged(double progress, QString status);
+    void calibrationDone(QJsonObject calibration);
+
+public slots:
+    void setCameraCalibration(int camera, QJsonObject calibration);
+    void start();
+    void stop();
+
+private slots:
+    void sample();
+
+private:
+    bool grabPair(cv::Mat *gray);
+    void solve();
+
+    QString m_name[2];
+    cv::Mat *frameBuffer[2];
+    qint64 *timeStampBuffer[2];
+    int bufferSize[2];
+    QAtomicInt *m_acqFrameNum[2];
+    QJsonObject m_calibration[2];
+    cv::Size m_imageSize[2];
+
+    cv::Size m_boardSize; // Inner corners
+    double m_squareSize;
+    int m_numViews;
+    int m_sampleIntervalMs;
+    qint64 m_maxPairOffsetMs;
+    QString m_fileName;
+
+    QTimer *m_timer;
+    int m_sampled;
+    std::vector<std::vector<cv::Point2f>> m_views[2];
+};
+
+#endif // STEREOCALIBRATOR_H
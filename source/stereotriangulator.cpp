@@ -0,0 +1,213 @@
+#include "stereotriangulator.h"
+#include "cameracalibrator.h"
+
+#include <QJsonArray>
+#include <QDebug>
+
+#include <opencv2/calib3d.hpp>
+
+#include <limits>
+#include <vector>
+
+StereoTriangulator::StereoTriangulator(QString name0, QString name1, QJsonObject options, QObject *parent) :
+    QObject(parent),
+    m_calibrated(false),
+    m_clockOffset(options["clockOffsetMs"].toDouble(0)),
+    m_maxPairOffsetMs(options["maxPairOffsetMs"].toDouble(0)),
+    m_unpaired(0),
+    m_batchSize(qMax(1, options["batchSize"].toInt(16)))
+{
+    m_name[0] = name0;
+    m_name[1] = name1;
+    for (int i = 0; i < 2; i++) {
+        timingBuffer[i] = nullptr;
+        bufferSize[i] = 0;
+        m_pointsUndistorted[i] = false;
+        m_period[i] = 0;
+        m_last[i].frameNum = 0;
+    }
+}
+
+void StereoTriangulator::setTimingBuffer(int camera, FrameTiming *timingBuf, int bufSize)
+{
+    timingBuffer[camera] = timingBuf;
+    bufferSize[camera] = bufSize;
+}
+
+void StereoTriangulator::setCameraCalibration(int camera, QJsonObject calibration, bool undistorted)
+{
+    cv::Mat distCoeffs;
+
+    m_pointsUndistorted[camera] = undistorted && CameraCalibrator::intrinsics(calibration, m_undistortedMatrix[camera], distCoeffs);
+}
+
+void StereoTriangulator::setCalibration(QJsonObject calibration)
+{
+    QJsonObject jIntrinsics = calibration["intrinsics"].toObject();
+    QJsonArray jR = calibration["R"].toArray();
+    QJsonArray jT = calibration["T"].toArray();
+
+    m_calibrated = false;
+    for (int i = 0; i < 2; i++) {
+        if (!CameraCalibrator::intrinsics(jIntrinsics[m_name[i]].toObject(), m_cameraMatrix[i], m_distCoeffs[i])) {
+            sendMessage("Error: Stereo calibration has no intrinsics for " + m_name[i] + ". No 3D trajectory.");
+            return;
+        }
+    }
+    if (jR.size() != 9 || jT.size() != 3) {
+        sendMessage("Error: Stereo calibration is missing R or T. No 3D trajectory.");
+        return;
+    }
+
+    // Triangulation works on normalized coordinates, so camera 0 is [I|0] and camera 1 is [R|T]
+    m_projection[0] = cv::Mat::eye(3, 4, CV_64F);
+    m_projection[1] = cv::Mat(3, 4, CV_64F);
+    for (int i = 0; i < 9; i++)
+        m_projection[1].at<double>(i / 3, i % 3) = jR[i].toDouble();
+    for (int i = 0; i < 3; i++)
+        m_projection[1].at<double>(i, 3) = jT[i].toDouble();
+    m_calibrated = true;
+}
+
+void StereoTriangulator::handlePosition(QString name, int frameNum, qint64 timeStamp, QVector<float> values)
+{
+    int camera = name == m_name[0] ? 0 : (name == m_name[1] ? 1 : -1);
+    Sample sample;
+
+    if (camera < 0 || values.size() < 2)
+        return;
+    sample.frameNum = frameNum;
+    sample.timeStamp = timeStamp;
+    sample.daqFrameNum = timingBuffer[camera] ? timingBuffer[camera][(frameNum - 1) % bufferSize[camera]].daqFrameNum : -1;
+    sample.point = cv::Point2f(values[0], values[1]);
+
+    updatePeriod(camera, sample);
+    m_queue[camera].append(sample);
+    if (m_queue[camera].size() > STEREO_MAX_QUEUED)
+        m_queue[camera].removeFirst();
+
+    pairSamples();
+    if (m_pending[0].size() >= m_batchSize)
+        triangulate();
+}
+
+void StereoTriangulator::flush()
+{
+    if (!m_pending[0].isEmpty())
+        triangulate();
+}
+
+void StereoTriangulator::updatePeriod(int camera, const Sample &sample)
+{
+    // DAQ frame numbers count frames dropped before they reached the computer, acquisition frame numbers only count the ones that did
+    const Sample &last = m_last[camera];
+    qint64 frames;
+    double period;
+
+    if (last.frameNum > 0) {
+        if (sample.daqFrameNum >= 0 && last.daqFrameNum >= 0)
+            frames = sample.daqFrameNum - last.daqFrameNum;
+        else
+            frames = sample.frameNum - last.frameNum;
+        if (frames > 0 && sample.timeStamp > last.timeStamp) {
+            period = (double) (sample.timeStamp - last.timeStamp) / frames;
+            m_period[camera] = m_period[camera] == 0 ? period : 0.95 * m_period[camera] + 0.05 * period;
+        }
+    }
+    m_last[camera] = sample;
+}
+
+double StereoTriangulator::tolerance()
+{
+    if (m_maxPairOffsetMs > 0)
+        return m_maxPairOffsetMs;
+    if (m_period[0] > 0 && m_period[1] > 0)
+        return 0.5 * qMin(m_period[0], m_period[1]);
+    return 10;
+}
+
+void StereoTriangulator::pairSamples()
+{
+    const double tol = tolerance();
+    double difference;
+
+    // Both queues are in time order. Whichever front has no partner within tol is dropped
+    while (!m_queue[0].isEmpty() && !m_queue[1].isEmpty()) {
+        const Sample &s0 = m_queue[0].first();
+        const Sample &s1 = m_queue[1].first();
+        difference = (s1.timeStamp - m_clockOffset) - s0.timeStamp;
+
+        if (qAbs(difference) <= tol) {
+            m_clockOffset += STEREO_OFFSET_GAIN * difference;
+            m_pending[0].append(s0);
+            m_pending[1].append(s1);
+            m_queue[0].removeFirst();
+            m_queue[1].removeFirst();
+            m_unpaired = 0;
+            continue;
+        }
+
+        if (++m_unpaired >= STEREO_RESYNC_UNPAIRED) {
+            // Clocks moved apart by more than the tolerance. Start over from the newest samples
+            m_clockOffset = m_queue[1].last().timeStamp - m_queue[0].last().timeStamp;
+            m_unpaired = 0;
+            qDebug() << "Stereo pairing lost sync. Clock offset is now" << m_clockOffset << "ms";
+        }
+        if (difference < 0)
+            m_queue[1].removeFirst();
+        else
+            m_queue[0].removeFirst();
+    }
+}
+
+void StereoTriangulator::triangulate()
+{
+    const float none = std::numeric_limits<float>::quiet_NaN();
+    const int n = m_pending[0].size();
+    std::vector<cv::Point2f> points[2], normalized[2];
+    std::vector<int> index;
+    cv::Mat homogeneous, xyz;
+    QVector<float> values;
+
+    // Only pairs where both cameras found the animal get triangulated, but every pair gets a row
+    for (int i = 0; i < n; i++) {
+        if (qIsNaN(m_pending[0][i].point.x) || qIsNaN(m_pending[1][i].point.x))
+            continue;
+        points[0].push_back(m_pending[0][i].point);
+        points[1].push_back(m_pending[1][i].point);
+        index.push_back(i);
+    }
+
+    if (m_calibrated && !index.empty()) {
+        // One call per camera for the whole batch
+        for (int c = 0; c < 2; c++) {
+            if (m_pointsUndistorted[c])
+                cv::undistortPoints(points[c], normalized[c], m_undistortedMatrix[c], cv::noArray());
+            else
+                cv::undistortPoints(points[c], normalized[c], m_cameraMatrix[c], m_distCoeffs[c]);
+        }
+        cv::triangulatePoints(m_projection[0], m_projection[1], normalized[0], normalized[1], homogeneous);
+        homogeneous.convertTo(homogeneous, CV_32F);
+
+        // Divide by w for all points at once, row by row
+        xyz = cv::Mat(3, homogeneous.cols, CV_32F);
+        for (int r = 0; r < 3; r++) {
+            cv::Mat row = xyz.row(r);
+            cv::divide(homogeneous.row(r), homogeneous.row(3), row);
+        }
+    }
+
+    for (int i = 0, k = 0; i < n; i++) {
+        values = {none, none, none, (float) m_pending[1][i].frameNum,
+                  (float) (m_pending[1][i].timeStamp - m_pending[0][i].timeStamp)};
+        if (!xyz.empty() && k < (int) index.size() && index[k] == i) {
+            values[0] = xyz.at<float>(0, k);
+            values[1] = xyz.at<float>(1, k);
+            values[2] = xyz.at<float>(2, k);
+            k++;
+        }
+        trajectoryReady(m_name[0], m_pending[0][i].frameNum, m_pending[0][i].timeStamp, values);
+    }
+    m_pending[0].clear();
+    m_pending[1].clear();
+}
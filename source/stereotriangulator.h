@@ -0,0 +1,81 @@
+#ifndef STEREOTRIANGULATOR_H
+#define STEREOTRIANGULATOR_H
+
+#include <QObject>
+#include <QJsonObject>
+#include <QStringList>
+#include <QVector>
+#include <QList>
+
+#include <opencv2/core/core.hpp>
+
+#include "latencytracker.h"
+
+#define STEREO_MAX_QUEUED           256 // Samples kept for one camera while the other one has none to pair them with
+#define STEREO_RESYNC_UNPAIRED      30  // After this many unpaired samples in a row the clock offset is measured again
+#define STEREO_OFFSET_GAIN          0.05
+
+// Turns the 2D positions that BehaviorTrackerWorker finds in two calibrated cameras into a 3D trajectory.
+// Positions are paired by acquisition time. The offset between the cameras' clocks is tracked from the pairs,
+// and the pairing tolerance follows the frame interval, which is measured from DAQ frame numbers when there are any so that
+// dropped frames don't look like a slower camera. Paired positions are triangulated in batches of batchSize.
+// Output is in the units of the stereo calibration's squareSize, in camera 0's coordinates.
+class StereoTriangulator : public QObject
+{
+    Q_OBJECT
+public:
+    StereoTriangulator(QString name0, QString name1, QJsonObject options, QObject *parent = nullptr);
+    void setTimingBuffer(int camera, FrameTiming *timingBuf, int bufSize);
+    QString getDeviceName() { return m_name[0]; }
+
+    static QStringList columns() { return {"X", "Y", "Z", "Paired Frame Number", "Pair Offset (ms)"}; }
+
+signals:
+    void sendMessage(QString msg);
+    // Same layout as columns(). Frame number and time stamp are camera 0's
+    void trajectoryReady(QString deviceName, int frameNum, qint64 timeStamp, QVector<float> values);
+
+public slots:
+    void setCalibration(QJsonObject calibration);
+    // The camera's own calibration, and whether its tracker undistorts positions with it. Those only need its camera matrix
+    void setCameraCalibration(int camera, QJsonObject calibration, bool undistorted);
+    void handlePosition(QString name, int frameNum, qint64 timeStamp, QVector<float> values);
+    void flush(); // Triangulates the pairs waiting for a full batch
+
+private:
+    struct Sample {
+        int frameNum;
+        qint64 timeStamp;
+        qint64 daqFrameNum;
+        cv::Point2f point;
+    };
+
+    void updatePeriod(int camera, const Sample &sample);
+    double tolerance();
+    void pairSamples();
+    void triangulate();
+
+    QString m_name[2];
+    FrameTiming *timingBuffer[2];
+    int bufferSize[2];
+    bool m_pointsUndistorted[2];
+    cv::Mat m_undistortedMatrix[2]; // Camera matrix the tracker undistorted positions to
+
+    bool m_calibrated;
+    cv::Mat m_cameraMatrix[2];
+    cv::Mat m_distCoeffs[2];
+    cv::Mat m_projection[2];
+
+    QList<Sample> m_queue[2];
+    Sample m_last[2];
+    double m_period[2]; // Frame interval in ms
+    double m_clockOffset; // Camera 1 time minus camera 0 time, in ms
+    double m_maxPairOffsetMs; // 0 means half a frame interval
+    int m_unpaired;
+    int m_batchSize;
+
+    // Paired, waiting for the next batch
+    QVector<Sample> m_pending[2];
+};
+
+#endif // STEREOTRIANGULATOR_H
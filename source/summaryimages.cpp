@@ -0,0 +1,234 @@
+#include "summaryimages.h"
+
+#include <QMutexLocker>
+#include <QDebug>
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+
+SummaryImages::SummaryImages() :
+    m_localCorrelation(true),
+    m_count(0),
+    m_warnedFormat(false)
+{
+}
+
+void SummaryImages::reset()
+{
+    QMutexLocker locker(&m_mutex);
+    m_count = 0;
+    m_mean.release();
+    m_m2.release();
+    m_max.release();
+    m_deltaOld.release();
+    m_deltaNew.release();
+    for (int d = 0; d < SUMMARY_NEIGHBOR_DIRECTIONS; d++)
+        m_coMoment[d].release();
+}
+
+qint64 SummaryImages::frameCount()
+{
+    QMutexLocker locker(&m_mutex);
+    return m_count;
+}
+
+void SummaryImages::allocate(cv::Size size)
+{
+    cv::Rect a, b;
+
+    m_count = 0;
+    m_mean = cv::Mat::zeros(size, CV_32F);
+    m_m2 = cv::Mat::zeros(size, CV_32F);
+    m_max = cv::Mat::zeros(size, CV_8U);
+    m_deltaOld.create(size, CV_32F);
+    m_deltaNew.create(size, CV_32F);
+    for (int d = 0; d < SUMMARY_NEIGHBOR_DIRECTIONS; d++) {
+        if (m_localCorrelation) {
+            neighborRects(d, a, b);
+            m_coMoment[d] = cv::Mat::zeros(a.size(), CV_32F);
+        }
+        else
+            m_coMoment[d].release();
+    }
+}
+
+void SummaryImages::addFrame(const cv::Mat &frame)
+{
+    if (frame.empty() || frame.type() != CV_8UC1) {
+        if (!frame.empty() && !m_warnedFormat) {
+            m_warnedFormat = true;
+            qDebug() << "Summary images only support mono 8 bit frames.";
+        }
+        return;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    if (frame.size() != m_mean.size())
+        allocate(frame.size());
+
+    m_count++;
+    updateMoments(frame);
+    if (m_localCorrelation && m_count > 1)
+        updateCoMoments();
+}
+
+void SummaryImages::updateMoments(const cv::Mat &frame)
+{
+    // Welford: delta = x - mean, mean += delta / n, M2 += delta * (x - new mean).
+    // Both deltas are kept for the neighbor co-moments
+    const float invN = 1.0f / m_count;
+
+    for (int y = 0; y < frame.rows; y++) {
+        const uchar *src = frame.ptr<uchar>(y);
+        uchar *maxRow = m_max.ptr<uchar>(y);
+        float *mean = m_mean.ptr<float>(y);
+        float *m2 = m_m2.ptr<float>(y);
+        float *deltaOld = m_deltaOld.ptr<float>(y);
+        float *deltaNew = m_deltaNew.ptr<float>(y);
+        int x = 0;
+
+#if CV_SIMD
+        const int lanes = cv::v_uint8::nlanes;
+        const int floatLanes = cv::v_float32::nlanes;
+        const cv::v_float32 vInvN = cv::vx_setall_f32(invN);
+        cv::v_uint16 x16[2];
+        cv::v_uint32 x32[4];
+        for (; x <= frame.cols - lanes; x += lanes) {
+            cv::v_uint8 pixels = cv::vx_load(src + x);
+            cv::v_store(maxRow + x, cv::v_max(cv::vx_load(maxRow + x), pixels));
+            cv::v_expand(pixels, x16[0], x16[1]);
+            cv::v_expand(x16[0], x32[0], x32[1]);
+            cv::v_expand(x16[1], x32[2], x32[3]);
+            for (int q = 0; q < 4; q++) {
+                const int i = x + q * floatLanes;
+                cv::v_float32 fx = cv::v_cvt_f32(cv::v_reinterpret_as_s32(x32[q]));
+                cv::v_float32 before = fx - cv::vx_load(mean + i);
+                cv::v_float32 updated = cv::v_fma(before, vInvN, cv::vx_load(mean + i));
+                cv::v_float32 after = fx - updated;
+                cv::v_store(mean + i, updated);
+                cv::v_store(m2 + i, cv::v_fma(before, after, cv::vx_load(m2 + i)));
+                cv::v_store(deltaOld + i, before);
+                cv::v_store(deltaNew + i, after);
+            }
+        }
+#endif
+        for (; x < frame.cols; x++) {
+            float fx = src[x];
+            float before = fx - mean[x];
+            mean[x] += before * invN;
+            float after = fx - mean[x];
+            m2[x] += before * after;
+            deltaOld[x] = before;
+            deltaNew[x] = after;
+            if (src[x] > maxRow[x])
+                maxRow[x] = src[x];
+        }
+    }
+}
+
+void SummaryImages::neighborRects(int direction, cv::Rect &a, cv::Rect &b)
+{
+    // a is the pixel, b its neighbor. Both cover the pixels that have that neighbor
+    const int w = m_mean.cols, h = m_mean.rows;
+    switch (direction) {
+    case 0: // Right
+        a = cv::Rect(0, 0, w - 1, h);
+        b = cv::Rect(1, 0, w - 1, h);
+        break;
+    case 1: // Down
+        a = cv::Rect(0, 0, w, h - 1);
+        b = cv::Rect(0, 1, w, h - 1);
+        break;
+    case 2: // Down-right
+        a = cv::Rect(0, 0, w - 1, h - 1);
+        b = cv::Rect(1, 1, w - 1, h - 1);
+        break;
+    default: // Down-left
+        a = cv::Rect(1, 0, w - 1, h - 1);
+        b = cv::Rect(0, 1, w - 1, h - 1);
+        break;
+    }
+}
+
+void SummaryImages::updateCoMoments()
+{
+    // Co-moment of a pixel pair: C += (x - old mean of x) * (y - new mean of y)
+    cv::Rect a, b;
+    for (int d = 0; d < SUMMARY_NEIGHBOR_DIRECTIONS; d++) {
+        neighborRects(d, a, b);
+        cv::accumulateProduct(m_deltaOld(a), m_deltaNew(b), m_coMoment[d]);
+    }
+}
+
+cv::Mat SummaryImages::correlationImage()
+{
+    // Each pixel gets the mean correlation with its eight neighbors. Pixels on the edge have fewer
+    cv::Mat sum = cv::Mat::zeros(m_mean.size(), CV_32F);
+    cv::Mat count = cv::Mat::zeros(m_mean.size(), CV_32F);
+    cv::Mat denominator, correlation, sumA, sumB, countA, countB;
+    cv::Rect a, b;
+
+    if (!m_localCorrelation || m_coMoment[0].empty())
+        return cv::Mat();
+
+    for (int d = 0; d < SUMMARY_NEIGHBOR_DIRECTIONS; d++) {
+        neighborRects(d, a, b);
+        cv::sqrt(m_m2(a).mul(m_m2(b)), denominator);
+        denominator = cv::max(denominator, 1e-6);
+        cv::divide(m_coMoment[d], denominator, correlation);
+        sumA = sum(a);
+        sumB = sum(b);
+        countA = count(a);
+        countB = count(b);
+        sumA += correlation;
+        sumB += correlation;
+        countA += 1;
+        countB += 1;
+    }
+    return sum / count;
+}
+
+cv::Mat SummaryImages::image(QString type)
+{
+    QMutexLocker locker(&m_mutex);
+    cv::Mat result;
+
+    if (m_count == 0)
+        return result;
+
+    if (type == "Mean")
+        result = m_mean.clone();
+    else if (type == "Max")
+        m_max.convertTo(result, CV_32F);
+    else if (type == "Std")
+        cv::sqrt(m_m2 / (double) qMax((qint64) 1, m_count - 1), result);
+    else if (type == "Correlation")
+        result = correlationImage();
+    return result;
+}
+
+cv::Mat SummaryImages::displayImage(QString type)
+{
+    cv::Mat source = image(type);
+    cv::Mat result;
+
+    if (!source.empty())
+        cv::normalize(source, result, 0, 255, cv::NORM_MINMAX, CV_8U);
+    return result;
+}
+
+bool SummaryImages::save(QString directory)
+{
+    QStringList names = types();
+    cv::Mat result;
+    bool success = true;
+
+    for (int i = 0; i < names.length(); i++) {
+        result = image(names[i]);
+        if (result.empty())
+            continue;
+        success &= cv::imwrite((directory + "/summary" + names[i] + ".tif").toUtf8().constData(), result);
+    }
+    return success;
+}
@@ -0,0 +1,55 @@
+#ifndef SUMMARYIMAGES_H
+#define SUMMARYIMAGES_H
+
+#include <QtGlobal>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+
+#include <opencv2/core/core.hpp>
+
+#define SUMMARY_NEIGHBOR_DIRECTIONS 4 // Right, down, down-right and down-left. The other four neighbors are the same pairs
+
+// Mean, max projection, standard deviation and local correlation images of a recording, accumulated one frame at a time.
+// Mean and variance use Welford's update in a single vectorized pass per frame. Local correlation keeps one co-moment
+// per neighbor pair, updated the same way, so it needs no second pass and no stored frames.
+// addFrame() is called from a single thread. Images can be taken from any thread.
+class SummaryImages
+{
+public:
+    SummaryImages();
+
+    static QStringList types() { return {"Mean", "Max", "Std", "Correlation"}; }
+
+    void setLocalCorrelation(bool enable) { m_localCorrelation = enable; }
+    void reset();
+    void addFrame(const cv::Mat &frame);
+    qint64 frameCount();
+
+    // CV_32F image of the given type, or an empty Mat before the first frame
+    cv::Mat image(QString type);
+    // Same image stretched to 8 bit for display
+    cv::Mat displayImage(QString type);
+    // Writes each image as a 32 bit float TIFF named summary<Type>.tif
+    bool save(QString directory);
+
+private:
+    void allocate(cv::Size size);
+    void updateMoments(const cv::Mat &frame);
+    void updateCoMoments();
+    void neighborRects(int direction, cv::Rect &a, cv::Rect &b);
+    cv::Mat correlationImage();
+
+    QMutex m_mutex;
+    bool m_localCorrelation;
+    qint64 m_count;
+    cv::Mat m_mean;
+    cv::Mat m_m2;
+    cv::Mat m_max;
+    cv::Mat m_deltaOld; // Frame minus the mean before this frame was added
+    cv::Mat m_deltaNew; // Frame minus the mean after this frame was added
+    cv::Mat m_coMoment[SUMMARY_NEIGHBOR_DIRECTIONS];
+    bool m_warnedFormat;
+};
+
+#endif // SUMMARYIMAGES_H
@@ -0,0 +1,183 @@
+#include "syncindex.h"
+
+#include <QJsonArray>
+#include <QDebug>
+
+#include <limits>
+#include <cstring>
+
+SyncIndex::SyncIndex() :
+    m_csv(false)
+{
+
+}
+
+bool SyncIndex::open(QString directory, QString reference, QStringList devices, bool csv)
+{
+    quint32 header[2];
+
+    close();
+    m_reference = reference;
+    m_devices = devices;
+    m_devices.removeAll(reference);
+    m_pending.clear();
+    m_frames.clear();
+    m_frames.resize(m_devices.size());
+    m_row.resize(sizeof(qint32) + sizeof(double) + m_devices.size() * (sizeof(qint32) + 2 * sizeof(float)));
+
+    m_file.setFileName(directory + "/syncIndex.bin");
+    if (!m_file.open(QFile::WriteOnly | QFile::Truncate)) {
+        qDebug() << "Could not open" << m_file.fileName();
+        return false;
+    }
+    header[0] = SYNC_FILE_VERSION;
+    header[1] = m_devices.size();
+    m_file.write(SYNC_FILE_MAGIC, 4);
+    m_file.write((const char*) header, sizeof(header));
+
+    m_csv = csv;
+    if (m_csv) {
+        m_csvFile.setFileName(directory + "/syncIndex.csv");
+        m_csvFile.open(QFile::WriteOnly | QFile::Truncate);
+        m_csvStream.setDevice(&m_csvFile);
+        m_csvStream << m_reference << " Frame Number,Corrected Time Stamp (ms)";
+        for (int i = 0; i < m_devices.size(); i++)
+            m_csvStream << "," << m_devices[i] << " Frame Number," << m_devices[i] << " Interpolated Frame," << m_devices[i] << " Offset (ms)";
+        m_csvStream << endl;
+    }
+    return true;
+}
+
+QJsonObject SyncIndex::layout() const
+{
+    QJsonObject jLayout;
+    jLayout["version"] = SYNC_FILE_VERSION;
+    jLayout["reference"] = m_reference;
+    jLayout["devices"] = QJsonArray::fromStringList(m_devices);
+    jLayout["headerBytes"] = 12;
+    jLayout["rowBytes"] = m_row.size();
+    jLayout["row"] = QJsonArray({"int32 reference frame number", "float64 corrected time stamp (ms)"});
+    jLayout["perDevice"] = QJsonArray({"int32 nearest frame number (-1 for none)", "float32 interpolated frame (NaN if outside of the device's frames)",
+                                       "float32 time stamp of nearest frame minus reference time stamp (ms)"});
+    return jLayout;
+}
+
+void SyncIndex::addFrame(const QString &name, qint64 frameNumber, double timeStamp)
+{
+    Entry entry = {frameNumber, timeStamp};
+    int device;
+
+    if (!isOpen())
+        return;
+    if (name == m_reference)
+        m_pending.append(entry);
+    else {
+        device = m_devices.indexOf(name);
+        if (device < 0)
+            return;
+        m_frames[device].append(entry);
+        // Reference device stalled. Only the newest frames are needed once it comes back
+        if (m_frames[device].size() > SYNC_MAX_PENDING)
+            m_frames[device].removeFirst();
+    }
+    resolve(false);
+}
+
+void SyncIndex::resolve(bool flushAll)
+{
+    bool ready;
+
+    while (!m_pending.isEmpty()) {
+        const double t = m_pending.first().timeStamp;
+
+        // A reference frame can be written once every device has a frame after it
+        ready = true;
+        for (int i = 0; i < m_devices.size() && ready; i++)
+            ready = !m_frames[i].isEmpty() && m_frames[i].last().timeStamp > t;
+        // Rows also get written when a device stopped sending frames and too many are waiting on it
+        if (!ready && !flushAll && m_pending.size() <= SYNC_MAX_PENDING)
+            return;
+
+        // Reference time stamps only go up, so frames before the one just before t are never needed again
+        for (int i = 0; i < m_devices.size(); i++) {
+            while (m_frames[i].size() >= 2 && m_frames[i][1].timeStamp <= t)
+                m_frames[i].removeFirst();
+        }
+        writeRow(m_pending.takeFirst());
+    }
+}
+
+void SyncIndex::writeRow(const Entry &reference)
+{
+    const float none = std::numeric_limits<float>::quiet_NaN();
+    char *p = m_row.data();
+    qint32 frameNumber = reference.frameNumber;
+    qint32 nearest;
+    float interpolated, offset;
+
+    memcpy(p, &frameNumber, sizeof(frameNumber));
+    p += sizeof(frameNumber);
+    memcpy(p, &reference.timeStamp, sizeof(reference.timeStamp));
+    p += sizeof(reference.timeStamp);
+    if (m_csv)
+        m_csvStream << reference.frameNumber << "," << QString::number(reference.timeStamp, 'f', 3);
+
+    for (int i = 0; i < m_devices.size(); i++) {
+        const QList<Entry> &frames = m_frames[i];
+        const Entry *before = nullptr, *after = nullptr;
+
+        if (!frames.isEmpty()) {
+            if (frames[0].timeStamp <= reference.timeStamp) {
+                before = &frames[0];
+                if (frames.size() > 1)
+                    after = &frames[1];
+            }
+            else
+                after = &frames[0];
+        }
+
+        nearest = -1;
+        interpolated = none;
+        offset = none;
+        if (before && after) {
+            const Entry *n = (reference.timeStamp - before->timeStamp <= after->timeStamp - reference.timeStamp) ? before : after;
+            nearest = n->frameNumber;
+            offset = n->timeStamp - reference.timeStamp;
+            if (after->timeStamp > before->timeStamp)
+                interpolated = before->frameNumber + (reference.timeStamp - before->timeStamp) * (after->frameNumber - before->frameNumber) /
+                        (after->timeStamp - before->timeStamp);
+            else
+                interpolated = before->frameNumber;
+        }
+        else if (before || after) {
+            // Before the device's first frame or after its last one
+            const Entry *n = before ? before : after;
+            nearest = n->frameNumber;
+            offset = n->timeStamp - reference.timeStamp;
+        }
+
+        memcpy(p, &nearest, sizeof(nearest));
+        p += sizeof(nearest);
+        memcpy(p, &interpolated, sizeof(interpolated));
+        p += sizeof(interpolated);
+        memcpy(p, &offset, sizeof(offset));
+        p += sizeof(offset);
+        if (m_csv)
+            m_csvStream << "," << nearest << "," << interpolated << "," << offset;
+    }
+    m_file.write(m_row);
+    if (m_csv)
+        m_csvStream << "\n";
+}
+
+void SyncIndex::close()
+{
+    if (!isOpen())
+        return;
+    resolve(true);
+    m_file.close();
+    if (m_csv) {
+        m_csvStream.flush();
+        m_csvFile.close();
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef SYNCINDEX_H
+#define SYNCINDEX_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QList>
+#include <QFile>
+#include <QTextStream>
+#include <QJsonObject>
+
+#define SYNC_FILE_MAGIC         "MSSI"  // syncIndex.bin starts with this, then version and number of other devices as uint32
+#define SYNC_FILE_VERSION       2
+#define SYNC_MAX_PENDING        4096    // Frames held waiting for a device that stopped sending any
+
+// Session level index that lines up every frame of a reference device (usually the Miniscope) with the frames of all
+// other recorded devices. Saved frames of all devices come in through addFrame() in the order DataSaver saves them.
+// Reference frames wait until every other device has saved a frame later than them, then a merge join over the
+// devices' recent frames finds the frames just before and after. Each row holds, per device, the nearest frame,
+// the frame index interpolated in time and the time offset of the nearest frame. Rows are written to syncIndex.bin
+// (little endian: int32 frame, double time stamp, then int32 nearest, float interpolated and float offset per device),
+// described by syncIndex.json, and optionally to syncIndex.csv.
+class SyncIndex
+{
+public:
+    SyncIndex();
+    bool open(QString directory, QString reference, QStringList devices, bool csv);
+    bool isOpen() const { return m_file.isOpen(); }
+    // Frame number and corrected time stamp as in the device's timeStamps.csv
+    void addFrame(const QString &name, qint64 frameNumber, double timeStamp);
+    // Writes the rows still waiting on a device and closes the files
+    void close();
+
+    QJsonObject layout() const;
+
+private:
+    struct Entry {
+        qint64 frameNumber;
+        double timeStamp;
+    };
+
+    void resolve(bool flushAll);
+    void writeRow(const Entry &reference);
+
+    QString m_reference;
+    QStringList m_devices; // All but the reference
+    QList<Entry> m_pending; // Reference frames not written yet
+    QVector<QList<Entry>> m_frames; // Per device, from the last frame before the oldest pending reference frame on
+
+    QFile m_file;
+    QByteArray m_row;
+    bool m_csv;
+    QFile m_csvFile;
+    QTextStream m_csvStream;
+};
+
+#endif // SYNCINDEX_H
@@ -0,0 +1,310 @@
+#include "traceextractor.h"
+
+#include <QFile>
+#include <QJsonDocument>
+#include <QMutexLocker>
+#include <QDebug>
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+
+TraceExtractor::TraceExtractor(cv::Mat *frameBuf, qint64 *tsBuf, int bufSize, QAtomicInt *sourceFrameNum, QJsonObject options, QObject *parent) :
+    QObject(parent),
+    frameBuffer(frameBuf),
+    timeStampBuffer(tsBuf),
+    bufferSize(bufSize),
+    m_sourceFrameNum(sourceFrameNum),
+    m_traceFrameNum(0),
+    m_neuropilCoefficient(options["neuropilCoefficient"].toDouble(0.7)),
+    m_backgroundInnerRadius(qMax(0, options["backgroundInnerRadius"].toInt(2))),
+    m_backgroundOuterRadius(qMax(1, options["backgroundOuterRadius"].toInt(10))),
+    m_baselineSeconds(qMax(0.1, options["baselineSeconds"].toDouble(30))),
+    m_roisChanged(false),
+    m_compiledSize(0, 0),
+    m_lastTimeStamp(0),
+    m_warnedFormat(false)
+{
+    traceBuffer = new float[bufferSize * TRACE_SLOT_SIZE];
+    for (int i = 0; i < bufferSize; i++)
+        traceBuffer[i * TRACE_SLOT_SIZE] = 0;
+
+    if (m_backgroundOuterRadius <= m_backgroundInnerRadius) {
+        m_backgroundOuterRadius = m_backgroundInnerRadius + 1;
+        qDebug() << "Trace extraction backgroundOuterRadius must be larger than backgroundInnerRadius. Using" << m_backgroundOuterRadius;
+    }
+}
+
+TraceExtractor::~TraceExtractor()
+{
+    delete [] traceBuffer;
+}
+
+bool TraceExtractor::addROI(QJsonObject roi)
+{
+    bool isRect = roi.contains("leftEdge") && roi.contains("topEdge") && roi["width"].toInt(0) > 0 && roi["height"].toInt(0) > 0;
+    bool isPixels = !roi["pixels"].toArray().isEmpty();
+
+    if (!isRect && !isPixels) {
+        sendMessage("Warning: Trace ROI needs leftEdge, topEdge, width and height or a list of pixels. ROI ignored.");
+        return false;
+    }
+
+    QMutexLocker locker(&m_roiMutex);
+    if (m_roiDefinitions.size() >= TRACE_MAX_ROIS) {
+        sendMessage("Warning: Only " + QString::number(TRACE_MAX_ROIS) + " trace ROIs are supported. ROI ignored.");
+        return false;
+    }
+    m_roiDefinitions.append(roi);
+    m_roisChanged = true;
+    return true;
+}
+
+int TraceExtractor::loadROIFile(QString filePath)
+{
+    QFile file(filePath);
+    QJsonDocument doc;
+    QJsonArray rois;
+    int count = 0;
+
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        sendMessage("Error: Cannot open trace ROI file " + filePath + ".");
+        return 0;
+    }
+    doc = QJsonDocument::fromJson(file.readAll());
+    file.close();
+
+    // Either a bare array of ROIs or the file DataSaver writes next to a recording
+    if (doc.isArray())
+        rois = doc.array();
+    else
+        rois = doc.object()["ROIs"].toArray();
+
+    for (int i = 0; i < rois.size(); i++) {
+        if (addROI(rois[i].toObject()))
+            count++;
+    }
+    sendMessage("Loaded " + QString::number(count) + " trace ROIs from " + filePath + ".");
+    return count;
+}
+
+QJsonArray TraceExtractor::roiDefinitions()
+{
+    QMutexLocker locker(&m_roiMutex);
+    return m_roiDefinitions;
+}
+
+void TraceExtractor::handleNewFrame()
+{
+    int available = m_sourceFrameNum->loadAcquire();
+    int next = m_traceFrameNum.loadAcquire() + 1;
+
+    // Frames are done strictly in order so the trace stream has no gaps
+    if (next > available)
+        return;
+    while (next <= available) {
+        processFrame(next);
+        m_traceFrameNum.storeRelease(next);
+        next++;
+    }
+    tracesReady();
+}
+
+void TraceExtractor::processFrame(int frameNum)
+{
+    int idx = (frameNum - 1) % bufferSize;
+    const cv::Mat &frame = frameBuffer[idx];
+    float *slot = &traceBuffer[idx * TRACE_SLOT_SIZE];
+    double dt, alpha, mean, background, corrected;
+    bool changed;
+
+    if (frame.empty() || frame.type() != CV_8UC1) {
+        if (!frame.empty() && !m_warnedFormat) {
+            m_warnedFormat = true;
+            sendMessage("Warning: Trace extraction only supports mono 8 bit frames.");
+        }
+        slot[0] = 0;
+        return;
+    }
+
+    m_roiMutex.lock();
+    changed = m_roisChanged;
+    m_roisChanged = false;
+    m_roiMutex.unlock();
+    if (changed || frame.size() != m_compiledSize)
+        compileROIs(frame.cols, frame.rows);
+
+    // Baselines follow a running average with a time constant of baselineSeconds, independent of frame rate
+    dt = m_lastTimeStamp > 0 ? (timeStampBuffer[idx] - m_lastTimeStamp) / 1000.0 : 0;
+    m_lastTimeStamp = timeStampBuffer[idx];
+    alpha = qBound(0.0, dt / m_baselineSeconds, 1.0);
+
+    slot[0] = m_rois.size();
+    for (int i = 0; i < m_rois.size(); i++) {
+        CompiledROI &roi = m_rois[i];
+        float *values = &slot[1 + i * TRACE_VALUES_PER_ROI];
+
+        mean = roi.pixelCount > 0 ? (double) sumSpans(frame, roi.spans) / roi.pixelCount : 0;
+        background = roi.backgroundPixelCount > 0 ? (double) sumSpans(frame, roi.backgroundSpans) / roi.backgroundPixelCount : 0;
+        corrected = mean - m_neuropilCoefficient * background;
+
+        if (!roi.hasBaseline) {
+            roi.baseline = corrected;
+            roi.hasBaseline = true;
+        }
+        else
+            roi.baseline += alpha * (corrected - roi.baseline);
+
+        values[0] = (float) mean;
+        values[1] = (float) corrected;
+        values[2] = qAbs(roi.baseline) > 1e-3 ? (float) ((corrected - roi.baseline) / qAbs(roi.baseline)) : 0.0f;
+    }
+}
+
+quint32 TraceExtractor::sumSpans(const cv::Mat &frame, const QVector<PixelSpan> &spans)
+{
+    quint32 total = 0;
+
+    for (int s = 0; s < spans.size(); s++) {
+        const uchar *src = frame.ptr<uchar>(spans[s].row) + spans[s].col;
+        const int length = spans[s].length;
+        int x = 0;
+
+#if CV_SIMD
+        const int lanes = cv::v_uint8::nlanes;
+        if (length >= lanes) {
+            cv::v_uint32 sum = cv::vx_setzero_u32();
+            cv::v_uint16 x16[2];
+            cv::v_uint32 x32[2];
+            for (; x <= length - lanes; x += lanes) {
+                // Two 8 bit values per 16 bit lane never overflow
+                cv::v_expand(cv::vx_load(src + x), x16[0], x16[1]);
+                cv::v_expand(x16[0] + x16[1], x32[0], x32[1]);
+                sum += x32[0] + x32[1];
+            }
+            total += cv::v_reduce_sum(sum);
+        }
+#endif
+        for (; x < length; x++)
+            total += src[x];
+    }
+    return total;
+}
+
+cv::Mat TraceExtractor::roiMask(const QJsonObject &roi, int width, int height, cv::Rect &bounds)
+{
+    cv::Rect frameRect(0, 0, width, height);
+    cv::Mat mask;
+
+    if (roi.contains("pixels")) {
+        QJsonArray pixels = roi["pixels"].toArray();
+        std::vector<cv::Point> points;
+        for (int i = 0; i < pixels.size(); i++) {
+            QJsonArray p = pixels[i].toArray();
+            cv::Point point(p[0].toInt(-1), p[1].toInt(-1));
+            if (frameRect.contains(point))
+                points.push_back(point);
+        }
+        if (points.empty()) {
+            bounds = cv::Rect();
+            return mask;
+        }
+        bounds = cv::boundingRect(points);
+        mask = cv::Mat::zeros(bounds.size(), CV_8UC1);
+        for (size_t i = 0; i < points.size(); i++)
+            mask.at<uchar>(points[i] - bounds.tl()) = 255;
+    }
+    else {
+        cv::Rect full(roi["leftEdge"].toInt(), roi["topEdge"].toInt(), roi["width"].toInt(), roi["height"].toInt());
+        bounds = full & frameRect;
+        if (bounds.empty())
+            return mask;
+        if (roi["circularMask"].toBool(false)) {
+            cv::Mat fullMask = cv::Mat::zeros(full.size(), CV_8UC1);
+            cv::ellipse(fullMask, cv::Point(full.width / 2, full.height / 2), cv::Size(full.width / 2, full.height / 2), 0, 0, 360, cv::Scalar(255), cv::FILLED);
+            mask = fullMask(cv::Rect(bounds.tl() - full.tl(), bounds.size())).clone();
+        }
+        else
+            mask = cv::Mat(bounds.size(), CV_8UC1, cv::Scalar(255));
+    }
+    return mask;
+}
+
+void TraceExtractor::appendSpans(const cv::Mat &mask, cv::Point origin, QVector<PixelSpan> &spans, int &pixelCount)
+{
+    int start;
+
+    for (int y = 0; y < mask.rows; y++) {
+        const uchar *row = mask.ptr<uchar>(y);
+        start = -1;
+        for (int x = 0; x <= mask.cols; x++) {
+            bool inside = x < mask.cols && row[x] != 0;
+            if (inside && start < 0)
+                start = x;
+            else if (!inside && start >= 0) {
+                spans.append({origin.y + y, origin.x + start, x - start});
+                pixelCount += x - start;
+                start = -1;
+            }
+        }
+    }
+}
+
+void TraceExtractor::compileROIs(int width, int height)
+{
+    QJsonArray definitions = roiDefinitions();
+    QVector<cv::Mat> masks(definitions.size());
+    QVector<cv::Rect> bounds(definitions.size());
+    cv::Mat allROIs = cv::Mat::zeros(height, width, CV_8UC1);
+    cv::Rect frameRect(0, 0, width, height);
+    cv::Mat innerKernel, outerKernel;
+    bool sizeChanged = cv::Size(width, height) != m_compiledSize;
+    int previousCount = m_rois.size();
+
+    innerKernel = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(2 * m_backgroundInnerRadius + 1, 2 * m_backgroundInnerRadius + 1));
+    outerKernel = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(2 * m_backgroundOuterRadius + 1, 2 * m_backgroundOuterRadius + 1));
+
+    for (int i = 0; i < definitions.size(); i++) {
+        masks[i] = roiMask(definitions[i].toObject(), width, height, bounds[i]);
+        if (!masks[i].empty()) {
+            cv::Mat target = allROIs(bounds[i]);
+            cv::bitwise_or(target, masks[i], target);
+        }
+    }
+
+    // Existing ROIs keep their baselines. Their index never changes since ROIs are only appended
+    m_rois.resize(definitions.size());
+    for (int i = 0; i < definitions.size(); i++) {
+        CompiledROI &roi = m_rois[i];
+        cv::Rect area;
+        cv::Mat local, inner, outer, ring;
+
+        if (i >= previousCount || sizeChanged) {
+            roi.baseline = 0;
+            roi.hasBaseline = false;
+        }
+        roi.spans.clear();
+        roi.backgroundSpans.clear();
+        roi.pixelCount = 0;
+        roi.backgroundPixelCount = 0;
+        if (masks[i].empty())
+            continue;
+
+        appendSpans(masks[i], bounds[i].tl(), roi.spans, roi.pixelCount);
+
+        // Background is an annulus around the ROI that leaves out every ROI, not just this one
+        area = cv::Rect(bounds[i].x - m_backgroundOuterRadius, bounds[i].y - m_backgroundOuterRadius,
+                        bounds[i].width + 2 * m_backgroundOuterRadius, bounds[i].height + 2 * m_backgroundOuterRadius) & frameRect;
+        local = cv::Mat::zeros(area.size(), CV_8UC1);
+        masks[i].copyTo(local(cv::Rect(bounds[i].tl() - area.tl(), bounds[i].size())));
+        cv::dilate(local, outer, outerKernel);
+        if (m_backgroundInnerRadius > 0)
+            cv::dilate(local, inner, innerKernel);
+        else
+            inner = local;
+        ring = outer & ~inner & ~allROIs(area);
+        appendSpans(ring, area.tl(), roi.backgroundSpans, roi.backgroundPixelCount);
+    }
+
+    m_compiledSize = cv::Size(width, height);
+    qDebug() << "Compiled" << m_rois.size() << "trace ROIs for" << width << "x" << height << "frames";
+}
@@ -0,0 +1,90 @@
+#ifndef TRACEEXTRACTOR_H
+#define TRACEEXTRACTOR_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QMutex>
+#include <QVector>
+
+#include <opencv2/core/core.hpp>
+
+#define TRACE_MAX_ROIS          2048
+#define TRACE_VALUES_PER_ROI    3   // Mean, background subtracted mean, dF/F
+#define TRACE_FILE_MAGIC        "MSTR"  // traces.bin starts with this, then version and values per ROI as uint32
+#define TRACE_FILE_VERSION      1
+#define TRACE_SLOT_SIZE         (1 + TRACE_MAX_ROIS * TRACE_VALUES_PER_ROI) // ROI count followed by the values of each ROI
+
+// Extracts fluorescence traces of cell ROIs from a mono video stream on its own thread.
+// ROIs get compiled into horizontal pixel spans, for the ROI itself and for a background annulus around it that
+// excludes all ROIs, so each frame only costs one vectorized sum per span.
+// Results are written to a buffer indexed like the frame buffer. traceFrameNum counts frames that are done,
+// the same way acqFrameNum counts acquired frames.
+// ROIs are only ever added so an ROI's index stays the same for the whole session.
+class TraceExtractor : public QObject
+{
+    Q_OBJECT
+public:
+    TraceExtractor(cv::Mat *frameBuf, qint64 *tsBuf, int bufSize, QAtomicInt *sourceFrameNum, QJsonObject options, QObject *parent = nullptr);
+    ~TraceExtractor();
+
+    float *getTraceBufferPointer() { return traceBuffer; }
+    QAtomicInt *getTraceFrameNumPointer() { return &m_traceFrameNum; }
+
+    // Thread safe. Each ROI is {"leftEdge", "topEdge", "width", "height", "circularMask"} or {"pixels": [[x, y], ...]}
+    bool addROI(QJsonObject roi);
+    int loadROIFile(QString filePath);
+    QJsonArray roiDefinitions();
+
+signals:
+    void sendMessage(QString msg);
+    void tracesReady(); // traceFrameNum advanced
+
+public slots:
+    void handleNewFrame(); // Works through every frame the source has finished since the last call
+
+private:
+    struct PixelSpan {
+        int row;
+        int col;
+        int length;
+    };
+    struct CompiledROI {
+        QVector<PixelSpan> spans;
+        QVector<PixelSpan> backgroundSpans;
+        int pixelCount;
+        int backgroundPixelCount;
+        double baseline;
+        bool hasBaseline;
+    };
+
+    void compileROIs(int width, int height);
+    cv::Mat roiMask(const QJsonObject &roi, int width, int height, cv::Rect &bounds);
+    void appendSpans(const cv::Mat &mask, cv::Point origin, QVector<PixelSpan> &spans, int &pixelCount);
+    void processFrame(int frameNum);
+    quint32 sumSpans(const cv::Mat &frame, const QVector<PixelSpan> &spans);
+
+    cv::Mat *frameBuffer;
+    qint64 *timeStampBuffer;
+    float *traceBuffer;
+    int bufferSize;
+    QAtomicInt *m_sourceFrameNum;
+    QAtomicInt m_traceFrameNum;
+
+    double m_neuropilCoefficient;
+    int m_backgroundInnerRadius;
+    int m_backgroundOuterRadius;
+    double m_baselineSeconds;
+
+    QMutex m_roiMutex;
+    QJsonArray m_roiDefinitions;
+    bool m_roisChanged;
+
+    QVector<CompiledROI> m_rois; // Only touched on the extractor's thread
+    cv::Size m_compiledSize;
+    qint64 m_lastTimeStamp;
+    bool m_warnedFormat;
+};
+
+#endif // TRACEEXTRACTOR_H
@@ -0,0 +1,107 @@
+#include "undistorter.h"
+#include "cameracalibrator.h"
+
+#include <QDebug>
+
+#include <opencv2/imgproc.hpp>
+#include <opencv2/calib3d.hpp>
+
+#include <vector>
+
+Undistorter::Undistorter() :
+    m_valid(false)
+{
+
+}
+
+bool Undistorter::setCalibration(QJsonObject calibration)
+{
+    m_valid = false;
+    m_region = cv::Rect();
+    m_map1.release();
+    m_map2.release();
+    m_pointTable.release();
+    if (!CameraCalibrator::intrinsics(calibration, m_cameraMatrix, m_distCoeffs))
+        return false;
+    m_imageSize = cv::Size(calibration["imageWidth"].toInt(), calibration["imageHeight"].toInt());
+    m_valid = true;
+    return true;
+}
+
+bool Undistorter::setRegion(cv::Rect region, cv::Size frameSize)
+{
+    cv::Mat mapX, mapY;
+    std::vector<cv::Point2f> points, undistorted;
+
+    if (!m_valid)
+        return false;
+    if (frameSize != m_imageSize) {
+        qDebug() << "Frame size" << frameSize.width << "x" << frameSize.height << "doesn't match the camera calibration";
+        m_valid = false;
+        return false;
+    }
+    if (region == m_region && !m_map1.empty())
+        return true;
+    m_region = region;
+
+    // The same math as cv::initUndistortRectifyMap, but only for the pixels of the region. The inverse mapping of
+    // each output pixel goes through the distortion model once here instead of for every frame
+    points.reserve(region.area());
+    for (int y = region.y; y < region.y + region.height; y++)
+        for (int x = region.x; x < region.x + region.width; x++)
+            points.push_back(cv::Point2f(x, y));
+    mapX.create(region.size(), CV_32FC1);
+    mapY.create(region.size(), CV_32FC1);
+    {
+        // Normalized undistorted coordinates of each output pixel, distorted again to find where it comes from
+        cv::Mat normalized(region.area(), 1, CV_64FC3), distorted;
+        const double fx = m_cameraMatrix.at<double>(0, 0), fy = m_cameraMatrix.at<double>(1, 1);
+        const double cx = m_cameraMatrix.at<double>(0, 2), cy = m_cameraMatrix.at<double>(1, 2);
+        for (int i = 0; i < (int) points.size(); i++)
+            normalized.at<cv::Vec3d>(i) = cv::Vec3d((points[i].x - cx) / fx, (points[i].y - cy) / fy, 1);
+        cv::projectPoints(normalized, cv::Vec3d(0, 0, 0), cv::Vec3d(0, 0, 0), m_cameraMatrix, m_distCoeffs, distorted);
+        for (int i = 0; i < (int) points.size(); i++) {
+            mapX.at<float>(i / region.width, i % region.width) = distorted.at<cv::Vec2d>(i)[0];
+            mapY.at<float>(i / region.width, i % region.width) = distorted.at<cv::Vec2d>(i)[1];
+        }
+    }
+    cv::convertMaps(mapX, mapY, m_map1, m_map2, CV_16SC2);
+
+    // Undistorted position of every distorted pixel of the region, for points
+    cv::undistortPoints(points, undistorted, m_cameraMatrix, m_distCoeffs, cv::noArray(), m_cameraMatrix);
+    m_pointTable = cv::Mat(undistorted, true).reshape(2, region.height);
+    return true;
+}
+
+void Undistorter::undistortFrame(const cv::Mat &frame, cv::Mat &dst)
+{
+    // Fixed point bilinear lookup
+    cv::remap(frame, dst, m_map1, m_map2, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+}
+
+cv::Point2f Undistorter::undistortPoint(cv::Point2f point)
+{
+    std::vector<cv::Point2f> in(1, point), out;
+    float fx, fy;
+    int x0, y0;
+
+    if (!m_valid)
+        return point;
+
+    fx = point.x - m_region.x;
+    fy = point.y - m_region.y;
+    x0 = (int) floor(fx);
+    y0 = (int) floor(fy);
+    if (m_pointTable.empty() || x0 < 0 || y0 < 0 || x0 + 1 >= m_region.width || y0 + 1 >= m_region.height) {
+        // Outside of the table, which only happens for points outside of the region
+        cv::undistortPoints(in, out, m_cameraMatrix, m_distCoeffs, cv::noArray(), m_cameraMatrix);
+        return out[0];
+    }
+
+    // Bilinear between the four table entries around the point
+    fx -= x0;
+    fy -= y0;
+    const cv::Point2f *row0 = m_pointTable.ptr<cv::Point2f>(y0) + x0;
+    const cv::Point2f *row1 = m_pointTable.ptr<cv::Point2f>(y0 + 1) + x0;
+    return (row0[0] * (1 - fx) + row0[1] * fx) * (1 - fy) + (row1[0] * (1 - fx) + row1[1] * fx) * fy;
+}
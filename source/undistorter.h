@@ -0,0 +1,41 @@
+#ifndef UNDISTORTER_H
+#define UNDISTORTER_H
+
+#include <QJsonObject>
+#include <QSize>
+
+#include <opencv2/core/core.hpp>
+
+// Removes lens distortion using a calibration from CameraCalibrator. Everything that depends on the calibration is computed
+// once per region: a fixed point remap table for whole frames and a table of undistorted coordinates for points,
+// so at runtime undistorting costs a table lookup per pixel or point. Tables only cover the region that gets used.
+// Not thread safe. Each user keeps its own.
+class Undistorter
+{
+public:
+    Undistorter();
+
+    bool setCalibration(QJsonObject calibration);
+    bool isValid() const { return m_valid; }
+    QSize imageSize() const { return QSize(m_imageSize.width, m_imageSize.height); }
+
+    // Builds the tables for region of frames of frameSize if they aren't already
+    bool setRegion(cv::Rect region, cv::Size frameSize);
+    // dst is the undistorted region, taken from the full frame
+    void undistortFrame(const cv::Mat &frame, cv::Mat &dst);
+    // Full frame pixel coordinates in and out
+    cv::Point2f undistortPoint(cv::Point2f point);
+
+private:
+    bool m_valid;
+    cv::Mat m_cameraMatrix;
+    cv::Mat m_distCoeffs;
+    cv::Size m_imageSize;
+
+    cv::Rect m_region;
+    cv::Mat m_map1; // CV_16SC2 integer source coordinates
+    cv::Mat m_map2; // CV_16UC1 index into OpenCV's fixed point interpolation table
+    cv::Mat m_pointTable; // CV_32FC2 undistorted coordinates of each region pixel
+};
+
+#endif // UNDISTORTER_H
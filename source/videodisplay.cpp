@@ -6,12 +6,16 @@
 #include <QtGui/QOpenGLTexture>
 
 #include <QImage>
+#include <QMutexLocker>
+#include <cstring>
 
 //! [7]
 VideoDisplay::VideoDisplay()
     : m_t(0),
       m_acqFPS(0),
+      m_saturatedFraction(0),
       m_renderer(nullptr),
+      m_latencyTracker(nullptr),
       m_roiSelectionActive(false),
       m_ROI({0,0,10,10,0}),
       lastMouseClickEvent(nullptr),
@@ -34,18 +38,34 @@ void VideoDisplay::setT(qreal t)
     if (window())
         window()->update();
 }
-void VideoDisplay::setDisplayFrame(QImage frame) {
+void VideoDisplay::setDisplayFrame(QImage frame, const FrameTiming &timing) {
 //    m_displayFrame2 = frame;
     // Checking to see if there is already a new frame waiting has solved a
     // consistent source of crash.
     // This crash was due to the texture data of the next frame in the queue to be displayed
     // changing before it is moved to GPU memory I think.
-    if (m_renderer && !m_renderer->m_newFrame)
-        m_renderer->setDisplayFrame(frame);
+    // The renderer does that check under its frame lock.
+    if (m_renderer)
+        m_renderer->setDisplayFrame(frame, timing);
 //    else
 //        qDebug() << "New frame available before last frame was displayed";
 }
 
+void VideoDisplay::setSaturatedFraction(double fraction)
+{
+    if (fraction == m_saturatedFraction)
+        return;
+    m_saturatedFraction = fraction;
+    saturatedFractionChanged();
+}
+
+QSize VideoDisplay::displaySize() const
+{
+    if (!window())
+        return QSize();
+    return window()->size() * window()->devicePixelRatio();
+}
+
 void VideoDisplay::setShowSaturation(double value)
 {
     m_showSaturation = value;
@@ -86,6 +106,50 @@ VideoDisplayRenderer::~VideoDisplayRenderer()
 {
     delete m_program;
     delete m_texture;
+    // Called from cleanup() while the scene graph's context is still current
+    if (m_monoTexture != 0)
+        glDeleteTextures(1, &m_monoTexture);
+    if (m_monoMapped) {
+        m_pbo[m_pboIndex].bind();
+        m_pbo[m_pboIndex].unmap();
+        m_pbo[m_pboIndex].release();
+    }
+    m_pbo[0].destroy();
+    m_pbo[1].destroy();
+}
+
+void VideoDisplayRenderer::setDisplayFrame(QImage frame, const FrameTiming &timing)
+{
+    // paint() takes the frame and its timing on the render thread
+    QMutexLocker locker(&m_monoMutex);
+    if (m_newFrame)
+        return; // paint() hasn't taken the last one yet
+    m_newTiming = timing;
+    if (frame.format() == QImage::Format_Grayscale8) {
+        // Rows get packed into the PBO paint() mapped when it fits, otherwise into the staging buffer
+        const int width = frame.width();
+        const int height = frame.height();
+        uchar *packed;
+
+        m_monoInPBO = m_monoMapped != nullptr && width == m_monoTextureWidth && height == m_monoTextureHeight;
+        if (m_monoInPBO)
+            packed = m_monoMapped;
+        else {
+            if (m_monoStaging.size() != width * height)
+                m_monoStaging.resize(width * height);
+            packed = reinterpret_cast<uchar*>(m_monoStaging.data());
+        }
+        for (int row = 0; row < height; row++)
+            memcpy(packed + row * width, frame.constScanLine(row), width);
+        m_monoWidth = width;
+        m_monoHeight = height;
+        m_monoFrame = true;
+    }
+    else {
+        m_displayFrame = frame.copy();
+        m_monoFrame = false;
+    }
+    m_newFrame = true;
 }
 //! [6]
 
@@ -95,8 +159,10 @@ void VideoDisplay::sync()
     if (!m_renderer) {
         m_renderer = new VideoDisplayRenderer();
         m_renderer->setShowSaturation(m_showSaturation);
+        m_renderer->setLatencyTracker(m_latencyTracker);
 //        m_renderer->setDisplayFrame(QImage("C:/Users/DBAharoni/Pictures/Miniscope/Logo/1.png"));
         connect(window(), &QQuickWindow::beforeRendering, m_renderer, &VideoDisplayRenderer::paint, Qt::DirectConnection);
+        connect(window(), &QQuickWindow::frameSwapped, m_renderer, &VideoDisplayRenderer::handleFrameSwapped, Qt::DirectConnection);
     }
     m_renderer->setViewportSize(window()->size() * window()->devicePixelRatio());
 //    m_renderer->setT(m_t);
@@ -174,12 +240,32 @@ void VideoDisplayRenderer::paint()
         m_texture = new QOpenGLTexture(QImage(":/img/MiniscopeLogo.png").rgbSwapped());
         m_texture->bind(0);
 
-
+        // Pixel buffer objects and GL_R8 need OpenGL (ES) 3.0
+        QOpenGLContext *context = QOpenGLContext::currentContext();
+        m_usePBO = context->format().majorVersion() >= 3;
 
     }
 //! [4] //! [5]
 
-    m_texture->bind(0);
+    // setDisplayFrame() doesn't touch either until m_newFrame is cleared, so the snapshot holds for this paint
+    bool newFrame, monoFrame;
+    {
+        QMutexLocker locker(&m_monoMutex);
+        newFrame = m_newFrame;
+        monoFrame = m_monoFrame;
+    }
+
+    if (newFrame && monoFrame) {
+        uploadMonoFrame();
+        m_textureTiming.uploaded = LatencyTracker::now();
+    }
+
+    if (monoFrame && m_monoTexture != 0) {
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, m_monoTexture);
+    }
+    else
+        m_texture->bind(0);
 
     m_program->bind();
 
@@ -211,6 +297,7 @@ void VideoDisplayRenderer::paint()
     m_program->setUniformValue("alpha", (float) m_alpha);
     m_program->setUniformValue("beta", (float) m_beta);
     m_program->setUniformValue("showSaturation", (float) m_showStaturation);
+    m_program->setUniformValue("isMono", (monoFrame && m_monoTexture != 0) ? 1.0f : 0.0f);
 
     glViewport(0, 0, m_viewportSize.width(), m_viewportSize.height());
 
@@ -223,6 +310,10 @@ void VideoDisplayRenderer::paint()
     glBlendFunc(GL_SRC_ALPHA, GL_ONE);
 
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    if (m_textureTiming.uploaded > 0) {
+        m_drawnTiming = m_textureTiming;
+        m_textureTiming = FrameTiming();
+    }
 
     m_program->disableAttributeArray(0);
     m_program->disableAttributeArray(1);
@@ -232,14 +323,99 @@ void VideoDisplayRenderer::paint()
     // mixing with raw OpenGL.
     m_window->resetOpenGLState();
 
-    if (m_newFrame) {
+    if (newFrame && !monoFrame) {
 //        qDebug() << "Set new texture QImage";
 
+        QMutexLocker locker(&m_monoMutex);
         m_texture->destroy();
         m_texture->create();
         m_texture->setData(m_displayFrame);
+        // Gets drawn on the next paint
+        m_textureTiming = m_newTiming;
+        m_textureTiming.uploaded = LatencyTracker::now();
         m_newFrame = false;
     }
 
 }
 //! [5]
+
+void VideoDisplayRenderer::handleFrameSwapped()
+{
+    // Render thread. The frame drawn in the last paint() is now on its way to the screen
+    if (m_drawnTiming.uploaded == 0)
+        return;
+    m_drawnTiming.swapped = LatencyTracker::now();
+    if (m_latencyTracker)
+        m_latencyTracker->addSample(m_drawnTiming);
+    m_drawnTiming = FrameTiming();
+}
+
+void VideoDisplayRenderer::uploadMonoFrame()
+{
+    QMutexLocker locker(&m_monoMutex);
+    int size = m_monoWidth * m_monoHeight;
+
+    m_newFrame = false;
+    if (size == 0)
+        return;
+    m_textureTiming = m_newTiming;
+
+    if (m_monoTexture == 0 || m_monoWidth != m_monoTextureWidth || m_monoHeight != m_monoTextureHeight) {
+        // (Re)allocate texture storage only when the frame size changes. The frame is in m_monoStaging then
+        if (m_monoMapped) {
+            m_pbo[m_pboIndex].bind();
+            m_pbo[m_pboIndex].unmap();
+            m_pbo[m_pboIndex].release();
+            m_monoMapped = nullptr;
+        }
+        if (m_monoTexture == 0)
+            glGenTextures(1, &m_monoTexture);
+        glBindTexture(GL_TEXTURE_2D, m_monoTexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        if (m_usePBO)
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, m_monoWidth, m_monoHeight, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+        else
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, m_monoWidth, m_monoHeight, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, nullptr);
+        m_monoTextureWidth = m_monoWidth;
+        m_monoTextureHeight = m_monoHeight;
+
+        if (m_usePBO) {
+            for (int i = 0; i < 2; i++) {
+                if (!m_pbo[i].isCreated())
+                    m_pbo[i].create();
+                m_pbo[i].setUsagePattern(QOpenGLBuffer::StreamDraw);
+                m_pbo[i].bind();
+                m_pbo[i].allocate(size);
+                m_pbo[i].release();
+            }
+        }
+    }
+
+    glBindTexture(GL_TEXTURE_2D, m_monoTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // Rows are tightly packed
+    if (m_monoInPBO) {
+        // The transfer runs from this PBO while the next frame gets written into the other one
+        m_pbo[m_pboIndex].bind();
+        m_pbo[m_pboIndex].unmap();
+        m_monoMapped = nullptr;
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_monoWidth, m_monoHeight, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+        m_pbo[m_pboIndex].release();
+        m_pboIndex = 1 - m_pboIndex;
+        m_monoInPBO = false;
+    }
+    else if (m_usePBO)
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_monoWidth, m_monoHeight, GL_RED, GL_UNSIGNED_BYTE, m_monoStaging.constData());
+    else
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_monoWidth, m_monoHeight, GL_LUMINANCE, GL_UNSIGNED_BYTE, m_monoStaging.constData());
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    if (m_usePBO && m_monoMapped == nullptr) {
+        // Ready for setDisplayFrame() to write the next frame into
+        m_pbo[m_pboIndex].bind();
+        m_monoMapped = static_cast<uchar*>(m_pbo[m_pboIndex].mapRange(0, size, QOpenGLBuffer::RangeWrite | QOpenGLBuffer::RangeInvalidateBuffer));
+        m_pbo[m_pboIndex].release();
+    }
+}
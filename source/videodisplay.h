@@ -3,15 +3,20 @@
 
 #include <QtQuick/QQuickItem>
 #include <QtGui/QOpenGLShaderProgram>
-#include <QtGui/QOpenGLFunctions>
+#include <QtGui/QOpenGLExtraFunctions>
 #include <QtGui/QOpenGLTexture>
+#include <QtGui/QOpenGLBuffer>
 
 #include <QImage>
+#include <QMutex>
+#include <QByteArray>
+
+#include "latencytracker.h"
 
 
 
 //! [1]
-class VideoDisplayRenderer : public QObject, protected QOpenGLFunctions
+class VideoDisplayRenderer : public QObject, protected QOpenGLExtraFunctions
 {
     Q_OBJECT
 public:
@@ -23,12 +28,25 @@ public:
         m_newFrame(false),
         m_alpha(1),
         m_beta(0),
-        m_showStaturation(1)
+        m_showStaturation(1),
+        m_monoFrame(false),
+        m_monoWidth(0),
+        m_monoHeight(0),
+        m_monoTexture(0),
+        m_monoTextureWidth(0),
+        m_monoTextureHeight(0),
+        m_usePBO(false),
+        m_pboIndex(0),
+        m_monoMapped(nullptr),
+        m_monoInPBO(false),
+        m_latencyTracker(nullptr),
+        m_pbo{QOpenGLBuffer(QOpenGLBuffer::PixelUnpackBuffer), QOpenGLBuffer(QOpenGLBuffer::PixelUnpackBuffer)}
     { }
     ~VideoDisplayRenderer();
 
     void setT(qreal t) { m_t = t; }
-    void setDisplayFrame(QImage frame) {m_displayFrame = frame.copy(); m_newFrame = true;}
+    void setDisplayFrame(QImage frame, const FrameTiming &timing);
+    void setLatencyTracker(LatencyTracker *tracker) { m_latencyTracker = tracker; }
     void setViewportSize(const QSize &size) { m_viewportSize = size; }
     void setWindow(QQuickWindow *window) { m_window = window; }
     void setAlpha(double a) {m_alpha = a;}
@@ -36,15 +54,18 @@ public:
     void setShowSaturation(double value) {m_showStaturation = value; }
 
 
-    bool m_newFrame;
+    bool m_newFrame; // Guarded by m_monoMutex
 
 signals:
     void requestNewFrame();
 
 public slots:
     void paint();
+    void handleFrameSwapped();
 
 private:
+    void uploadMonoFrame();
+
     QSize m_viewportSize;
     qreal m_t;
     QImage m_displayFrame;
@@ -57,7 +78,30 @@ private:
     double m_beta;
     double m_showStaturation;
 
-
+    // Single channel frames skip RGB conversion and go into a persistent 8 bit texture. paint() keeps one of two pixel
+    // buffer objects mapped. setDisplayFrame() writes the next frame straight into it and the following paint() uploads
+    // from it while mapping the other one. m_monoStaging holds frames that can't go into a PBO (first frame, new size, no PBOs).
+    QMutex m_monoMutex; // Guards the frame handoff from the GUI thread, together with m_displayFrame and m_newTiming
+    bool m_monoFrame;
+    QByteArray m_monoStaging;
+    int m_monoWidth;
+    int m_monoHeight;
+    GLuint m_monoTexture;
+    int m_monoTextureWidth;
+    int m_monoTextureHeight;
+    bool m_usePBO;
+    int m_pboIndex; // PBO that is mapped or gets mapped next
+    uchar *m_monoMapped;
+    bool m_monoInPBO; // The waiting frame is in m_pbo[m_pboIndex] rather than m_monoStaging
+
+    // Time stamps of the frame waiting for upload, the frame in the texture but not drawn yet
+    // and the frame drawn but not swapped yet
+    LatencyTracker *m_latencyTracker;
+    FrameTiming m_newTiming;
+    FrameTiming m_textureTiming;
+    FrameTiming m_drawnTiming;
+
+    QOpenGLBuffer m_pbo[2];
 };
 //! [1]
 
@@ -70,6 +114,8 @@ class VideoDisplay : public QQuickItem
     Q_PROPERTY(int bufferUsed READ bufferUsed WRITE setBufferUsed NOTIFY bufferUsedChanged)
     Q_PROPERTY(int maxBuffer READ maxBuffer WRITE setMaxBuffer NOTIFY maxBufferChanged)
     Q_PROPERTY(qreal t READ t WRITE setT NOTIFY tChanged)
+    Q_PROPERTY(double saturatedFraction READ saturatedFraction WRITE setSaturatedFraction NOTIFY saturatedFractionChanged)
+    Q_PROPERTY(QString latencySummary READ latencySummary WRITE setLatencySummary NOTIFY latencySummaryChanged)
 //    Q_PROPERTY(QImage displayFrame READ displayFrame WRITE setDisplayFrame NOTIFY displayFrameChanged)
 
     // For visualizing ROI
@@ -87,6 +133,8 @@ public:
     int maxBuffer() const {return m_maxBuffer; }
     int bufferUsed() const { return m_bufferUsed; }
     int droppedFrameCount() const {return m_droppedFrameCount; }
+    double saturatedFraction() const { return m_saturatedFraction; }
+    QString latencySummary() const { return m_latencySummary; }
 
 //    QImage displayFrame() { return m_displayFrame2; }
     void setT(qreal t);
@@ -96,12 +144,16 @@ public:
     void setMaxBuffer(int maxBuf) { m_maxBuffer = maxBuf; }
 
     void setDroppedFrameCount(int count) { m_droppedFrameCount = count; }
-    void setDisplayFrame(QImage frame);
+    void setSaturatedFraction(double fraction);
+    void setLatencySummary(QString summary) { m_latencySummary = summary; latencySummaryChanged(); }
+    void setLatencyTracker(LatencyTracker *tracker) { m_latencyTracker = tracker; if (m_renderer) m_renderer->setLatencyTracker(tracker); }
+    void setDisplayFrame(QImage frame, const FrameTiming &timing = FrameTiming());
     void setAlpha(double a) {m_renderer->setAlpha(a);}
     void setBeta(double b) {m_renderer->setBeta(b);}
     void setShowSaturation(double value);
     void setROISelectionState(bool state) { m_roiSelectionActive = state; }
     void setWindowScaleValue(double scale) { m_windowScaleValue = scale; }
+    QSize displaySize() const; // Size in device pixels the frame gets drawn at
 
 signals:
     void tChanged();
@@ -110,6 +162,8 @@ signals:
     void maxBufferChanged();
     void bufferUsedChanged();
     void droppedFrameCountChanged();
+    void saturatedFractionChanged();
+    void latencySummaryChanged();
 
     void displayFrameChanged();
     void newROISignal(int leftEdge, int topEdge, int width, int height);
@@ -127,8 +181,11 @@ private:
     int m_bufferUsed;
     int m_maxBuffer;
     int m_droppedFrameCount;
+    double m_saturatedFraction;
+    QString m_latencySummary;
 //    QImage m_displayFrame2;
     VideoDisplayRenderer *m_renderer;
+    LatencyTracker *m_latencyTracker;
 
     double m_showSaturation;
     bool m_roiSelectionActive;
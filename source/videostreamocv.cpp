@@ -12,6 +12,7 @@
 #include <QDateTime>
 #include <QThread>
 #include <QtMath>
+#include <QElapsedTimer>
 
 VideoStreamOCV::VideoStreamOCV(QObject *parent, int width, int height, double pixelClock) :
     QObject(parent),
@@ -20,11 +21,16 @@ VideoStreamOCV::VideoStreamOCV(QObject *parent, int width, int height, double pi
     m_headOrientationStreamState(false),
     m_headOrientationFilterState(false),
     m_isColor(false),
+    timingBuffer(nullptr),
+    clockModel(nullptr),
     m_trackExtTrigger(false),
     m_expectedWidth(width),
     m_expectedHeight(height),
     m_pixelClock(pixelClock),
-    m_connectionType("")
+    m_connectionType(""),
+    m_connectionState(0),
+    m_connectTime(0),
+    m_ready(0)
 {
 
 }
@@ -37,6 +43,8 @@ VideoStreamOCV::~VideoStreamOCV() {
 
 int VideoStreamOCV::connect2Camera(int cameraID) {
     int connectionState = 0;
+    QElapsedTimer timer;
+    timer.start();
     m_cameraID = cameraID;
     cam = new cv::VideoCapture;
 
@@ -65,54 +73,20 @@ int VideoStreamOCV::connect2Camera(int cameraID) {
     }
     // We need to make sure the MODE of the SERDES is correct
     // This needs to be done before any other commands are sent over SERDES
-    // Currently this is for the 913/914 TI SERES
-    // TODO: Probably should move this somewhere else
-    QVector<quint8> packet;
     if (m_pixelClock > 0 && connectionState != 0) {
-        if (m_pixelClock <= 50) {
-            // Set to 12bit low frequency in this case
-
-            // DES
-            packet.append(0xC0); // I2C Address
-            packet.append(0x1F); // reg
-            packet.append(0b00010000); // data
-            setPropertyI2C(0,packet);
-
-            // SER
-            packet.clear();
-            packet.append(0xB0); // I2C Address
-            packet.append(0x05); // reg
-            packet.append(0b00100000); // data
-            setPropertyI2C(1,packet);
-        }
-        else {
-            // Set to 10bit high frequency in this case
-
-            // DES
-            packet.clear();
-            packet.append(0xC0); // I2C Address
-            packet.append(0x1F); // reg
-            packet.append(0b00010001); // data
-            setPropertyI2C(0,packet);
-
-            // SER
-            packet.clear();
-            packet.append(0xB0); // I2C Address
-            packet.append(0x05); // reg
-            packet.append(0b00100001); // data
-            setPropertyI2C(1,packet);
-
-        }
-        sendCommands();
-        QThread::msleep(500);
-
+        setSerdesMode();
+        if (!waitForFrame(VIDEOSTREAM_SERDES_TIMEOUT_MS, false))
+            qDebug() << m_deviceName << "sent no frame after setting the SERDES mode";
     }
 
     if (connectionState != 0) {
          cam->set(cv::CAP_PROP_FRAME_WIDTH, m_expectedWidth);
          cam->set(cv::CAP_PROP_FRAME_HEIGHT, m_expectedHeight);
-         QThread::msleep(500);
+         if (!waitForFrame(VIDEOSTREAM_FORMAT_TIMEOUT_MS, true))
+             qDebug() << m_deviceName << "sent no" << m_expectedWidth << "x" << m_expectedHeight << "frame after setting the resolution";
     }
+    m_connectionState = connectionState;
+    m_connectTime = timer.elapsed();
 //    qDebug() <<  "Camera capture backend is" << QString::fromStdString (cam->getBackendName());
     return connectionState;
 
@@ -142,6 +116,7 @@ void VideoStreamOCV::startStream()
     double w, x, y, z;
     double extTriggerLast = -1;
     double extTrigger;
+    qint64 dequeuedTime;
     cv::Mat frame;
 
     m_stopStreaming = false;
@@ -174,6 +149,7 @@ void VideoStreamOCV::startStream()
             }
             else {
                 // Grab successful
+                dequeuedTime = LatencyTracker::now();
                 timeStampBuffer[idx%frameBufferSize] = QDateTime().currentMSecsSinceEpoch();
                 if (!cam->retrieve(frame)) {
                     // Retrieve failed
@@ -214,6 +190,8 @@ void VideoStreamOCV::startStream()
                                 // State change
                                 if (extTriggerLast == 0) {
                                     // Went from 0 to 1
+                                    // Time stamp of the frame the trigger arrived on. Sent first so it is known when recording starts
+                                    emit extTriggerTimeStamp(timeStampBuffer[idx%frameBufferSize]);
                                     emit extTriggered(true);
                                 }
                                 else {
@@ -263,6 +241,17 @@ void VideoStreamOCV::startStream()
                         }
                     }
                     else {
+                        if (timingBuffer) {
+                            timingBuffer[idx%frameBufferSize] = FrameTiming();
+                            timingBuffer[idx%frameBufferSize].dequeued = dequeuedTime;
+                            timingBuffer[idx%frameBufferSize].published = LatencyTracker::now();
+                            if (daqFrameNum != nullptr)
+                                timingBuffer[idx%frameBufferSize].daqFrameNum = *daqFrameNum;
+                            // Fit of host time against the DAQ's frame counter takes the USB and scheduling jitter out of the time stamp
+                            timingBuffer[idx%frameBufferSize].correctedTimeStamp = clockModel ?
+                                        clockModel->addFrame(timingBuffer[idx%frameBufferSize].daqFrameNum, timeStampBuffer[idx%frameBufferSize]) :
+                                        timeStampBuffer[idx%frameBufferSize];
+                        }
                         m_acqFrameNum->operator++();
                         // qDebug() << *m_acqFrameNum << *daqFrameNum;
                         idx++;
@@ -278,6 +267,9 @@ void VideoStreamOCV::startStream()
             QCoreApplication::processEvents(); // Is there a better way to do this. This is against best practices
             if (!sendCommandQueue.isEmpty())
                 sendCommands(); // Send last of each control property events that arrived on this processEvent() call then removes it from queue
+            // Initialize commands queued before the thread started went out with the first frame
+            if (*m_acqFrameNum > 0 && !m_ready.loadAcquire())
+                m_ready.storeRelease(1);
         }
         cam->release();
     }
@@ -402,98 +394,81 @@ void VideoStreamOCV::sendCommands()
 bool VideoStreamOCV::attemptReconnect()
 {
     // TODO: handle quitting nicely when stuck in this loop
-    QVector<quint8> packet;
-    if (m_connectionType == "DSHOW") {
-        if (cam->open(m_cameraID, cv::CAP_DSHOW)) {
-
-            if (m_pixelClock <= 50) {
-                // Set to 12bit low frequency in this case
-
-                // DES
-                packet.append(0xC0); // I2C Address
-                packet.append(0x1F); // reg
-                packet.append(0b00010000); // data
-                setPropertyI2C(0,packet);
-
-                // SER
-                packet.clear();
-                packet.append(0xB0); // I2C Address
-                packet.append(0x05); // reg
-                packet.append(0b00100000); // data
-                setPropertyI2C(1,packet);
-            }
-            else {
-                // Set to 10bit high frequency in this case
-
-                // DES
-//                packet.clear();
-                packet.append(0xC0); // I2C Address
-                packet.append(0x1F); // reg
-                packet.append(0b00010001); // data
-                setPropertyI2C(0,packet);
-
-                // SER
-                packet.clear();
-                packet.append(0xB0); // I2C Address
-                packet.append(0x05); // reg
-                packet.append(0b00100001); // data
-                setPropertyI2C(1,packet);
+    bool opened = false;
+    if (m_connectionType == "DSHOW")
+        opened = cam->open(m_cameraID, cv::CAP_DSHOW);
+    else if (m_connectionType == "OTHER")
+        opened = cam->open(m_cameraID);
+    if (!opened)
+        return false;
+
+    setSerdesMode();
+    waitForFrame(VIDEOSTREAM_SERDES_TIMEOUT_MS, false);
+    cam->set(cv::CAP_PROP_FRAME_WIDTH, m_expectedWidth);
+    cam->set(cv::CAP_PROP_FRAME_HEIGHT, m_expectedHeight);
+    waitForFrame(VIDEOSTREAM_FORMAT_TIMEOUT_MS, true);
+    requestInitCommands();
+    return true;
+}
 
-            }
-            sendCommands();
-            QThread::msleep(500);
-
-            cam->set(cv::CAP_PROP_FRAME_WIDTH, m_expectedWidth);
-            cam->set(cv::CAP_PROP_FRAME_HEIGHT, m_expectedHeight);
-            QThread::msleep(500);
-            requestInitCommands();
-            return true;
-        }
+void VideoStreamOCV::setSerdesMode()
+{
+    // Currently this is for the 913/914 TI SERES
+    QVector<quint8> packet;
+    if (m_pixelClock <= 50) {
+        // Set to 12bit low frequency in this case
+
+        // DES
+        packet.append(0xC0); // I2C Address
+        packet.append(0x1F); // reg
+        packet.append(0b00010000); // data
+        setPropertyI2C(0,packet);
+
+        // SER
+        packet.clear();
+        packet.append(0xB0); // I2C Address
+        packet.append(0x05); // reg
+        packet.append(0b00100000); // data
+        setPropertyI2C(1,packet);
     }
-    else if (m_connectionType == "OTHER") {
-        if (cam->open(m_cameraID)) {
-            if (m_pixelClock <= 50) {
-                // Set to 12bit low frequency in this case
-
-                // DES
-                packet.append(0xC0); // I2C Address
-                packet.append(0x1F); // reg
-                packet.append(0b00010000); // data
-                setPropertyI2C(0,packet);
-
-                // SER
-                packet.clear();
-                packet.append(0xB0); // I2C Address
-                packet.append(0x05); // reg
-                packet.append(0b00100000); // data
-                setPropertyI2C(1,packet);
-            }
-            else {
-                // Set to 10bit high frequency in this case
-
-                // DES
-//                packet.clear();
-                packet.append(0xC0); // I2C Address
-                packet.append(0x1F); // reg
-                packet.append(0b00010001); // data
-                setPropertyI2C(0,packet);
-
-                // SER
-                packet.clear();
-                packet.append(0xB0); // I2C Address
-                packet.append(0x05); // reg
-                packet.append(0b00100001); // data
-                setPropertyI2C(1,packet);
+    else {
+        // Set to 10bit high frequency in this case
+
+        // DES
+        packet.append(0xC0); // I2C Address
+        packet.append(0x1F); // reg
+        packet.append(0b00010001); // data
+        setPropertyI2C(0,packet);
+
+        // SER
+        packet.clear();
+        packet.append(0xB0); // I2C Address
+        packet.append(0x05); // reg
+        packet.append(0b00100001); // data
+        setPropertyI2C(1,packet);
+    }
+    sendCommands();
+}
 
-            }
-            sendCommands();
-            QThread::msleep(500);
-            cam->set(cv::CAP_PROP_FRAME_WIDTH, m_expectedWidth);
-            cam->set(cv::CAP_PROP_FRAME_HEIGHT, m_expectedHeight);
-            QThread::msleep(500);
-            requestInitCommands();
-            return true;
+bool VideoStreamOCV::waitForFrame(int timeoutMs, bool checkSize)
+{
+    // Replaces fixed waits after configuring the DAQ. It is ready once it delivers a frame captured after the command,
+    // in the new format when checkSize is set. Frames still queued from before the command are drained first
+    QElapsedTimer timer;
+    cv::Mat frame;
+    int grabbed = 0;
+
+    timer.start();
+    while (timer.elapsed() < timeoutMs) {
+        if (cam->grab()) {
+            if (++grabbed <= VIDEOSTREAM_QUEUED_FRAMES)
+                continue;
+            if (cam->retrieve(frame) && !frame.empty() &&
+                    (!checkSize || m_expectedWidth <= 0 || (frame.cols == m_expectedWidth && frame.rows == m_expectedHeight)))
+                return true;
         }
+        else
+            QThread::msleep(VIDEOSTREAM_POLL_MS);
     }
     return false;
 }
@@ -12,6 +12,15 @@
 #include <QAtomicInt>
 #include <QMap>
 #include <QVector>
+#include <QRunnable>
+
+#include "latencytracker.h"
+#include "clockmodel.h"
+
+#define VIDEOSTREAM_SERDES_TIMEOUT_MS   500     // Longest wait for a frame after setting the SERDES mode
+#define VIDEOSTREAM_FORMAT_TIMEOUT_MS   1000    // Longest wait for a frame of the expected size after setting the resolution
+#define VIDEOSTREAM_POLL_MS             5
+#define VIDEOSTREAM_QUEUED_FRAMES       4       // Frames the capture backend may hold from before a command (V4L2 queues 4 buffers)
 
 
 class VideoStreamOCV : public QObject
@@ -25,14 +34,21 @@ public:
                              int bufferSize, QSemaphore *freeFramesS, QSemaphore *usedFramesS,
                              QAtomicInt *acqFrameNum, QAtomicInt *daqFrameNumber);
     int connect2Camera(int cameraID);
+    int connectionState() { return m_connectionState; }
+    qint64 getConnectTime() { return m_connectTime; } // ms connect2Camera() took
+    // Set by the stream thread once the first frame came in after the initialize commands were sent
+    bool isReady() { return m_ready.loadAcquire(); }
     void setHeadOrientationConfig(bool enableState, bool filterState) { m_headOrientationStreamState = enableState; m_headOrientationFilterState = filterState; }
     void setIsColor(bool isColor) { m_isColor = isColor; }
     void setDeviceName(QString name) { m_deviceName = name; }
+    void setTimingBuffer(FrameTiming *timingBuf) { timingBuffer = timingBuf; }
+    void setClockModel(ClockModel *clock) { clockModel = clock; }
 
 signals:
     void sendMessage(QString msg);
     void newFrameAvailable(QString name, int frameNum);
     void extTriggered(bool triggerState);
+    void extTriggerTimeStamp(qint64 timeStamp);
     void requestInitCommands();
 
 public slots:
@@ -47,6 +63,8 @@ public slots:
 private:
     void sendCommands();
     bool attemptReconnect();
+    void setSerdesMode();
+    bool waitForFrame(int timeoutMs, bool checkSize);
     int m_cameraID;
     QString m_deviceName;
     cv::VideoCapture *cam;
@@ -57,6 +75,8 @@ private:
     bool m_isColor;
     cv::Mat *frameBuffer;
     qint64 *timeStampBuffer;
+    FrameTiming *timingBuffer;
+    ClockModel *clockModel;
     float *bnoBuffer;
     QSemaphore *freeFrames;
     QSemaphore *usedFrames;
@@ -75,7 +95,22 @@ private:
     double m_pixelClock;
 
     QString m_connectionType;
+    int m_connectionState;
+    qint64 m_connectTime;
+    QAtomicInt m_ready;
 
 };
 
+// Lets backEnd connect to all devices at once on a thread pool, since opening a camera and setting up its DAQ blocks
+class StreamConnectTask : public QRunnable
+{
+public:
+    StreamConnectTask(VideoStreamOCV *stream, int cameraID) : m_stream(stream), m_cameraID(cameraID) {}
+    void run() override { m_stream->connect2Camera(m_cameraID); }
+
+private:
+    VideoStreamOCV *m_stream;
+    int m_cameraID;
+};
+
 #endif // VIDEOSTREAMOCV_H
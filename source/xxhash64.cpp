@@ -0,0 +1,147 @@
+#include "xxhash64.h"
+
+#include <cstring>
+
+static const quint64 PRIME64_1 = 11400714785074694791ULL;
+static const quint64 PRIME64_2 = 14029467366897019727ULL;
+static const quint64 PRIME64_3 =  1609587929392839161ULL;
+static const quint64 PRIME64_4 =  9650029242287828579ULL;
+static const quint64 PRIME64_5 =  2870177450012600261ULL;
+
+static inline quint64 rotl64(quint64 x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline quint64 read64(const unsigned char *p)
+{
+    // xxHash is defined on little endian input
+    quint64 v = 0;
+    for (int i = 7; i >= 0; i--)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+static inline quint32 read32(const unsigned char *p)
+{
+    return (quint32)p[0] | ((quint32)p[1] << 8) | ((quint32)p[2] << 16) | ((quint32)p[3] << 24);
+}
+
+static inline quint64 round64(quint64 acc, quint64 input)
+{
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline quint64 mergeRound64(quint64 acc, quint64 val)
+{
+    acc ^= round64(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+XXHash64::XXHash64(quint64 seed)
+{
+    reset(seed);
+}
+
+void XXHash64::reset(quint64 seed)
+{
+    m_seed = seed;
+    m_v[0] = seed + PRIME64_1 + PRIME64_2;
+    m_v[1] = seed + PRIME64_2;
+    m_v[2] = seed;
+    m_v[3] = seed - PRIME64_1;
+    m_totalLength = 0;
+    m_memSize = 0;
+}
+
+void XXHash64::update(const void *data, qint64 length)
+{
+    const unsigned char *p = static_cast<const unsigned char*>(data);
+    const unsigned char *end = p + length;
+
+    if (length <= 0)
+        return;
+    m_totalLength += length;
+
+    if (m_memSize + length < 32) {
+        // Not enough for a full stripe yet
+        memcpy(m_mem + m_memSize, p, length);
+        m_memSize += length;
+        return;
+    }
+
+    if (m_memSize > 0) {
+        // Complete the stripe left over from the last call
+        memcpy(m_mem + m_memSize, p, 32 - m_memSize);
+        m_v[0] = round64(m_v[0], read64(m_mem));
+        m_v[1] = round64(m_v[1], read64(m_mem + 8));
+        m_v[2] = round64(m_v[2], read64(m_mem + 16));
+        m_v[3] = round64(m_v[3], read64(m_mem + 24));
+        p += 32 - m_memSize;
+        m_memSize = 0;
+    }
+
+    while (p + 32 <= end) {
+        m_v[0] = round64(m_v[0], read64(p));
+        m_v[1] = round64(m_v[1], read64(p + 8));
+        m_v[2] = round64(m_v[2], read64(p + 16));
+        m_v[3] = round64(m_v[3], read64(p + 24));
+        p += 32;
+    }
+
+    if (p < end) {
+        memcpy(m_mem, p, end - p);
+        m_memSize = end - p;
+    }
+}
+
+quint64 XXHash64::digest() const
+{
+    quint64 h;
+    const unsigned char *p = m_mem;
+    const unsigned char *end = m_mem + m_memSize;
+
+    if (m_totalLength >= 32) {
+        h = rotl64(m_v[0], 1) + rotl64(m_v[1], 7) + rotl64(m_v[2], 12) + rotl64(m_v[3], 18);
+        h = mergeRound64(h, m_v[0]);
+        h = mergeRound64(h, m_v[1]);
+        h = mergeRound64(h, m_v[2]);
+        h = mergeRound64(h, m_v[3]);
+    }
+    else {
+        h = m_seed + PRIME64_5;
+    }
+    h += m_totalLength;
+
+    while (p + 8 <= end) {
+        h ^= round64(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= (quint64)read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+quint64 XXHash64::hash(const void *data, qint64 length, quint64 seed)
+{
+    XXHash64 hasher(seed);
+    hasher.update(data, length);
+    return hasher.digest();
+}
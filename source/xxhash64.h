@@ -0,0 +1,29 @@
+#ifndef XXHASH64_H
+#define XXHASH64_H
+
+#include <QtGlobal>
+#include <QString>
+
+// Streaming implementation of the 64 bit xxHash (XXH64) algorithm.
+// Fast non-cryptographic hash used to check the integrity of recorded files.
+class XXHash64
+{
+public:
+    explicit XXHash64(quint64 seed = 0);
+    void reset(quint64 seed = 0);
+    void update(const void *data, qint64 length);
+    quint64 digest() const;
+    QString hexDigest() const { return toHex(digest()); }
+
+    static quint64 hash(const void *data, qint64 length, quint64 seed = 0);
+    static QString toHex(quint64 value) { return QString("%1").arg(value, 16, 16, QChar('0')); }
+
+private:
+    quint64 m_v[4];
+    quint64 m_seed;
+    quint64 m_totalLength;
+    unsigned char m_mem[32];
+    int m_memSize;
+};
+
+#endif // XXHASH64_H